@@ -3,6 +3,7 @@
 #include <scratchcpp/costume.h>
 
 #include "bitmapskin.h"
+#include "cputexturemanager.h"
 
 using namespace scratchcpprender;
 
@@ -12,41 +13,138 @@ BitmapSkin::BitmapSkin(libscratchcpp::Costume *costume) :
     if (!costume)
         return;
 
-    // Read image data
+    // Use the image decoded in the background if there's any (see SkinImageStore)
+    bool pending = false;
+    SkinImageStore::Images images = SkinImageStore::instance()->take(costume, &pending);
+
+    if (!images.image.isNull() && !images.texture.isNull())
+        setImages(images);
+    else if (pending) {
+        // The texture will be created when the image is decoded (see updateTextures())
+        m_pendingCostume = costume;
+        setSize(readImageSize(costume));
+        return;
+    } else {
+        m_image = decodeImage(costume);
+        setSize(m_image.size());
+
+        // Paint the image into a texture
+        createTexture();
+    }
+
+    if (!m_texture.isValid())
+        qWarning() << "invalid bitmap texture (costume name: " + costume->name() + ")";
+}
+
+Texture BitmapSkin::getTexture(double scale)
+{
+    // The texture is painted again if it has been deleted (see Skin::nextFrame())
+    if (!m_texture.isValid() && !m_image.isNull())
+        return createTexture();
+
+    markUsed(m_texture);
+    return m_texture;
+}
+
+double BitmapSkin::getTextureScale(const Texture &texture) const
+{
+    return 1;
+}
+
+bool BitmapSkin::updateTextures()
+{
+    // Creates the texture of a costume which has been decoded in the background
+    if (!m_pendingCostume)
+        return false;
+
+    bool pending = false;
+    SkinImageStore::Images images = SkinImageStore::instance()->take(m_pendingCostume, &pending);
+
+    if (images.image.isNull() || images.texture.isNull()) {
+        if (pending)
+            return false;
+
+        // The costume couldn't be decoded in the background
+        images.image = decodeImage(m_pendingCostume);
+        images.texture = prepareTexture(images.image);
+        CpuTextureManager::calculateConvexHullPoints(images.texture, images.hullPoints);
+    }
+
+    m_pendingCostume = nullptr;
+    setImages(images);
+    newTexturesAvailable();
+    return true;
+}
+
+bool BitmapSkin::claimPendingCostume()
+{
+    // Waits for the image if the costume is being decoded in the background (sensing can't wait until the next frame)
+    if (!m_pendingCostume)
+        return false;
+
+    SkinImageStore::instance()->claim(m_pendingCostume, true);
+    return updateTextures();
+}
+
+QSize BitmapSkin::readImageSize(const libscratchcpp::Costume *costume)
+{
+    // Reads the size of the image without decoding it
+    QBuffer buffer;
+    buffer.setData(static_cast<const char *>(costume->data()), costume->dataSize());
+    buffer.open(QBuffer::ReadOnly);
+    QImageReader reader(&buffer);
+    return reader.size();
+}
+
+QImage BitmapSkin::decodeImage(const libscratchcpp::Costume *costume)
+{
+    // Reads the image data of the costume (this can be called from any thread)
     QBuffer buffer;
     buffer.open(QBuffer::WriteOnly);
     buffer.write(static_cast<const char *>(costume->data()), costume->dataSize());
     buffer.close();
-    const char *format;
+    QByteArray format;
 
     {
         QImageReader reader(&buffer);
-        format = reader.format().toStdString().c_str();
+        format = reader.format();
     }
 
     buffer.close();
-    m_image.load(&buffer, format);
+    QImage image;
+    image.load(&buffer, format.constData());
+    return image;
+}
 
-    // Paint the image into a texture
-    m_texture = createAndPaintTexture(m_image.width(), m_image.height());
-    m_textureSize.setWidth(m_image.width());
-    m_textureSize.setHeight(m_image.height());
+QImage BitmapSkin::prepareTexture(const QImage &image)
+{
+    // Paints the texture image of a decoded image (this can be called from any thread)
+    return paintImage(image.width(), image.height(), [&image](QPainter *painter) { painter->drawImage(image.rect(), image, image.rect()); });
+}
 
-    if (!m_texture.isValid())
-        qWarning() << "invalid bitmap texture (costume name: " + costume->name() + ")";
+void BitmapSkin::paint(QPainter *painter)
+{
+    painter->drawImage(m_image.rect(), m_image, m_image.rect());
 }
 
-Texture BitmapSkin::getTexture(double scale) const
+void BitmapSkin::textureRemoved(const Texture &texture)
 {
-    return m_texture;
+    if (texture == m_texture)
+        m_texture = Texture();
 }
 
-double BitmapSkin::getTextureScale(const Texture &texture) const
+void BitmapSkin::setImages(const SkinImageStore::Images &images)
 {
-    return 1;
+    // The texture is created later if there isn't an OpenGL context (see getTexture())
+    m_image = images.image;
+    setSize(m_image.size());
+
+    if (!images.texture.isNull())
+        m_texture = Skin::createTexture(images.texture, &images.hullPoints);
 }
 
-void BitmapSkin::paint(QPainter *painter)
+Texture BitmapSkin::createTexture()
 {
-    painter->drawImage(m_image.rect(), m_image, m_image.rect());
+    m_texture = createAndPaintTexture(m_image.width(), m_image.height());
+    return m_texture;
 }
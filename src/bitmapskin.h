@@ -4,6 +4,7 @@
 
 #include "skin.h"
 #include "texture.h"
+#include "skinimagestore.h"
 
 namespace libscratchcpp
 {
@@ -20,16 +21,27 @@ class BitmapSkin : public Skin
     public:
         BitmapSkin(libscratchcpp::Costume *costume);
 
-        Texture getTexture(double scale) const override;
+        Texture getTexture(double scale) override;
         double getTextureScale(const Texture &texture) const override;
 
+        bool updateTextures() override;
+        bool claimPendingCostume() override;
+
+        static QSize readImageSize(const libscratchcpp::Costume *costume);
+        static QImage decodeImage(const libscratchcpp::Costume *costume);
+        static QImage prepareTexture(const QImage &image);
+
     protected:
         void paint(QPainter *painter) override;
+        void textureRemoved(const Texture &texture) override;
 
     private:
+        Texture createTexture();
+        void setImages(const SkinImageStore::Images &images);
+
         Texture m_texture;
-        QSize m_textureSize;
         QImage m_image;
+        const libscratchcpp::Costume *m_pendingCostume = nullptr; // decoded in the background (see SkinImageStore)
 };
 
 } // namespace scratchcpprender
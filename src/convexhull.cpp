@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <algorithm>
+
+#include "convexhull.h"
+
+using namespace scratchcpprender;
+
+static double cross(const QPointF &o, const QPointF &a, const QPointF &b)
+{
+    return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+}
+
+void ConvexHull::build(std::vector<QPointF> &points, std::vector<QPointF> &dst)
+{
+    // Monotone chain algorithm (the points are sorted)
+    dst.clear();
+
+    if (points.size() < 3) {
+        dst = points;
+        return;
+    }
+
+    std::sort(points.begin(), points.end(), [](const QPointF &a, const QPointF &b) { return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y()); });
+    dst.resize(points.size() * 2);
+    size_t count = 0;
+
+    // Lower hull
+    for (size_t i = 0; i < points.size(); i++) {
+        while (count >= 2 && cross(dst[count - 2], dst[count - 1], points[i]) <= 0)
+            count--;
+
+        dst[count++] = points[i];
+    }
+
+    // Upper hull
+    const size_t lowerCount = count + 1;
+
+    for (size_t i = points.size() - 1; i > 0; i--) {
+        while (count >= lowerCount && cross(dst[count - 2], dst[count - 1], points[i - 1]) <= 0)
+            count--;
+
+        dst[count++] = points[i - 1];
+    }
+
+    dst.resize(count - 1); // the last point is the first point
+}
+
+bool ConvexHull::intersects(const std::vector<QPointF> &a, const std::vector<QPointF> &b, const QPointF &offset)
+{
+    // Separating axis theorem (b is moved by offset), the edges of both polygons are the axes
+    auto project = [](const std::vector<QPointF> &polygon, double nx, double ny, double &min, double &max) {
+        min = max = polygon[0].x() * nx + polygon[0].y() * ny;
+
+        for (const QPointF &point : polygon) {
+            const double value = point.x() * nx + point.y() * ny;
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+    };
+
+    if (a.empty() || b.empty())
+        return false;
+
+    for (const std::vector<QPointF> *polygon : { &a, &b }) {
+        const size_t count = polygon->size();
+
+        for (size_t i = 0; i < count; i++) {
+            const QPointF &p1 = (*polygon)[i];
+            const QPointF &p2 = (*polygon)[(i + 1) % count];
+            const double nx = p1.y() - p2.y();
+            const double ny = p2.x() - p1.x();
+
+            if (nx == 0 && ny == 0)
+                continue;
+
+            double minA, maxA, minB, maxB;
+            project(a, nx, ny, minA, maxA);
+            project(b, nx, ny, minB, maxB);
+            const double shift = offset.x() * nx + offset.y() * ny;
+
+            if (maxA < minB + shift || maxB + shift < minA)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool ConvexHull::intersectionBounds(const std::vector<QPointF> &a, const std::vector<QPointF> &b, QRectF &dst, const QPointF &offset)
+{
+    // Clips b (moved by offset) by the edges of a (Sutherland-Hodgman algorithm), returns false if the polygons don't intersect
+    dst = QRectF();
+
+    if (a.size() < 3 || b.empty())
+        return false;
+
+    std::vector<QPointF> polygon;
+    std::vector<QPointF> clipped;
+    polygon.reserve(b.size());
+
+    for (const QPointF &point : b)
+        polygon.push_back(point + offset);
+
+    for (size_t i = 0; i < a.size() && !polygon.empty(); i++) {
+        const QPointF &p1 = a[i];
+        const QPointF &p2 = a[(i + 1) % a.size()];
+        clipped.clear();
+
+        for (size_t j = 0; j < polygon.size(); j++) {
+            const QPointF &current = polygon[j];
+            const QPointF &next = polygon[(j + 1) % polygon.size()];
+            const double currentSide = cross(p1, p2, current);
+            const double nextSide = cross(p1, p2, next);
+
+            if (currentSide >= 0)
+                clipped.push_back(current);
+
+            if ((currentSide >= 0) != (nextSide >= 0))
+                clipped.push_back(current + (next - current) * (currentSide / (currentSide - nextSide)));
+        }
+
+        polygon.swap(clipped);
+    }
+
+    if (polygon.empty())
+        return false;
+
+    double left = polygon[0].x();
+    double right = left;
+    double bottom = polygon[0].y();
+    double top = bottom;
+
+    for (const QPointF &point : polygon) {
+        left = std::min(left, point.x());
+        right = std::max(right, point.x());
+        bottom = std::min(bottom, point.y());
+        top = std::max(top, point.y());
+    }
+
+    dst = QRectF(QPointF(left, bottom), QPointF(right, top));
+    return true;
+}
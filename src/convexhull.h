@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QPointF>
+#include <QRectF>
+#include <vector>
+
+namespace scratchcpprender
+{
+
+/*! \brief The ConvexHull class provides functions for convex polygons (the vertices are in counterclockwise order). */
+class ConvexHull
+{
+    public:
+        ConvexHull() = delete;
+
+        static void build(std::vector<QPointF> &points, std::vector<QPointF> &dst);
+        static bool intersects(const std::vector<QPointF> &a, const std::vector<QPointF> &b, const QPointF &offset = QPointF());
+        static bool intersectionBounds(const std::vector<QPointF> &a, const std::vector<QPointF> &b, QRectF &dst, const QPointF &offset = QPointF());
+};
+
+} // namespace scratchcpprender
@@ -1,43 +1,49 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 
+#include <cmath>
+#include <algorithm>
+
 #include "cputexturemanager.h"
+#include "cputexturestore.h"
 #include "texture.h"
 #include "effecttransform.h"
 
 using namespace scratchcpprender;
 
-CpuTextureManager::CpuTextureManager()
+CpuTextureManager::CpuTextureManager() :
+    m_storeGeneration(CpuTextureStore::instance()->generation())
 {
 }
 
 CpuTextureManager::~CpuTextureManager()
 {
-    for (const auto &[handle, data] : m_textureData)
-        delete[] data;
+    // The store might be destroyed before global texture managers
+    CpuTextureStore *store = CpuTextureStore::instance();
+
+    if (!store || m_storeGeneration != store->generation())
+        return;
+
+    for (const auto &[handle, entry] : m_entries)
+        store->release(entry->texture());
 }
 
 GLubyte *CpuTextureManager::getTextureData(const Texture &texture)
 {
-    if (!texture.isValid())
-        return nullptr;
-
-    const GLuint handle = texture.handle();
-    auto it = m_textureData.find(handle);
+    CpuTextureStore::Entry *entry = getEntry(texture, true);
+    return entry ? entry->data() : nullptr;
+}
 
-    if (it == m_textureData.cend()) {
-        if (addTexture(texture))
-            return m_textureData[handle];
-        else
-            return nullptr;
-    } else
-        return it->second;
+const Silhouette *CpuTextureManager::getTextureSilhouette(const Texture &texture)
+{
+    CpuTextureStore::Entry *entry = getEntry(texture, false);
+    return entry ? &entry->silhouette() : nullptr;
 }
 
 void CpuTextureManager::getTextureConvexHullPoints(
     const Texture &texture,
     const QSize &skinSize,
     ShaderManager::Effect effectMask,
-    const std::unordered_map<ShaderManager::Effect, double> &effects,
+    const EffectState &effects,
     std::vector<QPoint> &dst)
 {
     dst.clear();
@@ -46,30 +52,53 @@ void CpuTextureManager::getTextureConvexHullPoints(
         return;
 
     // Remove effects that don't change shape
-    if (effectMask != 0) {
-        const auto &allEffects = ShaderManager::effects();
-
-        for (ShaderManager::Effect effect : allEffects) {
-            if ((effectMask & effect) != 0 && !ShaderManager::effectShapeChanges(effect))
-                effectMask &= ~effect;
-        }
-    }
+    effectMask = ShaderManager::shapeChangingEffects(effectMask);
 
     // If there are no shape-changing effects, use cached hull points
     if (effectMask == 0) {
-        const GLuint handle = texture.handle();
-        auto it = m_convexHullPoints.find(handle);
+        CpuTextureStore::Entry *entry = getEntry(texture, false);
 
-        if (it == m_convexHullPoints.cend()) {
-            if (addTexture(texture))
-                dst = m_convexHullPoints[handle];
-        } else
-            dst = it->second;
-    } else
-        readTexture(texture, skinSize, effectMask, effects, nullptr, dst);
+        if (entry)
+            dst = entry->hullPoints();
+
+        return;
+    }
+
+    // Hulls with effects are calculated from the silhouette, the results are cached for quantized effect values
+    CpuTextureStore::Entry *entry = getEntry(texture, false);
+
+    if (!entry || entry->silhouette().isNull())
+        return;
+
+    const HullKey key = createHullKey(entry, skinSize, effectMask, effects);
+    auto it = m_hullCacheIndex.find(key);
+
+    if (it != m_hullCacheIndex.cend()) {
+        m_hullCache.splice(m_hullCache.begin(), m_hullCache, it->second);
+        dst = it->second->points;
+        return;
+    }
+
+    EffectState quantizedEffects;
+
+    for (ShaderManager::Effect effect : HULL_EFFECTS) {
+        if ((effectMask & effect) != 0)
+            quantizedEffects.setValue(effect, quantizeHullValue(effects.value(effect)) * HULL_QUANTIZATION_STEP);
+    }
+
+    static const auto convexHullFunctions = createConvexHullFunctions(std::make_integer_sequence<int, EffectTransform::MASK_COUNT>());
+    convexHullFunctions[static_cast<int>(effectMask) & (EffectTransform::MASK_COUNT - 1)](entry->silhouette(), skinSize, quantizedEffects, dst);
+
+    m_hullCache.push_front({ key, dst });
+    m_hullCacheIndex[key] = m_hullCache.begin();
+
+    while (m_hullCache.size() > HULL_CACHE_SIZE) {
+        m_hullCacheIndex.erase(m_hullCache.back().key);
+        m_hullCache.pop_back();
+    }
 }
 
-QRgb CpuTextureManager::getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+QRgb CpuTextureManager::getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const EffectState &effects)
 {
     const int width = texture.width();
     const int height = texture.height();
@@ -87,6 +116,10 @@ QRgb CpuTextureManager::getPointColor(const Texture &texture, int x, int y, Shad
         return qRgba(0, 0, 0, 0);
 
     GLubyte *pixels = getTextureData(texture);
+
+    if (!pixels)
+        return qRgba(0, 0, 0, 0);
+
     QRgb color = qRgba(pixels[(y * width + x) * 4], pixels[(y * width + x) * 4 + 1], pixels[(y * width + x) * 4 + 2], pixels[(y * width + x) * 4 + 3]);
 
     if (effectMask == 0)
@@ -95,7 +128,67 @@ QRgb CpuTextureManager::getPointColor(const Texture &texture, int x, int y, Shad
         return EffectTransform::transformColor(effectMask, effects, color);
 }
 
-bool CpuTextureManager::textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects)
+void CpuTextureManager::getPointColors(const Texture &texture, const int *x, const int *y, int count, ShaderManager::Effect effectMask, const EffectState &effects, QRgb *dst)
+{
+    // Same as getPointColor() for each point, but the effects are applied to blocks of points
+    static const int blockSize = 256;
+    const int width = texture.width();
+    const int height = texture.height();
+    const EffectTransform::PointsTransform transform = EffectTransform::pointsTransform(effectMask);
+    GLubyte *pixels = nullptr;
+    bool pixelsRead = false;
+    float localX[blockSize];
+    float localY[blockSize];
+
+    for (int i = 0; i < count; i += blockSize) {
+        const int size = std::min(blockSize, count - i);
+
+        if (effectMask != 0) {
+            // Get local positions with effect transform
+            for (int j = 0; j < size; j++) {
+                localX[j] = x[i + j] / static_cast<float>(width);
+                localY[j] = y[i + j] / static_cast<float>(height);
+            }
+
+            transform(effects, texture.size(), localX, localY, localX, localY, size);
+        }
+
+        for (int j = 0; j < size; j++) {
+            int texelX = x[i + j];
+            int texelY = y[i + j];
+
+            if (effectMask != 0) {
+                texelX = localX[j] * width;
+                texelY = localY[j] * height;
+            }
+
+            if ((texelX < 0 || texelX >= width) || (texelY < 0 || texelY >= height)) {
+                dst[i + j] = qRgba(0, 0, 0, 0);
+                continue;
+            }
+
+            // The data is only read if it's needed (like in getPointColor())
+            if (!pixelsRead) {
+                pixels = getTextureData(texture);
+                pixelsRead = true;
+            }
+
+            if (!pixels) {
+                dst[i + j] = qRgba(0, 0, 0, 0);
+                continue;
+            }
+
+            const GLubyte *pixel = pixels + (texelY * width + texelX) * 4;
+            dst[i + j] = qRgba(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+
+        // Transparent colors (including points outside the texture) stay transparent
+        if (effectMask != 0)
+            EffectTransform::transformColors(effectMask, effects, dst + i, dst + i, size);
+    }
+}
+
+bool CpuTextureManager::textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const EffectState &effects)
 {
     // https://github.com/scratchfoundation/scratch-render/blob/7b823985bc6fe92f572cc3276a8915e550f7c5e6/src/Silhouette.js#L219-L226
     const int width = texture.width();
@@ -103,6 +196,9 @@ bool CpuTextureManager::textureContainsPoint(const Texture &texture, const QPoin
     int x = localPoint.x();
     int y = localPoint.y();
 
+    // Effects that don't change shape don't affect the silhouette
+    effectMask = ShaderManager::shapeChangingEffects(effectMask);
+
     if (effectMask != 0) {
         // Get local position with effect transform
         QVector2D transformedCoords;
@@ -115,49 +211,163 @@ bool CpuTextureManager::textureContainsPoint(const Texture &texture, const QPoin
     if ((x < 0 || x >= width) || (y < 0 || y >= height))
         return false;
 
-    GLubyte *pixels = getTextureData(texture);
+    const Silhouette *silhouette = getTextureSilhouette(texture);
 
-    if (pixels) {
-        QRgb color = qRgba(pixels[(y * width + x) * 4], pixels[(y * width + x) * 4 + 1], pixels[(y * width + x) * 4 + 2], pixels[(y * width + x) * 4 + 3]);
-        return qAlpha(color) > 0;
-    }
+    if (silhouette)
+        return silhouette->contains(x, y);
 
     return false;
 }
 
+void CpuTextureManager::textureContainsPoints(const Texture &texture, const int *x, const int *y, int count, ShaderManager::Effect effectMask, const EffectState &effects, char *dst)
+{
+    // Same as textureContainsPoint() for each point, but the effect transform is applied to blocks of points
+    static const int blockSize = 256;
+    const int width = texture.width();
+    const int height = texture.height();
+    const Silhouette *silhouette = nullptr;
+    bool silhouetteRead = false;
+
+    // Effects that don't change shape don't affect the silhouette
+    effectMask = ShaderManager::shapeChangingEffects(effectMask);
+    const EffectTransform::PointsTransform transform = EffectTransform::pointsTransform(effectMask);
+    float localX[blockSize];
+    float localY[blockSize];
+
+    for (int i = 0; i < count; i += blockSize) {
+        const int size = std::min(blockSize, count - i);
+
+        if (effectMask != 0) {
+            // Get local positions with effect transform
+            for (int j = 0; j < size; j++) {
+                localX[j] = x[i + j] / static_cast<float>(width);
+                localY[j] = y[i + j] / static_cast<float>(height);
+            }
+
+            transform(effects, texture.size(), localX, localY, localX, localY, size);
+        }
+
+        for (int j = 0; j < size; j++) {
+            int texelX = x[i + j];
+            int texelY = y[i + j];
+
+            if (effectMask != 0) {
+                texelX = localX[j] * width;
+                texelY = localY[j] * height;
+            }
+
+            if ((texelX < 0 || texelX >= width) || (texelY < 0 || texelY >= height)) {
+                dst[i + j] = false;
+                continue;
+            }
+
+            // The silhouette is only read if it's needed (like in textureContainsPoint())
+            if (!silhouetteRead) {
+                silhouette = getTextureSilhouette(texture);
+                silhouetteRead = true;
+            }
+
+            dst[i + j] = silhouette && silhouette->contains(texelX, texelY);
+        }
+    }
+}
+
 void CpuTextureManager::removeTexture(const Texture &texture)
 {
     if (!texture.isValid())
         return;
 
     const GLuint handle = texture.handle();
-    auto it = m_textureData.find(handle);
+    auto it = m_entries.find(handle);
+
+    if (it != m_entries.cend()) {
+        CpuTextureStore *store = CpuTextureStore::instance();
 
-    if (it != m_textureData.cend()) {
-        delete it->second;
-        m_textureData.erase(it);
-        m_convexHullPoints.erase(handle);
+        if (m_storeGeneration == store->generation())
+            store->release(it->second->texture());
+
+        m_entries.erase(it);
+    }
+
+    for (auto it = m_hullCache.begin(); it != m_hullCache.end();) {
+        if (it->key.handle == handle) {
+            m_hullCacheIndex.erase(it->key);
+            it = m_hullCache.erase(it);
+        } else
+            it++;
     }
 }
 
-bool CpuTextureManager::addTexture(const Texture &tex)
+void CpuTextureManager::calculateConvexHullPoints(const Silhouette &silhouette, std::vector<QPoint> &points)
 {
-    if (!tex.isValid())
-        return false;
+    getConvexHullPoints<0>(silhouette, QSize(silhouette.width(), silhouette.height()), {}, points);
+}
+
+void CpuTextureManager::calculateConvexHullPoints(const QImage &image, std::vector<QPoint> &points)
+{
+    // The image must be created by Skin::paintImage() (this can be called from any thread)
+    points.clear();
+
+    if (image.format() != QImage::Format_RGBA8888)
+        return;
 
-    const GLuint handle = tex.handle();
-    m_textureData[handle] = nullptr;
-    m_convexHullPoints[handle] = {};
-    return readTexture(tex, QSize(), ShaderManager::Effect::NoEffect, {}, &m_textureData[handle], m_convexHullPoints[handle]);
+    calculateConvexHullPoints(Silhouette(image.constBits(), image.width(), image.height(), true), points);
 }
 
-bool CpuTextureManager::readTexture(
-    const Texture &texture,
-    const QSize &skinSize,
-    ShaderManager::Effect effectMask,
-    const std::unordered_map<ShaderManager::Effect, double> &effects,
-    GLubyte **data,
-    std::vector<QPoint> &points) const
+CpuTextureStore::Entry *CpuTextureManager::getEntry(const Texture &texture, bool data)
+{
+    // Returns the shared CPU copy of the texture, missing parts are read back from the GPU
+    if (!texture.isValid())
+        return nullptr;
+
+    CpuTextureStore *store = CpuTextureStore::instance();
+    const bool concurrent = m_concurrentReaders > 0;
+
+    // The entries were deleted (e.g. with the OpenGL context)
+    if (m_storeGeneration != store->generation()) {
+        if (concurrent)
+            return nullptr;
+
+        m_entries.clear();
+        m_storeGeneration = store->generation();
+    }
+
+    const GLuint handle = texture.handle();
+    auto it = m_entries.find(handle);
+    CpuTextureStore::Entry *entry = nullptr;
+
+    if (it != m_entries.cend() && it->second->texture().size() == texture.size())
+        entry = it->second;
+    else if (!concurrent) {
+        if (it != m_entries.cend())
+            store->release(it->second->texture());
+
+        entry = store->acquire(texture);
+        m_entries[handle] = entry;
+    }
+
+    if (store->getTexture(entry, data))
+        return entry;
+
+    // Other threads might be reading the data (see ConcurrentReads)
+    if (concurrent) {
+        qWarning("error: CPU texture must be read before concurrent reads");
+        return nullptr;
+    }
+
+    // The full RGBA data is only kept if it's needed (e.g. for color queries)
+    std::vector<GLubyte> pixels;
+    std::vector<QPoint> points;
+    Silhouette silhouette;
+
+    if (!readTexture(texture, data ? &pixels : nullptr, points, silhouette))
+        return nullptr;
+
+    store->setTexture(entry, std::move(pixels), std::move(silhouette), std::move(points));
+    return entry;
+}
+
+bool CpuTextureManager::readTexture(const Texture &texture, std::vector<GLubyte> *data, std::vector<QPoint> &points, Silhouette &silhouette) const
 {
     if (!texture.isValid())
         return false;
@@ -194,8 +404,157 @@ bool CpuTextureManager::readTexture(
     }
 
     // Read pixels
-    GLubyte *pixels = new GLubyte[width * height * 4]; // 4 channels (RGBA)
-    glF.glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    std::vector<GLubyte> pixels(static_cast<size_t>(width) * height * 4); // 4 channels (RGBA)
+    glF.glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    silhouette = Silhouette(pixels.data(), width, height, true);
+    getConvexHullPoints<0>(silhouette, texture.size(), {}, points);
+
+    if (data) {
+        // Flip vertically
+        int rowSize = width * 4;
+        GLubyte *tempRow = new GLubyte[rowSize];
+
+        for (size_t i = 0; i < height / 2; ++i) {
+            size_t topRowIndex = i * rowSize;
+            size_t bottomRowIndex = (height - 1 - i) * rowSize;
+
+            // Swap rows
+            memcpy(tempRow, &pixels[topRowIndex], rowSize);
+            memcpy(&pixels[topRowIndex], &pixels[bottomRowIndex], rowSize);
+            memcpy(&pixels[bottomRowIndex], tempRow, rowSize);
+        }
+
+        delete[] tempRow;
+
+        *data = std::move(pixels);
+    }
+
+    // Cleanup
+    glF.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return true;
+}
+
+template<int... Masks>
+std::array<CpuTextureManager::ConvexHullFunction, sizeof...(Masks)> CpuTextureManager::createConvexHullFunctions(std::integer_sequence<int, Masks...>)
+{
+    // Only shape-changing effects are used in the loop, so other effects share the same specializations
+    static constexpr int shapeEffects =
+        static_cast<int>(ShaderManager::Effect::Mosaic) | static_cast<int>(ShaderManager::Effect::Pixelate) | static_cast<int>(ShaderManager::Effect::Whirl) | static_cast<int>(ShaderManager::Effect::Fisheye);
+
+    return { &getConvexHullPoints<Masks & shapeEffects>... };
+}
+
+int64_t CpuTextureManager::quantizeHullValue(double value)
+{
+    // Clamp before rounding, huge values (e.g. fisheye 1e9) don't fit into an integer
+    // The hull doesn't change noticeably beyond the limit anyway
+    static const double limit = 1e12;
+    const double steps = value / HULL_QUANTIZATION_STEP;
+
+    if (std::isnan(steps))
+        return 0;
+
+    return std::llround(std::clamp(steps, -limit, limit));
+}
+
+CpuTextureManager::HullKey CpuTextureManager::createHullKey(const CpuTextureStore::Entry *entry, const QSize &skinSize, ShaderManager::Effect effectMask, const EffectState &effects)
+{
+    HullKey key;
+    key.handle = entry->texture().handle();
+    key.version = entry->version();
+    key.width = skinSize.width();
+    key.height = skinSize.height();
+    key.mask = static_cast<int>(effectMask);
+
+    for (size_t i = 0; i < HULL_EFFECTS.size(); i++) {
+        if ((effectMask & HULL_EFFECTS[i]) != 0)
+            key.values[i] = quantizeHullValue(effects.value(HULL_EFFECTS[i]));
+    }
+
+    return key;
+}
+
+bool CpuTextureManager::HullKey::operator==(const HullKey &other) const
+{
+    return handle == other.handle && version == other.version && width == other.width && height == other.height && mask == other.mask && values == other.values;
+}
+
+size_t CpuTextureManager::HullKeyHash::operator()(const HullKey &key) const
+{
+    size_t ret = std::hash<GLuint>()(key.handle);
+
+    auto combine = [&ret](int64_t value) { ret ^= std::hash<int64_t>()(value) + 0x9e3779b9 + (ret << 6) + (ret >> 2); };
+    combine(key.version);
+    combine(key.width);
+    combine(key.height);
+    combine(key.mask);
+
+    for (int64_t value : key.values)
+        combine(value);
+
+    return ret;
+}
+
+template<int EffectMask>
+void CpuTextureManager::getConvexHullPoints(const Silhouette &silhouette, const QSize &skinSize, const EffectState &effects, std::vector<QPoint> &points)
+{
+    const int width = silhouette.width();
+    const int height = silhouette.height();
+
+    // Find the first and last opaque texel of each row (-1 if there isn't any)
+    std::vector<int> rowFirst(height, -1);
+    std::vector<int> rowLast(height, -1);
+
+    if constexpr (EffectMask == 0) {
+        // Without effects, rows are scanned a whole silhouette word at a time
+        for (int y = 0; y < height; y++)
+            silhouette.rowExtent(y, rowFirst[y], rowLast[y]);
+    } else {
+        // Transformed texel coordinates of the current row
+        std::vector<float> rowX(width);
+        std::vector<float> rowY(width);
+        std::vector<int> texelX(width);
+        std::vector<int> texelY(width);
+
+        // The effect transform uses flipped coordinates
+        auto contains = [&silhouette, &texelX, &texelY, height](int x) { return silhouette.contains(texelX[x], height - 1 - texelY[x]); };
+
+        for (int y = 0; y < height; y++) {
+            const int flippedY = height - 1 - y;
+            int x;
+
+            // Get local positions of the whole row with effect transform
+            for (x = 0; x < width; x++) {
+                rowX[x] = x / static_cast<float>(width);
+                rowY[x] = flippedY / static_cast<float>(height);
+            }
+
+            EffectTransform::transformPoints<EffectMask>(effects, skinSize, rowX.data(), rowY.data(), rowX.data(), rowY.data(), width);
+
+            for (x = 0; x < width; x++) {
+                texelX[x] = rowX[x] * width;
+                texelY[x] = rowY[x] * height;
+            }
+
+            x = 0;
+
+            while (x < width && !contains(x))
+                x++;
+
+            if (x >= width)
+                continue;
+
+            rowFirst[y] = x;
+            x = width - 1;
+
+            while (!contains(x))
+                x--;
+
+            rowLast[y] = x;
+        }
+    }
 
     std::vector<QPoint> leftHull;
     std::vector<QPoint> rightHull;
@@ -215,37 +574,11 @@ bool CpuTextureManager::readTexture(
     // Get convex hull points (flipped vertically)
     // https://github.com/scratchfoundation/scratch-render/blob/0f6663f3148b4f994d58e19590e14c152f1cc2f8/src/RenderWebGL.js#L1829-L1955
     for (int y = 0; y < height; y++) {
-        QPoint currentPoint;
-        int x;
-        const int flippedY = height - 1 - y;
-
-        for (x = 0; x < width; x++) {
-            int transformedX = x;
-            int transformedY = flippedY;
-
-            if (effectMask != 0) {
-                // Get local position with effect transform
-                QVector2D transformedCoords;
-                const QVector2D localCoords(transformedX / static_cast<float>(width), transformedY / static_cast<float>(height));
-                EffectTransform::transformPoint(effectMask, effects, skinSize, localCoords, transformedCoords);
-                transformedX = transformedCoords.x() * width;
-                transformedY = transformedCoords.y() * height;
-            }
-
-            if ((transformedX >= 0 && transformedX < width) && (transformedY >= 0 && transformedY < height)) {
-                int index = (transformedY * width + transformedX) * 4;
-
-                if (pixels[index + 3] > 0) {
-                    currentPoint.setX(x);
-                    currentPoint.setY(y);
-                    break;
-                }
-            }
-        }
-
-        if (x >= width)
+        if (rowFirst[y] == -1)
             continue;
 
+        QPoint currentPoint(rowFirst[y], y);
+
         while (leftEndPointIndex > 0) {
             if (determinant(leftHull[leftEndPointIndex], leftHull[leftEndPointIndex - 1], currentPoint) > 0)
                 break;
@@ -255,30 +588,7 @@ bool CpuTextureManager::readTexture(
         }
 
         leftHull[++leftEndPointIndex] = currentPoint;
-
-        for (x = width - 1; x >= 0; x--) {
-            int transformedX = x;
-            int transformedY = flippedY;
-
-            if (effectMask != 0) {
-                // Get local position with effect transform
-                QVector2D transformedCoords;
-                const QVector2D localCoords(transformedX / static_cast<float>(width), transformedY / static_cast<float>(height));
-                EffectTransform::transformPoint(effectMask, effects, skinSize, localCoords, transformedCoords);
-                transformedX = transformedCoords.x() * width;
-                transformedY = transformedCoords.y() * height;
-            }
-
-            if ((transformedX >= 0 && transformedX < width) && (transformedY >= 0 && transformedY < height)) {
-                int index = (transformedY * width + transformedX) * 4;
-
-                if (pixels[index + 3] > 0) {
-                    currentPoint.setX(x);
-                    currentPoint.setY(y);
-                    break;
-                }
-            }
-        }
+        currentPoint.setX(rowLast[y]);
 
         while (rightEndPointIndex > 0) {
             if (determinant(rightHull[rightEndPointIndex], rightHull[rightEndPointIndex - 1], currentPoint) < 0)
@@ -303,30 +613,4 @@ bool CpuTextureManager::readTexture(
     for (i = rightEndPointIndex; i >= 0; --i)
         if (rightHull[i].x() >= 0)
             points.push_back(rightHull[i]);
-
-    if (data) {
-        // Flip vertically
-        int rowSize = width * 4;
-        GLubyte *tempRow = new GLubyte[rowSize];
-
-        for (size_t i = 0; i < height / 2; ++i) {
-            size_t topRowIndex = i * rowSize;
-            size_t bottomRowIndex = (height - 1 - i) * rowSize;
-
-            // Swap rows
-            memcpy(tempRow, &pixels[topRowIndex], rowSize);
-            memcpy(&pixels[topRowIndex], &pixels[bottomRowIndex], rowSize);
-            memcpy(&pixels[bottomRowIndex], tempRow, rowSize);
-        }
-
-        delete[] tempRow;
-
-        *data = pixels;
-    } else
-        delete[] pixels;
-
-    // Cleanup
-    glF.glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    return true;
 }
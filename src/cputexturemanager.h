@@ -5,8 +5,14 @@
 #include <QPoint>
 #include <QtOpenGL>
 #include <unordered_map>
+#include <atomic>
+#include <array>
+#include <list>
+#include <utility>
 
-#include "shadermanager.h"
+#include "effectstate.h"
+#include "silhouette.h"
+#include "cputexturestore.h"
 
 namespace scratchcpprender
 {
@@ -16,35 +22,96 @@ class Texture;
 class CpuTextureManager
 {
     public:
+        /*!
+         * While an instance of this class exists, textures aren't added to any texture manager,
+         * so other threads can safely read the data of textures which were read before.
+         */
+        class ConcurrentReads
+        {
+            public:
+                ConcurrentReads() { m_concurrentReaders++; }
+                ConcurrentReads(const ConcurrentReads &) = delete;
+                ~ConcurrentReads() { m_concurrentReaders--; }
+
+                static bool active() { return m_concurrentReaders > 0; }
+        };
+
+        static inline const size_t HULL_CACHE_SIZE = 64;
+        static inline const double HULL_QUANTIZATION_STEP = 0.1;
+
         CpuTextureManager();
         ~CpuTextureManager();
 
         GLubyte *getTextureData(const Texture &texture);
+        const Silhouette *getTextureSilhouette(const Texture &texture);
         void getTextureConvexHullPoints(
             const Texture &texture,
             const QSize &skinSize,
             ShaderManager::Effect effectMask,
-            const std::unordered_map<ShaderManager::Effect, double> &effects,
+            const EffectState &effects,
             std::vector<QPoint> &dst);
 
-        QRgb getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
-        bool textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effects);
+        QRgb getPointColor(const Texture &texture, int x, int y, ShaderManager::Effect effectMask, const EffectState &effects);
+        void getPointColors(const Texture &texture, const int *x, const int *y, int count, ShaderManager::Effect effectMask, const EffectState &effects, QRgb *dst);
+        bool textureContainsPoint(const Texture &texture, const QPointF &localPoint, ShaderManager::Effect effectMask, const EffectState &effects);
+        void textureContainsPoints(const Texture &texture, const int *x, const int *y, int count, ShaderManager::Effect effectMask, const EffectState &effects, char *dst);
 
         void removeTexture(const Texture &texture);
 
+        static void calculateConvexHullPoints(const Silhouette &silhouette, std::vector<QPoint> &points);
+        static void calculateConvexHullPoints(const QImage &image, std::vector<QPoint> &points);
+
     private:
-        bool addTexture(const Texture &tex);
-        bool readTexture(
-            const Texture &texture,
-            const QSize &skinSize,
-            ShaderManager::Effect effectMask,
-            const std::unordered_map<ShaderManager::Effect, double> &effects,
-            GLubyte **data,
-            std::vector<QPoint> &points) const;
+        CpuTextureStore::Entry *getEntry(const Texture &texture, bool data);
+        bool readTexture(const Texture &texture, std::vector<GLubyte> *data, std::vector<QPoint> &points, Silhouette &silhouette) const;
+
+        struct HullKey
+        {
+                GLuint handle = 0;
+                unsigned int version = 0; // see CpuTextureStore::Entry::version()
+                int width = 0;
+                int height = 0;
+                int mask = 0;
+                std::array<int64_t, 4> values = {}; // quantized values of the shape-changing effects
+
+                bool operator==(const HullKey &other) const;
+        };
+
+        struct HullKeyHash
+        {
+                size_t operator()(const HullKey &key) const;
+        };
+
+        struct HullEntry
+        {
+                HullKey key;
+                std::vector<QPoint> points;
+        };
+
+        static inline const std::array<ShaderManager::Effect, 4> HULL_EFFECTS = {
+            ShaderManager::Effect::Fisheye,
+            ShaderManager::Effect::Whirl,
+            ShaderManager::Effect::Pixelate,
+            ShaderManager::Effect::Mosaic
+        };
+
+        static int64_t quantizeHullValue(double value);
+        static HullKey createHullKey(const CpuTextureStore::Entry *entry, const QSize &skinSize, ShaderManager::Effect effectMask, const EffectState &effects);
+
+        using ConvexHullFunction = void (*)(const Silhouette &, const QSize &, const EffectState &, std::vector<QPoint> &);
+
+        template<int... Masks>
+        static std::array<ConvexHullFunction, sizeof...(Masks)> createConvexHullFunctions(std::integer_sequence<int, Masks...>);
+
+        template<int EffectMask>
+        static void getConvexHullPoints(const Silhouette &silhouette, const QSize &skinSize, const EffectState &effects, std::vector<QPoint> &points);
 
         static inline GLuint m_fbo = 0;          // single FBO for all texture managers
-        std::unordered_map<GLuint, GLubyte *> m_textureData;
-        std::unordered_map<GLuint, std::vector<QPoint>> m_convexHullPoints;
+        static inline std::atomic<int> m_concurrentReaders = 0;
+        std::unordered_map<GLuint, CpuTextureStore::Entry *> m_entries; // textures referenced by this texture manager (see CpuTextureStore)
+        unsigned int m_storeGeneration = 0;
+        std::list<HullEntry> m_hullCache; // hulls with shape-changing effects, most recently used first
+        std::unordered_map<HullKey, std::list<HullEntry>::iterator, HullKeyHash> m_hullCacheIndex;
 };
 
 } // namespace scratchcpprender
@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <algorithm>
+
+#include "cputexturestore.h"
+#include "cputexturemanager.h"
+
+using namespace scratchcpprender;
+
+Q_GLOBAL_STATIC(CpuTextureStore, globalInstance)
+
+CpuTextureStore::Entry::Entry(const Texture &texture) :
+    m_texture(texture)
+{
+}
+
+qint64 CpuTextureStore::Entry::size() const
+{
+    return m_data.size() + m_silhouette.byteCount() + m_hullPoints.size() * sizeof(QPoint);
+}
+
+void CpuTextureStore::Entry::reset()
+{
+    m_data.clear();
+    m_data.shrink_to_fit();
+    m_silhouette = Silhouette();
+    m_hullPoints.clear();
+    m_hullPoints.shrink_to_fit();
+    m_hasShape = false;
+}
+
+CpuTextureStore::CpuTextureStore()
+{
+}
+
+CpuTextureStore *CpuTextureStore::instance()
+{
+    return globalInstance;
+}
+
+void CpuTextureStore::addTexture(const Texture &texture, const QImage &image, const std::vector<QPoint> *hullPoints)
+{
+    // Adds a reference to a texture rasterized on the CPU (release it when the texture isn't used anymore).
+    // The silhouette and the convex hull are calculated right away (unless the hull points are known), so the first query doesn't have to do it.
+    // The image isn't kept, only the flipped RGBA data is stored (it's counted in the memory budget like data read from the GPU).
+    if (!texture.isValid() || image.size() != texture.size() || image.format() != QImage::Format_RGBA8888)
+        return;
+
+    Silhouette silhouette(image.constBits(), image.width(), image.height(), true);
+    silhouette.runs(0); // the runs are counted in the entry size, so build them now
+    std::vector<QPoint> points;
+
+    if (hullPoints)
+        points = *hullPoints;
+    else
+        CpuTextureManager::calculateConvexHullPoints(silhouette, points);
+
+    // Flip the image vertically (the first row of the image is the bottom row, like in OpenGL)
+    const int width = image.width();
+    const int height = image.height();
+    const int rowSize = width * 4;
+    std::vector<GLubyte> data(static_cast<size_t>(rowSize) * height);
+
+    for (int y = 0; y < height; y++)
+        memcpy(&data[static_cast<size_t>(y) * rowSize], image.constScanLine(height - 1 - y), rowSize);
+
+    Entry *entry = acquire(texture);
+    QMutexLocker locker(&m_mutex);
+    const qint64 oldSize = entry->size();
+
+    // The texture has just been created, so the existing data (if any) belongs to a deleted texture
+    entry->reset();
+    entry->m_version++;
+    entry->m_data = std::move(data);
+    entry->m_silhouette = std::move(silhouette);
+    entry->m_hullPoints = std::move(points);
+    entry->m_hasShape = true;
+    entry->m_lastUse = ++m_clock;
+    updateSize(entry, oldSize);
+}
+
+CpuTextureStore::Entry *CpuTextureStore::acquire(const Texture &texture)
+{
+    // Returns the entry of the texture (it stays valid until the reference is released or the store is cleared)
+    if (!texture.isValid())
+        return nullptr;
+
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(texture.handle());
+
+    if (it == m_entries.cend()) {
+        it = m_entries.insert({ texture.handle(), std::unique_ptr<Entry>(new Entry(texture)) }).first;
+    } else if (it->second->m_texture.size() != texture.size()) {
+        // The handle has been reused by another texture
+        Entry *entry = it->second.get();
+        m_memoryUsage -= entry->size();
+        entry->m_texture = texture;
+        entry->reset();
+        entry->m_version++;
+    }
+
+    it->second->m_refCount++;
+    return it->second.get();
+}
+
+void CpuTextureStore::release(const Texture &texture)
+{
+    QMutexLocker locker(&m_mutex);
+    Entry *entry = findEntry(texture);
+
+    if (!entry || --entry->m_refCount > 0)
+        return;
+
+    m_memoryUsage -= entry->size();
+    m_entries.erase(texture.handle());
+}
+
+void CpuTextureStore::invalidate(const Texture &texture)
+{
+    // Drops the data of a texture which is going to be deleted (other users might still reference it, but the handle can be reused)
+    QMutexLocker locker(&m_mutex);
+    Entry *entry = findEntry(texture);
+
+    if (!entry)
+        return;
+
+    m_memoryUsage -= entry->size();
+    entry->reset();
+    entry->m_version++;
+}
+
+int CpuTextureStore::refCount(const Texture &texture) const
+{
+    QMutexLocker locker(&m_mutex);
+    Entry *entry = findEntry(texture);
+    return entry ? entry->m_refCount : 0;
+}
+
+void CpuTextureStore::pin(const Texture &texture)
+{
+    // Adds a reference to the texture and keeps its data until it's unpinned (the memory budget might be exceeded until then)
+    Entry *entry = acquire(texture);
+
+    if (!entry)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    entry->m_pinCount++;
+}
+
+void CpuTextureStore::unpin(const Texture &texture)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry *entry = findEntry(texture);
+
+        if (!entry || entry->m_pinCount == 0)
+            return;
+
+        if (--entry->m_pinCount == 0 && !CpuTextureManager::ConcurrentReads::active())
+            evict(m_memoryBudget, nullptr);
+    }
+
+    release(texture);
+}
+
+bool CpuTextureStore::isPinned(const Texture &texture) const
+{
+    QMutexLocker locker(&m_mutex);
+    Entry *entry = findEntry(texture);
+    return entry && entry->m_pinCount > 0;
+}
+
+bool CpuTextureStore::getTexture(Entry *entry, bool data)
+{
+    // Returns true if the silhouette (and the RGBA data if requested) is available, otherwise it must be read and set using setTexture().
+    // Available textures are returned without locking, so that they can be read by multiple threads (see CpuTextureManager::ConcurrentReads).
+    if (!entry)
+        return false;
+
+    if (entry->m_hasShape && (!data || entry->hasData())) {
+        entry->m_lastUse = ++m_clock;
+        m_hits++;
+        return true;
+    }
+
+    // Other threads might be reading the data
+    if (CpuTextureManager::ConcurrentReads::active())
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    m_misses++;
+    return false;
+}
+
+void CpuTextureStore::setTexture(Entry *entry, std::vector<GLubyte> &&data, Silhouette &&silhouette, std::vector<QPoint> &&hullPoints)
+{
+    // Sets the parts of the texture which were read back (the existing parts aren't replaced)
+    if (!entry)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    const qint64 oldSize = entry->size();
+
+    if (!entry->m_hasShape) {
+        if (!silhouette.isNull())
+            silhouette.runs(0); // the runs are counted in the entry size, so build them now
+
+        entry->m_silhouette = std::move(silhouette);
+        entry->m_hullPoints = std::move(hullPoints);
+        entry->m_hasShape = true;
+    }
+
+    if (!entry->hasData())
+        entry->m_data = std::move(data);
+
+    entry->m_lastUse = ++m_clock;
+    updateSize(entry, oldSize);
+}
+
+qint64 CpuTextureStore::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+void CpuTextureStore::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_memoryBudget = std::max(0LL, bytes);
+
+    if (!CpuTextureManager::ConcurrentReads::active())
+        evict(m_memoryBudget, nullptr);
+}
+
+qint64 CpuTextureStore::memoryUsage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_memoryUsage;
+}
+
+qint64 CpuTextureStore::hits() const
+{
+    return m_hits;
+}
+
+qint64 CpuTextureStore::misses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_misses;
+}
+
+qint64 CpuTextureStore::evictions() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_evictions;
+}
+
+int CpuTextureStore::count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
+
+unsigned int CpuTextureStore::generation() const
+{
+    // Changes when the entries are deleted (see clear()), so that users can drop the entries they store
+    return m_generation;
+}
+
+void CpuTextureStore::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+    m_memoryUsage = 0;
+    m_generation++;
+}
+
+CpuTextureStore::Entry *CpuTextureStore::findEntry(const Texture &texture) const
+{
+    if (!texture.isValid())
+        return nullptr;
+
+    auto it = m_entries.find(texture.handle());
+
+    if (it == m_entries.cend() || it->second->m_texture.size() != texture.size())
+        return nullptr;
+
+    return it->second.get();
+}
+
+void CpuTextureStore::updateSize(Entry *entry, qint64 oldSize)
+{
+    m_memoryUsage += entry->size() - oldSize;
+    evict(m_memoryBudget, entry);
+}
+
+void CpuTextureStore::evict(qint64 budget, const Entry *keep)
+{
+    // Drops the data of least recently used textures until the memory usage is within the budget (the entries stay until they're released).
+    // Pinned textures are skipped, they might be read by other threads.
+    if (m_memoryUsage <= budget)
+        return;
+
+    std::vector<Entry *> entries;
+
+    for (const auto &[handle, entry] : m_entries) {
+        if (entry.get() != keep && entry->m_pinCount == 0 && entry->size() > 0)
+            entries.push_back(entry.get());
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry *a, const Entry *b) { return a->m_lastUse < b->m_lastUse; });
+
+    for (Entry *entry : entries) {
+        if (m_memoryUsage <= budget)
+            break;
+
+        m_memoryUsage -= entry->size();
+        entry->reset();
+        m_evictions++;
+    }
+}
+
+CpuTextureStore::PinnedTextures::~PinnedTextures()
+{
+    // Pins live on the stack of queries, but a query running during application exit might finish after the global store is destroyed
+    CpuTextureStore *store = CpuTextureStore::instance();
+
+    if (!store)
+        return;
+
+    for (const Texture &texture : m_textures)
+        store->unpin(texture);
+}
+
+void CpuTextureStore::PinnedTextures::add(const Texture &texture)
+{
+    if (!texture.isValid())
+        return;
+
+    CpuTextureStore::instance()->pin(texture);
+    m_textures.push_back(texture);
+}
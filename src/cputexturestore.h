@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QMutex>
+#include <QtOpenGL>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include "texture.h"
+#include "silhouette.h"
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The CpuTextureStore class holds the CPU copies of textures for all texture managers.
+ * Each texture is stored once (no matter how many targets use it) and removed when the last reference is released.
+ * Textures which were rasterized on the CPU (e.g. skin textures) don't have to be read back from the GPU.
+ * Least recently used data is dropped when the memory budget is exceeded, it's read again when it's needed.
+ */
+class CpuTextureStore
+{
+    public:
+        static inline const qint64 DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+        class Entry
+        {
+            public:
+                Entry(const Entry &) = delete;
+
+                const Texture &texture() const { return m_texture; }
+                unsigned int version() const { return m_version; }
+
+                bool hasShape() const { return m_hasShape; }
+                bool hasData() const { return !m_data.empty(); }
+
+                GLubyte *data() { return m_data.data(); } // RGBA, the first row is the top row
+                const Silhouette &silhouette() const { return m_silhouette; }
+                const std::vector<QPoint> &hullPoints() const { return m_hullPoints; }
+
+            private:
+                Entry(const Texture &texture);
+                qint64 size() const;
+                void reset();
+
+                Texture m_texture;
+                int m_refCount = 0;
+                unsigned int m_version = 0; // changes when the texture is replaced
+                std::vector<GLubyte> m_data;
+                Silhouette m_silhouette;
+                std::vector<QPoint> m_hullPoints;
+                bool m_hasShape = false; // silhouette and hull points
+                int m_pinCount = 0;      // pinned entries aren't evicted (see pin())
+                std::atomic<quint64> m_lastUse = 0;
+
+                friend class CpuTextureStore;
+        };
+
+        /*!
+         * Textures added to an instance of this class aren't evicted until it's destroyed.
+         * Queries add all textures which are read by other threads (see RenderedTarget::prepareConcurrentReads()).
+         */
+        class PinnedTextures
+        {
+            public:
+                PinnedTextures() = default;
+                PinnedTextures(const PinnedTextures &) = delete;
+                ~PinnedTextures();
+
+                void add(const Texture &texture);
+
+            private:
+                std::vector<Texture> m_textures;
+        };
+
+        CpuTextureStore();
+        CpuTextureStore(const CpuTextureStore &) = delete;
+
+        static CpuTextureStore *instance();
+
+        void addTexture(const Texture &texture, const QImage &image, const std::vector<QPoint> *hullPoints = nullptr);
+
+        Entry *acquire(const Texture &texture);
+        void release(const Texture &texture);
+        void invalidate(const Texture &texture);
+        int refCount(const Texture &texture) const;
+
+        void pin(const Texture &texture);
+        void unpin(const Texture &texture);
+        bool isPinned(const Texture &texture) const;
+
+        bool getTexture(Entry *entry, bool data);
+        void setTexture(Entry *entry, std::vector<GLubyte> &&data, Silhouette &&silhouette, std::vector<QPoint> &&hullPoints);
+
+        qint64 memoryBudget() const;
+        void setMemoryBudget(qint64 bytes);
+        qint64 memoryUsage() const;
+
+        qint64 hits() const;
+        qint64 misses() const;
+        qint64 evictions() const;
+
+        int count() const;
+        unsigned int generation() const;
+
+        void clear();
+
+    private:
+        Entry *findEntry(const Texture &texture) const;
+        void updateSize(Entry *entry, qint64 oldSize);
+        void evict(qint64 budget, const Entry *keep);
+
+        mutable QMutex m_mutex;
+        std::unordered_map<GLuint, std::unique_ptr<Entry>> m_entries;
+        qint64 m_memoryBudget = DEFAULT_MEMORY_BUDGET;
+        qint64 m_memoryUsage = 0;
+        std::atomic<qint64> m_hits = 0;
+        qint64 m_misses = 0;
+        qint64 m_evictions = 0;
+        std::atomic<quint64> m_clock = 0;
+        std::atomic<unsigned int> m_generation = 0;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include "effectstate.h"
+
+using namespace scratchcpprender;
+
+EffectState::EffectState() :
+    m_uniformValues(defaultUniformValues())
+{
+}
+
+EffectState::EffectState(const std::unordered_map<ShaderManager::Effect, double> &effects) :
+    EffectState()
+{
+    for (const auto &[effect, value] : effects)
+        setValue(effect, value);
+}
+
+bool EffectState::setValue(ShaderManager::Effect effect, double value)
+{
+    // Returns true if the value has changed (effects with zero value are disabled)
+    if (effect == ShaderManager::Effect::NoEffect)
+        return false;
+
+    const int i = index(effect);
+
+    if (m_values[i] == value)
+        return false;
+
+    m_values[i] = value;
+    m_uniformValues[i] = ShaderManager::uniformValue(effect, value);
+
+    if (value == 0)
+        m_mask &= ~effect;
+    else
+        m_mask |= effect;
+
+    return true;
+}
+
+void EffectState::clear()
+{
+    m_mask = ShaderManager::Effect::NoEffect;
+    m_values.fill(0);
+    m_uniformValues = defaultUniformValues();
+}
+
+std::unordered_map<ShaderManager::Effect, double> EffectState::toMap() const
+{
+    std::unordered_map<ShaderManager::Effect, double> ret;
+
+    for (ShaderManager::Effect effect : ShaderManager::effects()) {
+        if (contains(effect))
+            ret[effect] = value(effect);
+    }
+
+    return ret;
+}
+
+const std::array<float, EffectState::EFFECT_COUNT> &EffectState::defaultUniformValues()
+{
+    static const std::array<float, EFFECT_COUNT> values = []() {
+        std::array<float, EFFECT_COUNT> ret;
+
+        for (int i = 0; i < EFFECT_COUNT; i++)
+            ret[i] = ShaderManager::uniformValue(static_cast<ShaderManager::Effect>(1 << i), 0);
+
+        return ret;
+    }();
+
+    return values;
+}
+
+namespace scratchcpprender
+{
+
+bool operator==(const EffectState &a, const EffectState &b)
+{
+    // Uniform values depend on the values
+    return a.m_mask == b.m_mask && a.m_values == b.m_values;
+}
+
+} // namespace scratchcpprender
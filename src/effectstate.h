@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <array>
+#include <unordered_map>
+
+#include "shadermanager.h"
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The EffectState class stores graphic effect values and their uniform values (see ShaderManager).
+ * Uniform values are converted when an effect changes, so the state can be used for each pixel and it's cheap to copy.
+ */
+class EffectState
+{
+    public:
+        static inline const int EFFECT_COUNT = 7;
+
+        EffectState();
+        explicit EffectState(const std::unordered_map<ShaderManager::Effect, double> &effects);
+
+        ShaderManager::Effect mask() const { return m_mask; }
+        bool empty() const { return m_mask == ShaderManager::Effect::NoEffect; }
+        bool contains(ShaderManager::Effect effect) const { return (m_mask & effect) != 0; }
+
+        double value(ShaderManager::Effect effect) const { return m_values[index(effect)]; }
+        float uniformValue(ShaderManager::Effect effect) const { return m_uniformValues[index(effect)]; }
+        bool setValue(ShaderManager::Effect effect, double value);
+        void clear();
+
+        std::unordered_map<ShaderManager::Effect, double> toMap() const;
+
+        friend bool operator==(const EffectState &a, const EffectState &b);
+        friend bool operator!=(const EffectState &a, const EffectState &b) { return !(a == b); }
+
+    private:
+        static int index(ShaderManager::Effect effect)
+        {
+            // Effects are single bits (NoEffect doesn't have a value)
+            int bits = static_cast<int>(effect);
+            int ret = 0;
+            Q_ASSERT(bits != 0 && (bits & (bits - 1)) == 0);
+
+            while (bits > 1) {
+                bits >>= 1;
+                ret++;
+            }
+
+            Q_ASSERT(ret < EFFECT_COUNT);
+            return ret;
+        }
+
+        static const std::array<float, EFFECT_COUNT> &defaultUniformValues();
+
+        ShaderManager::Effect m_mask = ShaderManager::Effect::NoEffect;
+        std::array<double, EFFECT_COUNT> m_values = {};
+        std::array<float, EFFECT_COUNT> m_uniformValues;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,363 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <cmath>
+#include <algorithm>
+
+#include "effecttexturecache.h"
+
+using namespace scratchcpprender;
+
+static const std::array<ShaderManager::Effect, 4> BAKED_EFFECT_LIST = { ShaderManager::Effect::Color, ShaderManager::Effect::Brightness, ShaderManager::Effect::Whirl, ShaderManager::Effect::Fisheye };
+
+Q_GLOBAL_STATIC(EffectTextureCache, globalInstance)
+
+EffectTextureCache::EffectTextureCache()
+{
+}
+
+EffectTextureCache::~EffectTextureCache()
+{
+    // Textures are deleted with the OpenGL context (see init())
+    QObject::disconnect(m_contextConnection);
+}
+
+EffectTextureCache *EffectTextureCache::instance()
+{
+    return globalInstance;
+}
+
+Texture EffectTextureCache::getTexture(const Texture &texture, const EffectState &effects)
+{
+    // Returns an invalid texture if there's nothing to bake or if the texture doesn't fit into the memory budget
+    if (!texture.isValid())
+        return Texture();
+
+    const EffectState baked = bakedEffects(effects);
+
+    if (baked.empty())
+        return Texture();
+
+    const Key key = createKey(texture, baked);
+    auto it = m_index.find(key);
+
+    if (it != m_index.cend()) {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->texture;
+    }
+
+    // Each texture is stored twice (in VRAM and in the CPU copy)
+    const qint64 size = static_cast<qint64>(texture.width()) * texture.height() * 4 * 2;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    if (size > m_memoryBudget || !context || CpuTextureManager::ConcurrentReads::active())
+        return Texture();
+
+    QOpenGLExtraFunctions *glF = context->extraFunctions();
+
+    if (!init(glF))
+        return Texture();
+
+    evict(m_memoryBudget - size);
+    Texture result = render(glF, texture, baked);
+
+    if (!result.isValid())
+        return Texture();
+
+    m_entries.push_front({ key, result, size });
+    m_index[key] = m_entries.begin();
+    m_memoryUsage += size;
+    return result;
+}
+
+void EffectTextureCache::removeTexture(const Texture &texture)
+{
+    // Removes the textures baked from the given texture (e.g. when it's going to be deleted)
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->key.handle == texture.handle())
+            removeEntry(it++);
+        else
+            it++;
+    }
+}
+
+CpuTextureManager *EffectTextureCache::textureManager()
+{
+    return &m_textureManager;
+}
+
+EffectState EffectTextureCache::bakedEffects(const EffectState &effects)
+{
+    // Values are quantized, so that small changes don't create new textures
+    EffectState ret;
+
+    for (ShaderManager::Effect effect : BAKED_EFFECT_LIST) {
+        if (effects.contains(effect))
+            ret.setValue(effect, quantizeValue(effects.value(effect)) * QUANTIZATION_STEP);
+    }
+
+    return ret;
+}
+
+EffectState EffectTextureCache::remainingEffects(const EffectState &effects)
+{
+    EffectState ret = effects;
+
+    for (ShaderManager::Effect effect : BAKED_EFFECT_LIST)
+        ret.setValue(effect, 0);
+
+    return ret;
+}
+
+ShaderManager::Effect EffectTextureCache::remainingEffects(ShaderManager::Effect effectMask)
+{
+    return effectMask & ~BAKED_EFFECTS;
+}
+
+qint64 EffectTextureCache::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+void EffectTextureCache::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget = std::max(0LL, bytes);
+
+    if (!CpuTextureManager::ConcurrentReads::active())
+        evict(m_memoryBudget);
+}
+
+qint64 EffectTextureCache::memoryUsage() const
+{
+    return m_memoryUsage;
+}
+
+int EffectTextureCache::count() const
+{
+    return m_entries.size();
+}
+
+unsigned int EffectTextureCache::generation() const
+{
+    // Changes when a texture is removed, so that users can drop the textures they store
+    return m_generation;
+}
+
+void EffectTextureCache::clear()
+{
+    evict(0);
+}
+
+bool EffectTextureCache::Key::operator==(const Key &other) const
+{
+    return handle == other.handle && width == other.width && height == other.height && mask == other.mask && values == other.values;
+}
+
+size_t EffectTextureCache::KeyHash::operator()(const Key &key) const
+{
+    size_t ret = std::hash<GLuint>()(key.handle);
+
+    auto combine = [&ret](int64_t value) { ret ^= std::hash<int64_t>()(value) + 0x9e3779b9 + (ret << 6) + (ret >> 2); };
+    combine(key.width);
+    combine(key.height);
+    combine(key.mask);
+
+    for (int64_t value : key.values)
+        combine(value);
+
+    return ret;
+}
+
+int64_t EffectTextureCache::quantizeValue(double value)
+{
+    // Clamp before rounding, huge values (e.g. fisheye 1e9) don't fit into an integer
+    static const double limit = 1e12;
+    const double steps = value / QUANTIZATION_STEP;
+
+    if (std::isnan(steps))
+        return 0;
+
+    return std::llround(std::clamp(steps, -limit, limit));
+}
+
+EffectTextureCache::Key EffectTextureCache::createKey(const Texture &texture, const EffectState &effects)
+{
+    Key key;
+    key.handle = texture.handle();
+    key.width = texture.width();
+    key.height = texture.height();
+    key.mask = static_cast<int>(effects.mask());
+
+    for (size_t i = 0; i < BAKED_EFFECT_LIST.size(); i++)
+        key.values[i] = quantizeValue(effects.value(BAKED_EFFECT_LIST[i]));
+
+    return key;
+}
+
+bool EffectTextureCache::init(QOpenGLExtraFunctions *glF)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    if (m_context == context)
+        return m_vao != 0;
+
+    // Textures of other contexts can't be used
+    clear();
+    m_context = context;
+
+    glF->glGenFramebuffers(1, &m_fbo);
+
+    // Set up VBO and VAO for a quad
+    const float vertices[] = { -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 1.0f };
+
+    glF->glGenVertexArrays(1, &m_vao);
+    glF->glGenBuffers(1, &m_vbo);
+
+    glF->glBindVertexArray(m_vao);
+
+    glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glF->glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+    // Position attribute
+    glF->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+    glF->glEnableVertexAttribArray(0);
+
+    // Texture coordinate attribute
+    glF->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+    glF->glEnableVertexAttribArray(1);
+
+    glF->glBindVertexArray(0);
+    glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    QObject::disconnect(m_contextConnection);
+
+    m_contextConnection = QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed, [this, context]() {
+        if (QOpenGLContext::currentContext() == context) {
+            clear();
+            QOpenGLExtraFunctions *glF = context->extraFunctions();
+            glF->glDeleteFramebuffers(1, &m_fbo);
+            glF->glDeleteVertexArrays(1, &m_vao);
+            glF->glDeleteBuffers(1, &m_vbo);
+        } else {
+            // The textures are deleted with the context
+            for (const Entry &entry : m_entries)
+                m_textureManager.removeTexture(entry.texture);
+
+            m_entries.clear();
+            m_index.clear();
+            m_memoryUsage = 0;
+            m_generation++;
+        }
+
+        m_context = nullptr;
+        m_fbo = 0;
+        m_vao = 0;
+        m_vbo = 0;
+    });
+
+    return m_vao != 0;
+}
+
+Texture EffectTextureCache::render(QOpenGLExtraFunctions *glF, const Texture &texture, const EffectState &effects)
+{
+    const int width = texture.width();
+    const int height = texture.height();
+
+    // Save the current state
+    GLint viewport[4];
+    GLint fbo;
+    glF->glGetIntegerv(GL_VIEWPORT, viewport);
+    glF->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+    const GLboolean scissorTest = glF->glIsEnabled(GL_SCISSOR_TEST);
+    const GLboolean depthTest = glF->glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean stencilTest = glF->glIsEnabled(GL_STENCIL_TEST);
+    const GLboolean blend = glF->glIsEnabled(GL_BLEND);
+
+    // Create the texture (same parameters as skin textures)
+    GLuint handle;
+    glF->glGenTextures(1, &handle);
+    glF->glBindTexture(GL_TEXTURE_2D, handle);
+    glF->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glF->glBindTexture(GL_TEXTURE_2D, 0);
+
+    glF->glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glF->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, handle, 0);
+
+    if (glF->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        qWarning() << "error: framebuffer incomplete (EffectTextureCache)";
+        glF->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glF->glDeleteTextures(1, &handle);
+        return Texture();
+    }
+
+    glF->glViewport(0, 0, width, height);
+    glF->glDisable(GL_SCISSOR_TEST);
+    glF->glDisable(GL_DEPTH_TEST);
+    glF->glDisable(GL_STENCIL_TEST);
+    glF->glDisable(GL_BLEND);
+    glF->glClearColor(0, 0, 0, 0);
+    glF->glClear(GL_COLOR_BUFFER_BIT);
+
+    // Get the shader program for the baked effects
+    ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(effects);
+    Q_ASSERT(shaderProgram);
+    Q_ASSERT(shaderProgram->isLinked());
+
+    // Render the texture with the same layout
+    shaderProgram->bind();
+    glF->glBindVertexArray(m_vao);
+    glF->glActiveTexture(GL_TEXTURE0);
+    glF->glBindTexture(GL_TEXTURE_2D, texture.handle());
+    shaderManager->setUniforms(shaderProgram, 0, texture.size(), effects); // set texture and effect uniforms
+    shaderProgram->setUniformValue("u_projectionMatrix", QMatrix4x4());
+    shaderProgram->setUniformValue("u_modelMatrix", QMatrix4x4());
+    glF->glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Restore the previous state
+    auto setEnabled = [glF](GLenum cap, GLboolean enabled) {
+        if (enabled)
+            glF->glEnable(cap);
+        else
+            glF->glDisable(cap);
+    };
+
+    shaderProgram->release();
+    glF->glBindVertexArray(0);
+    glF->glBindTexture(GL_TEXTURE_2D, 0);
+    setEnabled(GL_SCISSOR_TEST, scissorTest);
+    setEnabled(GL_DEPTH_TEST, depthTest);
+    setEnabled(GL_STENCIL_TEST, stencilTest);
+    setEnabled(GL_BLEND, blend);
+    glF->glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glF->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    return Texture(handle, width, height);
+}
+
+void EffectTextureCache::evict(qint64 budget)
+{
+    // Removes least recently used textures until the memory usage is within the budget
+    while (!m_entries.empty() && m_memoryUsage > budget)
+        removeEntry(std::prev(m_entries.end()));
+}
+
+void EffectTextureCache::removeEntry(std::list<Entry>::iterator it)
+{
+    m_textureManager.removeTexture(it->texture);
+
+    if (QOpenGLContext::currentContext() == m_context && m_context) {
+        GLuint handle = it->texture.handle();
+        m_context->extraFunctions()->glDeleteTextures(1, &handle);
+    }
+
+    m_memoryUsage -= it->size;
+    m_index.erase(it->key);
+    m_entries.erase(it);
+    m_generation++;
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QtOpenGL>
+#include <array>
+#include <list>
+#include <unordered_map>
+
+#include "effectstate.h"
+#include "texture.h"
+#include "cputexturemanager.h"
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The EffectTextureCache class stores textures with baked color, brightness, whirl and fisheye effects.
+ * Each texture is rendered once on the GPU (and read back once when it's used by the CPU), so drawing, stamping
+ * and sensing only apply the remaining effects. Least recently used textures are dropped when the memory budget is exceeded.
+ */
+class EffectTextureCache
+{
+    public:
+        static inline const ShaderManager::Effect BAKED_EFFECTS = ShaderManager::Effect::Color | ShaderManager::Effect::Brightness | ShaderManager::Effect::Whirl | ShaderManager::Effect::Fisheye;
+        static inline const double QUANTIZATION_STEP = 0.1;
+        static inline const qint64 DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+
+        EffectTextureCache();
+        EffectTextureCache(const EffectTextureCache &) = delete;
+        ~EffectTextureCache();
+
+        static EffectTextureCache *instance();
+
+        Texture getTexture(const Texture &texture, const EffectState &effects);
+        void removeTexture(const Texture &texture);
+        CpuTextureManager *textureManager();
+
+        static EffectState bakedEffects(const EffectState &effects);
+        static EffectState remainingEffects(const EffectState &effects);
+        static ShaderManager::Effect remainingEffects(ShaderManager::Effect effectMask);
+
+        qint64 memoryBudget() const;
+        void setMemoryBudget(qint64 bytes);
+        qint64 memoryUsage() const;
+
+        int count() const;
+        unsigned int generation() const;
+
+        void clear();
+
+    private:
+        struct Key
+        {
+                GLuint handle = 0;
+                int width = 0;
+                int height = 0;
+                int mask = 0;
+                std::array<int64_t, 4> values = {}; // quantized values of the baked effects
+
+                bool operator==(const Key &other) const;
+        };
+
+        struct KeyHash
+        {
+                size_t operator()(const Key &key) const;
+        };
+
+        struct Entry
+        {
+                Key key;
+                Texture texture;
+                qint64 size = 0;
+        };
+
+        static int64_t quantizeValue(double value);
+        static Key createKey(const Texture &texture, const EffectState &effects);
+        bool init(QOpenGLExtraFunctions *glF);
+        Texture render(QOpenGLExtraFunctions *glF, const Texture &texture, const EffectState &effects);
+        void evict(qint64 budget);
+        void removeEntry(std::list<Entry>::iterator it);
+
+        std::list<Entry> m_entries; // most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+        CpuTextureManager m_textureManager;
+        qint64 m_memoryBudget = DEFAULT_MEMORY_BUDGET;
+        qint64 m_memoryUsage = 0;
+        unsigned int m_generation = 0;
+        QOpenGLContext *m_context = nullptr;
+        QMetaObject::Connection m_contextConnection;
+        GLuint m_fbo = 0;
+        GLuint m_vao = 0;
+        GLuint m_vbo = 0;
+};
+
+} // namespace scratchcpprender
@@ -1,33 +1,611 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 
 #include <QVector2D>
+#include <climits>
+#include <cfloat>
+#include <cstdint>
+#include <array>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EFFECTTRANSFORM_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EFFECTTRANSFORM_NEON
+#endif
 
 #include "effecttransform.h"
 
 using namespace scratchcpprender;
 
-// A texture coordinate is between 0 and 1, 0.5 is the center position
-static const float CENTER_X = 0.5f;
-static const float CENTER_Y = 0.5f;
+// QColor channels use 16 bits
+static const float CHANNEL_MAX = USHRT_MAX;
+
+// Grayscale values are slightly saturated (see sprite.frag)
+static const float MIN_VALUE = 0.11f / 2.0f;
+static const float MIN_SATURATION = 0.09f;
+
+inline int round16(float x)
+{
+    // Converts a float channel to 16 bits like QColor
+    return qRound(x * CHANNEL_MAX);
+}
 
-inline float fract(float x)
+inline int div257(int x)
 {
-    // https://registry.khronos.org/OpenGL-Refpages/gl4/html/fract.xhtml
-    return x - std::floor(x);
+    // Converts a 16-bit channel to 8 bits like QColor (qt_div_257())
+    return (x - (x >> 8) + 0x80) >> 8;
 }
 
-QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, QRgb color)
+#if defined(EFFECTTRANSFORM_SSE2) || defined(EFFECTTRANSFORM_NEON)
+#define EFFECTTRANSFORM_SIMD
+
+namespace
+{
+
+// 4 float or int lanes (whirl and fisheye only need a few operations, so they're wrapped here instead of using a SIMD library)
+#ifdef EFFECTTRANSFORM_SSE2
+struct Float4
+{
+        __m128 v;
+};
+
+struct Int4
+{
+        __m128i v;
+};
+
+inline Float4 load(const float *p) { return { _mm_loadu_ps(p) }; }
+inline void store(float *p, Float4 a) { _mm_storeu_ps(p, a.v); }
+inline Float4 set1(float x) { return { _mm_set1_ps(x) }; }
+inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+inline Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline Float4 operator/(Float4 a, Float4 b) { return { _mm_div_ps(a.v, b.v) }; }
+inline Float4 min(Float4 a, Float4 b) { return { _mm_min_ps(a.v, b.v) }; }
+inline Float4 max(Float4 a, Float4 b) { return { _mm_max_ps(a.v, b.v) }; }
+inline Float4 sqrt(Float4 a) { return { _mm_sqrt_ps(a.v) }; }
+inline Float4 lessThan(Float4 a, Float4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline Float4 select(Float4 mask, Float4 a, Float4 b) { return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) }; }
+inline int laneMask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+
+inline Int4 iset1(int32_t x) { return { _mm_set1_epi32(x) }; }
+inline Int4 iadd(Int4 a, Int4 b) { return { _mm_add_epi32(a.v, b.v) }; }
+inline Int4 iand(Int4 a, Int4 b) { return { _mm_and_si128(a.v, b.v) }; }
+inline Int4 ior(Int4 a, Int4 b) { return { _mm_or_si128(a.v, b.v) }; }
+inline Int4 ixor(Int4 a, Int4 b) { return { _mm_xor_si128(a.v, b.v) }; }
+inline Int4 iequal(Int4 a, Int4 b) { return { _mm_cmpeq_epi32(a.v, b.v) }; }
+template<int N>
+inline Int4 ishl(Int4 a) { return { _mm_slli_epi32(a.v, N) }; }
+template<int N>
+inline Int4 ishr(Int4 a) { return { _mm_srli_epi32(a.v, N) }; }
+
+inline Int4 truncate(Float4 a) { return { _mm_cvttps_epi32(a.v) }; }
+inline Float4 toFloat(Int4 a) { return { _mm_cvtepi32_ps(a.v) }; }
+inline Float4 asFloat(Int4 a) { return { _mm_castsi128_ps(a.v) }; }
+inline Int4 asInt(Float4 a) { return { _mm_castps_si128(a.v) }; }
+#else
+struct Float4
+{
+        float32x4_t v;
+};
+
+struct Int4
+{
+        int32x4_t v;
+};
+
+inline Float4 load(const float *p) { return { vld1q_f32(p) }; }
+inline void store(float *p, Float4 a) { vst1q_f32(p, a.v); }
+inline Float4 set1(float x) { return { vdupq_n_f32(x) }; }
+inline Float4 operator+(Float4 a, Float4 b) { return { vaddq_f32(a.v, b.v) }; }
+inline Float4 operator-(Float4 a, Float4 b) { return { vsubq_f32(a.v, b.v) }; }
+inline Float4 operator*(Float4 a, Float4 b) { return { vmulq_f32(a.v, b.v) }; }
+inline Float4 operator/(Float4 a, Float4 b) { return { vdivq_f32(a.v, b.v) }; }
+inline Float4 min(Float4 a, Float4 b) { return { vminq_f32(a.v, b.v) }; }
+inline Float4 max(Float4 a, Float4 b) { return { vmaxq_f32(a.v, b.v) }; }
+inline Float4 sqrt(Float4 a) { return { vsqrtq_f32(a.v) }; }
+inline Float4 lessThan(Float4 a, Float4 b) { return { vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)) }; }
+inline Float4 select(Float4 mask, Float4 a, Float4 b) { return { vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v) }; }
+
+inline int laneMask(Float4 mask)
+{
+    uint32_t lanes[4];
+    vst1q_u32(lanes, vreinterpretq_u32_f32(mask.v));
+    return (lanes[0] & 1) | (lanes[1] & 2) | (lanes[2] & 4) | (lanes[3] & 8);
+}
+
+inline Int4 iset1(int32_t x) { return { vdupq_n_s32(x) }; }
+inline Int4 iadd(Int4 a, Int4 b) { return { vaddq_s32(a.v, b.v) }; }
+inline Int4 iand(Int4 a, Int4 b) { return { vandq_s32(a.v, b.v) }; }
+inline Int4 ior(Int4 a, Int4 b) { return { vorrq_s32(a.v, b.v) }; }
+inline Int4 ixor(Int4 a, Int4 b) { return { veorq_s32(a.v, b.v) }; }
+inline Int4 iequal(Int4 a, Int4 b) { return { vreinterpretq_s32_u32(vceqq_s32(a.v, b.v)) }; }
+template<int N>
+inline Int4 ishl(Int4 a) { return { vshlq_n_s32(a.v, N) }; }
+template<int N>
+inline Int4 ishr(Int4 a) { return { vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a.v), N)) }; }
+
+inline Int4 truncate(Float4 a) { return { vcvtq_s32_f32(a.v) }; }
+inline Float4 toFloat(Int4 a) { return { vcvtq_f32_s32(a.v) }; }
+inline Float4 asFloat(Int4 a) { return { vreinterpretq_f32_s32(a.v) }; }
+inline Int4 asInt(Float4 a) { return { vreinterpretq_s32_f32(a.v) }; }
+#endif
+
+inline Float4 bitXor(Float4 a, Int4 b) { return asFloat(ixor(asInt(a), b)); }
+
+// The angles of sincos4() must be within this range (the range reduction loses precision for larger angles)
+const float MAX_SINCOS_ANGLE = 8192.0f;
+
+void sincos4(Float4 angle, Float4 &sin, Float4 &cos)
+{
+    // Cephes sinf() and cosf() (http://www.netlib.org/cephes/), the absolute error is about 1e-7
+    const Int4 signMask = iset1(INT32_MIN);
+    const Int4 sign = iand(asInt(angle), signMask);
+    const Float4 x = asFloat(ixor(asInt(angle), sign)); // |angle|
+
+    // The octant is rounded to an even number, so that the remainder is within [-pi/4, pi/4]
+    Int4 j = truncate(x * set1(1.27323954473516f)); // 4 / pi
+    j = iand(iadd(j, iset1(1)), iset1(~1));
+    const Float4 y = toFloat(j);
+
+    // Extended precision modular arithmetic
+    const Float4 z = ((x - y * set1(0.78515625f)) - y * set1(2.4187564849853515625e-4f)) - y * set1(3.77489497744594108e-8f);
+    const Float4 zz = z * z;
+
+    const Float4 s = ((set1(-1.9515295891e-4f) * zz + set1(8.3321608736e-3f)) * zz - set1(1.6666654611e-1f)) * zz * z + z;
+    const Float4 c = ((set1(2.443315711809948e-5f) * zz - set1(1.388731625493765e-3f)) * zz + set1(4.166664568298827e-2f)) * zz * zz - set1(0.5f) * zz + set1(1.0f);
+
+    // Odd quadrants swap the polynomials, sin() is negative in quadrants 2 and 3 and cos() in quadrants 1 and 2
+    const Float4 swap = asFloat(iequal(iand(j, iset1(2)), iset1(2)));
+    sin = bitXor(select(swap, c, s), ixor(iand(ishl<29>(j), signMask), sign));
+    cos = bitXor(select(swap, s, c), iand(ixor(ishl<29>(j), ishl<30>(j)), signMask));
+}
+
+Float4 log4(Float4 x)
+{
+    // Cephes logf() for normal numbers within (0, 1], the relative error is about 1e-7
+    const Int4 bits = asInt(x);
+    Float4 e = toFloat(iadd(ishr<23>(bits), iset1(-126)));
+    Float4 f = asFloat(ior(iand(bits, iset1(0x807fffff)), iset1(0x3f000000))); // mantissa within [0.5, 1)
+
+    // f is moved to [sqrt(0.5) - 1, sqrt(2) - 1]
+    const Float4 small = lessThan(f, set1(0.707106781186547524f));
+    e = e - select(small, set1(1.0f), set1(0.0f));
+    f = select(small, (f + f) - set1(1.0f), f - set1(1.0f));
+    const Float4 z = f * f;
+
+    Float4 y = set1(7.0376836292e-2f);
+    y = y * f - set1(1.1514610310e-1f);
+    y = y * f + set1(1.1676998740e-1f);
+    y = y * f - set1(1.2420140846e-1f);
+    y = y * f + set1(1.4249322787e-1f);
+    y = y * f - set1(1.6668057665e-1f);
+    y = y * f + set1(2.0000714765e-1f);
+    y = y * f - set1(2.4999993993e-1f);
+    y = y * f + set1(3.3333331174e-1f);
+    y = y * f * z;
+
+    y = y + e * set1(-2.12194440e-4f);
+    y = y - set1(0.5f) * z;
+    return f + y + e * set1(0.693359375f);
+}
+
+Float4 exp4(Float4 x)
+{
+    // Cephes expf() for values <= 0, the relative error is about 1e-7 (results smaller than FLT_MIN are clamped to it)
+    x = max(x, set1(-87.3365447505f)); // ln(FLT_MIN)
+
+    // n = floor(x / ln(2) + 0.5), truncation rounds negative numbers up
+    const Float4 t = x * set1(1.44269504088896341f) + set1(0.5f);
+    Float4 n = toFloat(truncate(t));
+    n = n - select(lessThan(t, n), set1(1.0f), set1(0.0f));
+
+    x = x - n * set1(0.693359375f) - n * set1(-2.12194440e-4f);
+    const Float4 z = x * x;
+
+    Float4 y = set1(1.9875691500e-4f);
+    y = y * x + set1(1.3981999507e-3f);
+    y = y * x + set1(8.3334519073e-3f);
+    y = y * x + set1(4.1665795894e-2f);
+    y = y * x + set1(1.6666665459e-1f);
+    y = y * x + set1(5.0000001201e-1f);
+    y = y * z + x + set1(1.0f);
+
+    // 2^n
+    return y * asFloat(ishl<23>(iadd(truncate(n), iset1(127))));
+}
+
+} // namespace
+
+#endif // EFFECTTRANSFORM_SSE2 || EFFECTTRANSFORM_NEON
+
+// Each effect mask has its own specialized transform, like the shader permutations (see ShaderManager)
+static constexpr int COLOR = static_cast<int>(ShaderManager::Effect::Color);
+static constexpr int BRIGHTNESS = static_cast<int>(ShaderManager::Effect::Brightness);
+static constexpr int GHOST = static_cast<int>(ShaderManager::Effect::Ghost);
+static constexpr int SHAPE_EFFECTS =
+    static_cast<int>(ShaderManager::Effect::Mosaic) | static_cast<int>(ShaderManager::Effect::Pixelate) | static_cast<int>(ShaderManager::Effect::Whirl) | static_cast<int>(ShaderManager::Effect::Fisheye);
+
+template<int... Masks>
+static constexpr std::array<EffectTransform::PointTransform, sizeof...(Masks)> createPointTransforms(std::integer_sequence<int, Masks...>)
+{
+    // Color effects don't change points, so they use the same specializations
+    return { &EffectTransform::transformPoint<Masks & SHAPE_EFFECTS>... };
+}
+
+template<int... Masks>
+static constexpr std::array<EffectTransform::PointsTransform, sizeof...(Masks)> createPointsTransforms(std::integer_sequence<int, Masks...>)
+{
+    return { &EffectTransform::transformPoints<Masks & SHAPE_EFFECTS>... };
+}
+
+static const auto POINT_TRANSFORMS = createPointTransforms(std::make_integer_sequence<int, EffectTransform::MASK_COUNT>());
+static const auto POINTS_TRANSFORMS = createPointsTransforms(std::make_integer_sequence<int, EffectTransform::MASK_COUNT>());
+
+QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const EffectState &effects, QRgb color)
+{
+    transformColors(effectMask, effects, &color, &color, 1);
+    return color;
+}
+
+void EffectTransform::transformColors(ShaderManager::Effect effectMask, const EffectState &effects, const QRgb *src, QRgb *dst, int count)
+{
+    colorTransform(effectMask, effects)(effects, src, dst, count);
+}
+
+void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const EffectState &effects, const QSize &size, const QVector2D &vec, QVector2D &dst)
+{
+    pointTransform(effectMask)(effects, size, vec, dst);
+}
+
+void EffectTransform::transformPoints(ShaderManager::Effect effectMask, const EffectState &effects, const QSize &size, const float *srcX, const float *srcY, float *dstX, float *dstY, int count)
+{
+    pointsTransform(effectMask)(effects, size, srcX, srcY, dstX, dstY, count);
+}
+
+EffectTransform::PointTransform EffectTransform::pointTransform(ShaderManager::Effect effectMask)
+{
+    return POINT_TRANSFORMS[static_cast<int>(effectMask) & (MASK_COUNT - 1)];
+}
+
+EffectTransform::PointsTransform EffectTransform::pointsTransform(ShaderManager::Effect effectMask)
+{
+    return POINTS_TRANSFORMS[static_cast<int>(effectMask) & (MASK_COUNT - 1)];
+}
+
+EffectTransform::ColorTransform EffectTransform::colorTransform(ShaderManager::Effect effectMask, const EffectState &effects)
+{
+    // Shape effects don't change colors, and the ghost effect is skipped when it's fully opaque
+    static const std::array<ColorTransform, 8> transforms = {
+        &transformColors<0>,
+        &transformColors<COLOR>,
+        &transformColors<BRIGHTNESS>,
+        &transformColors<COLOR | BRIGHTNESS>,
+        &transformColors<GHOST>,
+        &transformColors<COLOR | GHOST>,
+        &transformColors<BRIGHTNESS | GHOST>,
+        &transformColors<COLOR | BRIGHTNESS | GHOST>
+    };
+
+    static_assert((COLOR | BRIGHTNESS | GHOST) == 7);
+    int index = static_cast<int>(effectMask) & (COLOR | BRIGHTNESS);
+
+    if (effects.uniformValue(ShaderManager::Effect::Ghost) != 1)
+        index |= GHOST;
+
+    return transforms[index];
+}
+
+template<int EffectMask>
+void EffectTransform::transformColors(const EffectState &effects, const QRgb *src, QRgb *dst, int count)
+{
+    // The colors are processed in blocks, each step of the kernel is a simple loop over the block
+    const Uniforms uniforms = { effects.uniformValue(ShaderManager::Effect::Color), effects.uniformValue(ShaderManager::Effect::Brightness) * 255.0f, effects.uniformValue(ShaderManager::Effect::Ghost) };
+    Block block;
+
+    for (int i = 0; i < count; i += BLOCK_SIZE) {
+        const int size = std::min(BLOCK_SIZE, count - i);
+        transformBlock<EffectMask>(uniforms, src + i, dst + i, size, block);
+
+        // Colors which aren't premultiplied (any channel is greater than alpha) use the slow path
+        for (int j = 0; j < size; j++) {
+            if (!block.valid[j])
+                dst[i + j] = transformColorSlow(static_cast<ShaderManager::Effect>(EffectMask), effects, src[i + j]);
+        }
+    }
+}
+
+template<int EffectMask>
+void EffectTransform::transformBlock(const Uniforms &uniforms, const QRgb *src, QRgb *dst, int size, Block &block)
 {
     // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L40-L119
+    // Channels use 16 bits and they're rounded like in QColor, so that the results match transformColorSlow()
+    int *r = block.r;
+    int *g = block.g;
+    int *b = block.b;
+    int *a = block.a;
+    float *alpha = block.alpha;
+    bool *valid = block.valid;
+
+    for (int i = 0; i < size; i++) {
+        r[i] = qRed(src[i]) * 0x101;
+        g[i] = qGreen(src[i]) * 0x101;
+        b[i] = qBlue(src[i]) * 0x101;
+        a[i] = qAlpha(src[i]) * 0x101;
+        alpha[i] = a[i] / CHANNEL_MAX;
+        valid[i] = true;
+    }
+
+    if constexpr ((EffectMask & (COLOR | BRIGHTNESS)) != 0) {
+        // gl_FragColor.rgb /= gl_FragColor.a + epsilon;
+        // Fully transparent colors aren't transformed, so they can use any alpha
+        for (int i = 0; i < size; i++) {
+            const float divisor = a[i] == 0 ? 1.0f : alpha[i];
+            const float rf = (r[i] / CHANNEL_MAX) / divisor;
+            const float gf = (g[i] / CHANNEL_MAX) / divisor;
+            const float bf = (b[i] / CHANNEL_MAX) / divisor;
+            valid[i] = rf <= 1.0f && gf <= 1.0f && bf <= 1.0f;
+            r[i] = round16(std::min(rf, 1.0f));
+            g[i] = round16(std::min(gf, 1.0f));
+            b[i] = round16(std::min(bf, 1.0f));
+        }
+
+        if constexpr ((EffectMask & COLOR) != 0) {
+            int *h = block.h;
+            int *s = block.s;
+            int *v = block.v;
+
+            // vec3 hsv = convertRGB2HSV(gl_FragColor.xyz);
+            for (int i = 0; i < size; i++) {
+                const float rf = r[i] / CHANNEL_MAX;
+                const float gf = g[i] / CHANNEL_MAX;
+                const float bf = b[i] / CHANNEL_MAX;
+                const float max = std::max(rf, std::max(gf, bf));
+                const float min = std::min(rf, std::min(gf, bf));
+                const float delta = max - min;
+                const bool achromatic = qFuzzyIsNull(delta);
+                const float safeDelta = achromatic ? 1.0f : delta;
+                float hue = qFuzzyCompare(rf, max) ? (gf - bf) / safeDelta : (qFuzzyCompare(gf, max) ? 2.0f + (bf - rf) / safeDelta : 4.0f + (rf - gf) / safeDelta);
+                hue *= 60.0f;
+                hue = hue < 0.0f ? hue + 360.0f : hue;
+                h[i] = achromatic ? USHRT_MAX : qRound(hue * 100.0f);
+                s[i] = achromatic ? 0 : round16(delta / max);
+                v[i] = round16(max);
+            }
+
+            // this code forces grayscale values to be slightly saturated
+            // so that some slight change of hue will be visible
+            // if (hsv.z < minLightness) hsv = vec3(0.0, 1.0, minLightness);
+            // else if (hsv.y < minSaturation) hsv = vec3(0.0, minSaturation, hsv.z);
+            // hsv.x = mod(hsv.x + u_color, 1.0);
+            // if (hsv.x < 0.0) hsv.x += 1.0;
+            static const int minV = round16(MIN_VALUE);
+            static const int minS = round16(MIN_SATURATION);
+
+            for (int i = 0; i < size; i++) {
+                const bool lowValue = v[i] / CHANNEL_MAX < MIN_VALUE;
+                const bool lowSaturation = !lowValue && s[i] / CHANNEL_MAX < MIN_SATURATION;
+                h[i] = lowValue || lowSaturation ? 0 : h[i];
+                s[i] = lowValue ? USHRT_MAX : (lowSaturation ? minS : s[i]);
+                v[i] = lowValue ? minV : v[i];
+
+                float hue = std::fmod(uniforms.colorShift + h[i] / 36000.0f, 1.0f);
+                hue = hue < 0.0f ? hue + 1.0f : hue;
+                h[i] = qRound(hue * 36000.0f);
+            }
+
+            // gl_FragColor.rgb = convertHSV2RGB(hsl);
+            for (int i = 0; i < size; i++) {
+                const float hue = h[i] == 36000 ? 0.0f : h[i] / 6000.0f;
+                const float sf = s[i] / CHANNEL_MAX;
+                const float vf = v[i] / CHANNEL_MAX;
+                const int sector = hue;
+                const float f = hue - sector;
+                const int p = round16(vf * (1.0f - sf));
+                const int q = round16(vf * (1.0f - (sf * f)));
+                const int t = round16(vf * (1.0f - (sf * (1.0f - f))));
+                const int value = v[i];
+                r[i] = (sector == 0 || sector == 5) ? value : (sector == 1 ? q : (sector == 4 ? t : p));
+                g[i] = (sector == 1 || sector == 2) ? value : (sector == 0 ? t : (sector == 3 ? q : p));
+                b[i] = (sector == 3 || sector == 4) ? value : (sector == 2 ? t : (sector == 5 ? q : p));
+            }
+        }
+
+        if constexpr ((EffectMask & BRIGHTNESS) != 0) {
+            // gl_FragColor.rgb = clamp(gl_FragColor.rgb + vec3(u_brightness), vec3(0), vec3(1));
+            const float brightness = uniforms.brightness255;
+
+            for (int i = 0; i < size; i++) {
+                r[i] = static_cast<int>(std::clamp(div257(r[i]) + brightness, 0.0f, 255.0f)) * 0x101;
+                g[i] = static_cast<int>(std::clamp(div257(g[i]) + brightness, 0.0f, 255.0f)) * 0x101;
+                b[i] = static_cast<int>(std::clamp(div257(b[i]) + brightness, 0.0f, 255.0f)) * 0x101;
+            }
+        }
+
+        // gl_FragColor.rgb *= gl_FragColor.a + epsilon;
+        // Now we're doing the reverse, premultiplying by the alpha once again.
+        for (int i = 0; i < size; i++) {
+            r[i] = round16((r[i] / CHANNEL_MAX) * alpha[i]);
+            g[i] = round16((g[i] / CHANNEL_MAX) * alpha[i]);
+            b[i] = round16((b[i] / CHANNEL_MAX) * alpha[i]);
+            a[i] = round16(alpha[i]);
+        }
+    }
+
+    if constexpr ((EffectMask & GHOST) != 0) {
+        const float ghost = uniforms.ghost;
+
+        // gl_FragColor *= u_ghost
+        for (int i = 0; i < size; i++) {
+            r[i] = round16((r[i] / CHANNEL_MAX) * ghost);
+            g[i] = round16((g[i] / CHANNEL_MAX) * ghost);
+            b[i] = round16((b[i] / CHANNEL_MAX) * ghost);
+            a[i] = round16((a[i] / CHANNEL_MAX) * ghost);
+        }
+    }
+
+    // If the color is fully transparent, don't bother attempting any transformations.
+    for (int i = 0; i < size; i++)
+        dst[i] = qAlpha(src[i]) == 0 ? src[i] : qRgba(div257(r[i]), div257(g[i]), div257(b[i]), div257(a[i]));
+}
+
+void EffectTransform::whirlPoints(float whirl, float *x, float *y, int count)
+{
+    int i = 0;
+
+#ifdef EFFECTTRANSFORM_SIMD
+    if (std::abs(whirl) <= MAX_SINCOS_ANGLE) {
+        for (; i + 4 <= count; i += 4)
+            whirl4(whirl, x + i, y + i, x + i, y + i);
+
+        if (i < count) {
+            // The last points are padded
+            const int n = count - i;
+            float bufX[4] = { CENTER_X, CENTER_X, CENTER_X, CENTER_X };
+            float bufY[4] = { CENTER_Y, CENTER_Y, CENTER_Y, CENTER_Y };
+            std::copy(x + i, x + count, bufX);
+            std::copy(y + i, y + count, bufY);
+            whirl4(whirl, bufX, bufY, bufX, bufY);
+            std::copy(bufX, bufX + n, x + i);
+            std::copy(bufY, bufY + n, y + i);
+            i = count;
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+        whirlPoint(whirl, x[i], y[i]);
+}
+
+void EffectTransform::fisheyePoints(float fisheye, float *x, float *y, int count)
+{
+    int i = 0;
+
+#ifdef EFFECTTRANSFORM_SIMD
+    for (; i < count; i += 4) {
+        // The last points are padded
+        const int n = std::min(4, count - i);
+        float srcX[4] = { 1, 1, 1, 1 };
+        float srcY[4] = { 1, 1, 1, 1 };
+        float dstX[4];
+        float dstY[4];
+        std::copy(x + i, x + i + n, srcX);
+        std::copy(y + i, y + i + n, srcY);
+        const int scalarLanes = fisheye4(fisheye, srcX, srcY, dstX, dstY);
+
+        for (int j = 0; j < n; j++) {
+            if (scalarLanes & (1 << j))
+                fisheyePoint(fisheye, x[i + j], y[i + j]);
+            else {
+                x[i + j] = dstX[j];
+                y[i + j] = dstY[j];
+            }
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+        fisheyePoint(fisheye, x[i], y[i]);
+}
+
+#ifdef EFFECTTRANSFORM_SIMD
+// The kernels aren't inlined, so that the compiler can't fuse their operations differently in each caller
+// (each point gets the same result regardless of the batch size)
+Q_NEVER_INLINE void EffectTransform::whirl4(float whirl, const float *srcX, const float *srcY, float *dstX, float *dstY)
+{
+    // Same as whirlPoint()
+    const Float4 center = set1(CENTER_X);
+    const Float4 offsetX = load(srcX) - center;
+    const Float4 offsetY = load(srcY) - center;
+    const Float4 offsetMagnitude = sqrt((offsetX * offsetX) + (offsetY * offsetY));
+    const Float4 whirlFactor = max(set1(1.0f) - (offsetMagnitude / set1(0.5f)), set1(0.0f));
+    Float4 sinWhirl, cosWhirl;
+    sincos4(set1(whirl) * whirlFactor * whirlFactor, sinWhirl, cosWhirl);
+
+    store(dstX, (cosWhirl * offsetX) + (sinWhirl * offsetY) + center);
+    store(dstY, ((set1(0.0f) - sinWhirl) * offsetX) + (cosWhirl * offsetY) + center);
+}
+
+Q_NEVER_INLINE int EffectTransform::fisheye4(float fisheye, const float *srcX, const float *srcY, float *dstX, float *dstY)
+{
+    // Same as fisheyePoint()
+    const Float4 center = set1(CENTER_X);
+    const Float4 one = set1(1.0f);
+    const Float4 vX = (load(srcX) - center) / center;
+    const Float4 vY = (load(srcY) - center) / center;
+    const Float4 vLength = sqrt((vX * vX) + (vY * vY));
+
+    // pow(min(vecLength, 1.0), u_fisheye) = exp(u_fisheye * log(min(vecLength, 1.0)))
+    const Float4 r = exp4(set1(fisheye) * log4(min(vLength, one))) * max(one, vLength);
+
+    store(dstX, center + (r * (vX / vLength) * center));
+    store(dstY, center + (r * (vY / vLength) * center));
+
+    // log4() doesn't support 0 and denormals (points at the center), these lanes must use fisheyePoint()
+    return laneMask(lessThan(vLength, set1(FLT_MIN)));
+}
+#endif
+
+void EffectTransform::whirlPoint(float whirl, float &x, float &y)
+{
+    // const float kRadius = 0.5;
+    const float RADIUS = 0.5f;
+
+    // vec2 offset = texcoord0 - kCenter;
+    const float offsetX = x - CENTER_X;
+    const float offsetY = y - CENTER_Y;
+    // float offsetMagnitude = length(offset);
+    const float offsetMagnitude = std::sqrt((offsetX * offsetX) + (offsetY * offsetY));
+    // float whirlFactor = max(1.0 - (offsetMagnitude / kRadius), 0.0);
+    const float whirlFactor = std::max(1.0f - (offsetMagnitude / RADIUS), 0.0f);
+    // float whirlActual = u_whirl * whirlFactor * whirlFactor;
+    const float whirlActual = whirl * whirlFactor * whirlFactor;
+    // float sinWhirl = sin(whirlActual);
+    const float sinWhirl = std::sin(whirlActual);
+    // float cosWhirl = cos(whirlActual);
+    const float cosWhirl = std::cos(whirlActual);
+    // mat2 rotationMatrix = mat2(
+    //     cosWhirl, -sinWhirl,
+    //     sinWhirl, cosWhirl
+    // );
+    const float rot1 = cosWhirl;
+    const float rot2 = -sinWhirl;
+    const float rot3 = sinWhirl;
+    const float rot4 = cosWhirl;
+
+    // texcoord0 = rotationMatrix * offset + kCenter;
+    x = (rot1 * offsetX) + (rot3 * offsetY) + CENTER_X;
+    y = (rot2 * offsetX) + (rot4 * offsetY) + CENTER_Y;
+}
+
+void EffectTransform::fisheyePoint(float fisheye, float &x, float &y)
+{
+    // vec2 vec = (texcoord0 - kCenter) / kCenter;
+    const float vX = (x - CENTER_X) / CENTER_X;
+    const float vY = (y - CENTER_Y) / CENTER_Y;
+    // float vecLength = length(vec);
+    const float vLength = std::sqrt((vX * vX) + (vY * vY));
+    // float r = pow(min(vecLength, 1.0), u_fisheye) * max(1.0, vecLength);
+    const float r = std::pow(std::min(vLength, 1.0f), fisheye) * std::max(1.0f, vLength);
+    // vec2 unit = vec / vecLength;
+    const float unitX = vX / vLength;
+    const float unitY = vY / vLength;
+    // texcoord0 = kCenter + r * unit * kCenter;
+    x = CENTER_X + (r * unitX * CENTER_X);
+    y = CENTER_Y + (r * unitY * CENTER_Y);
+}
+
+QRgb EffectTransform::transformColorSlow(ShaderManager::Effect effectMask, const EffectState &effects, QRgb color)
+{
+    // QColor based implementation, used for colors with channels greater than alpha (they aren't premultiplied and QColor stores them with extended range)
     // If the color is fully transparent, don't bother attempting any transformations.
     if (qAlpha(color) == 0)
         return color;
 
     QColor inOutColor = QColor::fromRgba(color);
 
-    std::unordered_map<ShaderManager::Effect, float> uniforms;
-    ShaderManager::getUniformValuesForEffects(effectValues, uniforms);
-
     const bool enableColor = (effectMask & ShaderManager::Effect::Color) != 0;
     const bool enableBrightness = (effectMask & ShaderManager::Effect::Brightness) != 0;
 
@@ -67,7 +645,7 @@ QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std
 
             // hsv.x = mod(hsv.x + u_color, 1.0);
             // if (hsv.x < 0.0) hsv.x += 1.0;
-            float hue = std::fmod(uniforms[ShaderManager::Effect::Color] + hsv.hueF(), 1.0f);
+            float hue = std::fmod(effects.uniformValue(ShaderManager::Effect::Color) + hsv.hueF(), 1.0f);
 
             if (hue < 0.0f)
                 hue += 1.0f;
@@ -79,7 +657,7 @@ QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std
         }
 
         if (enableBrightness) {
-            const float brightness = uniforms[ShaderManager::Effect::Brightness] * 255.0f;
+            const float brightness = effects.uniformValue(ShaderManager::Effect::Brightness) * 255.0f;
             // gl_FragColor.rgb = clamp(gl_FragColor.rgb + vec3(u_brightness), vec3(0), vec3(1));
             inOutColor.setRed(std::clamp(inOutColor.red() + brightness, 0.0f, 255.0f));
             inOutColor.setGreen(std::clamp(inOutColor.green() + brightness, 0.0f, 255.0f));
@@ -96,7 +674,7 @@ QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std
         inOutColor.setAlphaF(alpha);
     }
 
-    const float ghost = uniforms[ShaderManager::Effect::Ghost];
+    const float ghost = effects.uniformValue(ShaderManager::Effect::Ghost);
 
     if (ghost != 1) {
         // gl_FragColor *= u_ghost
@@ -108,78 +686,3 @@ QRgb EffectTransform::transformColor(ShaderManager::Effect effectMask, const std
 
     return inOutColor.rgba();
 }
-
-void EffectTransform::transformPoint(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QSize &size, const QVector2D &vec, QVector2D &dst)
-{
-    // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L128-L194
-    dst = vec;
-
-    std::unordered_map<ShaderManager::Effect, float> uniforms;
-    ShaderManager::getUniformValuesForEffects(effectValues, uniforms);
-
-    if ((effectMask & ShaderManager::Effect::Mosaic) != 0) {
-        // texcoord0 = fract(u_mosaic * texcoord0);
-        const float mosaic = uniforms[ShaderManager::Effect::Mosaic];
-        dst.setX(fract(mosaic * dst.x()));
-        dst.setY(fract(mosaic * dst.y()));
-    }
-
-    if ((effectMask & ShaderManager::Effect::Pixelate) != 0) {
-        // vec2 pixelTexelSize = u_skinSize / u_pixelate;
-        const float pixelate = uniforms[ShaderManager::Effect::Pixelate];
-        const float texelX = size.width() / pixelate;
-        const float texelY = size.height() / pixelate;
-        // texcoord0 = (floor(texcoord0 * pixelTexelSize) + kCenter) /
-        //   pixelTexelSize;
-        dst.setX((std::floor(dst.x() * texelX) + CENTER_X) / texelX);
-        dst.setY((std::floor(dst.y() * texelY) + CENTER_Y) / texelY);
-    }
-
-    if ((effectMask & ShaderManager::Effect::Whirl) != 0) {
-        const float whirl = uniforms[ShaderManager::Effect::Whirl];
-        // const float kRadius = 0.5;
-        const float RADIUS = 0.5f;
-        // vec2 offset = texcoord0 - kCenter;
-        const float offsetX = dst.x() - CENTER_X;
-        const float offsetY = dst.y() - CENTER_Y;
-        // float offsetMagnitude = length(offset);
-        const float offsetMagnitude = std::sqrt(std::pow(offsetX, 2.0f) + std::pow(offsetY, 2.0f));
-        // float whirlFactor = max(1.0 - (offsetMagnitude / kRadius), 0.0);
-        const float whirlFactor = std::max(1.0f - (offsetMagnitude / RADIUS), 0.0f);
-        // float whirlActual = u_whirl * whirlFactor * whirlFactor;
-        const float whirlActual = whirl * whirlFactor * whirlFactor;
-        // float sinWhirl = sin(whirlActual);
-        const float sinWhirl = std::sin(whirlActual);
-        // float cosWhirl = cos(whirlActual);
-        const float cosWhirl = std::cos(whirlActual);
-        // mat2 rotationMatrix = mat2(
-        //     cosWhirl, -sinWhirl,
-        //     sinWhirl, cosWhirl
-        // );
-        const float rot1 = cosWhirl;
-        const float rot2 = -sinWhirl;
-        const float rot3 = sinWhirl;
-        const float rot4 = cosWhirl;
-
-        // texcoord0 = rotationMatrix * offset + kCenter;
-        dst.setX((rot1 * offsetX) + (rot3 * offsetY) + CENTER_X);
-        dst.setY((rot2 * offsetX) + (rot4 * offsetY) + CENTER_Y);
-    }
-
-    if ((effectMask & ShaderManager::Effect::Fisheye) != 0) {
-        const float fisheye = uniforms[ShaderManager::Effect::Fisheye];
-        // vec2 vec = (texcoord0 - kCenter) / kCenter;
-        const float vX = (dst.x() - CENTER_X) / CENTER_X;
-        const float vY = (dst.y() - CENTER_Y) / CENTER_Y;
-        // float vecLength = length(vec);
-        const float vLength = std::sqrt((vX * vX) + (vY * vY));
-        // float r = pow(min(vecLength, 1.0), u_fisheye) * max(1.0, vecLength);
-        const float r = std::pow(std::min(vLength, 1.0f), fisheye) * std::max(1.0f, vLength);
-        // vec2 unit = vec / vecLength;
-        const float unitX = vX / vLength;
-        const float unitY = vY / vLength;
-        // texcoord0 = kCenter + r * unit * kCenter;
-        dst.setX(CENTER_X + (r * unitX * CENTER_X));
-        dst.setY(CENTER_Y + (r * unitY * CENTER_Y));
-    }
-}
@@ -3,8 +3,11 @@
 #pragma once
 
 #include <QColor>
+#include <QVector2D>
+#include <cmath>
+#include <algorithm>
 
-#include "shadermanager.h"
+#include "effectstate.h"
 
 namespace scratchcpprender
 {
@@ -14,8 +17,133 @@ class EffectTransform
     public:
         EffectTransform() = delete;
 
-        static QRgb transformColor(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, QRgb color);
-        static void transformPoint(ShaderManager::Effect effectMask, const std::unordered_map<ShaderManager::Effect, double> &effectValues, const QSize &size, const QVector2D &vec, QVector2D &dst);
+        static QRgb transformColor(ShaderManager::Effect effectMask, const EffectState &effects, QRgb color);
+        static void transformColors(ShaderManager::Effect effectMask, const EffectState &effects, const QRgb *src, QRgb *dst, int count);
+        static void transformPoint(ShaderManager::Effect effectMask, const EffectState &effects, const QSize &size, const QVector2D &vec, QVector2D &dst);
+        static void transformPoints(ShaderManager::Effect effectMask, const EffectState &effects, const QSize &size, const float *srcX, const float *srcY, float *dstX, float *dstY, int count);
+
+        /*! Number of effect mask combinations. */
+        static inline const int MASK_COUNT = 1 << EffectState::EFFECT_COUNT;
+
+        using PointTransform = void (*)(const EffectState &, const QSize &, const QVector2D &, QVector2D &);
+        using PointsTransform = void (*)(const EffectState &, const QSize &, const float *, const float *, float *, float *, int);
+        using ColorTransform = void (*)(const EffectState &, const QRgb *, QRgb *, int);
+
+        /*! Returns the point transform specialized for the given effect mask. Use this to avoid per-point effect checks in loops. */
+        static PointTransform pointTransform(ShaderManager::Effect effectMask);
+
+        /*! Returns the batched point transform specialized for the given effect mask. */
+        static PointsTransform pointsTransform(ShaderManager::Effect effectMask);
+
+        /*! Returns the color transform specialized for the given effect mask and ghost value. */
+        static ColorTransform colorTransform(ShaderManager::Effect effectMask, const EffectState &effects);
+
+        /*! Transforms the point with the given effects. Disabled effects are removed at compile time. */
+        template<int EffectMask>
+        static void transformPoint(const EffectState &effects, const QSize &size, const QVector2D &vec, QVector2D &dst)
+        {
+            float x = vec.x();
+            float y = vec.y();
+            transformPoints<EffectMask>(effects, size, &x, &y, &x, &y, 1);
+            dst = QVector2D(x, y);
+        }
+
+        /*!
+         * Transforms the points stored in the x and y arrays (the source and destination arrays can be the same).
+         * Each effect is a separate loop over the arrays, so the uniforms and effect checks are handled once per batch.
+         * Whirl and fisheye process 4 points at a time with SSE2 or NEON if it's available, using polynomial approximations
+         * of sin, cos, exp and log (the error is about 1e-7). The texture coordinates differ from the scalar path (std::sin(),
+         * std::cos() and std::pow()) by less than 1e-5, which is 0.02 texels of a 2048 texels wide texture. This holds for whirl
+         * angles up to 100 radians, larger angles amplify the rounding error of the angle itself. Each point is computed
+         * independently of the others, so the results don't depend on the batch size.
+         */
+        template<int EffectMask>
+        static void transformPoints(const EffectState &effects, const QSize &size, const float *srcX, const float *srcY, float *dstX, float *dstY, int count)
+        {
+            // https://github.com/scratchfoundation/scratch-render/blob/e075e5f5ebc95dec4a2718551624ad587c56f0a6/src/EffectTransform.js#L128-L194
+            if (dstX != srcX)
+                std::copy(srcX, srcX + count, dstX);
+
+            if (dstY != srcY)
+                std::copy(srcY, srcY + count, dstY);
+
+            if constexpr ((EffectMask & static_cast<int>(ShaderManager::Effect::Mosaic)) != 0) {
+                // texcoord0 = fract(u_mosaic * texcoord0);
+                const float mosaic = effects.uniformValue(ShaderManager::Effect::Mosaic);
+
+                for (int i = 0; i < count; i++) {
+                    dstX[i] = fract(mosaic * dstX[i]);
+                    dstY[i] = fract(mosaic * dstY[i]);
+                }
+            }
+
+            if constexpr ((EffectMask & static_cast<int>(ShaderManager::Effect::Pixelate)) != 0) {
+                // vec2 pixelTexelSize = u_skinSize / u_pixelate;
+                const float pixelate = effects.uniformValue(ShaderManager::Effect::Pixelate);
+                const float texelX = size.width() / pixelate;
+                const float texelY = size.height() / pixelate;
+
+                // texcoord0 = (floor(texcoord0 * pixelTexelSize) + kCenter) /
+                //   pixelTexelSize;
+                for (int i = 0; i < count; i++) {
+                    dstX[i] = (std::floor(dstX[i] * texelX) + CENTER_X) / texelX;
+                    dstY[i] = (std::floor(dstY[i] * texelY) + CENTER_Y) / texelY;
+                }
+            }
+
+            if constexpr ((EffectMask & static_cast<int>(ShaderManager::Effect::Whirl)) != 0)
+                whirlPoints(effects.uniformValue(ShaderManager::Effect::Whirl), dstX, dstY, count);
+
+            if constexpr ((EffectMask & static_cast<int>(ShaderManager::Effect::Fisheye)) != 0)
+                fisheyePoints(effects.uniformValue(ShaderManager::Effect::Fisheye), dstX, dstY, count);
+        }
+
+    private:
+        static inline const int BLOCK_SIZE = 64;
+
+        // A texture coordinate is between 0 and 1, 0.5 is the center position
+        static inline const float CENTER_X = 0.5f;
+        static inline const float CENTER_Y = 0.5f;
+
+        struct Uniforms
+        {
+                float colorShift;
+                float brightness255;
+                float ghost;
+        };
+
+        struct Block
+        {
+                int r[BLOCK_SIZE];
+                int g[BLOCK_SIZE];
+                int b[BLOCK_SIZE];
+                int a[BLOCK_SIZE];
+                int h[BLOCK_SIZE];
+                int s[BLOCK_SIZE];
+                int v[BLOCK_SIZE];
+                float alpha[BLOCK_SIZE];
+                bool valid[BLOCK_SIZE];
+        };
+
+        static void whirlPoints(float whirl, float *x, float *y, int count);
+        static void fisheyePoints(float fisheye, float *x, float *y, int count);
+        static void whirl4(float whirl, const float *srcX, const float *srcY, float *dstX, float *dstY);
+        static int fisheye4(float fisheye, const float *srcX, const float *srcY, float *dstX, float *dstY);
+        static void whirlPoint(float whirl, float &x, float &y);
+        static void fisheyePoint(float fisheye, float &x, float &y);
+
+        static float fract(float x)
+        {
+            // https://registry.khronos.org/OpenGL-Refpages/gl4/html/fract.xhtml
+            return x - std::floor(x);
+        }
+
+        template<int EffectMask>
+        static void transformColors(const EffectState &effects, const QRgb *src, QRgb *dst, int count);
+
+        template<int EffectMask>
+        static void transformBlock(const Uniforms &uniforms, const QRgb *src, QRgb *dst, int size, Block &block);
+        static QRgb transformColorSlow(ShaderManager::Effect effectMask, const EffectState &effects, QRgb color);
 };
 
 } // namespace scratchcpprender
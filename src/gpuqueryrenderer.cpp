@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLShaderProgram>
+
+#include "gpuqueryrenderer.h"
+
+using namespace scratchcpprender;
+
+// Pixel centers are moved by this amount (in Scratch units) to the right and bottom, so that points
+// on texel edges (all points, see RenderedTarget::touchingColorGpu()) use the same texels as the CPU
+static const float SAMPLE_OFFSET = 1 / 64.0f;
+
+bool GpuQueryRenderer::render(const QRect &rect, const Drawable &target, StencilMode stencilMode, QRgb mask, const std::vector<Drawable> &drawables, std::vector<GLubyte> &dst)
+{
+    // NOTE: The rectangle uses Scratch coordinates, top() is the lowest y coordinate and each pixel is a point of the rectangle
+    dst.clear();
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    if (!context || rect.isEmpty())
+        return false;
+
+    QOpenGLExtraFunctions *glF = context->extraFunctions();
+
+    // Save the current state (init() binds buffers and textures too)
+    GLint viewport[4];
+    GLint fbo, program, vao, arrayBuffer, activeTexture, texture;
+    GLint blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha;
+    GLint stencilWriteMask, stencilFunc, stencilRef, stencilValueMask, stencilFail, stencilPassDepthFail, stencilPassDepthPass, clearStencil;
+    GLboolean colorWriteMask[4];
+    GLfloat clearColor[4];
+    glF->glGetIntegerv(GL_VIEWPORT, viewport);
+    glF->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+    glF->glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glF->glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+    glF->glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &arrayBuffer);
+    glF->glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+    glF->glActiveTexture(GL_TEXTURE0);
+    glF->glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glF->glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrcRgb);
+    glF->glGetIntegerv(GL_BLEND_DST_RGB, &blendDstRgb);
+    glF->glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendSrcAlpha);
+    glF->glGetIntegerv(GL_BLEND_DST_ALPHA, &blendDstAlpha);
+    glF->glGetIntegerv(GL_STENCIL_WRITEMASK, &stencilWriteMask);
+    glF->glGetIntegerv(GL_STENCIL_FUNC, &stencilFunc);
+    glF->glGetIntegerv(GL_STENCIL_REF, &stencilRef);
+    glF->glGetIntegerv(GL_STENCIL_VALUE_MASK, &stencilValueMask);
+    glF->glGetIntegerv(GL_STENCIL_FAIL, &stencilFail);
+    glF->glGetIntegerv(GL_STENCIL_PASS_DEPTH_FAIL, &stencilPassDepthFail);
+    glF->glGetIntegerv(GL_STENCIL_PASS_DEPTH_PASS, &stencilPassDepthPass);
+    glF->glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &clearStencil);
+    glF->glGetBooleanv(GL_COLOR_WRITEMASK, colorWriteMask);
+    glF->glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    const GLboolean scissorTest = glF->glIsEnabled(GL_SCISSOR_TEST);
+    const GLboolean depthTest = glF->glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean stencilTest = glF->glIsEnabled(GL_STENCIL_TEST);
+    const GLboolean blend = glF->glIsEnabled(GL_BLEND);
+
+    if (!init(glF, rect.size())) {
+        glF->glBindTexture(GL_TEXTURE_2D, texture);
+        glF->glActiveTexture(activeTexture);
+        return false;
+    }
+
+    // Projection matrix (maps the points of the rectangle to pixel centers)
+    QMatrix4x4 projectionMatrix;
+    const float left = rect.left() - 0.5f + SAMPLE_OFFSET;
+    const float bottom = rect.top() - 0.5f - SAMPLE_OFFSET;
+    projectionMatrix.ortho(left, left + rect.width(), bottom, bottom + rect.height(), -1, 1);
+
+    glF->glBindFramebuffer(GL_FRAMEBUFFER, m_fbo->handle());
+    glF->glViewport(0, 0, rect.width(), rect.height());
+    glF->glDisable(GL_SCISSOR_TEST);
+    glF->glDisable(GL_DEPTH_TEST);
+    glF->glDisable(GL_BLEND);
+    glF->glEnable(GL_STENCIL_TEST);
+    glF->glStencilMask(0xFF);
+    glF->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Transparent pixels are black, so they match black masks (see RenderedTarget::maskMatches())
+    const bool maskMatchesTransparent = stencilMode == StencilMode::ColorMask && (qRed(mask) & 0b11111000) == 0 && (qGreen(mask) & 0b11111000) == 0 && (qBlue(mask) & 0b11111000) == 0;
+
+    glF->glClearColor(0, 0, 0, 0);
+    glF->glClearStencil(maskMatchesTransparent ? 1 : 0);
+    glF->glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+    // Draw the target into the stencil buffer
+    glF->glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glF->glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glF->glStencilFunc(GL_ALWAYS, 1, 0xFF);
+
+    switch (stencilMode) {
+        case StencilMode::Silhouette:
+            draw(glF, target, ShaderManager::DrawMode::Silhouette, projectionMatrix);
+            break;
+
+        case StencilMode::ColorMask:
+            if (maskMatchesTransparent) {
+                // Points outside the texture match, so clear the whole texture and draw the matching texels again
+                glF->glStencilFunc(GL_ALWAYS, 0, 0xFF);
+                draw(glF, target, ShaderManager::DrawMode::Default, projectionMatrix);
+                glF->glStencilFunc(GL_ALWAYS, 1, 0xFF);
+            }
+
+            draw(glF, target, ShaderManager::DrawMode::ColorMask, projectionMatrix, mask);
+            break;
+    }
+
+    // Draw the candidates from back to front (textures use premultiplied alpha)
+    glF->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glF->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glF->glStencilFunc(GL_EQUAL, 1, 0xFF);
+    glF->glEnable(GL_BLEND);
+    glF->glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    for (const Drawable &drawable : drawables)
+        draw(glF, drawable, ShaderManager::DrawMode::Default, projectionMatrix);
+
+    // Draw white background behind everything (see RenderedTarget::sampleColor3b())
+    Drawable background;
+    background.texture = Texture(m_whiteTexture, 1, 1);
+    background.scratchToLocal.scale(1.0 / (rect.width() + 2), 1.0 / (rect.height() + 2));
+    background.scratchToLocal.translate(1 - rect.left(), 1 - rect.top());
+    glF->glBlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+    draw(glF, background, ShaderManager::DrawMode::Default, projectionMatrix);
+
+    // Read the pixels (pixels outside the stencil are transparent)
+    dst.resize(rect.width() * rect.height() * 4);
+    glF->glReadPixels(0, 0, rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, dst.data());
+
+    // Restore the previous state
+    auto setEnabled = [glF](GLenum cap, GLboolean enabled) {
+        if (enabled)
+            glF->glEnable(cap);
+        else
+            glF->glDisable(cap);
+    };
+
+    glF->glStencilMask(stencilWriteMask);
+    glF->glStencilFunc(stencilFunc, stencilRef, stencilValueMask);
+    glF->glStencilOp(stencilFail, stencilPassDepthFail, stencilPassDepthPass);
+    glF->glClearStencil(clearStencil);
+    glF->glColorMask(colorWriteMask[0], colorWriteMask[1], colorWriteMask[2], colorWriteMask[3]);
+    glF->glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glF->glBlendFuncSeparate(blendSrcRgb, blendDstRgb, blendSrcAlpha, blendDstAlpha);
+    setEnabled(GL_SCISSOR_TEST, scissorTest);
+    setEnabled(GL_DEPTH_TEST, depthTest);
+    setEnabled(GL_STENCIL_TEST, stencilTest);
+    setEnabled(GL_BLEND, blend);
+    glF->glBindTexture(GL_TEXTURE_2D, texture);
+    glF->glActiveTexture(activeTexture);
+    glF->glUseProgram(program);
+    glF->glBindVertexArray(vao);
+    glF->glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer);
+    glF->glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glF->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    return true;
+}
+
+bool GpuQueryRenderer::init(QOpenGLExtraFunctions *glF, const QSize &size)
+{
+    if (m_vao == 0) {
+        // Set up VBO and VAO (vertices are updated for each drawable)
+        glF->glGenVertexArrays(1, &m_vao);
+        glF->glGenBuffers(1, &m_vbo);
+
+        glF->glBindVertexArray(m_vao);
+
+        glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+        glF->glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+
+        // Position attribute
+        glF->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+        glF->glEnableVertexAttribArray(0);
+
+        // Texture coordinate attribute
+        glF->glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
+        glF->glEnableVertexAttribArray(1);
+
+        glF->glBindVertexArray(0);
+        glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // Create white texture for the background
+        const GLubyte white[] = { 255, 255, 255, 255 };
+        glF->glGenTextures(1, &m_whiteTexture);
+        glF->glBindTexture(GL_TEXTURE_2D, m_whiteTexture);
+        glF->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glF->glBindTexture(GL_TEXTURE_2D, 0);
+
+        QObject::connect(QOpenGLContext::currentContext(), &QOpenGLContext::aboutToBeDestroyed, []() {
+            if (QOpenGLContext::currentContext()) {
+                QOpenGLExtraFunctions *glF = QOpenGLContext::currentContext()->extraFunctions();
+                glF->glDeleteVertexArrays(1, &m_vao);
+                glF->glDeleteBuffers(1, &m_vbo);
+                glF->glDeleteTextures(1, &m_whiteTexture);
+                m_fbo.reset();
+            }
+
+            m_vao = 0;
+            m_vbo = 0;
+            m_whiteTexture = 0;
+        });
+    }
+
+    // The FBO only grows, smaller rectangles use its bottom left part
+    if (!m_fbo || m_fbo->width() < size.width() || m_fbo->height() < size.height()) {
+        QOpenGLFramebufferObjectFormat format;
+        format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+        m_fbo = std::make_unique<QOpenGLFramebufferObject>(m_fbo ? m_fbo->size().expandedTo(size) : size, format);
+        Q_ASSERT(m_fbo->isValid());
+    }
+
+    return m_fbo->isValid();
+}
+
+void GpuQueryRenderer::draw(QOpenGLExtraFunctions *glF, const Drawable &drawable, ShaderManager::DrawMode drawMode, const QMatrix4x4 &projectionMatrix, QRgb mask)
+{
+    const Texture &texture = drawable.texture;
+    bool invertible = false;
+    const QTransform localToScratch = drawable.scratchToLocal.inverted(&invertible);
+
+    if (!texture.isValid() || !invertible)
+        return;
+
+    // Quad in texture coordinates (the first row of the texture is the last row in OpenGL)
+    const float width = texture.width();
+    const float height = texture.height();
+
+    // clang-format off
+    const float vertices[] = {
+        0.0f, height, 0.0f, 0.0f,
+        width, height, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f,
+        width, height, 1.0f, 0.0f,
+        width, 0.0f, 1.0f, 1.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+    // clang-format on
+
+    glF->glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glF->glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+    glF->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Get the shader program for the current set of effects
+    ShaderManager *shaderManager = ShaderManager::instance();
+    QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(drawable.effects, drawMode);
+    Q_ASSERT(shaderProgram);
+    Q_ASSERT(shaderProgram->isLinked());
+
+    shaderProgram->bind();
+    glF->glActiveTexture(GL_TEXTURE0);
+    glF->glBindTexture(GL_TEXTURE_2D, texture.handle());
+
+    // Use the nearest texel like the CPU does
+    GLint minFilter, magFilter, wrapS, wrapT;
+    glF->glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+    glF->glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+    glF->glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &wrapS);
+    glF->glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &wrapT);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    shaderManager->setUniforms(shaderProgram, 0, texture.size(), drawable.effects); // set texture and effect uniforms
+    shaderProgram->setUniformValue("u_projectionMatrix", projectionMatrix);
+    shaderProgram->setUniformValue("u_modelMatrix", QMatrix4x4(localToScratch));
+
+    if (drawMode == ShaderManager::DrawMode::ColorMask)
+        shaderProgram->setUniformValue("u_colorMask", QVector3D(qRed(mask) / 255.0f, qGreen(mask) / 255.0f, qBlue(mask) / 255.0f));
+
+    glF->glBindVertexArray(m_vao);
+    glF->glDrawArrays(GL_TRIANGLES, 0, 6);
+    glF->glBindVertexArray(0);
+
+    // Cleanup
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+    glF->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+    glF->glBindTexture(GL_TEXTURE_2D, 0);
+    shaderProgram->release();
+}
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "effectstate.h"
+#include "texture.h"
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The GpuQueryRenderer class renders small parts of the stage for collision queries.
+ * Everything is rendered into a shared offscreen FBO and only the queried rectangle is read back.
+ */
+class GpuQueryRenderer
+{
+    public:
+        struct Drawable
+        {
+                Texture texture;
+                QTransform scratchToLocal; // maps Scratch coordinates to texture coordinates (the first row is the top row)
+                EffectState effects;
+        };
+
+        enum class StencilMode
+        {
+            Silhouette, // non-transparent pixels of the target
+            ColorMask   // pixels of the target which match the mask color
+        };
+
+        static bool render(const QRect &rect, const Drawable &target, StencilMode stencilMode, QRgb mask, const std::vector<Drawable> &drawables, std::vector<GLubyte> &dst);
+
+    private:
+        static bool init(QOpenGLExtraFunctions *glF, const QSize &size);
+        static void draw(QOpenGLExtraFunctions *glF, const Drawable &drawable, ShaderManager::DrawMode drawMode, const QMatrix4x4 &projectionMatrix, QRgb mask = 0);
+
+        static inline std::unique_ptr<QOpenGLFramebufferObject> m_fbo;
+        static inline GLuint m_vao = 0;
+        static inline GLuint m_vbo = 0;
+        static inline GLuint m_whiteTexture = 0;
+};
+
+} // namespace scratchcpprender
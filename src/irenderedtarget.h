@@ -6,7 +6,7 @@
 #include <qnanoquickitem.h>
 #include <scratchcpp/sprite.h>
 
-#include "shadermanager.h"
+#include "effectstate.h"
 
 class QBuffer;
 class QNanoPainter;
@@ -73,6 +73,8 @@ class IRenderedTarget : public QNanoQuickItem
         virtual QRectF getBoundsForBubble() const = 0;
         virtual libscratchcpp::Rect getFastBounds() const = 0;
 
+        virtual const QMatrix4x4 &stampModelMatrix(double scale) const = 0;
+
         virtual QPointF mapFromScene(const QPointF &point) const = 0;
 
         virtual bool mirrorHorizontally() const = 0;
@@ -82,7 +84,7 @@ class IRenderedTarget : public QNanoQuickItem
         virtual int costumeWidth() const = 0;
         virtual int costumeHeight() const = 0;
 
-        virtual const std::unordered_map<ShaderManager::Effect, double> &graphicEffects() const = 0;
+        virtual const EffectState &graphicEffects() const = 0;
         virtual void setGraphicEffect(ShaderManager::Effect effect, double value) = 0;
         virtual void clearGraphicEffects() = 0;
 
@@ -5,9 +5,9 @@
 #include "penlayer.h"
 #include "penlayerpainter.h"
 #include "penattributes.h"
-#include "irenderedtarget.h"
-#include "spritemodel.h"
+#include "renderedtarget.h"
 #include "stagemodel.h"
+#include "stagecomposite.h"
 
 using namespace scratchcpprender;
 
@@ -15,13 +15,6 @@ static const double pi = std::acos(-1); // TODO: Use std::numbers::pi in C++20
 
 std::unordered_map<libscratchcpp::IEngine *, IPenLayer *> PenLayer::m_projectPenLayers;
 
-// TODO: Move this to a separate class
-template<typename T>
-short sgn(T x)
-{
-    return (T(0) < x) - (x < T(0));
-}
-
 PenLayer::PenLayer(QNanoQuickItem *parent) :
     IPenLayer(parent)
 {
@@ -142,6 +135,7 @@ void scratchcpprender::PenLayer::clear()
 
     m_textureDirty = true;
     m_boundsDirty = true;
+    StageComposite::invalidateProject(m_engine);
     update();
 }
 
@@ -203,6 +197,7 @@ void scratchcpprender::PenLayer::drawLine(const PenAttributes &penAttributes, do
 
     m_textureDirty = true;
     m_boundsDirty = true;
+    StageComposite::invalidateProject(m_engine);
     update();
 }
 
@@ -220,43 +215,17 @@ void PenLayer::stamp(IRenderedTarget *target)
     if (!bounds.intersects(libscratchcpp::Rect(-stageWidth / 2, stageHeight / 2, stageWidth / 2, -stageHeight / 2)))
         return;
 
-    float x = 0;
-    float y = 0;
-    float angle = 180;
-    float scaleX = 1;
-    float scaleY = 1;
-
-    SpriteModel *spriteModel = target->spriteModel();
-
-    if (spriteModel) {
-        libscratchcpp::Sprite *sprite = spriteModel->sprite();
-
-        switch (sprite->rotationStyle()) {
-            case libscratchcpp::Sprite::RotationStyle::AllAround:
-                angle = 270 - sprite->direction();
-                break;
-
-            case libscratchcpp::Sprite::RotationStyle::LeftRight:
-                scaleX = sgn(sprite->direction());
-                break;
-
-            default:
-                break;
-        }
-
-        scaleY = sprite->size() / 100;
-        scaleX *= scaleY;
-    }
-
-    scaleX *= m_scale;
-    scaleY *= m_scale;
-
-    const Texture &texture = target->cpuTexture();
+    Texture texture = target->cpuTexture();
 
     if (!texture.isValid())
         return;
 
-    const float textureScale = texture.width() / static_cast<float>(target->costumeWidth());
+    // Use the texture with baked effects if there's one
+    EffectState effects = target->graphicEffects();
+
+    if (RenderedTarget *renderedTarget = dynamic_cast<RenderedTarget *>(target))
+        renderedTarget->bakeEffects(texture, effects);
+
     const float skinWidth = texture.width();
     const float skinHeight = texture.height();
 
@@ -266,11 +235,8 @@ void PenLayer::stamp(IRenderedTarget *target)
     projectionMatrix.ortho(1.0f, -1.0f, aspectRatio, -aspectRatio, 0.1f, 0.0f);
     projectionMatrix.scale(skinWidth / bounds.width() / m_scale, skinHeight / bounds.height() / m_scale);
 
-    // Model matrix
-    // TODO: This should be calculated and cached by targets
-    QMatrix4x4 modelMatrix;
-    modelMatrix.rotate(angle, 0, 0, 1);
-    modelMatrix.scale(scaleX / textureScale, aspectRatio * scaleY / textureScale);
+    // Model matrix (cached by the target)
+    const QMatrix4x4 &modelMatrix = target->stampModelMatrix(m_scale);
     m_glF->glDisable(GL_SCISSOR_TEST);
     m_glF->glDisable(GL_DEPTH_TEST);
     m_glF->glEnable(GL_BLEND);
@@ -292,7 +258,6 @@ void PenLayer::stamp(IRenderedTarget *target)
     // Get the shader program for the current set of effects
     ShaderManager *shaderManager = ShaderManager::instance();
 
-    const auto &effects = target->graphicEffects();
     QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(effects);
     Q_ASSERT(shaderProgram);
     Q_ASSERT(shaderProgram->isLinked());
@@ -321,6 +286,7 @@ void PenLayer::stamp(IRenderedTarget *target)
 
     m_textureDirty = true;
     m_boundsDirty = true;
+    StageComposite::invalidateProject(m_engine);
     update();
 }
 
@@ -353,11 +319,28 @@ QRgb PenLayer::colorAtScratchPoint(double x, double y) const
         return qRgba(0, 0, 0, 0);
 
     GLubyte *data = m_textureManager.getTextureData(m_texture);
+
+    if (!data)
+        return qRgba(0, 0, 0, 0);
+
     const int index = (y * width + x) * 4; // RGBA channels
     Q_ASSERT(index >= 0 && index < width * height * 4);
     return qRgba(data[index], data[index + 1], data[index + 2], data[index + 3]);
 }
 
+bool PenLayer::hasPartialAlpha() const
+{
+    // Returns true if some pixels are partially transparent (e.g. antialiased lines)
+    if (m_textureDirty)
+        const_cast<PenLayer *>(this)->updateTexture();
+
+    if (!m_texture.isValid())
+        return false;
+
+    const Silhouette *silhouette = m_textureManager.getTextureSilhouette(m_texture);
+    return silhouette && silhouette->hasPartialAlpha();
+}
+
 const libscratchcpp::Rect &PenLayer::getBounds() const
 {
     if (m_textureDirty)
@@ -455,6 +438,7 @@ void PenLayer::createFbo()
     m_fbo.reset(newFbo);
     m_texture = Texture(m_fbo->texture(), m_fbo->size());
     m_scale = width() / m_engine->stageWidth();
+    StageComposite::invalidateProject(m_engine);
 }
 
 void PenLayer::updateTexture()
@@ -41,6 +41,7 @@ class PenLayer : public IPenLayer
 
         QOpenGLFramebufferObject *framebufferObject() const override;
         QRgb colorAtScratchPoint(double x, double y) const override;
+        bool hasPartialAlpha() const;
 
         const libscratchcpp::Rect &getBounds() const override;
 
@@ -12,6 +12,8 @@
 #include "valuemonitormodel.h"
 #include "listmonitormodel.h"
 #include "renderedtarget.h"
+#include "skin.h"
+#include "skinimagestore.h"
 #include "blocks/penblocks.h"
 
 using namespace scratchcpprender;
@@ -49,6 +51,12 @@ ProjectLoader::~ProjectLoader()
 
     for (SpriteModel *sprite : m_sprites)
         sprite->deleteLater();
+
+    // The costumes are deleted with the project
+    SkinImageStore *store = SkinImageStore::instance();
+
+    if (store)
+        store->clear(this);
 }
 
 const QString &ProjectLoader::fileName() const
@@ -80,6 +88,11 @@ void ProjectLoader::setFileName(const QString &newFileName)
     emit downloadedAssetsChanged();
     emit assetCountChanged();
 
+    m_preparedCostumes = 0;
+    m_costumeCount = 0;
+    emit preparedCostumesChanged();
+    emit costumeCountChanged();
+
     emit loadStatusChanged();
     emit fileNameChanged();
 
@@ -102,6 +115,8 @@ void ProjectLoader::stopLoading()
         m_stopLoading = true;
         m_loadThread.waitForFinished();
     }
+
+    stopPreparing();
 }
 
 bool ProjectLoader::running() const
@@ -282,12 +297,35 @@ void ProjectLoader::clear()
     m_oldEngine = m_engine;
     m_engine = nullptr;
     emit engineChanged();
+
+    // Delete prepared costume images which haven't been used
+    stopPreparing();
+    SkinImageStore::instance()->clear(this);
 }
 
 void ProjectLoader::load()
 {
     m_unpositionedMonitors.clear();
     m_loadStatus = m_project.load() ? LoadStatus::Loaded : LoadStatus::Failed;
+
+    std::vector<Costume *> costumes;
+
+    if (m_loadStatus == LoadStatus::Loaded && !m_stopLoading) {
+        costumes = loadedCostumes();
+        SkinImageStore *store = SkinImageStore::instance();
+
+        // The entries of the costumes are deleted with the project (other projects keep theirs)
+        for (Costume *costume : costumes)
+            store->setOwner(costume, this);
+
+        if (m_progressiveLoading) {
+            // Costumes are prepared after the project is published, skins wait for them (see SkinImageStore)
+            for (Costume *costume : costumes)
+                store->setPending(costume);
+        } else
+            prepareCostumes(costumes);
+    }
+
     m_engineMutex.lock();
     m_engine = m_project.engine().get();
 
@@ -365,6 +403,9 @@ void ProjectLoader::load()
 
     m_engineMutex.unlock();
 
+    if (m_progressiveLoading && !costumes.empty())
+        m_prepareThread = QtConcurrent::run(&ProjectLoader::prepareCostumes, this, costumes);
+
     emit loadStatusChanged();
     emit loadingFinished();
     emit engineChanged();
@@ -372,6 +413,60 @@ void ProjectLoader::load()
     emit spritesChanged();
 }
 
+std::vector<Costume *> ProjectLoader::loadedCostumes() const
+{
+    // Returns the costumes of all targets, current costumes of visible targets come first
+    auto engine = m_project.engine();
+    std::vector<Costume *> current;
+    std::vector<Costume *> other;
+
+    if (!engine)
+        return current;
+
+    for (auto target : engine->targets()) {
+        const bool visible = target->isStage() || static_cast<Sprite *>(target.get())->visible();
+        Costume *currentCostume = target->currentCostume().get();
+
+        for (auto costume : target->costumes()) {
+            if (visible && costume.get() == currentCostume)
+                current.push_back(costume.get());
+            else
+                other.push_back(costume.get());
+        }
+    }
+
+    current.insert(current.end(), other.begin(), other.end());
+    return current;
+}
+
+void ProjectLoader::prepareCostumes(const std::vector<Costume *> &costumes)
+{
+    // Decode costumes on all threads, so that skins only have to upload their textures (see SkinImageStore)
+    m_costumeCount = costumes.size();
+    emit costumeCountChanged();
+
+    QtConcurrent::blockingMap(costumes, [this](Costume *costume) {
+        if (m_stopLoading || m_stopPreparing)
+            return;
+
+        SkinImageStore::instance()->prepare(costume);
+        m_preparedCostumes++;
+        emit preparedCostumesChanged();
+    });
+}
+
+void ProjectLoader::stopPreparing()
+{
+    if (m_prepareThread.isRunning()) {
+        m_stopPreparing = true;
+        m_prepareThread.waitForFinished();
+        m_stopPreparing = false;
+
+        // Skins of costumes which weren't prepared must decode them
+        SkinImageStore::instance()->clearPending(this);
+    }
+}
+
 void ProjectLoader::initTimer()
 {
     m_timerId = startTimer(1000 / m_fps);
@@ -401,6 +496,9 @@ void ProjectLoader::redraw()
             renderedTarget->beforeRedraw();
     }
 
+    // Delete textures which haven't been used for a while
+    Skin::nextFrame();
+
     m_engine->updateMonitors();
 }
 
@@ -631,3 +729,28 @@ unsigned int ProjectLoader::assetCount() const
 {
     return m_assetCount;
 }
+
+unsigned int ProjectLoader::preparedCostumes() const
+{
+    return m_preparedCostumes;
+}
+
+unsigned int ProjectLoader::costumeCount() const
+{
+    return m_costumeCount;
+}
+
+bool ProjectLoader::progressiveLoading() const
+{
+    return m_progressiveLoading;
+}
+
+void ProjectLoader::setProgressiveLoading(bool newProgressiveLoading)
+{
+    // Publishes projects right after they're loaded, costumes are decoded in the background after that
+    if (m_progressiveLoading == newProgressiveLoading)
+        return;
+
+    m_progressiveLoading = newProgressiveLoading;
+    emit progressiveLoadingChanged();
+}
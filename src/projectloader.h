@@ -41,6 +41,9 @@ class ProjectLoader : public QObject
         Q_PROPERTY(bool mute READ mute WRITE setMute NOTIFY muteChanged)
         Q_PROPERTY(unsigned int downloadedAssets READ downloadedAssets NOTIFY downloadedAssetsChanged)
         Q_PROPERTY(unsigned int assetCount READ assetCount NOTIFY assetCountChanged)
+        Q_PROPERTY(unsigned int preparedCostumes READ preparedCostumes NOTIFY preparedCostumesChanged)
+        Q_PROPERTY(unsigned int costumeCount READ costumeCount NOTIFY costumeCountChanged)
+        Q_PROPERTY(bool progressiveLoading READ progressiveLoading WRITE setProgressiveLoading NOTIFY progressiveLoadingChanged)
 
     public:
         enum class LoadStatus
@@ -111,6 +114,13 @@ class ProjectLoader : public QObject
 
         unsigned int assetCount() const;
 
+        unsigned int preparedCostumes() const;
+
+        unsigned int costumeCount() const;
+
+        bool progressiveLoading() const;
+        void setProgressiveLoading(bool newProgressiveLoading);
+
         int renderFps() const;
 
     signals:
@@ -134,6 +144,9 @@ class ProjectLoader : public QObject
         void muteChanged();
         void downloadedAssetsChanged();
         void assetCountChanged();
+        void preparedCostumesChanged();
+        void costumeCountChanged();
+        void progressiveLoadingChanged();
         void cloneCreated(SpriteModel *model);
         void cloneDeleted(SpriteModel *model);
         void monitorAdded(MonitorModel *model);
@@ -148,6 +161,9 @@ class ProjectLoader : public QObject
         static void callLoad(ProjectLoader *loader);
         void clear();
         void load();
+        std::vector<libscratchcpp::Costume *> loadedCostumes() const;
+        void prepareCostumes(const std::vector<libscratchcpp::Costume *> &costumes);
+        void stopPreparing();
         void initTimer();
         void redraw();
         void addClone(SpriteModel *model);
@@ -159,6 +175,7 @@ class ProjectLoader : public QObject
         int m_timerId = -1;
         QString m_fileName;
         QFuture<void> m_loadThread;
+        QFuture<void> m_prepareThread; // prepares costumes after loading in progressive mode
         libscratchcpp::Project m_project;
         bool m_running = false;
         QElapsedTimer m_renderTimer;
@@ -184,6 +201,10 @@ class ProjectLoader : public QObject
         bool m_mute = false;
         std::atomic<unsigned int> m_downloadedAssets = 0;
         std::atomic<unsigned int> m_assetCount = 0;
+        std::atomic<unsigned int> m_preparedCostumes = 0;
+        std::atomic<unsigned int> m_costumeCount = 0;
+        bool m_progressiveLoading = false;
+        std::atomic<bool> m_stopPreparing = false;
         std::atomic<bool> m_stopLoading = false;
 };
 
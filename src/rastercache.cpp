@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QDir>
+
+#include "rastercache.h"
+
+using namespace scratchcpprender;
+
+Q_GLOBAL_STATIC(RasterCache, globalInstance)
+
+namespace
+{
+
+struct Header
+{
+        char magic[4];
+        quint32 version;
+        qint32 width;
+        qint32 height;
+        quint32 hullPointCount;
+};
+
+const char MAGIC[4] = { 'S', 'C', 'R', 'C' };
+
+} // namespace
+
+RasterCache::RasterCache() :
+    m_directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/rastercache")
+{
+}
+
+RasterCache *RasterCache::instance()
+{
+    return globalInstance;
+}
+
+QByteArray RasterCache::hash(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+bool RasterCache::enabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_enabled;
+}
+
+void RasterCache::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_enabled = enabled;
+}
+
+QString RasterCache::directory() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_directory;
+}
+
+void RasterCache::setDirectory(const QString &directory)
+{
+    QMutexLocker locker(&m_mutex);
+    m_directory = directory;
+    m_files.clear();
+    m_size = 0;
+    m_scanned = false;
+}
+
+qint64 RasterCache::sizeLimit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_sizeLimit;
+}
+
+void RasterCache::setSizeLimit(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_sizeLimit = std::max(0LL, bytes);
+
+    if (m_scanned)
+        trim(m_sizeLimit);
+}
+
+qint64 RasterCache::size()
+{
+    QMutexLocker locker(&m_mutex);
+    scan();
+    return m_size;
+}
+
+bool RasterCache::load(const QByteArray &hash, int index, Entry &entry)
+{
+    // Reads a cached texture (this can be called from any thread)
+    QString name = fileName(hash, index);
+    QString path;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!m_enabled || hash.isEmpty())
+            return false;
+
+        path = m_directory + "/" + name;
+    }
+
+    QFile file(path);
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    const qint64 fileSize = file.size();
+    const uchar *bytes = fileSize >= qint64(sizeof(Header)) ? file.map(0, fileSize) : nullptr;
+    Header header;
+    bool valid = false;
+
+    if (bytes) {
+        memcpy(&header, bytes, sizeof(Header));
+        const qint64 pixelsOffset = sizeof(Header) + qint64(header.hullPointCount) * 2 * sizeof(qint32);
+
+        valid = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == FORMAT_VERSION && header.width > 0 && header.height > 0 &&
+                fileSize == pixelsOffset + qint64(header.width) * header.height * 4;
+    }
+
+    if (!valid) {
+        // Delete files which are broken or were written by another version
+        file.close();
+        QMutexLocker locker(&m_mutex);
+        auto it = m_files.find(name);
+
+        if (it != m_files.cend()) {
+            m_size -= it->second.size;
+            m_files.erase(it);
+        }
+
+        QFile::remove(path);
+        return false;
+    }
+
+    const qint32 *points = reinterpret_cast<const qint32 *>(bytes + sizeof(Header));
+    entry.hullPoints.clear();
+    entry.hullPoints.reserve(header.hullPointCount);
+
+    for (quint32 i = 0; i < header.hullPointCount; i++)
+        entry.hullPoints.push_back(QPoint(points[i * 2], points[i * 2 + 1]));
+
+    // The pixels are copied, so that the file isn't kept open (and can be deleted) while the texture exists
+    const uchar *pixels = reinterpret_cast<const uchar *>(points + header.hullPointCount * 2);
+    entry.image = QImage(pixels, header.width, header.height, header.width * 4, QImage::Format_RGBA8888).copy();
+
+    // Update the modification time, so that recently used files are kept after restarting
+    const QDateTime now = QDateTime::currentDateTime();
+    file.setFileTime(now, QFileDevice::FileModificationTime);
+    file.close();
+
+    QMutexLocker locker(&m_mutex);
+    auto it = m_files.find(name);
+
+    if (it != m_files.cend())
+        it->second.lastUse = now.toMSecsSinceEpoch();
+
+    return true;
+}
+
+void RasterCache::store(const QByteArray &hash, int index, const Entry &entry)
+{
+    // Writes a texture to the cache (this can be called from any thread)
+    const QImage &image = entry.image;
+    const QString name = fileName(hash, index);
+    QString dir;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!m_enabled || hash.isEmpty() || image.isNull() || image.format() != QImage::Format_RGBA8888)
+            return;
+
+        dir = m_directory;
+    }
+
+    if (!QDir().mkpath(dir))
+        return;
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.width = image.width();
+    header.height = image.height();
+    header.hullPointCount = entry.hullPoints.size();
+
+    std::vector<qint32> points;
+    points.reserve(entry.hullPoints.size() * 2);
+
+    for (const QPoint &point : entry.hullPoints) {
+        points.push_back(point.x());
+        points.push_back(point.y());
+    }
+
+    // QSaveFile replaces the file atomically, so other processes never read incomplete files
+    QSaveFile file(dir + "/" + name);
+
+    if (!file.open(QFile::WriteOnly))
+        return;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char *>(points.data()), points.size() * sizeof(qint32));
+
+    for (int y = 0; y < image.height(); y++)
+        file.write(reinterpret_cast<const char *>(image.constScanLine(y)), image.width() * 4);
+
+    const qint64 fileSize = sizeof(Header) + points.size() * sizeof(qint32) + qint64(image.width()) * image.height() * 4;
+
+    if (!file.commit())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    scan();
+    File &info = m_files[name];
+    m_size += fileSize - info.size;
+    info.size = fileSize;
+    info.lastUse = QDateTime::currentMSecsSinceEpoch();
+    trim(m_sizeLimit);
+}
+
+void RasterCache::clear()
+{
+    // Deletes all cached files
+    QMutexLocker locker(&m_mutex);
+    scan();
+    trim(-1);
+}
+
+QString RasterCache::fileName(const QByteArray &hash, int index)
+{
+    return QString::fromLatin1(hash.toHex()) + "_" + QString::number(index) + "_v" + QString::number(FORMAT_VERSION) + ".raster";
+}
+
+void RasterCache::scan()
+{
+    // Reads the sizes and modification times of the cached files (the mutex must be locked)
+    if (m_scanned)
+        return;
+
+    m_scanned = true;
+    m_files.clear();
+    m_size = 0;
+
+    const QFileInfoList files = QDir(m_directory).entryInfoList({ "*.raster" }, QDir::Files);
+
+    for (const QFileInfo &info : files) {
+        m_files[info.fileName()] = { info.size(), info.lastModified().toMSecsSinceEpoch() };
+        m_size += info.size();
+    }
+}
+
+void RasterCache::trim(qint64 limit)
+{
+    // Deletes least recently used files until the size is within the limit (the mutex must be locked)
+    if (m_size <= limit)
+        return;
+
+    std::vector<std::pair<QString, File>> files(m_files.begin(), m_files.end());
+    std::sort(files.begin(), files.end(), [](const auto &a, const auto &b) { return a.second.lastUse < b.second.lastUse; });
+
+    for (const auto &[name, file] : files) {
+        if (m_size <= limit)
+            break;
+
+        QFile::remove(m_directory + "/" + name);
+        m_size -= file.size;
+        m_files.erase(name);
+    }
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QMutex>
+#include <unordered_map>
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The RasterCache class stores rasterized costume textures (e.g. SVG mip levels) and their convex hull points on disk.
+ * Costume assets are identified by the MD5 hash of their data, so cached textures stay valid across restarts.
+ * Files are memory-mapped and closed after their pixels are copied, least recently used files are deleted when the size limit is exceeded.
+ * The cache is disabled by default.
+ */
+class RasterCache
+{
+    public:
+        static inline const quint32 FORMAT_VERSION = 1;
+        static inline const qint64 DEFAULT_SIZE_LIMIT = 256 * 1024 * 1024;
+
+        struct Entry
+        {
+                QImage image; // premultiplied RGBA8888 (like images from Skin::paintImage())
+                std::vector<QPoint> hullPoints;
+        };
+
+        RasterCache();
+        RasterCache(const RasterCache &) = delete;
+
+        static RasterCache *instance();
+
+        static QByteArray hash(const QByteArray &data);
+
+        bool enabled() const;
+        void setEnabled(bool enabled);
+
+        QString directory() const;
+        void setDirectory(const QString &directory);
+
+        qint64 sizeLimit() const;
+        void setSizeLimit(qint64 bytes);
+        qint64 size();
+
+        bool load(const QByteArray &hash, int index, Entry &entry);
+        void store(const QByteArray &hash, int index, const Entry &entry);
+
+        void clear();
+
+    private:
+        struct File
+        {
+                qint64 size = 0;
+                qint64 lastUse = 0; // msecs since epoch
+        };
+
+        static QString fileName(const QByteArray &hash, int index);
+        void scan();
+        void trim(qint64 limit);
+
+        mutable QMutex m_mutex;
+        bool m_enabled = false;
+        QString m_directory;
+        qint64 m_sizeLimit = DEFAULT_SIZE_LIMIT;
+        std::unordered_map<QString, File> m_files;
+        qint64 m_size = 0;
+        bool m_scanned = false;
+};
+
+} // namespace scratchcpprender
@@ -5,6 +5,8 @@
 #include <scratchcpp/rect.h>
 #include <scratchcpp/value.h>
 #include <QtSvg/QSvgRenderer>
+#include <QThreadPool>
+#include <QSemaphore>
 #include <qnanopainter.h>
 
 #include "renderedtarget.h"
@@ -16,12 +18,25 @@
 #include "svgskin.h"
 #include "cputexturemanager.h"
 #include "penlayer.h"
+#include "spatialindex.h"
+#include "gpuqueryrenderer.h"
+#include "stagecomposite.h"
+#include "convexhull.h"
+#include "effecttexturecache.h"
+#include "skinimagestore.h"
+#include "skinregistry.h"
 
 using namespace scratchcpprender;
 using namespace libscratchcpp;
 
 static const double SVG_SCALE_LIMIT = 0.1; // the maximum viewport dimensions are multiplied by this
 static const double pi = std::acos(-1);    // TODO: Use std::numbers::pi in C++20
+static const size_t MAX_QUERY_RESULTS = 16; // results of touching queries cached by each target
+static const int MIN_BAND_ROWS = 4;          // minimum number of rows scanned by a thread
+static const int EFFECT_BAKE_FRAMES = 2;     // redraws with unchanged effects before they're baked into textures
+static const int PREFETCH_COSTUMES = 4;      // costumes after the current costume which are decoded in the background
+static const int PREFETCH_PRIORITY = 1;
+static const int IDLE_PREFETCH_PRIORITY = 0;
 
 RenderedTarget::RenderedTarget(QQuickItem *parent) :
     IRenderedTarget(parent)
@@ -31,9 +46,19 @@ RenderedTarget::RenderedTarget(QQuickItem *parent) :
 
 RenderedTarget::~RenderedTarget()
 {
-    if (!m_skinsInherited) {
-        for (const auto &[costume, skin] : m_skins)
-            delete skin;
+    if (m_spatialIndex) {
+        m_spatialIndex->remove(this);
+
+        if (m_spatialIndex->isEmpty())
+            SpatialIndex::removeProjectIndex(m_engine);
+    }
+
+    if (m_stageComposite) {
+        m_stageComposite->remove(this);
+        m_stageComposite->invalidate();
+
+        if (m_stageComposite->isEmpty())
+            StageComposite::removeProjectComposite(m_engine);
     }
 }
 
@@ -45,6 +70,9 @@ void RenderedTarget::updateVisibility(bool visible)
     setVisible(visible);
     calculatePos();
     m_convexHullDirty = true;
+
+    if (m_spatialIndex)
+        m_spatialIndex->setVisible(this, visible);
 }
 
 void RenderedTarget::updateX(double x)
@@ -100,6 +128,9 @@ void RenderedTarget::updateRotationStyle(libscratchcpp::Sprite::RotationStyle st
 void RenderedTarget::updateLayerOrder(int layerOrder)
 {
     setZ(layerOrder);
+
+    if (m_stageComposite)
+        m_stageComposite->invalidate();
 }
 
 void RenderedTarget::updateCostume(Costume *costume)
@@ -110,12 +141,8 @@ void RenderedTarget::updateCostume(Costume *costume)
     m_costume = costume;
 
     if (m_costumesLoaded) {
-        auto it = m_skins.find(m_costume);
-
-        if (it == m_skins.end())
-            m_skin = nullptr;
-        else
-            m_skin = it->second;
+        m_skin = getSkin(m_costume);
+        prefetchCostumes();
     }
 
     setSmooth(m_costume->dataFormat() == "svg");
@@ -131,40 +158,19 @@ bool RenderedTarget::costumesLoaded() const
 
 void RenderedTarget::loadCostumes()
 {
-    // Delete previous skins
-    if (!m_skinsInherited) {
-        for (const auto &[costume, skin] : m_skins)
-            delete skin;
-    }
-
-    m_skinsInherited = false;
-    m_skins.clear();
-
-    // Generate a skin for each costume
-    Target *target = scratchTarget();
+    // Delete previous skins (skins of other costumes are created when they're used, see updateCostume())
+    m_skins = std::make_shared<SkinMap>();
+    m_skin = nullptr;
+    m_idlePrefetchStarted = false;
 
-    if (!target)
+    if (!scratchTarget())
         return;
 
-    const auto &costumes = target->costumes();
-
-    for (auto costume : costumes) {
-        Skin *skin = nullptr;
-        if (costume->dataFormat() == "svg")
-            skin = new SVGSkin(costume.get());
-        else
-            skin = new BitmapSkin(costume.get());
-
-        if (skin)
-            m_skins[costume.get()] = skin;
-
-        if (m_costume && costume.get() == m_costume)
-            m_skin = skin;
-    }
-
     m_costumesLoaded = true;
 
     if (m_costume) {
+        m_skin = getSkin(m_costume);
+        prefetchCostumes();
         calculateSize();
         calculatePos();
     }
@@ -176,11 +182,37 @@ void RenderedTarget::beforeRedraw()
     setWidth(m_width);
     setHeight(m_height);
 
+    // Use textures which have been created in the background (e.g. large SVG mip levels)
+    if (m_skin) {
+        m_skin->updateTextures();
+
+        if (m_costume && m_skin->textureVersion() != m_skinTextureVersion) {
+            calculateSize();
+            calculatePos();
+        }
+    }
+
+    // Current textures must not be deleted (see Skin::nextFrame())
+    if (m_skin) {
+        m_skin->markUsed(m_texture);
+        m_skin->markUsed(m_cpuTexture);
+    }
+
     if (!m_oldTexture.isValid() || (m_texture.isValid() && m_texture != m_oldTexture)) {
         m_oldTexture = m_texture;
         update();
     }
 
+    // Effects which don't change anymore are baked (see bakeEffects())
+    if (m_stableEffectFrames < EFFECT_BAKE_FRAMES && !m_graphicEffects.empty()) {
+        if (++m_stableEffectFrames == EFFECT_BAKE_FRAMES) {
+            update();
+
+            if (m_stageComposite)
+                m_stageComposite->invalidate();
+        }
+    }
+
     // Update drag position
     if (m_spriteModel) {
         Sprite *sprite = m_spriteModel->sprite();
@@ -199,6 +231,9 @@ void RenderedTarget::deinitClone()
     // Release drag lock
     if (m_mouseArea->draggedSprite() == this)
         m_mouseArea->setDraggedSprite(nullptr);
+
+    if (m_stageComposite)
+        m_stageComposite->invalidate();
 }
 
 IEngine *RenderedTarget::engine() const
@@ -211,24 +246,45 @@ void RenderedTarget::setEngine(IEngine *newEngine)
     if (m_engine == newEngine)
         return;
 
-    m_engine = newEngine;
-    m_costume = nullptr;
-    m_costumesLoaded = false;
+    if (m_spatialIndex) {
+        m_spatialIndex->remove(this);
+
+        if (m_spatialIndex->isEmpty())
+            SpatialIndex::removeProjectIndex(m_engine);
+    }
+
+    if (m_stageComposite) {
+        m_stageComposite->remove(this);
+        m_stageComposite->invalidate();
+
+        if (m_stageComposite->isEmpty())
+            StageComposite::removeProjectComposite(m_engine);
+    }
 
-    if (!m_skinsInherited) {
-        for (const auto &[costume, skin] : m_skins)
-            delete skin;
+    m_engine = newEngine;
+    m_spatialIndex = SpatialIndex::getProjectIndex(m_engine);
+    m_stageComposite = StageComposite::getProjectComposite(m_engine);
 
-        m_skins.clear();
+    if (m_spatialIndex) {
+        m_spatialIndex->add(this);
+        m_spatialIndex->setGroup(this, cloneGroup(m_spriteModel));
     }
 
+    if (m_stageComposite)
+        m_stageComposite->add(this);
+
+    m_costume = nullptr;
+    m_costumesLoaded = false;
+    m_skins.reset();
+    m_idlePrefetchStarted = false;
     m_skin = nullptr;
     m_texture = Texture();
     m_oldTexture = Texture();
     m_cpuTexture = Texture();
+    m_bakedCpuTexture = Texture();
     m_penLayer = PenLayer::getProjectPenLayer(m_engine);
     m_convexHullDirty = true;
-    m_transformedHullDirty = true;
+    invalidateTransform();
     clearGraphicEffects();
     m_hullPoints.clear();
 
@@ -269,6 +325,9 @@ void RenderedTarget::setSpriteModel(SpriteModel *newSpriteModel)
 
     m_spriteModel = newSpriteModel;
 
+    if (m_spatialIndex)
+        m_spatialIndex->setGroup(this, cloneGroup(m_spriteModel));
+
     if (m_spriteModel) {
         SpriteModel *cloneRoot = m_spriteModel->cloneRoot();
 
@@ -281,9 +340,9 @@ void RenderedTarget::setSpriteModel(SpriteModel *newSpriteModel)
             m_hullPoints = target->m_hullPoints;
 
             if (target->costumesLoaded()) {
-                m_skins = target->m_skins; // TODO: Avoid copying - maybe using a pointer?
+                m_skins = target->m_skins;
                 m_costumesLoaded = true;
-                m_skinsInherited = true; // avoid double free
+                m_idlePrefetchStarted = true; // the clone root does it
             }
         }
 
@@ -377,6 +436,10 @@ Rect RenderedTarget::getBounds() const
     double right = -std::numeric_limits<double>::infinity();
     double bottom = std::numeric_limits<double>::infinity();
 
+    // Use placeholder bounds until the texture is available
+    if (m_skin && m_costume && !m_cpuTexture.isValid() && !m_skin->size().isEmpty())
+        return getFastBounds();
+
     const std::vector<QPointF> &points = transformedHullPoints();
 
     for (const QPointF &point : points) {
@@ -420,13 +483,23 @@ QRectF RenderedTarget::getBoundsForBubble() const
 
 Rect RenderedTarget::getFastBounds() const
 {
-    if (!m_costume || !m_skin || !m_texture.isValid() || !m_cpuTexture.isValid())
+    // The bounds are cached relative to the position, so moving the target doesn't require any calculations
+    if (m_fastBoundsVersion == m_geometryVersion)
+        return Rect(m_fastBounds.left() + m_x, m_fastBounds.top() + m_y, m_fastBounds.right() + m_x, m_fastBounds.bottom() + m_y);
+
+    m_fastBoundsVersion = m_geometryVersion;
+
+    if (!m_costume || !m_skin || ((!m_texture.isValid() || !m_cpuTexture.isValid()) && m_skin->size().isEmpty())) {
+        m_fastBounds = Rect(0, 0, 0, 0);
         return Rect(m_x, m_y, m_x, m_y);
+    }
 
-    const double textureScale = m_skin->getTextureScale(m_cpuTexture);
+    // Placeholder bounds are based on the size of the skin until the textures are available
+    const bool placeholder = !m_texture.isValid() || !m_cpuTexture.isValid();
+    const QSizeF size = placeholder ? QSizeF(m_skin->size()) : QSizeF(m_cpuTexture.size()) / m_skin->getTextureScale(m_cpuTexture);
     const double bitmapRes = m_costume->bitmapResolution();
-    const double width = m_cpuTexture.width() * m_size / textureScale / bitmapRes;
-    const double height = m_cpuTexture.height() * m_size / textureScale / bitmapRes;
+    const double width = size.width() * m_size / bitmapRes;
+    const double height = size.height() * m_size / bitmapRes;
     const double originX = m_costume->rotationCenterX() * m_size / bitmapRes - width / 2;
     const double originY = -m_costume->rotationCenterY() * m_size / bitmapRes + height / 2;
     const double rot = -rotation() * pi / 180;
@@ -451,9 +524,55 @@ Rect RenderedTarget::getFastBounds() const
     const double minY = std::min(yList);
     const double maxY = std::max(yList);
 
+    m_fastBounds = Rect(minX, maxY, maxX, minY);
     return Rect(minX + m_x, maxY + m_y, maxX + m_x, minY + m_y);
 }
 
+const QMatrix4x4 &RenderedTarget::stampModelMatrix(double scale) const
+{
+    // Model matrix of the CPU texture used by the pen layer (see PenLayer::stamp())
+    if (m_modelMatrixVersion == m_geometryVersion && m_modelMatrixScale == scale)
+        return m_modelMatrix;
+
+    m_modelMatrixVersion = m_geometryVersion;
+    m_modelMatrixScale = scale;
+    m_modelMatrix.setToIdentity();
+
+    float angle = 180;
+    float scaleX = 1;
+    float scaleY = 1;
+
+    if (m_spriteModel) {
+        switch (m_rotationStyle) {
+            case Sprite::RotationStyle::AllAround:
+                angle = 270 - m_direction;
+                break;
+
+            case Sprite::RotationStyle::LeftRight:
+                scaleX = (0 < m_direction) - (m_direction < 0);
+                break;
+
+            default:
+                break;
+        }
+
+        scaleY = m_size;
+        scaleX *= scaleY;
+    }
+
+    scaleX *= scale;
+    scaleY *= scale;
+
+    if (!m_cpuTexture.isValid())
+        return m_modelMatrix;
+
+    const float textureScale = m_cpuTexture.width() / static_cast<float>(costumeWidth());
+    const float aspectRatio = m_cpuTexture.height() / static_cast<float>(m_cpuTexture.width());
+    m_modelMatrix.rotate(angle, 0, 0, 1);
+    m_modelMatrix.scale(scaleX / textureScale, aspectRatio * scaleY / textureScale);
+    return m_modelMatrix;
+}
+
 QPointF RenderedTarget::mapFromScene(const QPointF &point) const
 {
     return QNanoQuickItem::mapFromScene(point);
@@ -522,7 +641,8 @@ int RenderedTarget::costumeWidth() const
     if (!m_skin || !m_costume)
         return 0;
 
-    return m_skin->getTexture(1).width() / m_costume->bitmapResolution();
+    // The size is available before the texture is created
+    return m_skin->size().width() / m_costume->bitmapResolution();
 }
 
 int RenderedTarget::costumeHeight() const
@@ -530,37 +650,27 @@ int RenderedTarget::costumeHeight() const
     if (!m_skin || !m_costume)
         return 0;
 
-    return m_skin->getTexture(1).height() / m_costume->bitmapResolution();
+    return m_skin->size().height() / m_costume->bitmapResolution();
 }
 
-const std::unordered_map<ShaderManager::Effect, double> &RenderedTarget::graphicEffects() const
+const EffectState &RenderedTarget::graphicEffects() const
 {
     return m_graphicEffects;
 }
 
 void RenderedTarget::setGraphicEffect(ShaderManager::Effect effect, double value)
 {
-    bool changed = false;
+    if (m_graphicEffects.setValue(effect, value)) {
+        update();
 
-    if (value == 0) {
-        if ((m_graphicEffectMask & effect) != 0) {
-            changed = true;
-            m_graphicEffects.erase(effect);
-            m_graphicEffectMask &= ~effect;
+        // Other effects are applied on top of the baked texture (see bakeEffects())
+        if ((effect & EffectTextureCache::BAKED_EFFECTS) != 0) {
+            m_stableEffectFrames = 0;
+            m_bakedCpuTexture = Texture();
         }
-    } else {
-        if ((m_graphicEffectMask & effect) != 0)
-            changed = m_graphicEffects[effect] != value;
-        else {
-            changed = true;
-            m_graphicEffectMask |= effect;
-        }
-
-        m_graphicEffects[effect] = value;
-    }
 
-    if (changed) {
-        update();
+        if (m_stageComposite)
+            m_stageComposite->invalidate();
 
         if (ShaderManager::effectShapeChanges(effect)) {
             m_convexHullDirty = true;
@@ -571,19 +681,37 @@ void RenderedTarget::setGraphicEffect(ShaderManager::Effect effect, double value
 
 void RenderedTarget::clearGraphicEffects()
 {
-    if (!m_graphicEffects.empty())
+    if (!m_graphicEffects.empty()) {
         update();
 
-    for (const auto &[effect, value] : m_graphicEffects) {
-        if (ShaderManager::effectShapeChanges(effect)) {
-            m_convexHullDirty = true;
-            m_transformedHullDirty = true;
-            break;
-        }
+        if (m_stageComposite)
+            m_stageComposite->invalidate();
+    }
+
+    if (ShaderManager::shapeChangingEffects(m_graphicEffects.mask()) != 0) {
+        m_convexHullDirty = true;
+        m_transformedHullDirty = true;
     }
 
     m_graphicEffects.clear();
-    m_graphicEffectMask = ShaderManager::Effect::NoEffect;
+    m_stableEffectFrames = 0;
+    m_bakedCpuTexture = Texture();
+}
+
+bool RenderedTarget::bakeEffects(Texture &texture, EffectState &effects) const
+{
+    // Replaces the texture with a texture from the effect texture cache and removes the effects which are applied in it
+    if (!effectsBakeable())
+        return false;
+
+    const Texture baked = EffectTextureCache::instance()->getTexture(texture, effects);
+
+    if (!baked.isValid())
+        return false;
+
+    texture = baked;
+    effects = EffectTextureCache::remainingEffects(effects);
+    return true;
 }
 
 const std::vector<QPoint> &RenderedTarget::hullPoints() const
@@ -612,12 +740,15 @@ bool RenderedTarget::containsScratchPoint(double x, double y) const
     if (!m_engine || !m_skin || !m_costume)
         return false;
 
+    claimCostume();
     return containsLocalPoint(mapFromScratchToLocal(QPointF(x, y)));
 }
 
 QRgb RenderedTarget::colorAtScratchPoint(double x, double y) const
 {
     // NOTE: Only this target is processed! Use sampleColor3b() to get the final color.
+    claimCostume();
+
     if (!m_engine || !m_cpuTexture.isValid())
         return qRgba(0, 0, 0, 0);
 
@@ -633,13 +764,62 @@ QRgb RenderedTarget::colorAtScratchPoint(double x, double y) const
     if ((x < 0 || x >= width) || (y < 0 || y >= height))
         return qRgba(0, 0, 0, 0);
 
-    return textureManager()->getPointColor(m_cpuTexture, x, y, m_graphicEffectMask, m_graphicEffects);
+    const Texture baked = bakedCpuTexture();
+
+    if (baked.isValid())
+        return EffectTextureCache::instance()->textureManager()->getPointColor(baked, x, y, EffectTextureCache::remainingEffects(m_graphicEffects.mask()), m_graphicEffects);
+
+    return textureManager()->getPointColor(m_cpuTexture, x, y, m_graphicEffects.mask(), m_graphicEffects);
 }
 
 bool RenderedTarget::touchingClones(const std::vector<libscratchcpp::Sprite *> &clones) const
+{
+    // Results are reused until the scene changes
+    const bool cacheable = clonesCacheable(clones);
+    bool touching;
+
+    if (cacheable && findQueryResult(QueryKind::TouchingClones, 0, 0, clones, touching))
+        return touching;
+
+    touching = checkTouchingClones(clones);
+
+    if (cacheable)
+        addQueryResult(QueryKind::TouchingClones, 0, 0, clones, touching);
+
+    return touching;
+}
+
+bool RenderedTarget::touchingColor(Rgb color) const
+{
+    return touchingColor(color, false, 0);
+}
+
+bool RenderedTarget::touchingColor(Rgb color, Rgb mask) const
+{
+    return touchingColor(color, true, mask);
+}
+
+unsigned int RenderedTarget::queryCacheHits()
+{
+    return m_queryCacheHits;
+}
+
+unsigned int RenderedTarget::queryCacheMisses()
+{
+    return m_queryCacheMisses;
+}
+
+void RenderedTarget::resetQueryCacheStats()
+{
+    m_queryCacheHits = 0;
+    m_queryCacheMisses = 0;
+}
+
+bool RenderedTarget::checkTouchingClones(const std::vector<libscratchcpp::Sprite *> &clones) const
 {
     // https://github.com/scratchfoundation/scratch-render/blob/941562438fe3dd6e7d98d9387607d535dcd68d24/src/RenderWebGL.js#L967-L1002
     // TODO: Use Rect methods and do not use QRects
+    claimCostume();
     const QRectF myRect = touchingBounds();
 
     if (myRect.isEmpty())
@@ -647,39 +827,215 @@ bool RenderedTarget::touchingClones(const std::vector<libscratchcpp::Sprite *> &
 
     std::vector<IRenderedTarget *> candidates;
 
-    // Calculate the union of the bounding rectangle intersections
+    // Calculate the union of the bounding rectangle intersections (bounds of pending costumes can change when they're claimed)
     QRectF united = candidatesBounds(myRect, clones, candidates);
 
+    if (claimCostumes(candidates))
+        united = candidatesBounds(myRect, clones, candidates);
+
     if (united.isEmpty() || candidates.empty())
         return false;
 
+    // Drop candidates whose convex hull doesn't intersect the hull of this target, only the intersection of the hulls is checked
+    if (spansSupported() && !collisionHull().empty()) {
+        united = QRectF();
+
+        auto disjoint = [this, &myRect, &united](IRenderedTarget *candidate) {
+            QRectF rect = rectIntersection(myRect, candidate->getFastBounds());
+            const RenderedTarget *target = dynamic_cast<const RenderedTarget *>(candidate);
+            QRectF hullRect;
+
+            if (target && target->spansSupported() && !target->collisionHull().empty()) {
+                if (!hullsIntersect(target, hullRect))
+                    return true;
+
+                rect = rect.intersected(hullRect);
+
+                if (rect.isEmpty())
+                    return true;
+            }
+
+            united = united.united(rect);
+            return false;
+        };
+
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), disjoint), candidates.end());
+
+        if (candidates.empty())
+            return false;
+    }
+
+    // Compare opaque spans of rows if all targets support it
+    std::vector<const RenderedTarget *> spanCandidates;
+
+    if (spansSupported()) {
+        spanCandidates.reserve(candidates.size());
+
+        for (IRenderedTarget *candidate : candidates) {
+            const RenderedTarget *target = dynamic_cast<const RenderedTarget *>(candidate);
+
+            if (!target || !target->spansSupported()) {
+                spanCandidates.clear();
+                break;
+            }
+
+            spanCandidates.push_back(target);
+        }
+    }
+
+    if (!spanCandidates.empty())
+        return touchingSpans(united, spanCandidates);
+
+    // Only data of real targets can be read from other threads
+    CpuTextureStore::PinnedTextures pins;
+    bool concurrent = true;
+
+    for (IRenderedTarget *candidate : candidates) {
+        RenderedTarget *target = dynamic_cast<RenderedTarget *>(candidate);
+
+        if (target)
+            target->prepareConcurrentReads(false, pins);
+        else {
+            concurrent = false;
+            break;
+        }
+    }
+
+    if (concurrent)
+        prepareConcurrentReads(false, pins);
+
     // Loop through the points of the union
-    for (int y = united.top(); y <= united.bottom(); y++) {
-        for (int x = united.left(); x <= united.right(); x++) {
-            if (this->containsScratchPoint(x, y)) {
-                for (IRenderedTarget *candidate : candidates) {
-                    if (candidate->containsScratchPoint(x, y))
-                        return true;
+    const int left = united.left();
+    const int right = std::floor(united.right());
+
+    return scanRows(united.top(), std::floor(united.bottom()), right - left + 1, concurrent, [this, left, right, &candidates](int top, int bottom, const std::atomic<bool> &cancel) {
+        std::vector<char> inside(right - left + 1);
+
+        for (int y = top; y <= bottom && !cancel; y++) {
+            this->containsScratchRow(y, left, right, inside.data());
+
+            for (int x = left; x <= right; x++) {
+                if (inside[x - left]) {
+                    for (IRenderedTarget *candidate : candidates) {
+                        if (candidate->containsScratchPoint(x, y))
+                            return true;
+                    }
                 }
             }
         }
-    }
 
-    return false;
+        return false;
+    });
 }
 
-bool RenderedTarget::touchingColor(Rgb color) const
+bool RenderedTarget::gpuQueriesEnabled()
 {
-    return touchingColor(color, false, 0);
+    return m_gpuQueriesEnabled;
 }
 
-bool RenderedTarget::touchingColor(Rgb color, Rgb mask) const
+void RenderedTarget::setGpuQueriesEnabled(bool enabled)
 {
-    return touchingColor(color, true, mask);
+    // Color queries are rendered on the GPU if possible (only the rectangle of the target is read back)
+    if (m_gpuQueriesEnabled == enabled)
+        return;
+
+    m_gpuQueriesEnabled = enabled;
+    StageComposite::invalidateAll(); // drop cached results
+}
+
+int RenderedTarget::parallelScanThreshold()
+{
+    return m_parallelScanThreshold;
+}
+
+void RenderedTarget::setParallelScanThreshold(int points)
+{
+    // Rectangles with at least this number of points are scanned by multiple threads
+    m_parallelScanThreshold = points;
+}
+
+RenderedTarget::SkinMap::~SkinMap()
+{
+    SkinImageStore *store = SkinImageStore::instance();
+
+    if (store) {
+        for (Costume *costume : prefetched)
+            store->remove(costume);
+    }
+}
+
+Skin *RenderedTarget::getSkin(Costume *costume)
+{
+    // Returns the skin of the costume, it's created if it doesn't exist
+    if (!costume)
+        return nullptr;
+
+    if (!m_skins)
+        m_skins = std::make_shared<SkinMap>();
+
+    auto it = m_skins->skins.find(costume);
+
+    if (it != m_skins->skins.cend())
+        return it->second.get();
+
+    // Identical costumes (e.g. costumes of copied sprites) share their skins
+    SkinRegistry *registry = SkinRegistry::instance();
+    const bool shared = registry->contains(costume);
+    std::shared_ptr<Skin> skin = registry->getSkin(costume);
+    m_skins->skins[costume] = skin;
+
+    // The prefetched images of the costume aren't going to be used
+    if (shared && m_skins->prefetched.erase(costume) > 0)
+        SkinImageStore::instance()->remove(costume);
+
+    return skin.get();
+}
+
+void RenderedTarget::prefetchCostumes()
+{
+    // Decodes the next costumes in the background (animations usually switch to the next costume),
+    // other costumes are decoded when there's nothing else to prefetch
+    Target *target = scratchTarget();
+
+    if (!target || !m_costume || !m_skins)
+        return;
+
+    const auto &costumes = target->costumes();
+    const int count = costumes.size();
+    auto it = std::find_if(costumes.begin(), costumes.end(), [this](const std::shared_ptr<Costume> &costume) { return costume.get() == m_costume; });
+
+    if (it == costumes.end())
+        return;
+
+    SkinImageStore *store = SkinImageStore::instance();
+    SkinRegistry *registry = SkinRegistry::instance();
+    const int index = it - costumes.begin();
+
+    for (int i = 1; i <= std::min(PREFETCH_COSTUMES, count - 1); i++) {
+        Costume *costume = costumes[(index + i) % count].get();
+
+        if (m_skins->skins.find(costume) == m_skins->skins.cend() && !registry->contains(costume)) {
+            store->prefetch(costume, PREFETCH_PRIORITY);
+            m_skins->prefetched.insert(costume);
+        }
+    }
+
+    if (!m_idlePrefetchStarted) {
+        m_idlePrefetchStarted = true;
+
+        for (auto costume : costumes) {
+            if (m_skins->skins.find(costume.get()) == m_skins->skins.cend() && !registry->contains(costume.get())) {
+                store->prefetch(costume.get(), IDLE_PREFETCH_PRIORITY);
+                m_skins->prefetched.insert(costume.get());
+            }
+        }
+    }
 }
 
 void RenderedTarget::calculatePos()
 {
+    invalidateTransform(true);
+
     if (!m_skin || !m_costume || !m_engine)
         return;
 
@@ -697,12 +1053,12 @@ void RenderedTarget::calculatePos()
         setTransformOrigin(QQuickItem::TopLeft);
     else
         setTransformOrigin(QQuickItem::Center);
-
-    m_transformedHullDirty = true;
 }
 
 void RenderedTarget::calculateRotation()
 {
+    invalidateTransform();
+
     // Direction
     bool oldMirrorHorizontally = m_mirrorHorizontally;
 
@@ -728,26 +1084,72 @@ void RenderedTarget::calculateRotation()
 
     if (m_mirrorHorizontally != oldMirrorHorizontally)
         emit mirrorHorizontallyChanged();
-
-    m_transformedHullDirty = true;
 }
 
 void RenderedTarget::calculateSize()
 {
+    invalidateTransform();
+
     if (m_skin && m_costume) {
         GLuint oldTexture = m_cpuTexture.handle();
         bool wasValid = m_cpuTexture.isValid();
         m_texture = m_skin->getTexture(m_size * m_stageScale);
         m_cpuTexture = m_skin->getTexture(m_size);
-        m_width = m_texture.width();
-        m_height = m_texture.height();
+        m_skinTextureVersion = m_skin->textureVersion();
+        m_bakedCpuTexture = Texture();
+
+        // Use the size of the skin until the texture is available (e.g. while the costume is decoded in the background)
+        const QSize size = m_texture.isValid() ? m_texture.size() : m_skin->size();
+        m_width = size.width();
+        m_height = size.height();
         setScale(m_size * m_stageScale / m_skin->getTextureScale(m_texture) / m_costume->bitmapResolution());
 
         if (wasValid && m_cpuTexture.handle() != oldTexture)
             m_convexHullDirty = true;
+    }
+}
 
-        m_transformedHullDirty = true;
+bool RenderedTarget::claimCostume() const
+{
+    // Sensing needs the texture, so the costume is prepared now if it's still being prepared in the background (see SkinImageStore)
+    if (!m_skin || !m_costume || m_cpuTexture.isValid() || !m_skin->claimPendingCostume())
+        return false;
+
+    RenderedTarget *self = const_cast<RenderedTarget *>(this);
+    self->calculateSize();
+    self->calculatePos();
+    return true;
+}
+
+bool RenderedTarget::claimCostumes(const std::vector<IRenderedTarget *> &targets)
+{
+    bool claimed = false;
+
+    for (IRenderedTarget *target : targets) {
+        const RenderedTarget *renderedTarget = dynamic_cast<const RenderedTarget *>(target);
+
+        if (renderedTarget && renderedTarget->claimCostume())
+            claimed = true;
+    }
+
+    return claimed;
+}
+
+void RenderedTarget::invalidateTransform(bool positionOnly)
+{
+    // Cached transforms are recalculated when they're needed
+    m_transformVersion++;
+
+    if (!positionOnly) {
+        m_geometryVersion++;
+        m_transformedHullDirty = true; // transformed hull points don't depend on the position
     }
+
+    if (m_spatialIndex)
+        m_spatialIndex->invalidate(this);
+
+    if (m_stageComposite)
+        m_stageComposite->invalidate();
 }
 
 void RenderedTarget::handleSceneMouseMove(qreal x, qreal y)
@@ -775,13 +1177,13 @@ void RenderedTarget::updateHullPoints()
         return;
     }
 
-    textureManager()->getTextureConvexHullPoints(m_cpuTexture, m_skin->getTexture(1).size(), m_graphicEffectMask, m_graphicEffects, m_hullPoints);
+    textureManager()->getTextureConvexHullPoints(m_cpuTexture, m_skin->getTexture(1).size(), m_graphicEffects.mask(), m_graphicEffects, m_hullPoints);
 }
 
 const std::vector<QPointF> &RenderedTarget::transformedHullPoints() const
 {
     // https://github.com/scratchfoundation/scratch-render/blob/9fe90e8f4c2da35d4684359f84b69c264d884133/src/Drawable.js#L594-L616
-    if (!m_transformedHullDirty)
+    if (!m_transformedHullDirty && !convexHullPointsNeeded())
         return m_transformedHullPoints;
 
     m_transformedHullPoints.clear();
@@ -815,26 +1217,243 @@ const std::vector<QPointF> &RenderedTarget::transformedHullPoints() const
     return m_transformedHullPoints;
 }
 
-bool RenderedTarget::containsLocalPoint(const QPointF &point) const
+const std::vector<QPointF> &RenderedTarget::collisionHull() const
 {
-    return textureManager()->textureContainsPoint(m_cpuTexture, point, m_graphicEffectMask, m_graphicEffects);
+    // Returns a convex polygon with all points where containsScratchPoint() can return true (without shape-changing effects).
+    // Local coordinates are truncated, so the hull of the opaque texels is extended by 1 texel in each direction.
+    if (m_collisionHullVersion == m_geometryVersion)
+        return m_collisionHull;
+
+    m_collisionHullVersion = m_geometryVersion;
+    m_collisionHull.clear();
+
+    if (!m_engine || !m_skin || !m_costume || !m_cpuTexture.isValid())
+        return m_collisionHull;
+
+    std::vector<QPoint> points;
+    textureManager()->getTextureConvexHullPoints(m_cpuTexture, m_cpuTexture.size(), ShaderManager::Effect::NoEffect, {}, points);
+
+    bool invertible = false;
+    const QTransform localToScratch = scratchToLocalTransform().inverted(&invertible);
+
+    if (points.empty() || !invertible || !std::isfinite(localToScratch.determinant()))
+        return m_collisionHull;
+
+    // The hull is relative to the position, so it doesn't change when the target moves
+    const QPointF position(m_x, m_y);
+    std::vector<QPointF> corners;
+    corners.reserve(points.size() * 4);
+
+    for (const QPoint &point : points) {
+        corners.push_back(localToScratch.map(QPointF(point.x() - 1, point.y() - 1)) - position);
+        corners.push_back(localToScratch.map(QPointF(point.x() + 1, point.y() - 1)) - position);
+        corners.push_back(localToScratch.map(QPointF(point.x() + 1, point.y() + 1)) - position);
+        corners.push_back(localToScratch.map(QPointF(point.x() - 1, point.y() + 1)) - position);
+    }
+
+    ConvexHull::build(corners, m_collisionHull);
+    return m_collisionHull;
 }
 
-QPointF RenderedTarget::transformPoint(double scratchX, double scratchY, double originX, double originY, double rot) const
+bool RenderedTarget::hullsIntersect(const RenderedTarget *target, QRectF &dst) const
 {
-    return transformPoint(scratchX, scratchY, originX, originY, std::sin(rot), std::cos(rot));
+    // Returns false if the collision hulls don't intersect, dst is the bounding rectangle of the intersection (same format as in touchingBounds())
+    const QPointF offset(target->m_x - m_x, target->m_y - m_y);
+    QRectF bounds;
+
+    if (!ConvexHull::intersects(collisionHull(), target->collisionHull(), offset) || !ConvexHull::intersectionBounds(collisionHull(), target->collisionHull(), bounds, offset))
+        return false;
+
+    bounds.translate(m_x, m_y);
+    dst = QRect(QPoint(std::floor(bounds.left()), std::floor(bounds.top())), QPoint(std::ceil(bounds.right()), std::ceil(bounds.bottom())));
+    return true;
 }
 
-QPointF RenderedTarget::transformPoint(double scratchX, double scratchY, double originX, double originY, double sinRot, double cosRot) const
+bool RenderedTarget::containsLocalPoint(const QPointF &point) const
 {
-    const double x = (scratchX - originX) * cosRot - (scratchY - originY) * sinRot;
-    const double y = (scratchX - originX) * sinRot + (scratchY - originY) * cosRot;
-    return QPointF(x, y);
+    const Texture baked = bakedCpuTexture();
+
+    if (baked.isValid())
+        return EffectTextureCache::instance()->textureManager()->textureContainsPoint(baked, point, EffectTextureCache::remainingEffects(m_graphicEffects.mask()), m_graphicEffects);
+
+    return textureManager()->textureContainsPoint(m_cpuTexture, point, m_graphicEffects.mask(), m_graphicEffects);
 }
 
-QPointF RenderedTarget::mapFromStageWithOriginPoint(const QPointF &scenePoint) const
+void RenderedTarget::containsScratchRow(int y, int left, int right, char *dst) const
 {
-    // mapFromItem() doesn't use the transformOriginPoint property, so we must do this ourselves
+    // Same as containsScratchPoint() for each point of the row, but the effect transform is applied to all points at once.
+    // Local coordinates are calculated in the same way as in QTransform::map().
+    const int count = right - left + 1;
+
+    if (count <= 0)
+        return;
+
+    if (!m_engine || !m_skin || !m_costume) {
+        std::fill(dst, dst + count, false);
+        return;
+    }
+
+    const QTransform &transform = scratchToLocalTransform();
+    const double m11 = transform.m11();
+    const double m12 = transform.m12();
+    const double dx = transform.dx();
+    const double dy = transform.dy();
+    const double rowX = transform.m21() * y;
+    const double rowY = transform.m22() * y;
+    std::vector<int> texelX(count);
+    std::vector<int> texelY(count);
+
+    for (int i = 0; i < count; i++) {
+        const double x = left + i;
+        texelX[i] = m11 * x + rowX + dx;
+        texelY[i] = m12 * x + rowY + dy;
+    }
+
+    const Texture baked = bakedCpuTexture();
+
+    if (baked.isValid())
+        EffectTextureCache::instance()->textureManager()->textureContainsPoints(
+            baked,
+            texelX.data(),
+            texelY.data(),
+            count,
+            EffectTextureCache::remainingEffects(m_graphicEffects.mask()),
+            m_graphicEffects,
+            dst);
+    else
+        textureManager()->textureContainsPoints(m_cpuTexture, texelX.data(), texelY.data(), count, m_graphicEffects.mask(), m_graphicEffects, dst);
+}
+
+void RenderedTarget::colorAtScratchRow(int y, int left, int right, QRgb *dst) const
+{
+    // Same as colorAtScratchPoint() for each point of the row, but the effects are applied to all points at once (see containsScratchRow())
+    const int count = right - left + 1;
+
+    if (count <= 0)
+        return;
+
+    std::fill(dst, dst + count, qRgba(0, 0, 0, 0));
+
+    if (!m_engine || !m_cpuTexture.isValid())
+        return;
+
+    const QTransform &transform = scratchToLocalTransform();
+    const double m11 = transform.m11();
+    const double m12 = transform.m12();
+    const double dx = transform.dx();
+    const double dy = transform.dy();
+    const double rowX = transform.m21() * y;
+    const double rowY = transform.m22() * y;
+    const double width = m_cpuTexture.width();
+    const double height = m_cpuTexture.height();
+    std::vector<int> texelX;
+    std::vector<int> texelY;
+    std::vector<int> indices;
+    texelX.reserve(count);
+    texelY.reserve(count);
+    indices.reserve(count);
+
+    // Points outside the texture are transparent (only the other points are read)
+    for (int i = 0; i < count; i++) {
+        const double x = left + i;
+        const double localX = std::floor(m11 * x + rowX + dx);
+        const double localY = std::floor(m12 * x + rowY + dy);
+
+        if ((localX < 0 || localX >= width) || (localY < 0 || localY >= height))
+            continue;
+
+        texelX.push_back(localX);
+        texelY.push_back(localY);
+        indices.push_back(i);
+    }
+
+    if (indices.empty())
+        return;
+
+    std::vector<QRgb> colors(indices.size());
+    const Texture baked = bakedCpuTexture();
+
+    if (baked.isValid())
+        EffectTextureCache::instance()->textureManager()->getPointColors(
+            baked,
+            texelX.data(),
+            texelY.data(),
+            indices.size(),
+            EffectTextureCache::remainingEffects(m_graphicEffects.mask()),
+            m_graphicEffects,
+            colors.data());
+    else
+        textureManager()->getPointColors(m_cpuTexture, texelX.data(), texelY.data(), indices.size(), m_graphicEffects.mask(), m_graphicEffects, colors.data());
+
+    for (size_t i = 0; i < indices.size(); i++)
+        dst[indices[i]] = colors[i];
+}
+
+bool RenderedTarget::effectsBakeable() const
+{
+    return m_stableEffectFrames >= EFFECT_BAKE_FRAMES && (m_graphicEffects.mask() & EffectTextureCache::BAKED_EFFECTS) != 0;
+}
+
+Texture RenderedTarget::bakedCpuTexture() const
+{
+    // Returns an invalid texture if the effects aren't baked
+    if (!effectsBakeable() || !m_cpuTexture.isValid())
+        return Texture();
+
+    EffectTextureCache *cache = EffectTextureCache::instance();
+
+    if (m_bakedCpuTexture.isValid() && m_bakedCpuTextureGeneration == cache->generation())
+        return m_bakedCpuTexture;
+
+    // Textures can't be baked while other threads read this target (see prepareConcurrentReads())
+    if (CpuTextureManager::ConcurrentReads::active())
+        return Texture();
+
+    m_bakedCpuTexture = cache->getTexture(m_cpuTexture, m_graphicEffects);
+    m_bakedCpuTextureGeneration = cache->generation();
+    return m_bakedCpuTexture;
+}
+
+QPointF RenderedTarget::transformPoint(double scratchX, double scratchY, double originX, double originY, double rot) const
+{
+    return transformPoint(scratchX, scratchY, originX, originY, std::sin(rot), std::cos(rot));
+}
+
+QPointF RenderedTarget::transformPoint(double scratchX, double scratchY, double originX, double originY, double sinRot, double cosRot) const
+{
+    const double x = (scratchX - originX) * cosRot - (scratchY - originY) * sinRot;
+    const double y = (scratchX - originX) * sinRot + (scratchY - originY) * cosRot;
+    return QPointF(x, y);
+}
+
+QPointF RenderedTarget::mapFromStageWithOriginPoint(const QPointF &scenePoint) const
+{
+    // mapFromItem() doesn't use the transformOriginPoint property, so we must do this ourselves
+    updateLocalTransforms();
+    QPointF localPoint = m_stageToLocal.map(scenePoint);
+    return localPoint;
+}
+
+QPointF RenderedTarget::mapFromScratchToLocal(const QPointF &point) const
+{
+    QPointF localPoint = scratchToLocalTransform().map(point);
+    return localPoint;
+}
+
+const QTransform &RenderedTarget::scratchToLocalTransform() const
+{
+    updateLocalTransforms();
+    return m_scratchToLocal;
+}
+
+void RenderedTarget::updateLocalTransforms() const
+{
+    if (m_localTransformVersion == m_transformVersion)
+        return;
+
+    m_localTransformVersion = m_transformVersion;
+
+    // Stage (item coordinates of the parent) to local
     QTransform t;
     const double mirror = m_mirrorHorizontally ? -1 : 1;
     const double originX = transformOriginPoint().x();
@@ -844,25 +1463,241 @@ QPointF RenderedTarget::mapFromStageWithOriginPoint(const QPointF &scenePoint) c
     t.scale(1 / scale() * mirror, 1 / scale());
     t.translate(-originX * mirror, -originY);
     t.translate(-x(), -y());
+    m_stageToLocal = t;
 
-    QPointF localPoint = t.map(scenePoint);
-    return localPoint;
+    // Scratch coordinates to CPU texture coordinates
+    t.reset();
+
+    if (m_skin && m_costume) {
+        const double textureScale = m_skin->getTextureScale(m_cpuTexture);
+        const double scale = m_size / textureScale;
+        const double bitmapRes = m_costume->bitmapResolution();
+        t.translate(m_costume->rotationCenterX() * textureScale, m_costume->rotationCenterY() * textureScale);
+        t.rotate(-rotation());
+        t.scale(bitmapRes * mirror / scale, -bitmapRes / scale);
+        t.translate(-m_x, -m_y);
+    }
+
+    m_scratchToLocal = t;
 }
 
-QPointF RenderedTarget::mapFromScratchToLocal(const QPointF &point) const
+bool RenderedTarget::spansSupported() const
 {
-    QTransform t;
-    const double textureScale = m_skin->getTextureScale(m_cpuTexture);
-    const double scale = m_size / textureScale;
-    const double mirror = m_mirrorHorizontally ? -1 : 1;
-    const double bitmapRes = m_costume->bitmapResolution();
-    t.translate(m_costume->rotationCenterX() * textureScale, m_costume->rotationCenterY() * textureScale);
-    t.rotate(-rotation());
-    t.scale(bitmapRes * mirror / scale, -bitmapRes / scale);
-    t.translate(-m_x, -m_y);
+    // Shape-changing effects move texels, so the silhouette can't be used directly
+    return m_engine && m_skin && m_costume && m_cpuTexture.isValid() && ShaderManager::shapeChangingEffects(m_graphicEffects.mask()) == 0;
+}
 
-    QPointF localPoint = t.map(point);
-    return localPoint;
+void RenderedTarget::getOpaqueSpans(const QTransform &transform, int y, int left, int right, std::vector<std::pair<int, int>> &dst) const
+{
+    // Finds the ranges of x coordinates (inclusive) in the given row of the stage where this target is opaque.
+    // Texel coordinates are calculated in the same way as in QTransform::map() and containsLocalPoint(), so the result matches containsScratchPoint().
+    dst.clear();
+
+    if (left > right)
+        return;
+
+    const Silhouette *silhouette = textureManager()->getTextureSilhouette(m_cpuTexture);
+
+    if (!silhouette || silhouette->isNull())
+        return;
+
+    const int width = silhouette->width();
+    const int height = silhouette->height();
+    const double m11 = transform.m11();
+    const double m12 = transform.m12();
+    const double dx = transform.dx();
+    const double dy = transform.dy();
+    const double rowX = transform.m21() * y;
+    const double rowY = transform.m22() * y;
+
+    auto texelX = [m11, rowX, dx](int x) { return static_cast<int>(m11 * x + rowX + dx); };
+    auto texelY = [m12, rowY, dy](int x) { return static_cast<int>(m12 * x + rowY + dy); };
+
+    // Skip the parts of the row outside the texture (values in (-1, 0) are truncated to 0)
+    auto clip = [&left, &right](double a, double b, int size, int first) {
+        if (a == 0) {
+            const int texel = static_cast<int>(a * first + b);
+            return texel >= 0 && texel < size;
+        }
+
+        const double x1 = (-1 - b) / a;
+        const double x2 = (size - b) / a;
+        const double min = std::floor(std::min(x1, x2)) - 1;
+        const double max = std::ceil(std::max(x1, x2)) + 1;
+
+        if (min > right || max < left)
+            return false;
+
+        left = std::max(min, static_cast<double>(left));
+        right = std::min(max, static_cast<double>(right));
+        return left <= right;
+    };
+
+    if (!clip(m11, rowX + dx, width, left) || !clip(m12, rowY + dy, height, left))
+        return;
+
+    if (m12 == 0 && m11 != 0) {
+        // The texel row doesn't change in this stage row, so the runs of the silhouette can be mapped to the stage
+        const int row = texelY(left);
+
+        if (row < 0 || row >= height)
+            return;
+
+        // Finds the first x for which pred() is true (pred() must be monotonic)
+        auto lowerBound = [left, right](auto pred) {
+            int lo = left;
+            int hi = right + 1;
+
+            while (lo < hi) {
+                const int mid = lo + (hi - lo) / 2;
+
+                if (pred(mid))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+
+            return lo;
+        };
+
+        const std::vector<Silhouette::Run> &runs = silhouette->runs(row);
+        const int count = runs.size();
+
+        for (int i = 0; i < count; i++) {
+            // Runs are mapped in reverse order if the texture is mirrored
+            const Silhouette::Run &run = runs[m11 > 0 ? i : count - 1 - i];
+            int start, end;
+
+            if (m11 > 0) {
+                start = lowerBound([&](int x) { return texelX(x) >= run.start; });
+                end = lowerBound([&](int x) { return texelX(x) >= run.end; }) - 1;
+            } else {
+                start = lowerBound([&](int x) { return texelX(x) < run.end; });
+                end = lowerBound([&](int x) { return texelX(x) < run.start; }) - 1;
+            }
+
+            if (start <= end)
+                dst.push_back({ start, end });
+        }
+    } else {
+        // Rotated texture: check each point
+        int start = 0;
+        bool inSpan = false;
+
+        for (int x = left; x <= right; x++) {
+            if (silhouette->contains(texelX(x), texelY(x))) {
+                if (!inSpan) {
+                    start = x;
+                    inSpan = true;
+                }
+            } else if (inSpan) {
+                dst.push_back({ start, x - 1 });
+                inSpan = false;
+            }
+        }
+
+        if (inSpan)
+            dst.push_back({ start, right });
+    }
+}
+
+bool RenderedTarget::touchingSpans(const QRectF &rect, const std::vector<const RenderedTarget *> &candidates) const
+{
+    // Same points as in the per-point loop in touchingClones()
+    const int left = rect.left();
+    const int right = std::floor(rect.right());
+    const int top = rect.top();
+    const int bottom = std::floor(rect.bottom());
+    const QTransform &transform = scratchToLocalTransform();
+    std::vector<const RenderedTarget *> spanCandidates;
+    std::vector<QTransform> candidateTransforms;
+    spanCandidates.reserve(candidates.size());
+    candidateTransforms.reserve(candidates.size());
+
+    // Targets which aren't rotated or scaled and are at integer positions are compared word by word using their silhouettes
+    int dx, dy;
+    const Silhouette *silhouette = texelOffset(transform, dx, dy) ? textureManager()->getTextureSilhouette(m_cpuTexture) : nullptr;
+    const QRect texelRect(QPoint(left + dx, dy - bottom), QPoint(right + dx, dy - top));
+
+    for (const RenderedTarget *candidate : candidates) {
+        const QTransform &candidateTransform = candidate->scratchToLocalTransform();
+        int candidateDx, candidateDy;
+
+        if (silhouette && texelOffset(candidateTransform, candidateDx, candidateDy)) {
+            const Silhouette *candidateSilhouette = candidate->textureManager()->getTextureSilhouette(candidate->m_cpuTexture);
+
+            if (candidateSilhouette && silhouette->intersects(*candidateSilhouette, dx - candidateDx, dy - candidateDy, texelRect))
+                return true;
+
+            continue;
+        }
+
+        spanCandidates.push_back(candidate);
+        candidateTransforms.push_back(candidateTransform);
+    }
+
+    if (spanCandidates.empty())
+        return false;
+
+    CpuTextureStore::PinnedTextures pins;
+    prepareConcurrentReads(false, pins);
+
+    for (const RenderedTarget *candidate : spanCandidates)
+        candidate->prepareConcurrentReads(false, pins);
+
+    return scanRows(top, bottom, right - left + 1, true, [&](int top, int bottom, const std::atomic<bool> &cancel) {
+        std::vector<std::pair<int, int>> spans;
+        std::vector<std::pair<int, int>> candidateSpans;
+
+        for (int y = top; y <= bottom && !cancel; y++) {
+            getOpaqueSpans(transform, y, left, right, spans);
+
+            if (spans.empty())
+                continue;
+
+            for (size_t i = 0; i < spanCandidates.size(); i++) {
+                spanCandidates[i]->getOpaqueSpans(candidateTransforms[i], y, spans.front().first, spans.back().second, candidateSpans);
+
+                if (spansIntersect(spans, candidateSpans))
+                    return true;
+            }
+        }
+
+        return false;
+    });
+}
+
+bool RenderedTarget::texelOffset(const QTransform &transform, int &dx, int &dy)
+{
+    // Returns true if the transform maps Scratch points to texels (x + dx, dy - y), i.e. the target isn't rotated,
+    // mirrored or scaled and it's at an integer position (texels can be compared using Silhouette::intersects() then)
+    if (transform.m11() != 1 || transform.m12() != 0 || transform.m21() != 0 || transform.m22() != -1)
+        return false;
+
+    if (transform.dx() != std::floor(transform.dx()) || transform.dy() != std::floor(transform.dy()))
+        return false;
+
+    dx = transform.dx();
+    dy = transform.dy();
+    return true;
+}
+
+bool RenderedTarget::spansIntersect(const std::vector<std::pair<int, int>> &a, const std::vector<std::pair<int, int>> &b)
+{
+    // Both lists must be sorted
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < a.size() && j < b.size()) {
+        if (a[i].second < b[j].first)
+            i++;
+        else if (b[j].second < a[i].first)
+            j++;
+        else
+            return true;
+    }
+
+    return false;
 }
 
 CpuTextureManager *RenderedTarget::textureManager() const
@@ -873,45 +1708,189 @@ CpuTextureManager *RenderedTarget::textureManager() const
     return m_textureManager.get();
 }
 
+void RenderedTarget::prepareConcurrentReads(bool colors, CpuTextureStore::PinnedTextures &pins) const
+{
+    // Everything which is created on demand must exist before other threads read this target (see scanRows()).
+    // The textures are pinned, so that preparing other targets doesn't evict them.
+    scratchToLocalTransform();
+    getFastBounds();
+    CpuTextureManager *manager = textureManager();
+    pins.add(m_cpuTexture);
+    const Silhouette *silhouette = manager->getTextureSilhouette(m_cpuTexture);
+
+    if (silhouette && !silhouette->isNull())
+        silhouette->runs(0);
+
+    if (colors)
+        manager->getTextureData(m_cpuTexture);
+
+    const Texture baked = bakedCpuTexture();
+
+    if (baked.isValid()) {
+        manager = EffectTextureCache::instance()->textureManager();
+        pins.add(baked);
+        silhouette = manager->getTextureSilhouette(baked);
+
+        if (silhouette && !silhouette->isNull())
+            silhouette->runs(0);
+
+        if (colors)
+            manager->getTextureData(baked);
+    }
+}
+
+bool RenderedTarget::scanRows(int top, int bottom, int width, bool concurrent, const std::function<bool(int, int, const std::atomic<bool> &)> &scanBand)
+{
+    // Calls scanBand() for bands of rows (inclusive) and returns true if it returns true for any band.
+    // Large rectangles are split into bands which are scanned by idle threads of the global thread pool,
+    // scanBand() should stop when cancel is set (another band has been found).
+    // NOTE: Everything read by scanBand() must be prepared by the calling thread (see prepareConcurrentReads()).
+    std::atomic<bool> found = false;
+    const int rows = bottom - top + 1;
+
+    if (rows <= 0)
+        return false;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int threadCount = pool->maxThreadCount();
+
+    if (!concurrent || threadCount < 2 || rows < MIN_BAND_ROWS * 2 || static_cast<long long>(rows) * width < m_parallelScanThreshold)
+        return scanBand(top, bottom, found);
+
+    // Threads take the bands one by one, so that threads with cheap bands scan more of them
+    const int bandRows = std::max(MIN_BAND_ROWS, rows / (threadCount * 4));
+    const int bandCount = (rows + bandRows - 1) / bandRows;
+    std::atomic<int> nextBand = 0;
+
+    auto scan = [&]() {
+        int band;
+
+        while (!found && (band = nextBand++) < bandCount) {
+            const int bandTop = top + band * bandRows;
+
+            if (scanBand(bandTop, std::min(bandTop + bandRows - 1, bottom), found))
+                found = true;
+        }
+    };
+
+    // Textures can't be read by the CPU texture managers until all threads finish
+    CpuTextureManager::ConcurrentReads concurrentReads;
+    QSemaphore finished;
+    int workerCount = 0;
+
+    auto worker = [&scan, &finished]() {
+        scan();
+        finished.release();
+    };
+
+    // Don't wait for busy threads (e.g. project loading), this thread scans the remaining bands
+    for (int i = 1; i < std::min(threadCount, bandCount); i++) {
+        if (!pool->tryStart(worker))
+            break;
+
+        workerCount++;
+    }
+
+    scan();
+    finished.acquire(workerCount);
+    return found;
+}
+
 bool RenderedTarget::touchingColor(Rgb color, bool hasMask, Rgb mask) const
+{
+    // Results are reused until the scene changes (the composite knows whether all targets invalidate it)
+    const QueryKind kind = hasMask ? QueryKind::TouchingColorMask : QueryKind::TouchingColor;
+    bool touching;
+
+    if (m_stageComposite && m_stageComposite->supported() && findQueryResult(kind, color, mask, {}, touching))
+        return touching;
+
+    touching = checkTouchingColor(color, hasMask, mask);
+
+    if (m_stageComposite && m_stageComposite->supported())
+        addQueryResult(kind, color, mask, {}, touching);
+
+    return touching;
+}
+
+bool RenderedTarget::checkTouchingColor(Rgb color, bool hasMask, Rgb mask) const
 {
     // https://github.com/scratchfoundation/scratch-render/blob/0a04c2fb165f5c20406ec34ab2ea5682ae45d6e0/src/RenderWebGL.js#L775-L841
     if (!m_engine)
         return false;
 
+    claimCostume();
     QRgb rgb = qRgb(qRed(color), qGreen(color), qBlue(color)); // ignore alpha
     QRgb mask3b;
-    double ghostValue = 0;
+    const EffectState effects = m_graphicEffects;
 
     if (hasMask) {
         // Ignore ghost effect when checking mask
-        if ((m_graphicEffectMask & ShaderManager::Effect::Ghost) != 0) {
-            ghostValue = m_graphicEffects[ShaderManager::Effect::Ghost];
-            m_graphicEffects.erase(ShaderManager::Effect::Ghost);
-            m_graphicEffectMask &= ~ShaderManager::Effect::Ghost;
-        }
-
+        m_graphicEffects.setValue(ShaderManager::Effect::Ghost, 0);
         mask3b = qRgb(qRed(mask), qGreen(mask), qBlue(mask)); // ignore alpha
     }
 
+    auto restoreGhost = [this, &effects]() {
+        // Restore ghost effect value
+        m_graphicEffects = effects;
+    };
+
+    QRectF myRect = touchingBounds();
+    bool touching;
+
+    // Use the cached composite of the other layers if the scene hasn't changed
+    if (!m_gpuQueriesEnabled && m_stageComposite && touchingColorComposite(myRect, rgb, hasMask, mask3b, touching)) {
+        restoreGhost();
+        return touching;
+    }
+
     std::vector<Target *> targets;
     m_engine->getVisibleTargets(targets);
 
-    QRectF myRect = touchingBounds();
     std::vector<IRenderedTarget *> candidates;
     QRectF bounds = candidatesBounds(myRect, targets, candidates);
 
+    if (claimCostumes(candidates))
+        bounds = candidatesBounds(myRect, targets, candidates);
+
     if (colorMatches(rgb, qRgb(255, 255, 255))) {
         // The color we're checking for is the background color which spans the entire stage
         bounds = myRect;
 
-        if (bounds.isEmpty())
+        if (bounds.isEmpty()) {
+            restoreGhost();
             return false;
+        }
     } else if (candidates.empty()) {
         // If not checking for the background color, we can return early if there are no candidate drawables
+        restoreGhost();
         return false;
     }
 
+    if (m_gpuQueriesEnabled && touchingColorGpu(bounds, rgb, hasMask, mask3b, candidates, touching)) {
+        restoreGhost();
+        return touching;
+    }
+
+    // Colors of real targets are read row by row
+    std::vector<const RenderedTarget *> renderedTargets;
+    renderedTargets.reserve(candidates.size());
+
+    for (IRenderedTarget *candidate : candidates) {
+        const RenderedTarget *target = dynamic_cast<const RenderedTarget *>(candidate);
+
+        if (!target)
+            break;
+
+        renderedTargets.push_back(target);
+    }
+
+    if (renderedTargets.size() == candidates.size()) {
+        touching = touchingColorRows(bounds, rgb, hasMask, mask3b, renderedTargets);
+        restoreGhost();
+        return touching;
+    }
+
     // Loop through the points of the union
     for (int y = bounds.top(); y <= bounds.bottom(); y++) {
         for (int x = bounds.left(); x <= bounds.right(); x++) {
@@ -919,27 +1898,432 @@ bool RenderedTarget::touchingColor(Rgb color, bool hasMask, Rgb mask) const
                 QRgb pixelColor = sampleColor3b(x, y, candidates);
 
                 if (colorMatches(rgb, pixelColor)) {
-                    // Restore ghost effect value
-                    if (hasMask && ghostValue != 0) {
-                        m_graphicEffects[ShaderManager::Effect::Ghost] = ghostValue;
-                        m_graphicEffectMask |= ShaderManager::Effect::Ghost;
-                    }
+                    restoreGhost();
+                    return true;
+                }
+            }
+        }
+    }
+
+    restoreGhost();
+    return false;
+}
+
+bool RenderedTarget::touchingColorRows(const QRectF &bounds, QRgb color, bool hasMask, QRgb mask, const std::vector<const RenderedTarget *> &candidates) const
+{
+    // Same as the loop in checkTouchingColor(), but the points of this target and the colors of the candidates are read for whole rows
+    const int left = bounds.left();
+    const int right = std::floor(bounds.right());
+    const int width = right - left + 1;
+
+    if (width <= 0)
+        return false;
+
+    std::vector<char> inside(width);
+    std::vector<QRgb> colors(width);
+
+    for (int y = bounds.top(); y <= bounds.bottom(); y++) {
+        if (hasMask) {
+            colorAtScratchRow(y, left, right, colors.data());
+
+            for (int i = 0; i < width; i++)
+                inside[i] = maskMatches(colors[i], mask);
+        } else
+            containsScratchRow(y, left, right, inside.data());
+
+        // Only the part of the row between the first and the last point is sampled
+        const auto first = std::find(inside.begin(), inside.end(), 1);
+
+        if (first == inside.end())
+            continue;
+
+        const int firstIndex = first - inside.begin();
+        const int lastIndex = width - 1 - (std::find(inside.rbegin(), inside.rend(), 1) - inside.rbegin());
+        sampleColorRow(y, left + firstIndex, left + lastIndex, inside.data() + firstIndex, candidates, colors.data());
+
+        for (int i = 0; i <= lastIndex - firstIndex; i++) {
+            if (inside[firstIndex + i] && colorMatches(color, colors[i]))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool RenderedTarget::touchingColorComposite(const QRectF &rect, QRgb color, bool hasMask, QRgb mask, bool &dst) const
+{
+    // Returns false if the composite can't be used (targets which aren't RenderedTarget don't invalidate it)
+    if (!m_stageComposite->targetsValid()) {
+        // Visible targets are only read once per scene version
+        std::vector<Target *> targets;
+        m_engine->getVisibleTargets(targets);
+
+        std::vector<IRenderedTarget *> renderedTargets;
+        renderedTargets.reserve(targets.size());
+        bool supported = !m_penLayer || dynamic_cast<PenLayer *>(m_penLayer);
 
+        for (Target *target : targets) {
+            IRenderedTarget *renderedTarget = renderedTargetOf(target);
+
+            if (renderedTarget) {
+                renderedTargets.push_back(renderedTarget);
+                supported &= (dynamic_cast<RenderedTarget *>(renderedTarget) != nullptr);
+            }
+        }
+
+        // Claiming pending costumes invalidates the composite, so it's done before the targets are set
+        claimCostumes(renderedTargets);
+        m_stageComposite->setTargets(renderedTargets, supported);
+    }
+
+    if (!m_stageComposite->supported())
+        return false;
+
+    const int tileSize = StageComposite::TILE_SIZE;
+    const int left = rect.left();
+    const int right = std::floor(rect.right());
+    const int top = rect.top();
+    const int bottom = std::floor(rect.bottom());
+    dst = false;
+
+    if (left > right || top > bottom)
+        return true;
+
+    const int width = right - left + 1;
+
+    if (static_cast<long long>(width) * (bottom - top + 1) >= m_parallelScanThreshold) {
+        dst = touchingColorCompositeConcurrent(left, right, top, bottom, color, hasMask, mask);
+        return true;
+    }
+
+    // Loop through the points of the rectangle (points outside of other targets are white)
+    int tileX = 0;
+    int tileY = 0;
+    const QRgb *tile = nullptr;
+    std::vector<char> inside(width);
+    std::vector<QRgb> colors(hasMask ? width : 0);
+
+    for (int y = top; y <= bottom; y++) {
+        if (hasMask) {
+            colorAtScratchRow(y, left, right, colors.data());
+
+            for (int i = 0; i < width; i++)
+                inside[i] = maskMatches(colors[i], mask);
+        } else
+            containsScratchRow(y, left, right, inside.data());
+
+        for (int x = left; x <= right; x++) {
+            if (inside[x - left]) {
+                const int pointTileX = StageComposite::tileCoord(x);
+                const int pointTileY = StageComposite::tileCoord(y);
+
+                if (!tile || pointTileX != tileX || pointTileY != tileY) {
+                    tileX = pointTileX;
+                    tileY = pointTileY;
+                    tile = m_stageComposite->tile(this, tileX, tileY);
+
+                    if (!tile)
+                        tile = buildCompositeTile(tileX, tileY);
+                }
+
+                if (colorMatches(color, tile[(y - tileY * tileSize) * tileSize + x - tileX * tileSize])) {
+                    dst = true;
                     return true;
                 }
             }
         }
     }
 
-    // Restore ghost effect value
-    if (hasMask && ghostValue != 0) {
-        m_graphicEffects[ShaderManager::Effect::Ghost] = ghostValue;
-        m_graphicEffectMask |= ShaderManager::Effect::Ghost;
+    return true;
+}
+
+bool RenderedTarget::touchingColorCompositeConcurrent(int left, int right, int top, int bottom, QRgb color, bool hasMask, QRgb mask) const
+{
+    // Finds the points of this target first, then builds the missing tiles and compares the colors (each step uses multiple threads)
+    CpuTextureStore::PinnedTextures pins;
+    prepareConcurrentReads(hasMask, pins);
+    const int tileSize = StageComposite::TILE_SIZE;
+    const int width = right - left + 1;
+    std::vector<char> inside(width * (bottom - top + 1));
+
+    scanRows(top, bottom, width, true, [&](int bandTop, int bandBottom, const std::atomic<bool> &) {
+        std::vector<QRgb> colors(hasMask ? width : 0);
+
+        for (int y = bandTop; y <= bandBottom; y++) {
+            char *row = inside.data() + (y - top) * width;
+
+            if (hasMask) {
+                colorAtScratchRow(y, left, right, colors.data());
+
+                for (int x = left; x <= right; x++)
+                    row[x - left] = maskMatches(colors[x - left], mask);
+            } else
+                this->containsScratchRow(y, left, right, row);
+        }
+
+        return false;
+    });
+
+    // Get the tiles with points of this target
+    const int firstTileX = StageComposite::tileCoord(left);
+    const int firstTileY = StageComposite::tileCoord(top);
+    const int tileColumns = StageComposite::tileCoord(right) - firstTileX + 1;
+    const int tileRows = StageComposite::tileCoord(bottom) - firstTileY + 1;
+    std::vector<const QRgb *> tiles(tileColumns * tileRows, nullptr);
+    std::vector<std::pair<QRgb *, QPoint>> missingTiles;
+
+    for (int i = 0; i < tileRows; i++) {
+        const int tileY = firstTileY + i;
+        const int tileTop = std::max(top, tileY * tileSize);
+        const int tileBottom = std::min(bottom, tileY * tileSize + tileSize - 1);
+
+        for (int j = 0; j < tileColumns; j++) {
+            const int tileX = firstTileX + j;
+            const int tileLeft = std::max(left, tileX * tileSize) - left;
+            const int tileRight = std::min(right, tileX * tileSize + tileSize - 1) - left;
+            bool used = false;
+
+            for (int y = tileTop; y <= tileBottom && !used; y++) {
+                const char *row = inside.data() + (y - top) * width;
+                used = std::find(row + tileLeft, row + tileRight + 1, 1) != row + tileRight + 1;
+            }
+
+            if (!used)
+                continue;
+
+            const QRgb *tile = m_stageComposite->tile(this, tileX, tileY);
+
+            if (!tile) {
+                QRgb *newTile = m_stageComposite->addTile(this, tileX, tileY);
+                missingTiles.push_back({ newTile, QPoint(tileX, tileY) });
+                tile = newTile;
+            }
+
+            tiles[i * tileColumns + j] = tile;
+        }
+    }
+
+    if (!missingTiles.empty()) {
+        for (IRenderedTarget *target : m_stageComposite->targets())
+            static_cast<RenderedTarget *>(target)->prepareConcurrentReads(true, pins); // all targets are RenderedTarget (see touchingColorComposite())
+
+        // The pen layer is prepared last, so nothing can evict its texture before the tiles are built
+        if (m_penLayer)
+            m_penLayer->colorAtScratchPoint(0, 0); // updates the texture of the pen layer
+    }
+
+    // Each missing tile is a row
+    scanRows(0, static_cast<int>(missingTiles.size()) - 1, tileSize * tileSize, true, [this, &missingTiles](int first, int last, const std::atomic<bool> &) {
+        for (int i = first; i <= last; i++)
+            fillCompositeTile(missingTiles[i].first, missingTiles[i].second.x(), missingTiles[i].second.y());
+
+        return false;
+    });
+
+    return scanRows(top, bottom, width, true, [&](int bandTop, int bandBottom, const std::atomic<bool> &cancel) {
+        for (int y = bandTop; y <= bandBottom && !cancel; y++) {
+            const char *row = inside.data() + (y - top) * width;
+            const int tileY = StageComposite::tileCoord(y);
+            const QRgb *const *tileRow = tiles.data() + (tileY - firstTileY) * tileColumns;
+
+            for (int x = left; x <= right; x++) {
+                if (row[x - left]) {
+                    const int tileX = StageComposite::tileCoord(x);
+                    const QRgb *tile = tileRow[tileX - firstTileX];
+
+                    if (colorMatches(color, tile[(y - tileY * tileSize) * tileSize + x - tileX * tileSize]))
+                        return true;
+                }
+            }
+        }
+
+        return false;
+    });
+}
+
+const QRgb *RenderedTarget::buildCompositeTile(int tileX, int tileY) const
+{
+    QRgb *tile = m_stageComposite->addTile(this, tileX, tileY);
+    fillCompositeTile(tile, tileX, tileY);
+    return tile;
+}
+
+void RenderedTarget::fillCompositeTile(QRgb *tile, int tileX, int tileY) const
+{
+    // Blends the colors of all targets except this one
+    const int tileSize = StageComposite::TILE_SIZE;
+    const int left = tileX * tileSize;
+    const int bottom = tileY * tileSize;
+    const QRectF tileRect(left - 1, bottom - 1, tileSize + 2, tileSize + 2);
+    std::vector<const RenderedTarget *> candidates;
+
+    // All targets of the composite are RenderedTarget (see touchingColorComposite())
+    for (IRenderedTarget *target : m_stageComposite->targets()) {
+        if (target != this && !candidateIntersection(tileRect, target).isEmpty())
+            candidates.push_back(static_cast<const RenderedTarget *>(target));
+    }
+
+    const std::vector<char> inside(tileSize, 1);
+
+    for (int y = 0; y < tileSize; y++)
+        sampleColorRow(bottom + y, left, left + tileSize - 1, inside.data(), candidates, tile + y * tileSize);
+}
+
+bool RenderedTarget::touchingColorGpu(const QRectF &bounds, QRgb color, bool hasMask, QRgb mask, const std::vector<IRenderedTarget *> &candidates, bool &dst) const
+{
+    // Returns false if the query can't be rendered exactly like on the CPU (the CPU is used in that case).
+    // Only whole-texel mappings (see texelOffset()) of opaque or fully transparent texels without effects are rendered.
+    // Transformed points and blended colors are rounded differently on the GPU, so anything else could give different results.
+    if (!m_skin || !m_costume || !m_cpuTexture.isValid())
+        return false;
+
+    // The ghost effect doesn't affect the silhouette (and it's already removed when checking the mask)
+    GpuQueryRenderer::Drawable me = { m_cpuTexture, scratchToLocalTransform(), m_graphicEffects };
+    me.effects.setValue(ShaderManager::Effect::Ghost, 0);
+    int dx, dy;
+
+    if (!texelOffset(me.scratchToLocal, dx, dy) || me.effects.mask() != 0)
+        return false;
+
+    if (hasMask) {
+        // The colors of this target are compared with the mask
+        const Silhouette *silhouette = textureManager()->getTextureSilhouette(m_cpuTexture);
+
+        if (!silhouette || silhouette->hasPartialAlpha())
+            return false;
+    }
+
+    const PenLayer *penLayer = nullptr;
+
+    if (m_penLayer) {
+        penLayer = dynamic_cast<const PenLayer *>(m_penLayer);
+
+        if (!penLayer || penLayer->hasPartialAlpha())
+            return false;
+    }
+
+    // Check candidates (other implementations of IRenderedTarget can't be drawn)
+    std::vector<const RenderedTarget *> targets;
+    targets.reserve(candidates.size());
+    bool hasStage = false;
+
+    for (IRenderedTarget *candidate : candidates) {
+        const RenderedTarget *target = dynamic_cast<const RenderedTarget *>(candidate);
+
+        if (!target)
+            return false;
+
+        if (target->m_engine && target->m_cpuTexture.isValid()) {
+            const Silhouette *silhouette = target->textureManager()->getTextureSilhouette(target->m_cpuTexture);
+
+            if (!texelOffset(target->scratchToLocalTransform(), dx, dy) || target->m_graphicEffects.mask() != 0 || !silhouette || silhouette->hasPartialAlpha())
+                return false;
+        }
+
+        targets.push_back(target);
+        hasStage |= (target->m_stageModel != nullptr);
+    }
+
+    // The pen layer is right above the stage (see sampleColor3b())
+    std::vector<GpuQueryRenderer::Drawable> drawables;
+    drawables.reserve(candidates.size() + 1);
+
+    QOpenGLFramebufferObject *penFbo = penLayer ? penLayer->framebufferObject() : nullptr;
+    QTransform penTransform;
+
+    if (penFbo) {
+        const double scale = penFbo->width() / static_cast<double>(m_engine->stageWidth());
+        penTransform = QTransform(scale, 0, 0, -scale, penFbo->width() / 2.0, penFbo->height() / 2.0);
+
+        if (!texelOffset(penTransform, dx, dy)) // HQ pen
+            return false;
+    }
+
+    auto addPenLayer = [penFbo, &penTransform, &drawables]() {
+        if (penFbo)
+            drawables.push_back({ Texture(penFbo->texture(), penFbo->size()), penTransform, {} });
+    };
+
+    if (!hasStage)
+        addPenLayer();
+
+    // Candidates are sorted from front to back
+    for (auto it = targets.rbegin(); it != targets.rend(); it++) {
+        const RenderedTarget *target = *it;
+
+        if (target->m_engine && target->m_cpuTexture.isValid())
+            drawables.push_back({ target->m_cpuTexture, target->scratchToLocalTransform(), target->m_graphicEffects });
+
+        if (target->m_stageModel)
+            addPenLayer();
+    }
+
+    const QRect rect(QPoint(bounds.left(), bounds.top()), QPoint(std::floor(bounds.right()), std::floor(bounds.bottom())));
+    std::vector<GLubyte> pixels;
+
+    if (!GpuQueryRenderer::render(rect, me, hasMask ? GpuQueryRenderer::StencilMode::ColorMask : GpuQueryRenderer::StencilMode::Silhouette, mask, drawables, pixels))
+        return false;
+
+    dst = false;
+
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        // Pixels outside the target are transparent
+        if (pixels[i + 3] != 0 && colorMatches(color, qRgb(pixels[i], pixels[i + 1], pixels[i + 2]))) {
+            dst = true;
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool RenderedTarget::clonesCacheable(const std::vector<libscratchcpp::Sprite *> &clones) const
+{
+    // Results can be cached if all targets invalidate the composite of this project
+    if (!m_stageComposite)
+        return false;
+
+    for (Sprite *clone : clones) {
+        SpriteModel *model = clone ? static_cast<SpriteModel *>(clone->getInterface()) : nullptr;
+        const RenderedTarget *target = model ? dynamic_cast<const RenderedTarget *>(model->renderedTarget()) : nullptr;
+
+        if (!target || target->m_stageComposite != m_stageComposite)
+            return false;
+    }
+
+    return true;
+}
+
+bool RenderedTarget::findQueryResult(QueryKind kind, Rgb color, Rgb mask, const std::vector<libscratchcpp::Sprite *> &clones, bool &dst) const
+{
+    const unsigned int sceneVersion = m_stageComposite->version();
+
+    for (const QueryResult &result : m_queryResults) {
+        if (result.kind == kind && result.color == color && result.mask == mask && result.transformVersion == m_transformVersion && result.sceneVersion == sceneVersion && result.clones == clones) {
+            m_queryCacheHits++;
+            dst = result.result;
+            return true;
+        }
     }
 
     return false;
 }
 
+void RenderedTarget::addQueryResult(QueryKind kind, Rgb color, Rgb mask, const std::vector<libscratchcpp::Sprite *> &clones, bool result) const
+{
+    const unsigned int sceneVersion = m_stageComposite->version();
+    m_queryCacheMisses++;
+
+    // Remove outdated results
+    auto outdated = [this, sceneVersion](const QueryResult &result) { return result.transformVersion != m_transformVersion || result.sceneVersion != sceneVersion; };
+    m_queryResults.erase(std::remove_if(m_queryResults.begin(), m_queryResults.end(), outdated), m_queryResults.end());
+
+    if (m_queryResults.size() >= MAX_QUERY_RESULTS)
+        m_queryResults.erase(m_queryResults.begin());
+
+    m_queryResults.push_back({ kind, color, mask, clones, m_transformVersion, sceneVersion, result });
+}
+
 QRectF RenderedTarget::touchingBounds() const
 {
     // https://github.com/scratchfoundation/scratch-render/blob/0a04c2fb165f5c20406ec34ab2ea5682ae45d6e0/src/RenderWebGL.js#L1330-L1350
@@ -963,35 +2347,38 @@ QRectF RenderedTarget::candidatesBounds(const QRectF &targetRect, const std::vec
     QRectF united;
     dst.clear();
 
-    for (auto candidate : candidates) {
-        Q_ASSERT(candidate);
+    if (m_spatialIndex && m_spatialIndex->visibleCount() == candidates.size()) {
+        // All visible targets are indexed, so only the targets returned by the index have to be checked
+        const auto &results = m_spatialIndex->query(targetRect);
 
-        if (!candidate)
-            continue;
+        for (const SpatialIndex::Result &result : results) {
+            if (result.visible && result.target != this) {
+                united = united.united(rectIntersection(targetRect, result.bounds));
+                dst.push_back(result.target);
+            }
+        }
 
-        IRenderedTarget *target = nullptr;
+        // Keep the order of the visible targets (front to back, the stage is the last one)
+        std::stable_sort(dst.begin(), dst.end(), [](IRenderedTarget *a, IRenderedTarget *b) {
+            const bool aStage = a->stageModel();
+            const bool bStage = b->stageModel();
+            return aStage != bStage ? bStage : a->z() > b->z();
+        });
+    } else {
+        if (m_spatialIndex)
+            m_spatialIndex->query(targetRect);
 
-        if (candidate->isStage()) {
-            Stage *stage = static_cast<Stage *>(candidate);
-            StageModel *model = static_cast<StageModel *>(stage->getInterface());
-            Q_ASSERT(model);
+        for (auto candidate : candidates) {
+            Q_ASSERT(candidate);
 
-            if (model)
-                target = model->renderedTarget();
-        } else {
-            Sprite *sprite = static_cast<Sprite *>(candidate);
-            SpriteModel *model = static_cast<SpriteModel *>(sprite->getInterface());
-            Q_ASSERT(model);
+            if (!candidate)
+                continue;
 
-            if (model)
-                target = model->renderedTarget();
-        }
-
-        Q_ASSERT(target);
+            IRenderedTarget *target = renderedTargetOf(candidate);
+            Q_ASSERT(target);
 
-        if (target && target != this) {
-            united = united.united(candidateIntersection(targetRect, target));
-            dst.push_back(target);
+            if (target && target != this && addCandidate(targetRect, target, united))
+                dst.push_back(target);
         }
     }
 
@@ -1007,6 +2394,29 @@ QRectF RenderedTarget::candidatesBounds(const QRectF &targetRect, const std::vec
     QRectF united;
     dst.clear();
 
+    // Clones of a sprite are in the same group (see cloneGroup())
+    const void *group = nullptr;
+
+    if (!candidates.empty() && candidates.front())
+        group = cloneGroup(static_cast<SpriteModel *>(candidates.front()->getInterface()));
+
+    if (m_spatialIndex && group && m_spatialIndex->visibleGroupSize(group) == candidates.size()) {
+        // All visible clones are indexed (only visible clones are passed), so only the targets returned by the index have to be checked
+        const auto &results = m_spatialIndex->query(targetRect);
+
+        for (const SpatialIndex::Result &result : results) {
+            if (result.visible && result.group == group && result.target != this) {
+                united = united.united(rectIntersection(targetRect, result.bounds));
+                dst.push_back(result.target);
+            }
+        }
+
+        return united;
+    }
+
+    if (m_spatialIndex)
+        m_spatialIndex->query(targetRect);
+
     for (auto candidate : candidates) {
         Q_ASSERT(candidate);
 
@@ -1022,15 +2432,60 @@ QRectF RenderedTarget::candidatesBounds(const QRectF &targetRect, const std::vec
 
         Q_ASSERT(target);
 
-        if (target && target != this) {
-            united = united.united(candidateIntersection(targetRect, target));
+        if (target && target != this && addCandidate(targetRect, target, united))
             dst.push_back(target);
-        }
     }
 
     return united;
 }
 
+const void *RenderedTarget::cloneGroup(SpriteModel *model)
+{
+    // Returns the spatial index group of the sprite and its clones
+    if (!model)
+        return nullptr;
+
+    SpriteModel *cloneRoot = model->cloneRoot();
+    return cloneRoot ? cloneRoot : model;
+}
+
+IRenderedTarget *RenderedTarget::renderedTargetOf(Target *target)
+{
+    if (target->isStage()) {
+        Stage *stage = static_cast<Stage *>(target);
+        StageModel *model = static_cast<StageModel *>(stage->getInterface());
+        Q_ASSERT(model);
+
+        if (model)
+            return model->renderedTarget();
+    } else {
+        Sprite *sprite = static_cast<Sprite *>(target);
+        SpriteModel *model = static_cast<SpriteModel *>(sprite->getInterface());
+        Q_ASSERT(model);
+
+        if (model)
+            return model->renderedTarget();
+    }
+
+    return nullptr;
+}
+
+bool RenderedTarget::addCandidate(const QRectF &targetRect, IRenderedTarget *target, QRectF &united) const
+{
+    // Use the bounds from the spatial index if the target is indexed (this avoids calculating bounds of all targets)
+    if (m_spatialIndex && m_spatialIndex->contains(target)) {
+        const Rect *bounds = m_spatialIndex->result(target);
+
+        if (!bounds)
+            return false; // the target is too far
+
+        united = united.united(rectIntersection(targetRect, *bounds));
+    } else
+        united = united.united(candidateIntersection(targetRect, target));
+
+    return true;
+}
+
 QRectF RenderedTarget::candidateIntersection(const QRectF &targetRect, IRenderedTarget *target)
 {
     Q_ASSERT(target);
@@ -1115,6 +2570,73 @@ QRgb RenderedTarget::sampleColor3b(double x, double y, const std::vector<IRender
     return qRgb(r, g, b);
 }
 
+void RenderedTarget::sampleColorRow(int y, int left, int right, const char *inside, const std::vector<const RenderedTarget *> &targets, QRgb *dst) const
+{
+    // Same as sampleColor3b() for the points of the row which are inside (other points are skipped),
+    // but the colors of each target are read for the whole row at once
+    const int count = right - left + 1;
+
+    if (count <= 0)
+        return;
+
+    std::vector<double> blendAlpha(count);
+    std::vector<int> r(count, 0), g(count, 0), b(count, 0);
+    std::vector<QRgb> colors(count);
+    int remaining = 0; // points which aren't fully covered yet
+    bool penLayerChecked = false;
+
+    for (int i = 0; i < count; i++) {
+        blendAlpha[i] = inside[i] ? 1 : 0;
+        remaining += inside[i] ? 1 : 0;
+    }
+
+    auto blend = [&](int i, QRgb blendColor) {
+        r[i] += qRed(blendColor) * blendAlpha[i];
+        g[i] += qGreen(blendColor) * blendAlpha[i];
+        b[i] += qBlue(blendColor) * blendAlpha[i];
+        blendAlpha[i] *= (1.0 - (qAlpha(blendColor) / 255.0));
+        remaining -= (blendAlpha[i] == 0);
+    };
+
+    auto blendPenLayer = [&]() {
+        // The pen layer is read point by point (it's right above the stage, see sampleColor3b())
+        penLayerChecked = true;
+
+        if (!m_penLayer)
+            return;
+
+        for (int i = 0; i < count && remaining > 0; i++) {
+            if (blendAlpha[i] != 0)
+                blend(i, m_penLayer->colorAtScratchPoint(left + i, y));
+        }
+    };
+
+    for (const RenderedTarget *target : targets) {
+        if (target->m_stageModel && !penLayerChecked)
+            blendPenLayer();
+
+        if (remaining == 0)
+            break;
+
+        target->colorAtScratchRow(y, left, right, colors.data());
+
+        for (int i = 0; i < count; i++) {
+            if (blendAlpha[i] != 0)
+                blend(i, colors[i]);
+        }
+    }
+
+    if (!penLayerChecked && remaining > 0)
+        blendPenLayer();
+
+    for (int i = 0; i < count; i++) {
+        r[i] += blendAlpha[i] * 255;
+        g[i] += blendAlpha[i] * 255;
+        b[i] += blendAlpha[i] * 255;
+        dst[i] = qRgb(r[i], g[i], b[i]);
+    }
+}
+
 bool RenderedTarget::mirrorHorizontally() const
 {
     return m_mirrorHorizontally;
@@ -7,9 +7,14 @@
 #include <QMutex>
 #include <QtSvg/QSvgRenderer>
 #include <QImage>
+#include <scratchcpp/rect.h>
+#include <functional>
+#include <atomic>
+#include <unordered_set>
 
 #include "irenderedtarget.h"
 #include "texture.h"
+#include "cputexturestore.h"
 
 Q_MOC_INCLUDE("stagemodel.h");
 Q_MOC_INCLUDE("spritemodel.h");
@@ -21,6 +26,8 @@ namespace scratchcpprender
 class Skin;
 class CpuTextureManager;
 class IPenLayer;
+class SpatialIndex;
+class StageComposite;
 
 class RenderedTarget : public IRenderedTarget
 {
@@ -81,6 +88,8 @@ class RenderedTarget : public IRenderedTarget
         Q_INVOKABLE QRectF getBoundsForBubble() const override;
         libscratchcpp::Rect getFastBounds() const override;
 
+        const QMatrix4x4 &stampModelMatrix(double scale) const override;
+
         QPointF mapFromScene(const QPointF &point) const override;
 
         bool mirrorHorizontally() const override;
@@ -90,9 +99,10 @@ class RenderedTarget : public IRenderedTarget
         int costumeWidth() const override;
         int costumeHeight() const override;
 
-        const std::unordered_map<ShaderManager::Effect, double> &graphicEffects() const override;
+        const EffectState &graphicEffects() const override;
         void setGraphicEffect(ShaderManager::Effect effect, double value) override;
         void clearGraphicEffects() override;
+        bool bakeEffects(Texture &texture, EffectState &effects) const;
 
         const std::vector<QPoint> &hullPoints() const override;
 
@@ -104,6 +114,16 @@ class RenderedTarget : public IRenderedTarget
         bool touchingColor(libscratchcpp::Rgb color) const override;
         bool touchingColor(libscratchcpp::Rgb color, libscratchcpp::Rgb mask) const override;
 
+        static bool gpuQueriesEnabled();
+        static void setGpuQueriesEnabled(bool enabled);
+
+        static int parallelScanThreshold();
+        static void setParallelScanThreshold(int points);
+
+        static unsigned int queryCacheHits();
+        static unsigned int queryCacheMisses();
+        static void resetQueryCacheStats();
+
     signals:
         void engineChanged();
         void stageModelChanged();
@@ -119,47 +139,117 @@ class RenderedTarget : public IRenderedTarget
         void mouseMoveEvent(QMouseEvent *event) override;
 
     private:
+        enum class QueryKind
+        {
+            TouchingClones,
+            TouchingColor,
+            TouchingColorMask
+        };
+
+        struct QueryResult
+        {
+                QueryKind kind;
+                libscratchcpp::Rgb color;
+                libscratchcpp::Rgb mask;
+                std::vector<libscratchcpp::Sprite *> clones;
+                unsigned int transformVersion;
+                unsigned int sceneVersion;
+                bool result;
+        };
+
+        struct SkinMap
+        {
+                ~SkinMap();
+
+                std::unordered_map<libscratchcpp::Costume *, std::shared_ptr<Skin>> skins; // shared with identical costumes (see SkinRegistry)
+                std::unordered_set<libscratchcpp::Costume *> prefetched; // removed from SkinImageStore with the skins
+        };
+
+        Skin *getSkin(libscratchcpp::Costume *costume);
+        void prefetchCostumes();
         void calculatePos();
         void calculateRotation();
         void calculateSize();
+        bool claimCostume() const;
+        static bool claimCostumes(const std::vector<IRenderedTarget *> &targets);
+        void invalidateTransform(bool positionOnly = false);
         void handleSceneMouseMove(qreal x, qreal y);
         bool convexHullPointsNeeded() const;
         void updateHullPoints();
         const std::vector<QPointF> &transformedHullPoints() const;
+        const std::vector<QPointF> &collisionHull() const;
+        bool hullsIntersect(const RenderedTarget *target, QRectF &dst) const;
         bool containsLocalPoint(const QPointF &point) const;
+        void containsScratchRow(int y, int left, int right, char *dst) const;
+        void colorAtScratchRow(int y, int left, int right, QRgb *dst) const;
+        bool effectsBakeable() const;
+        Texture bakedCpuTexture() const;
         QPointF transformPoint(double scratchX, double scratchY, double originX, double originY, double rot) const;
         QPointF transformPoint(double scratchX, double scratchY, double originX, double originY, double sinRot, double cosRot) const;
         QPointF mapFromStageWithOriginPoint(const QPointF &scenePoint) const;
         QPointF mapFromScratchToLocal(const QPointF &point) const;
+        const QTransform &scratchToLocalTransform() const;
+        void updateLocalTransforms() const;
+        bool spansSupported() const;
+        void getOpaqueSpans(const QTransform &transform, int y, int left, int right, std::vector<std::pair<int, int>> &dst) const;
+        bool touchingSpans(const QRectF &rect, const std::vector<const RenderedTarget *> &candidates) const;
+        static bool spansIntersect(const std::vector<std::pair<int, int>> &a, const std::vector<std::pair<int, int>> &b);
+        static bool texelOffset(const QTransform &transform, int &dx, int &dy);
         CpuTextureManager *textureManager() const;
+        void prepareConcurrentReads(bool colors, CpuTextureStore::PinnedTextures &pins) const;
+        static bool scanRows(int top, int bottom, int width, bool concurrent, const std::function<bool(int, int, const std::atomic<bool> &)> &scanBand);
+        bool checkTouchingClones(const std::vector<libscratchcpp::Sprite *> &clones) const;
         bool touchingColor(libscratchcpp::Rgb color, bool hasMask, libscratchcpp::Rgb mask) const;
+        bool checkTouchingColor(libscratchcpp::Rgb color, bool hasMask, libscratchcpp::Rgb mask) const;
+        bool touchingColorRows(const QRectF &bounds, QRgb color, bool hasMask, QRgb mask, const std::vector<const RenderedTarget *> &candidates) const;
+        bool touchingColorComposite(const QRectF &rect, QRgb color, bool hasMask, QRgb mask, bool &dst) const;
+        bool touchingColorCompositeConcurrent(int left, int right, int top, int bottom, QRgb color, bool hasMask, QRgb mask) const;
+        const QRgb *buildCompositeTile(int tileX, int tileY) const;
+        void fillCompositeTile(QRgb *tile, int tileX, int tileY) const;
+        bool touchingColorGpu(const QRectF &bounds, QRgb color, bool hasMask, QRgb mask, const std::vector<IRenderedTarget *> &candidates, bool &dst) const;
+        bool clonesCacheable(const std::vector<libscratchcpp::Sprite *> &clones) const;
+        bool findQueryResult(QueryKind kind, libscratchcpp::Rgb color, libscratchcpp::Rgb mask, const std::vector<libscratchcpp::Sprite *> &clones, bool &dst) const;
+        void addQueryResult(QueryKind kind, libscratchcpp::Rgb color, libscratchcpp::Rgb mask, const std::vector<libscratchcpp::Sprite *> &clones, bool result) const;
         QRectF touchingBounds() const;
         QRectF candidatesBounds(const QRectF &targetRect, const std::vector<libscratchcpp::Target *> &candidates, std::vector<IRenderedTarget *> &dst) const;
         QRectF candidatesBounds(const QRectF &targetRect, const std::vector<libscratchcpp::Sprite *> &candidates, std::vector<IRenderedTarget *> &dst) const;
+        static IRenderedTarget *renderedTargetOf(libscratchcpp::Target *target);
+        static const void *cloneGroup(SpriteModel *model);
+        bool addCandidate(const QRectF &targetRect, IRenderedTarget *target, QRectF &united) const;
         static QRectF candidateIntersection(const QRectF &targetRect, IRenderedTarget *target);
         static QRectF rectIntersection(const QRectF &targetRect, const libscratchcpp::Rect &candidateRect);
         static void clampRect(libscratchcpp::Rect &rect, double left, double right, double bottom, double top);
         static bool colorMatches(QRgb a, QRgb b);
         static bool maskMatches(QRgb a, QRgb b);
         QRgb sampleColor3b(double x, double y, const std::vector<IRenderedTarget *> &targets) const;
+        void sampleColorRow(int y, int left, int right, const char *inside, const std::vector<const RenderedTarget *> &targets, QRgb *dst) const;
 
+        static inline bool m_gpuQueriesEnabled = false;
+        static inline int m_parallelScanThreshold = 16384; // number of points
+        static inline unsigned int m_queryCacheHits = 0;
+        static inline unsigned int m_queryCacheMisses = 0;
         libscratchcpp::IEngine *m_engine = nullptr;
         libscratchcpp::Costume *m_costume = nullptr;
         StageModel *m_stageModel = nullptr;
         SpriteModel *m_spriteModel = nullptr;
         SceneMouseArea *m_mouseArea = nullptr;
         IPenLayer *m_penLayer = nullptr;
+        SpatialIndex *m_spatialIndex = nullptr;
+        StageComposite *m_stageComposite = nullptr;
         bool m_costumesLoaded = false;
-        std::unordered_map<libscratchcpp::Costume *, Skin *> m_skins;
-        bool m_skinsInherited = false;
+        std::shared_ptr<SkinMap> m_skins; // skins are created when they're used, clones share them with the clone root
+        bool m_idlePrefetchStarted = false;
         Skin *m_skin = nullptr;
+        unsigned int m_skinTextureVersion = 0;
         Texture m_texture;
         Texture m_oldTexture;
         Texture m_cpuTexture;                                        // without stage scale
         mutable std::shared_ptr<CpuTextureManager> m_textureManager; // NOTE: Use textureManager()!
         std::unique_ptr<QOpenGLFunctions> m_glF;
-        mutable std::unordered_map<ShaderManager::Effect, double> m_graphicEffects;
-        mutable ShaderManager::Effect m_graphicEffectMask = ShaderManager::Effect::NoEffect;
+        mutable EffectState m_graphicEffects;
+        int m_stableEffectFrames = 0;          // redraws since the last effect change
+        mutable Texture m_bakedCpuTexture;     // NOTE: Use bakedCpuTexture()!
+        mutable unsigned int m_bakedCpuTextureGeneration = 0;
         double m_size = 1;
         double m_x = 0;
         double m_y = 0;
@@ -175,6 +265,19 @@ class RenderedTarget : public IRenderedTarget
         std::vector<QPoint> m_hullPoints;
         mutable bool m_transformedHullDirty = true;
         mutable std::vector<QPointF> m_transformedHullPoints; // NOTE: Use transformedHullPoints();
+        unsigned int m_transformVersion = 1;                  // incremented when position, size, rotation or costume changes
+        unsigned int m_geometryVersion = 1;                   // same as m_transformVersion, but not incremented by position changes
+        mutable unsigned int m_localTransformVersion = 0;
+        mutable QTransform m_scratchToLocal; // NOTE: Use scratchToLocalTransform()!
+        mutable QTransform m_stageToLocal;
+        mutable unsigned int m_fastBoundsVersion = 0;
+        mutable std::vector<QPointF> m_collisionHull; // relative to the position, use collisionHull()
+        mutable unsigned int m_collisionHullVersion = 0;
+        mutable libscratchcpp::Rect m_fastBounds; // relative to the position
+        mutable unsigned int m_modelMatrixVersion = 0;
+        mutable double m_modelMatrixScale = 0;
+        mutable QMatrix4x4 m_modelMatrix;
+        mutable std::vector<QueryResult> m_queryResults; // results of touching queries (see findQueryResult())
         bool m_clicked = false;                               // left mouse button only!
         double m_dragX = 0;
         double m_dragY = 0;
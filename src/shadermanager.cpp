@@ -6,6 +6,7 @@
 #include <scratchcpp/scratchconfiguration.h>
 
 #include "shadermanager.h"
+#include "effectstate.h"
 #include "graphicseffect.h"
 
 using namespace scratchcpprender;
@@ -45,6 +46,8 @@ static const std::unordered_map<ShaderManager::Effect, const char *> EFFECT_UNIF
     { ShaderManager::Effect::Whirl, "u_whirl" }, { ShaderManager::Effect::Pixelate, "u_pixelate" },     { ShaderManager::Effect::Mosaic, "u_mosaic" }
 };
 
+static const std::unordered_map<ShaderManager::DrawMode, const char *> DRAW_MODE_TO_NAME = { { ShaderManager::DrawMode::Silhouette, "silhouette" }, { ShaderManager::DrawMode::ColorMask, "colorMask" } };
+
 static const std::unordered_map<ShaderManager::Effect, ConverterFunc> EFFECT_CONVERTER = {
     { ShaderManager::Effect::Color, [](float x) { return wrapClamp(x / 200.0f, 0.0f, 1.0f); } },
     { ShaderManager::Effect::Brightness, [](float x) { return std::clamp(x, -100.0f, 100.0f) / 100.0f; } },
@@ -99,22 +102,17 @@ ShaderManager *ShaderManager::instance()
     return globalInstance;
 }
 
-QOpenGLShaderProgram *ShaderManager::getShaderProgram(const std::unordered_map<Effect, double> &effectValues)
+QOpenGLShaderProgram *ShaderManager::getShaderProgram(const EffectState &effects, DrawMode drawMode)
 {
-    int effectBits = 0;
-    bool firstSet = false;
-
-    for (const auto &[effect, value] : effectValues) {
-        if (value != 0)
-            effectBits |= static_cast<int>(effect);
-    }
+    // The draw mode is stored above the effect bits
+    const int effectBits = static_cast<int>(effects.mask()) | (static_cast<int>(drawMode) << 16);
 
     // Find the selected effect combination
     auto it = m_shaderPrograms.find(effectBits);
 
     if (it == m_shaderPrograms.cend()) {
         // Create a new shader program if this combination doesn't exist yet
-        QOpenGLShaderProgram *program = createShaderProgram(effectValues);
+        QOpenGLShaderProgram *program = createShaderProgram(effects, drawMode);
 
         if (program)
             m_shaderPrograms[effectBits] = program;
@@ -124,25 +122,23 @@ QOpenGLShaderProgram *ShaderManager::getShaderProgram(const std::unordered_map<E
         return it->second;
 }
 
-void ShaderManager::getUniformValuesForEffects(const std::unordered_map<Effect, double> &effectValues, std::unordered_map<Effect, float> &dst)
+void ShaderManager::getUniformValuesForEffects(const EffectState &effects, std::unordered_map<Effect, float> &dst)
 {
+    // NOTE: Use EffectState::uniformValue() to get a single value
     dst.clear();
 
-    for (const auto &[effect, name] : EFFECT_TO_NAME) {
-        const auto it = effectValues.find(effect);
-        double value;
-
-        if (it == effectValues.cend())
-            value = 0; // reset the effect
-        else
-            value = it->second;
+    for (const auto &[effect, name] : EFFECT_TO_NAME)
+        dst[effect] = effects.uniformValue(effect);
+}
 
-        auto converter = EFFECT_CONVERTER.at(effect);
-        dst[effect] = converter(value);
-    }
+float ShaderManager::uniformValue(Effect effect, double value)
+{
+    // Converts the effect value to the uniform value (disabled effects use zero)
+    auto converter = EFFECT_CONVERTER.at(effect);
+    return converter(value);
 }
 
-void ShaderManager::setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues)
+void ShaderManager::setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const EffectState &effects)
 {
     // Set the texture unit
     program->setUniformValue(TEXTURE_UNIT_UNIFORM, textureUnit);
@@ -150,12 +146,9 @@ void ShaderManager::setUniforms(QOpenGLShaderProgram *program, int textureUnit,
     // Set skin size
     program->setUniformValue(SKIN_SIZE_UNIFORM, QVector2D(skinSize.width(), skinSize.height()));
 
-    // Set uniform values
-    std::unordered_map<Effect, float> values;
-    getUniformValuesForEffects(effectValues, values);
-
-    for (const auto &[effect, value] : values)
-        program->setUniformValue(EFFECT_UNIFORM_NAME.at(effect), value);
+    // Set uniform values (they're converted when the effects change)
+    for (const auto &[effect, name] : EFFECT_UNIFORM_NAME)
+        program->setUniformValue(name, effects.uniformValue(effect));
 }
 
 const std::unordered_set<ShaderManager::Effect> &ShaderManager::effects()
@@ -174,6 +167,22 @@ bool ShaderManager::effectShapeChanges(Effect effect)
     return EFFECT_SHAPE_CHANGES.at(effect);
 }
 
+ShaderManager::Effect ShaderManager::shapeChangingEffects(Effect effectMask)
+{
+    // Remove effects that don't change shape
+    Effect ret = Effect::NoEffect;
+
+    if (effectMask == 0)
+        return ret;
+
+    for (const auto &[effect, shapeChanges] : EFFECT_SHAPE_CHANGES) {
+        if (shapeChanges && (effectMask & effect) != 0)
+            ret |= effect;
+    }
+
+    return ret;
+}
+
 void ShaderManager::registerEffects()
 {
     // Register graphic effects in libscratchcpp
@@ -183,7 +192,7 @@ void ShaderManager::registerEffects()
     }
 }
 
-QOpenGLShaderProgram *ShaderManager::createShaderProgram(const std::unordered_map<Effect, double> &effectValues)
+QOpenGLShaderProgram *ShaderManager::createShaderProgram(const EffectState &effects, DrawMode drawMode)
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
     Q_ASSERT(context && m_vertexShader);
@@ -195,14 +204,21 @@ QOpenGLShaderProgram *ShaderManager::createShaderProgram(const std::unordered_ma
     QByteArray fragSource = SHADER_PREFIX.toUtf8();
 
     // Add defines for the effects
-    for (const auto &[effect, value] : effectValues) {
-        if (value != 0) {
+    for (const auto &[effect, name] : EFFECT_TO_NAME) {
+        if (effects.contains(effect)) {
             fragSource.push_back("#define ENABLE_");
-            fragSource.push_back(EFFECT_TO_NAME.at(effect));
+            fragSource.push_back(name);
             fragSource.push_back('\n');
         }
     }
 
+    // Add define for the draw mode
+    if (drawMode != DrawMode::Default) {
+        fragSource.push_back("#define DRAW_MODE_");
+        fragSource.push_back(DRAW_MODE_TO_NAME.at(drawMode));
+        fragSource.push_back('\n');
+    }
+
     // Add the actual fragment shader
     fragSource.push_back(m_fragmentShaderSource);
 
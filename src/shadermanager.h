@@ -12,6 +12,8 @@ class QOpenGLShader;
 namespace scratchcpprender
 {
 
+class EffectState;
+
 class ShaderManager : public QObject
 {
     public:
@@ -27,16 +29,25 @@ class ShaderManager : public QObject
             Mosaic = 1 << 6
         };
 
+        enum class DrawMode
+        {
+            Default = 0,
+            Silhouette = 1, // discard transparent pixels
+            ColorMask = 2   // discard pixels which don't match u_colorMask
+        };
+
         explicit ShaderManager(QObject *parent = nullptr);
 
         static ShaderManager *instance();
 
-        QOpenGLShaderProgram *getShaderProgram(const std::unordered_map<Effect, double> &effectValues);
-        static void getUniformValuesForEffects(const std::unordered_map<Effect, double> &effectValues, std::unordered_map<Effect, float> &dst);
-        void setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const std::unordered_map<Effect, double> &effectValues);
+        QOpenGLShaderProgram *getShaderProgram(const EffectState &effects, DrawMode drawMode = DrawMode::Default);
+        static void getUniformValuesForEffects(const EffectState &effects, std::unordered_map<Effect, float> &dst);
+        static float uniformValue(Effect effect, double value);
+        void setUniforms(QOpenGLShaderProgram *program, int textureUnit, const QSize skinSize, const EffectState &effects);
 
         static const std::unordered_set<Effect> &effects();
         static bool effectShapeChanges(Effect effect);
+        static Effect shapeChangingEffects(Effect effectMask);
 
     private:
         struct Registrar
@@ -46,7 +57,7 @@ class ShaderManager : public QObject
 
         static void registerEffects();
 
-        QOpenGLShaderProgram *createShaderProgram(const std::unordered_map<Effect, double> &effectValues);
+        QOpenGLShaderProgram *createShaderProgram(const EffectState &effects, DrawMode drawMode);
 
         static Registrar m_registrar;
         static std::unordered_set<Effect> m_effects;
@@ -35,6 +35,10 @@ uniform vec2 u_skinSize;
 uniform float u_mosaic;
 #endif // ENABLE_mosaic
 
+#ifdef DRAW_MODE_colorMask
+uniform vec3 u_colorMask;
+#endif // DRAW_MODE_colorMask
+
 varying vec2 v_texCoord;
 uniform sampler2D u_skin;
 
@@ -183,4 +187,18 @@ void main()
     #ifdef ENABLE_ghost
     gl_FragColor *= u_ghost;
     #endif // ENABLE_ghost
+
+    #ifdef DRAW_MODE_silhouette
+    if (gl_FragColor.a == 0.0)
+        discard;
+    #endif // DRAW_MODE_silhouette
+
+    #ifdef DRAW_MODE_colorMask
+    // Compare the 5 most significant bits of each channel (like RenderedTarget::maskMatches())
+    ivec3 maskColor = ivec3(floor(gl_FragColor.rgb * 255.0 + 0.5)) / 8;
+    ivec3 mask = ivec3(floor(u_colorMask * 255.0 + 0.5)) / 8;
+
+    if (any(notEqual(maskColor, mask)))
+        discard;
+    #endif // DRAW_MODE_colorMask
 }
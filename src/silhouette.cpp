@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QtGlobal>
+#include <QtAlgorithms>
+#include <algorithm>
+
+#include "silhouette.h"
+
+using namespace scratchcpprender;
+
+Silhouette::Silhouette()
+{
+}
+
+Silhouette::Silhouette(const GLubyte *pixels, int width, int height, bool bottomUp) :
+    m_width(std::max(width, 0)),
+    m_height(std::max(height, 0)),
+    m_wordsPerRow((m_width + 63) / 64)
+{
+    m_words.resize(static_cast<size_t>(m_wordsPerRow) * m_height, 0);
+
+    if (!pixels)
+        return;
+
+    uint64_t partialAlpha = 0;
+
+    for (int y = 0; y < m_height; y++) {
+        const GLubyte *src = pixels + static_cast<size_t>(bottomUp ? m_height - 1 - y : y) * m_width * 4 + 3; // alpha channel
+        uint64_t *dst = m_words.data() + static_cast<size_t>(y) * m_wordsPerRow;
+
+        // Each word is built without branches, so the compiler can vectorize the loop
+        for (int i = 0; i < m_wordsPerRow; i++) {
+            const GLubyte *alpha = src + i * 64 * 4;
+            const int count = std::min(64, m_width - i * 64);
+            uint64_t word = 0;
+
+            for (int x = 0; x < count; x++) {
+                word |= uint64_t(alpha[x * 4] > 0) << x;
+                partialAlpha |= GLubyte(alpha[x * 4] - 1) < 254; // 1-254
+            }
+
+            dst[i] = word;
+        }
+    }
+
+    m_partialAlpha = partialAlpha != 0;
+}
+
+bool Silhouette::intersects(const Silhouette &other, int dx, int dy) const
+{
+    // Checks whether a texel of this silhouette overlaps a texel of the other silhouette placed at (dx, dy)
+    return intersects(other, dx, dy, QRect(0, 0, m_width, m_height));
+}
+
+bool Silhouette::intersects(const Silhouette &other, int dx, int dy, const QRect &rect) const
+{
+    // Same as intersects(), but only texels of this silhouette in the given rectangle are checked
+    if (isNull() || other.isNull() || rect.isEmpty())
+        return false;
+
+    const int top = std::max({ 0, dy, rect.top() });
+    const int bottom = std::min({ m_height, dy + other.m_height, rect.bottom() + 1 });
+    const int left = std::max({ 0, dx, rect.left() });
+    const int right = std::min({ m_width, dx + other.m_width, rect.right() + 1 });
+
+    if (top >= bottom || left >= right)
+        return false;
+
+    const int firstWord = left >> 6;
+    const int lastWord = (right - 1) >> 6;
+    const uint64_t firstMask = ~uint64_t(0) << (left & 63);
+    const uint64_t lastMask = ~uint64_t(0) >> (63 - ((right - 1) & 63));
+
+    for (int y = top; y < bottom; y++) {
+        const uint64_t *thisRow = row(y);
+        const uint64_t *otherRow = other.row(y - dy);
+
+        for (int i = firstWord; i <= lastWord; i++) {
+            uint64_t word = thisRow[i];
+
+            if (i == firstWord)
+                word &= firstMask;
+
+            if (i == lastWord)
+                word &= lastMask;
+
+            if (word == 0)
+                continue;
+
+            // Bits outside the other silhouette are 0, so there's no need to mask its edges
+            if (word & bitsAt(otherRow, other.m_wordsPerRow, i * 64 - dx))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool Silhouette::rowExtent(int y, int &first, int &last) const
+{
+    // Finds the first and last opaque texel of the given row using bit scans (unused bits of the last word are always 0)
+    Q_ASSERT(y >= 0 && y < m_height);
+    const uint64_t *words = row(y);
+    int i = 0;
+
+    while (i < m_wordsPerRow && words[i] == 0)
+        i++;
+
+    if (i == m_wordsPerRow) {
+        first = -1;
+        last = -1;
+        return false;
+    }
+
+    first = i * 64 + qCountTrailingZeroBits(words[i]);
+    i = m_wordsPerRow - 1;
+
+    while (words[i] == 0)
+        i--;
+
+    last = i * 64 + 63 - qCountLeadingZeroBits(words[i]);
+    return true;
+}
+
+const std::vector<Silhouette::Run> &Silhouette::runs(int y) const
+{
+    // Returns the opaque runs of the given row
+    Q_ASSERT(y >= 0 && y < m_height);
+
+    if (m_runs.empty() && m_height > 0) {
+        m_runs.resize(m_height);
+
+        for (int i = 0; i < m_height; i++) {
+            const uint64_t *words = row(i);
+            std::vector<Run> &rowRuns = m_runs[i];
+            int start = -1;
+
+            for (int x = 0; x < m_width; x++) {
+                const uint64_t word = words[x >> 6];
+
+                // Skip whole words without any change
+                if ((x & 63) == 0 && x + 64 <= m_width && (word == 0 || word == ~uint64_t(0))) {
+                    if ((word == 0) == (start == -1)) {
+                        x += 63;
+                        continue;
+                    }
+                }
+
+                const bool opaque = (word >> (x & 63)) & 1;
+
+                if (opaque && start == -1)
+                    start = x;
+                else if (!opaque && start != -1) {
+                    rowRuns.push_back({ start, x });
+                    start = -1;
+                }
+            }
+
+            if (start != -1)
+                rowRuns.push_back({ start, m_width });
+        }
+    }
+
+    return m_runs[y];
+}
+
+size_t Silhouette::byteCount() const
+{
+    // Includes the runs (if they have been built)
+    size_t ret = m_words.size() * sizeof(uint64_t) + m_runs.capacity() * sizeof(std::vector<Run>);
+
+    for (const std::vector<Run> &rowRuns : m_runs)
+        ret += rowRuns.capacity() * sizeof(Run);
+
+    return ret;
+}
+
+uint64_t Silhouette::bitsAt(const uint64_t *row, int wordCount, int start)
+{
+    // Returns 64 bits of the row starting at the given bit (bits outside the row are 0)
+    const int word = start >= 0 ? start / 64 : -((-start + 63) / 64);
+    const int shift = start - word * 64;
+    const uint64_t low = (word >= 0 && word < wordCount) ? row[word] : 0;
+
+    if (shift == 0)
+        return low;
+
+    const uint64_t high = (word + 1 >= 0 && word + 1 < wordCount) ? row[word + 1] : 0;
+    return (low >> shift) | (high << (64 - shift));
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <qopengl.h>
+#include <QRect>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The Silhouette class is a 1-bit mask of the non-transparent texels of a texture.
+ * Each row is aligned to 64-bit words, the first row is the top row of the texture.
+ */
+class Silhouette
+{
+    public:
+        struct Run
+        {
+                int start; // first opaque texel
+                int end;   // texel after the last opaque texel
+        };
+
+        Silhouette();
+        Silhouette(const GLubyte *pixels, int width, int height, bool bottomUp = false);
+
+        int width() const { return m_width; }
+        int height() const { return m_height; }
+        bool isNull() const { return m_width <= 0 || m_height <= 0; }
+        int wordsPerRow() const { return m_wordsPerRow; }
+        bool hasPartialAlpha() const { return m_partialAlpha; } // true if some texels aren't fully opaque or fully transparent
+
+        const uint64_t *row(int y) const { return m_words.data() + y * m_wordsPerRow; }
+
+        bool contains(int x, int y) const
+        {
+            if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+                return false;
+
+            return (m_words[y * m_wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+        }
+
+        bool intersects(const Silhouette &other, int dx, int dy) const;
+        bool intersects(const Silhouette &other, int dx, int dy, const QRect &rect) const;
+        bool rowExtent(int y, int &first, int &last) const;
+
+        const std::vector<Run> &runs(int y) const;
+
+        size_t byteCount() const;
+
+    private:
+        static uint64_t bitsAt(const uint64_t *row, int wordCount, int start);
+
+        int m_width = 0;
+        int m_height = 0;
+        int m_wordsPerRow = 0;
+        bool m_partialAlpha = false;
+        std::vector<uint64_t> m_words;
+        mutable std::vector<std::vector<Run>> m_runs; // built when needed
+};
+
+} // namespace scratchcpprender
@@ -4,34 +4,187 @@
 
 #include "skin.h"
 #include "texture.h"
+#include "cputexturestore.h"
+#include "effecttexturecache.h"
 
 using namespace scratchcpprender;
 
 Skin::Skin()
 {
+    // Skins can be created without a current OpenGL context, textures are created when they're used then
     QOpenGLContext *context = QOpenGLContext::currentContext();
-    Q_ASSERT(context);
 
-    if (!m_connectedCtx || (context && context != m_connectedCtx)) {
+    if (context && context != m_connectedCtx) {
         QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed, []() {
             // Destroy textures
-            m_textures.clear();
+            for (Skin *skin : m_skins) {
+                for (const auto &[handle, entry] : skin->m_textures)
+                    skin->textureRemoved(entry.info);
+
+                skin->m_textures.clear();
+            }
+
+            m_orphanedTextures.clear();
+            m_memoryUsage = 0;
+            CpuTextureStore::instance()->clear();
         });
 
         m_connectedCtx = context;
     }
+
+    m_skins.insert(this);
+}
+
+Skin::~Skin()
+{
+    m_skins.erase(this);
+    CpuTextureStore *store = CpuTextureStore::instance();
+    EffectTextureCache *cache = EffectTextureCache::instance();
+    const bool current = contextCurrent();
+
+    for (const auto &[handle, entry] : m_textures) {
+        // The handle might be reused by another texture
+        if (store) {
+            store->invalidate(entry.info);
+            store->release(entry.info);
+        }
+
+        if (cache)
+            cache->removeTexture(entry.info);
+
+        if (!current)
+            m_orphanedTextures.push_back(entry.texture);
+
+        m_memoryUsage -= entry.size;
+    }
+}
+
+unsigned int Skin::textureVersion() const
+{
+    // Changes when new textures are available (e.g. textures created in the background, see updateTextures()),
+    // so that users can request their textures again
+    return m_textureVersion;
+}
+
+QSize Skin::size() const
+{
+    // Returns the size of the texture at scale 1 (it's available before the texture is created, e.g. while the costume is decoded in the background)
+    return m_size;
+}
+
+void Skin::markUsed(const Texture &texture) const
+{
+    // Textures which are used in every frame (e.g. current textures of targets) must be marked before nextFrame() is called
+    auto it = m_textures.find(texture.handle());
+
+    if (it != m_textures.cend())
+        it->second.lastUse = m_frame;
+}
+
+int Skin::textureCount() const
+{
+    return m_textures.size();
+}
+
+qint64 Skin::textureMemoryUsage() const
+{
+    // Returns the size of the textures of this skin in VRAM
+    qint64 ret = 0;
+
+    for (const auto &[handle, entry] : m_textures)
+        ret += entry.size;
+
+    return ret;
+}
+
+void Skin::nextFrame()
+{
+    // Deletes textures which haven't been used for a while (it's postponed to the next texture creation if there isn't a current OpenGL context)
+    m_frame++;
+
+    if (contextCurrent())
+        collectTextures(m_memoryBudget, 2);
+}
+
+unsigned int Skin::unusedFrames()
+{
+    return m_unusedFrames;
+}
+
+void Skin::setUnusedFrames(unsigned int frames)
+{
+    m_unusedFrames = std::max(frames, 2u);
+}
+
+qint64 Skin::memoryBudget()
+{
+    return m_memoryBudget;
+}
+
+void Skin::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget = std::max(0LL, bytes);
+}
+
+qint64 Skin::memoryUsage()
+{
+    return m_memoryUsage;
 }
 
 Texture Skin::createAndPaintTexture(int width, int height)
 {
     QOpenGLContext *context = QOpenGLContext::currentContext();
 
+    if (!context || !context->isValid() || (width <= 0 || height <= 0))
+        return Texture();
+
+    return createTexture(paintImage(width, height, [this](QPainter *painter) { paint(painter); }));
+}
+
+Texture Skin::createTexture(const QImage &image, const std::vector<QPoint> *hullPoints)
+{
+    // Uploads an image created by paintImage()
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    const int width = image.width();
+    const int height = image.height();
+
     if (!context || !context->isValid() || (width <= 0 || height <= 0))
         return Texture();
 
     QOpenGLExtraFunctions glF(context);
     glF.initializeOpenGLFunctions();
 
+    // Make space for the new texture
+    const qint64 size = static_cast<qint64>(width) * height * 4;
+
+    if (contextCurrent())
+        collectTextures(m_memoryBudget - size, 2);
+
+    // Create final texture from the image
+    auto texture = std::make_shared<QOpenGLTexture>(image);
+    texture->setMinificationFilter(QOpenGLTexture::Nearest);
+    texture->setMagnificationFilter(QOpenGLTexture::Nearest);
+    texture->bind();
+    glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    texture->release();
+
+    Texture ret(texture->textureId(), width, height);
+    m_textures[ret.handle()] = { texture, ret, size, m_frame };
+    m_memoryUsage += size;
+
+    // Pass the image to the CPU texture store, so that it doesn't have to be read back from the GPU
+    CpuTextureStore::instance()->addTexture(ret, image, hullPoints);
+
+    return ret;
+}
+
+QImage Skin::paintImage(int width, int height, const std::function<void(QPainter *)> &paint)
+{
+    // Returns a flipped image with premultiplied alpha which can be uploaded by createTexture() (this can be called from any thread)
+    if (width <= 0 || height <= 0)
+        return QImage();
+
     // Render to QImage
     QImage image(width, height, QImage::Format_RGBA8888);
 
@@ -55,15 +208,71 @@ Texture Skin::createAndPaintTexture(int width, int height)
         }
     }
 
-    // Create final texture from the image
-    auto texture = std::make_shared<QOpenGLTexture>(image);
-    m_textures.push_back(texture);
-    texture->setMinificationFilter(QOpenGLTexture::Nearest);
-    texture->setMagnificationFilter(QOpenGLTexture::Nearest);
-    texture->bind();
-    glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glF.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    texture->release();
+    return image;
+}
+
+void Skin::newTexturesAvailable()
+{
+    m_textureVersion++;
+}
+
+void Skin::setSize(const QSize &size)
+{
+    m_size = size;
+}
+
+void Skin::removeTexture(GLuint handle)
+{
+    auto it = m_textures.find(handle);
+    Q_ASSERT(it != m_textures.cend());
+    const Texture texture = it->second.info;
+    textureRemoved(texture);
+
+    // The handle might be reused by another texture
+    CpuTextureStore *store = CpuTextureStore::instance();
+    store->invalidate(texture);
+    store->release(texture);
+    EffectTextureCache::instance()->removeTexture(texture);
 
-    return Texture(texture->textureId(), width, height);
+    m_memoryUsage -= it->second.size;
+    m_textures.erase(it);
+}
+
+void Skin::collectTextures(qint64 budget, unsigned int minUnusedFrames)
+{
+    // Deletes textures which haven't been used for the given number of frames, starting with least recently used ones,
+    // until the memory usage is within the budget. Textures which haven't been used for unusedFrames() frames are always deleted.
+    // NOTE: The OpenGL context must be current.
+    m_orphanedTextures.clear();
+
+    struct Candidate
+    {
+            Skin *skin;
+            GLuint handle;
+            unsigned int lastUse;
+    };
+
+    std::vector<Candidate> candidates;
+
+    for (Skin *skin : m_skins) {
+        for (const auto &[handle, entry] : skin->m_textures) {
+            if (m_frame - entry.lastUse >= minUnusedFrames)
+                candidates.push_back({ skin, handle, entry.lastUse });
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.lastUse < b.lastUse; });
+
+    for (const Candidate &candidate : candidates) {
+        if (m_memoryUsage <= budget && m_frame - candidate.lastUse <= m_unusedFrames)
+            break;
+
+        candidate.skin->removeTexture(candidate.handle);
+    }
+}
+
+bool Skin::contextCurrent()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    return context && context == m_connectedCtx;
 }
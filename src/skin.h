@@ -5,28 +5,83 @@
 #include <QPointF>
 #include <QSizeF>
 #include <QtOpenGL>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+
+#include "texture.h"
 
 namespace scratchcpprender
 {
 
-class Texture;
-
+/*!
+ * \brief The Skin class is the base class of costume skins, it owns the textures it creates.
+ * Textures which aren't used for a number of frames (see nextFrame()) are deleted and created again when they're needed.
+ */
 class Skin
 {
     public:
+        static inline const unsigned int DEFAULT_UNUSED_FRAMES = 300;
+        static inline const qint64 DEFAULT_MEMORY_BUDGET = 512 * 1024 * 1024;
+
         Skin();
         Skin(const Skin &) = delete;
-        virtual ~Skin() { }
+        virtual ~Skin();
 
-        virtual Texture getTexture(double scale) const = 0;
+        virtual Texture getTexture(double scale) = 0; // textures which don't exist (anymore) might be created
         virtual double getTextureScale(const Texture &texture) const = 0;
 
+        virtual bool updateTextures() { return false; }
+        virtual bool claimPendingCostume() { return false; } // creates the texture of a costume which is prepared in the background now
+        unsigned int textureVersion() const;
+
+        QSize size() const;
+
+        void markUsed(const Texture &texture) const;
+
+        int textureCount() const;
+        qint64 textureMemoryUsage() const;
+
+        static void nextFrame();
+
+        static unsigned int unusedFrames();
+        static void setUnusedFrames(unsigned int frames);
+
+        static qint64 memoryBudget();
+        static void setMemoryBudget(qint64 bytes);
+        static qint64 memoryUsage();
+
     protected:
         Texture createAndPaintTexture(int width, int height);
+        Texture createTexture(const QImage &image, const std::vector<QPoint> *hullPoints = nullptr);
+        static QImage paintImage(int width, int height, const std::function<void(QPainter *)> &paint);
         virtual void paint(QPainter *painter) = 0;
+        virtual void textureRemoved(const Texture &texture) { } // called before a texture is deleted
+        void newTexturesAvailable();
+        void setSize(const QSize &size);
 
     private:
-        static inline std::vector<std::shared_ptr<QOpenGLTexture>> m_textures;
+        struct TextureEntry
+        {
+                std::shared_ptr<QOpenGLTexture> texture;
+                Texture info;
+                qint64 size = 0;
+                mutable unsigned int lastUse = 0; // frame
+        };
+
+        void removeTexture(GLuint handle);
+        static void collectTextures(qint64 budget, unsigned int minUnusedFrames);
+        static bool contextCurrent();
+
+        std::unordered_map<GLuint, TextureEntry> m_textures;
+        unsigned int m_textureVersion = 0;
+        QSize m_size;
+        static inline std::unordered_set<Skin *> m_skins;
+        static inline std::vector<std::shared_ptr<QOpenGLTexture>> m_orphanedTextures; // textures of deleted skins, deleted when the context is current
+        static inline unsigned int m_frame = 0;
+        static inline unsigned int m_unusedFrames = DEFAULT_UNUSED_FRAMES;
+        static inline qint64 m_memoryBudget = DEFAULT_MEMORY_BUDGET;
+        static inline qint64 m_memoryUsage = 0;
         static inline QOpenGLContext *m_connectedCtx = nullptr;
 };
 
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <scratchcpp/costume.h>
+#include <QThreadPool>
+
+#include "skinimagestore.h"
+#include "bitmapskin.h"
+#include "svgskin.h"
+#include "cputexturemanager.h"
+
+using namespace scratchcpprender;
+
+Q_GLOBAL_STATIC(SkinImageStore, globalInstance)
+Q_GLOBAL_STATIC(QThreadPool, prefetchPool)
+
+SkinImageStore::SkinImageStore()
+{
+}
+
+SkinImageStore *SkinImageStore::instance()
+{
+    return globalInstance;
+}
+
+void SkinImageStore::setOwner(const libscratchcpp::Costume *costume, const void *owner)
+{
+    // Sets the project loader (or other owner) which deletes the costume (see clear())
+    QMutexLocker locker(&m_mutex);
+    m_owners[costume] = owner;
+}
+
+void SkinImageStore::setPending(const libscratchcpp::Costume *costume)
+{
+    // Marks the costume as going to be prepared (see prepare())
+    QMutexLocker locker(&m_mutex);
+    m_pending.insert(costume);
+}
+
+bool SkinImageStore::isPending(const libscratchcpp::Costume *costume) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_pending.find(costume) != m_pending.cend();
+}
+
+void SkinImageStore::prepare(libscratchcpp::Costume *costume)
+{
+    // Decodes the costume and paints its default texture image (this can be called from any thread)
+    if (!costume)
+        return;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        // Skip costumes which are being prepared in another thread or which have been claimed (see claim())
+        if (m_preparing.find(costume) != m_preparing.cend() || m_claimed.erase(costume) > 0)
+            return;
+
+        m_preparing.insert(costume);
+    }
+
+    finishPreparing(costume, prepareImages(costume));
+}
+
+SkinImageStore::Images SkinImageStore::take(const libscratchcpp::Costume *costume, bool *pending)
+{
+    // Returns the prepared images of the costume and removes them from the store (empty images are returned if they aren't available)
+    QMutexLocker locker(&m_mutex);
+    auto it = m_images.find(costume);
+
+    if (pending)
+        *pending = m_pending.find(costume) != m_pending.cend();
+
+    if (it == m_images.cend())
+        return Images();
+
+    Images ret = std::move(it->second);
+    m_images.erase(it);
+    return ret;
+}
+
+void SkinImageStore::prefetch(libscratchcpp::Costume *costume, int priority)
+{
+    // Prepares the costume in the background (jobs with higher priority run first)
+    if (!costume)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+
+    if (m_images.find(costume) != m_images.cend() || m_pending.find(costume) != m_pending.cend())
+        return;
+
+    QRunnable *job = QRunnable::create([this, costume]() {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_jobs.erase(costume);
+            m_runningJobs.insert(costume);
+        }
+
+        prepare(costume);
+
+        QMutexLocker locker(&m_mutex);
+        m_runningJobs.erase(costume);
+        m_jobFinished.wakeAll();
+    });
+
+    m_pending.insert(costume);
+    m_claimed.erase(costume); // the job must not be skipped (see prepare())
+    m_jobs[costume] = job;
+    prefetchPool->start(job, priority);
+}
+
+void SkinImageStore::claim(const libscratchcpp::Costume *costume, bool preparePending)
+{
+    // Runs the queued prefetch job of the costume in this thread (so that it doesn't have to wait for other jobs)
+    // or waits for the job if it's running, so that the images are available after this returns.
+    // Costumes which are pending for ProjectLoader are only prepared here if preparePending is true (sensing can't wait for them).
+    QRunnable *job = nullptr;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_jobs.find(costume);
+
+        if (it != m_jobs.cend() && prefetchPool->tryTake(it->second)) {
+            job = it->second;
+            m_jobs.erase(it);
+        } else {
+            while (m_runningJobs.find(costume) != m_runningJobs.cend() || m_jobs.find(costume) != m_jobs.cend() || (preparePending && m_preparing.find(costume) != m_preparing.cend()))
+                m_jobFinished.wait(&m_mutex);
+
+            if (!preparePending || m_pending.find(costume) == m_pending.cend())
+                return;
+
+            // The costume is going to be prepared later (see ProjectLoader), so it's prepared in this thread and skipped later
+            m_preparing.insert(costume);
+            m_claimed.insert(costume);
+        }
+    }
+
+    if (job) {
+        job->run();
+        delete job;
+    } else
+        finishPreparing(costume, prepareImages(costume));
+}
+
+bool SkinImageStore::isQueued(const libscratchcpp::Costume *costume) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_jobs.find(costume) != m_jobs.cend();
+}
+
+void SkinImageStore::remove(const libscratchcpp::Costume *costume)
+{
+    // Cancels the prefetch job of the costume and deletes its images (the costume can be deleted after this)
+    QMutexLocker locker(&m_mutex);
+    auto it = m_jobs.find(costume);
+
+    if (it != m_jobs.cend() && prefetchPool->tryTake(it->second)) {
+        delete it->second;
+        m_jobs.erase(it);
+    }
+
+    while (m_runningJobs.find(costume) != m_runningJobs.cend() || m_jobs.find(costume) != m_jobs.cend() || m_preparing.find(costume) != m_preparing.cend())
+        m_jobFinished.wait(&m_mutex);
+
+    m_images.erase(costume);
+    m_pending.erase(costume);
+    m_claimed.erase(costume);
+    m_owners.erase(costume);
+}
+
+int SkinImageStore::count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_images.size();
+}
+
+void SkinImageStore::clearPending(const void *owner)
+{
+    // Unmarks pending costumes of the owner which aren't going to be prepared anymore (their skins must decode them),
+    // prefetched costumes and prepared images are kept
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_claimed.begin(); it != m_claimed.end();) {
+        if (isOwned(*it, owner))
+            it = m_claimed.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        const libscratchcpp::Costume *costume = *it;
+        const bool busy = m_jobs.find(costume) != m_jobs.cend() || m_runningJobs.find(costume) != m_runningJobs.cend() || m_preparing.find(costume) != m_preparing.cend();
+
+        if (!busy && isOwned(costume, owner))
+            it = m_pending.erase(it);
+        else
+            ++it;
+    }
+}
+
+void SkinImageStore::clear(const void *owner)
+{
+    // Deletes the entries of the costumes of the owner (e.g. when its project is deleted), entries of other owners are kept
+    QMutexLocker locker(&m_mutex);
+
+    for (auto it = m_jobs.begin(); it != m_jobs.end();) {
+        if (isOwned(it->first, owner) && prefetchPool->tryTake(it->second)) {
+            delete it->second;
+            it = m_jobs.erase(it);
+        } else
+            ++it;
+    }
+
+    // Running jobs must finish because costumes can be deleted after this
+    auto busy = [this, owner]() {
+        for (const auto *set : { &m_runningJobs, &m_preparing }) {
+            for (const libscratchcpp::Costume *costume : *set) {
+                if (isOwned(costume, owner))
+                    return true;
+            }
+        }
+
+        for (const auto &[costume, job] : m_jobs) {
+            if (isOwned(costume, owner))
+                return true;
+        }
+
+        return false;
+    };
+
+    while (busy())
+        m_jobFinished.wait(&m_mutex);
+
+    std::vector<const libscratchcpp::Costume *> costumes;
+
+    for (const auto &[costume, costumeOwner] : m_owners) {
+        if (costumeOwner == owner)
+            costumes.push_back(costume);
+    }
+
+    for (const libscratchcpp::Costume *costume : costumes) {
+        m_images.erase(costume);
+        m_pending.erase(costume);
+        m_claimed.erase(costume);
+        m_owners.erase(costume);
+    }
+}
+
+void SkinImageStore::clear()
+{
+    // Cancel prefetch jobs (running jobs must finish because costumes can be deleted after this)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        for (const auto &[costume, job] : m_jobs) {
+            if (prefetchPool->tryTake(job))
+                delete job;
+        }
+
+        m_jobs.clear();
+    }
+
+    prefetchPool->waitForDone();
+
+    QMutexLocker locker(&m_mutex);
+    m_images.clear();
+    m_pending.clear();
+    m_claimed.clear();
+    m_owners.clear();
+}
+
+bool SkinImageStore::isOwned(const libscratchcpp::Costume *costume, const void *owner) const
+{
+    auto it = m_owners.find(costume);
+    return it != m_owners.cend() && it->second == owner;
+}
+
+SkinImageStore::Images SkinImageStore::prepareImages(const libscratchcpp::Costume *costume)
+{
+    Images images;
+
+    if (costume->dataFormat() == "svg") {
+        RasterCache::Entry entry = SVGSkin::prepareTexture(costume);
+        images.texture = entry.image;
+        images.hullPoints = std::move(entry.hullPoints);
+    } else {
+        images.image = BitmapSkin::decodeImage(costume);
+        images.texture = BitmapSkin::prepareTexture(images.image);
+        CpuTextureManager::calculateConvexHullPoints(images.texture, images.hullPoints);
+    }
+
+    return images;
+}
+
+void SkinImageStore::finishPreparing(const libscratchcpp::Costume *costume, Images &&images)
+{
+    QMutexLocker locker(&m_mutex);
+    m_preparing.erase(costume);
+    m_pending.erase(costume);
+
+    if (!images.texture.isNull())
+        m_images[costume] = std::move(images);
+
+    m_jobFinished.wakeAll();
+}
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QMutex>
+#include <QRunnable>
+#include <QWaitCondition>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace libscratchcpp
+{
+
+class Costume;
+
+}
+
+namespace scratchcpprender
+{
+
+/*!
+ * \brief The SkinImageStore class holds costume images which were prepared on worker threads (see ProjectLoader).
+ * Skins take the images when they're created, so only the texture upload is done in the GUI thread.
+ * Skins of pending costumes (which are going to be prepared) wait for the images instead of decoding the costumes themselves.
+ * Costumes can also be prefetched in the background (e.g. costumes which are likely going to be used soon).
+ * Pending costumes can be claimed when they're needed right away (e.g. for sensing), they're prepared in the calling thread then.
+ * Costumes belong to the project loader which loaded them, so that clearing the entries of a project doesn't affect other projects.
+ */
+class SkinImageStore
+{
+    public:
+        struct Images
+        {
+                QImage image;   // decoded bitmap (bitmap costumes only)
+                QImage texture; // texture image created by Skin::paintImage() (the default mip level of SVG costumes)
+                std::vector<QPoint> hullPoints; // convex hull points of the texture
+        };
+
+        SkinImageStore();
+        SkinImageStore(const SkinImageStore &) = delete;
+
+        static SkinImageStore *instance();
+
+        void setOwner(const libscratchcpp::Costume *costume, const void *owner);
+
+        void setPending(const libscratchcpp::Costume *costume);
+        bool isPending(const libscratchcpp::Costume *costume) const;
+
+        void prepare(libscratchcpp::Costume *costume);
+        Images take(const libscratchcpp::Costume *costume, bool *pending = nullptr);
+
+        void prefetch(libscratchcpp::Costume *costume, int priority);
+        void claim(const libscratchcpp::Costume *costume, bool preparePending = false);
+        bool isQueued(const libscratchcpp::Costume *costume) const;
+        void remove(const libscratchcpp::Costume *costume);
+
+        int count() const;
+        void clearPending(const void *owner);
+        void clear(const void *owner);
+        void clear();
+
+    private:
+        bool isOwned(const libscratchcpp::Costume *costume, const void *owner) const;
+        static Images prepareImages(const libscratchcpp::Costume *costume);
+        void finishPreparing(const libscratchcpp::Costume *costume, Images &&images);
+
+        mutable QMutex m_mutex;
+        std::unordered_map<const libscratchcpp::Costume *, Images> m_images;
+        std::unordered_set<const libscratchcpp::Costume *> m_pending;
+        std::unordered_map<const libscratchcpp::Costume *, QRunnable *> m_jobs; // queued prefetch jobs
+        std::unordered_set<const libscratchcpp::Costume *> m_runningJobs;
+        std::unordered_set<const libscratchcpp::Costume *> m_preparing;
+        std::unordered_set<const libscratchcpp::Costume *> m_claimed; // pending costumes which were prepared by claim() (see preparePending)
+        std::unordered_map<const libscratchcpp::Costume *, const void *> m_owners;
+        QWaitCondition m_jobFinished;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <scratchcpp/costume.h>
+#include <QtGlobal>
+
+#include "skinregistry.h"
+#include "skinimagestore.h"
+#include "bitmapskin.h"
+#include "svgskin.h"
+
+using namespace scratchcpprender;
+
+Q_GLOBAL_STATIC(SkinRegistry, globalInstance)
+
+bool SkinRegistry::Key::operator==(const Key &other) const
+{
+    return id == other.id && dataFormat == other.dataFormat && data == other.data && bitmapResolution == other.bitmapResolution;
+}
+
+size_t SkinRegistry::KeyHash::operator()(const Key &key) const
+{
+    size_t ret = std::hash<std::string>()(key.id);
+
+    auto combine = [&ret](size_t hash) { ret ^= hash + 0x9e3779b9 + (ret << 6) + (ret >> 2); };
+    combine(std::hash<std::string>()(key.dataFormat));
+    combine(std::hash<const void *>()(key.data));
+    combine(std::hash<double>()(key.bitmapResolution));
+
+    return ret;
+}
+
+SkinRegistry::SkinRegistry()
+{
+}
+
+SkinRegistry *SkinRegistry::instance()
+{
+    return globalInstance;
+}
+
+std::shared_ptr<Skin> SkinRegistry::getSkin(libscratchcpp::Costume *costume)
+{
+    // Returns the skin of the costume or an identical costume, it's created if it doesn't exist
+    if (!costume)
+        return nullptr;
+
+    const Key key = createKey(costume);
+    auto it = m_skins.find(key);
+
+    if (it != m_skins.cend()) {
+        std::shared_ptr<Skin> skin = it->second.lock();
+
+        if (skin)
+            return skin;
+    }
+
+    std::shared_ptr<Skin> skin(createSkin(costume), [key](Skin *skin) {
+        // Remove the skin from the registry when the last reference is released
+        SkinRegistry *registry = SkinRegistry::instance();
+
+        if (registry) {
+            auto it = registry->m_skins.find(key);
+
+            if (it != registry->m_skins.cend() && it->second.expired())
+                registry->m_skins.erase(it);
+        }
+
+        delete skin;
+    });
+
+    m_skins[key] = skin;
+    return skin;
+}
+
+bool SkinRegistry::contains(const libscratchcpp::Costume *costume) const
+{
+    // Returns true if there's a skin of the costume or an identical costume
+    if (!costume)
+        return false;
+
+    auto it = m_skins.find(createKey(costume));
+    return it != m_skins.cend() && !it->second.expired();
+}
+
+int SkinRegistry::count() const
+{
+    return m_skins.size();
+}
+
+SkinRegistry::Key SkinRegistry::createKey(const libscratchcpp::Costume *costume)
+{
+    // Asset IDs are MD5 hashes of the asset data (costumes created without an ID are identified by their data)
+    Key key;
+    key.id = costume->id();
+    key.dataFormat = costume->dataFormat();
+    key.bitmapResolution = costume->bitmapResolution();
+
+    if (key.id.empty())
+        key.data = costume->data();
+
+    return key;
+}
+
+Skin *SkinRegistry::createSkin(libscratchcpp::Costume *costume)
+{
+    // Prefetched costumes which haven't been decoded yet are decoded right away (costumes which are pending for ProjectLoader aren't, see Skin::claimPendingCostume())
+    SkinImageStore::instance()->claim(costume);
+
+    if (costume->dataFormat() == "svg")
+        return new SVGSkin(costume);
+    else
+        return new BitmapSkin(costume);
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <unordered_map>
+#include <memory>
+#include <string>
+
+namespace libscratchcpp
+{
+
+class Costume;
+
+}
+
+namespace scratchcpprender
+{
+
+class Skin;
+
+/*!
+ * \brief The SkinRegistry class shares skins of identical costumes (e.g. costumes of copied sprites).
+ * Costumes are identified by their asset ID (the MD5 hash of the asset) or their data, and their bitmap resolution.
+ * Identical costumes share the skin, its textures, the CPU copies of the textures and the convex hulls.
+ * Skins are deleted when the last reference is released.
+ */
+class SkinRegistry
+{
+    public:
+        SkinRegistry();
+        SkinRegistry(const SkinRegistry &) = delete;
+
+        static SkinRegistry *instance();
+
+        std::shared_ptr<Skin> getSkin(libscratchcpp::Costume *costume);
+        bool contains(const libscratchcpp::Costume *costume) const;
+
+        int count() const;
+
+    private:
+        struct Key
+        {
+                std::string id;
+                std::string dataFormat;
+                const void *data = nullptr; // costumes without an asset ID
+                double bitmapResolution = 1;
+
+                bool operator==(const Key &other) const;
+        };
+
+        struct KeyHash
+        {
+                size_t operator()(const Key &key) const;
+        };
+
+        static Key createKey(const libscratchcpp::Costume *costume);
+        static Skin *createSkin(libscratchcpp::Costume *costume);
+
+        std::unordered_map<Key, std::weak_ptr<Skin>, KeyHash> m_skins;
+};
+
+} // namespace scratchcpprender
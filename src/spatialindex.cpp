@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <cmath>
+#include <algorithm>
+
+#include "spatialindex.h"
+#include "irenderedtarget.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+static const double CELL_SIZE = 64;
+static const int MAX_CELLS = 64; // targets which cover more cells are checked in every query
+static const double MAX_COORDINATE = 1e6;
+
+static int cellCoord(double coord)
+{
+    // Clamp to avoid overflow with huge sprites
+    return std::floor(std::clamp(coord, -MAX_COORDINATE, MAX_COORDINATE) / CELL_SIZE);
+}
+
+std::unordered_map<IEngine *, std::unique_ptr<SpatialIndex>> SpatialIndex::m_projectIndexes;
+
+SpatialIndex::SpatialIndex()
+{
+}
+
+void SpatialIndex::add(IRenderedTarget *target)
+{
+    if (!target || contains(target))
+        return;
+
+    // The bounds are calculated in the next query
+    Entry entry;
+    entry.visible = target->isVisible();
+    m_entries[target] = entry;
+    m_dirtyEntries.push_back(target);
+
+    if (entry.visible)
+        m_visibleCount++;
+}
+
+void SpatialIndex::remove(IRenderedTarget *target)
+{
+    auto it = m_entries.find(target);
+
+    if (it == m_entries.end())
+        return;
+
+    Entry &entry = it->second;
+
+    if (entry.dirty)
+        m_dirtyEntries.erase(std::remove(m_dirtyEntries.begin(), m_dirtyEntries.end(), target), m_dirtyEntries.end());
+
+    removeFromCells(target, entry);
+
+    if (entry.visible)
+        m_visibleCount--;
+
+    setGroup(target, nullptr);
+    m_entries.erase(it);
+}
+
+void SpatialIndex::invalidate(IRenderedTarget *target)
+{
+    auto it = m_entries.find(target);
+
+    if (it == m_entries.end() || it->second.dirty)
+        return;
+
+    // Keep the target in its cells until the next query so that an unchanged position doesn't cause any work
+    it->second.dirty = true;
+    m_dirtyEntries.push_back(target);
+}
+
+void SpatialIndex::setVisible(IRenderedTarget *target, bool visible)
+{
+    auto it = m_entries.find(target);
+
+    if (it == m_entries.end() || it->second.visible == visible)
+        return;
+
+    it->second.visible = visible;
+    m_visibleCount += visible ? 1 : -1;
+
+    if (it->second.group)
+        addToGroupCount(m_visibleGroupSizes, it->second.group, visible ? 1 : -1);
+}
+
+void SpatialIndex::setGroup(IRenderedTarget *target, const void *group)
+{
+    auto it = m_entries.find(target);
+
+    if (it == m_entries.end() || it->second.group == group)
+        return;
+
+    Entry &entry = it->second;
+
+    if (entry.group) {
+        addToGroupCount(m_groupSizes, entry.group, -1);
+
+        if (entry.visible)
+            addToGroupCount(m_visibleGroupSizes, entry.group, -1);
+    }
+
+    entry.group = group;
+
+    if (group) {
+        addToGroupCount(m_groupSizes, group, 1);
+
+        if (entry.visible)
+            addToGroupCount(m_visibleGroupSizes, group, 1);
+    }
+}
+
+bool SpatialIndex::contains(IRenderedTarget *target) const
+{
+    return m_entries.find(target) != m_entries.cend();
+}
+
+bool SpatialIndex::isEmpty() const
+{
+    return m_entries.empty();
+}
+
+int SpatialIndex::visibleCount() const
+{
+    return m_visibleCount;
+}
+
+int SpatialIndex::groupSize(const void *group) const
+{
+    auto it = m_groupSizes.find(group);
+    return it == m_groupSizes.cend() ? 0 : it->second;
+}
+
+int SpatialIndex::visibleGroupSize(const void *group) const
+{
+    auto it = m_visibleGroupSizes.find(group);
+    return it == m_visibleGroupSizes.cend() ? 0 : it->second;
+}
+
+const std::vector<SpatialIndex::Result> &SpatialIndex::query(const QRectF &rect)
+{
+    // Returns the targets whose bounds overlap the rectangle (each target is returned once)
+    refresh();
+    m_queryId++;
+    m_results.clear();
+
+    if (rect.isEmpty())
+        return m_results;
+
+    // Be conservative: rectangles are snapped to integers by the callers
+    const QRectF queryRect = rect.adjusted(-1, -1, 1, 1);
+    const int left = cellCoord(queryRect.left());
+    const int right = cellCoord(queryRect.right());
+    const int bottom = cellCoord(queryRect.top()); // QRectF::top() is the lowest Scratch y coordinate
+    const int top = cellCoord(queryRect.bottom());
+
+    auto check = [this, &queryRect](IRenderedTarget *target) {
+        Entry &entry = m_entries[target];
+        const Rect &bounds = entry.bounds;
+
+        // Targets can be in multiple cells
+        if (entry.queryId == m_queryId)
+            return;
+
+        if (bounds.right() >= queryRect.left() && bounds.left() <= queryRect.right() && bounds.top() >= queryRect.top() && bounds.bottom() <= queryRect.bottom()) {
+            entry.queryId = m_queryId;
+            m_results.push_back({ target, bounds, entry.visible, entry.group });
+        }
+    };
+
+    for (int y = bottom; y <= top; y++) {
+        for (int x = left; x <= right; x++) {
+            auto it = m_cells.find(cellKey(x, y));
+
+            if (it == m_cells.cend())
+                continue;
+
+            for (IRenderedTarget *target : it->second)
+                check(target);
+        }
+    }
+
+    for (IRenderedTarget *target : m_largeEntries)
+        check(target);
+
+    return m_results;
+}
+
+const Rect *SpatialIndex::result(IRenderedTarget *target) const
+{
+    auto it = m_entries.find(target);
+
+    if (it == m_entries.cend() || it->second.queryId != m_queryId)
+        return nullptr;
+
+    return &it->second.bounds;
+}
+
+SpatialIndex *SpatialIndex::getProjectIndex(IEngine *engine)
+{
+    if (!engine)
+        return nullptr;
+
+    auto it = m_projectIndexes.find(engine);
+
+    if (it != m_projectIndexes.cend())
+        return it->second.get();
+
+    SpatialIndex *index = new SpatialIndex;
+    m_projectIndexes[engine] = std::unique_ptr<SpatialIndex>(index);
+    return index;
+}
+
+void SpatialIndex::removeProjectIndex(IEngine *engine)
+{
+    m_projectIndexes.erase(engine);
+}
+
+void SpatialIndex::refresh()
+{
+    for (IRenderedTarget *target : m_dirtyEntries) {
+        auto it = m_entries.find(target);
+        Q_ASSERT(it != m_entries.end());
+
+        if (it == m_entries.end())
+            continue;
+
+        Entry &entry = it->second;
+        const Rect bounds = target->getFastBounds();
+        const int left = cellCoord(bounds.left() - 1);
+        const int right = cellCoord(bounds.right() + 1);
+        const int top = cellCoord(bounds.top() + 1);
+        const int bottom = cellCoord(bounds.bottom() - 1);
+        entry.bounds = bounds;
+        entry.dirty = false;
+
+        if (left == entry.left && right == entry.right && top == entry.top && bottom == entry.bottom)
+            continue; // still in the same cells
+
+        removeFromCells(target, entry);
+        entry.left = left;
+        entry.right = right;
+        entry.top = top;
+        entry.bottom = bottom;
+        insertIntoCells(target, entry);
+    }
+
+    m_dirtyEntries.clear();
+}
+
+void SpatialIndex::insertIntoCells(IRenderedTarget *target, Entry &entry)
+{
+    const double cellCount = (static_cast<double>(entry.right) - entry.left + 1) * (static_cast<double>(entry.top) - entry.bottom + 1);
+    entry.large = cellCount > MAX_CELLS || cellCount <= 0;
+
+    if (entry.large) {
+        m_largeEntries.push_back(target);
+        return;
+    }
+
+    for (int y = entry.bottom; y <= entry.top; y++) {
+        for (int x = entry.left; x <= entry.right; x++)
+            m_cells[cellKey(x, y)].push_back(target);
+    }
+}
+
+void SpatialIndex::removeFromCells(IRenderedTarget *target, Entry &entry)
+{
+    if (entry.large) {
+        m_largeEntries.erase(std::remove(m_largeEntries.begin(), m_largeEntries.end(), target), m_largeEntries.end());
+        entry.large = false;
+        return;
+    }
+
+    for (int y = entry.bottom; y <= entry.top; y++) {
+        for (int x = entry.left; x <= entry.right; x++) {
+            auto it = m_cells.find(cellKey(x, y));
+
+            if (it == m_cells.end())
+                continue;
+
+            std::vector<IRenderedTarget *> &cell = it->second;
+            cell.erase(std::remove(cell.begin(), cell.end(), target), cell.end());
+
+            if (cell.empty())
+                m_cells.erase(it);
+        }
+    }
+}
+
+void SpatialIndex::addToGroupCount(std::unordered_map<const void *, int> &counts, const void *group, int delta)
+{
+    // Groups without any targets are removed
+    int &count = counts[group];
+    count += delta;
+    Q_ASSERT(count >= 0);
+
+    if (count == 0)
+        counts.erase(group);
+}
+
+long long SpatialIndex::cellKey(int x, int y)
+{
+    return static_cast<long long>((static_cast<unsigned long long>(static_cast<unsigned int>(x)) << 32) | static_cast<unsigned int>(y));
+}
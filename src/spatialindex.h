@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QRectF>
+#include <scratchcpp/rect.h>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+
+namespace libscratchcpp
+{
+
+class IEngine;
+
+}
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+
+/*!
+ * \brief The SpatialIndex class is a uniform grid of target bounding rectangles.
+ * It's used to quickly find the candidates of collision queries (touching sprite, touching color).
+ * Targets can be assigned to a group (e.g. clones of a sprite), and the index counts visible targets and (visible) targets in each group,
+ * so that callers can tell whether a candidate list only contains indexed targets.
+ */
+class SpatialIndex
+{
+    public:
+        struct Result
+        {
+                IRenderedTarget *target = nullptr;
+                libscratchcpp::Rect bounds;
+                bool visible = true;
+                const void *group = nullptr;
+        };
+
+        SpatialIndex();
+        SpatialIndex(const SpatialIndex &) = delete;
+
+        void add(IRenderedTarget *target);
+        void remove(IRenderedTarget *target);
+        void invalidate(IRenderedTarget *target);
+
+        void setVisible(IRenderedTarget *target, bool visible);
+        void setGroup(IRenderedTarget *target, const void *group);
+
+        bool contains(IRenderedTarget *target) const;
+        bool isEmpty() const;
+        int visibleCount() const;
+        int groupSize(const void *group) const;
+        int visibleGroupSize(const void *group) const;
+
+        const std::vector<Result> &query(const QRectF &rect);
+        const libscratchcpp::Rect *result(IRenderedTarget *target) const;
+
+        static SpatialIndex *getProjectIndex(libscratchcpp::IEngine *engine);
+        static void removeProjectIndex(libscratchcpp::IEngine *engine);
+
+    private:
+        struct Entry
+        {
+                libscratchcpp::Rect bounds;
+                int left = 0;
+                int top = 0;
+                int right = -1;
+                int bottom = -1;
+                bool large = false;
+                bool dirty = true;
+                bool visible = true;
+                const void *group = nullptr;
+                unsigned int queryId = 0;
+        };
+
+        void refresh();
+        void insertIntoCells(IRenderedTarget *target, Entry &entry);
+        void removeFromCells(IRenderedTarget *target, Entry &entry);
+        static void addToGroupCount(std::unordered_map<const void *, int> &counts, const void *group, int delta);
+        static long long cellKey(int x, int y);
+
+        static std::unordered_map<libscratchcpp::IEngine *, std::unique_ptr<SpatialIndex>> m_projectIndexes;
+        std::unordered_map<IRenderedTarget *, Entry> m_entries;
+        std::unordered_map<long long, std::vector<IRenderedTarget *>> m_cells;
+        std::vector<IRenderedTarget *> m_largeEntries; // entries which span too many cells
+        std::vector<IRenderedTarget *> m_dirtyEntries;
+        std::vector<Result> m_results; // targets found by the last query
+        std::unordered_map<const void *, int> m_groupSizes;
+        std::unordered_map<const void *, int> m_visibleGroupSizes;
+        int m_visibleCount = 0;
+        unsigned int m_queryId = 0;
+};
+
+} // namespace scratchcpprender
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <cmath>
+
+#include "stagecomposite.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+std::unordered_map<IEngine *, std::unique_ptr<StageComposite>> StageComposite::m_projectComposites;
+
+StageComposite::StageComposite()
+{
+}
+
+void StageComposite::add(IRenderedTarget *target)
+{
+    if (target)
+        m_users.insert(target);
+}
+
+void StageComposite::remove(IRenderedTarget *target)
+{
+    m_users.erase(target);
+    m_tiles.erase(target);
+}
+
+bool StageComposite::isEmpty() const
+{
+    return m_users.empty();
+}
+
+void StageComposite::invalidate()
+{
+    // Tiles and the list of targets are dropped in the next query
+    m_version++;
+}
+
+unsigned int StageComposite::version() const
+{
+    return m_version;
+}
+
+bool StageComposite::targetsValid() const
+{
+    return m_targetsVersion == m_version;
+}
+
+bool StageComposite::supported() const
+{
+    // Only targets which invalidate the composite can be cached
+    return targetsValid() && m_supported;
+}
+
+const std::vector<IRenderedTarget *> &StageComposite::targets() const
+{
+    return m_targets;
+}
+
+void StageComposite::setTargets(const std::vector<IRenderedTarget *> &targets, bool supported)
+{
+    m_targets = targets;
+    m_supported = supported;
+    m_targetsVersion = m_version;
+}
+
+const QRgb *StageComposite::tile(const IRenderedTarget *excludedTarget, int tileX, int tileY)
+{
+    update();
+    auto it = m_tiles.find(excludedTarget);
+
+    if (it == m_tiles.cend())
+        return nullptr;
+
+    auto tileIt = it->second.find(tileKey(tileX, tileY));
+
+    if (tileIt == it->second.cend())
+        return nullptr;
+
+    return tileIt->second.data();
+}
+
+QRgb *StageComposite::addTile(const IRenderedTarget *excludedTarget, int tileX, int tileY)
+{
+    // The colors are stored row by row, starting with the lowest y coordinate
+    update();
+    std::vector<QRgb> &tile = m_tiles[excludedTarget][tileKey(tileX, tileY)];
+    tile.resize(TILE_SIZE * TILE_SIZE);
+    return tile.data();
+}
+
+int StageComposite::tileCoord(int coord)
+{
+    return std::floor(coord / static_cast<double>(TILE_SIZE));
+}
+
+StageComposite *StageComposite::getProjectComposite(IEngine *engine)
+{
+    if (!engine)
+        return nullptr;
+
+    auto it = m_projectComposites.find(engine);
+
+    if (it != m_projectComposites.cend())
+        return it->second.get();
+
+    StageComposite *composite = new StageComposite;
+    m_projectComposites[engine] = std::unique_ptr<StageComposite>(composite);
+    return composite;
+}
+
+void StageComposite::removeProjectComposite(IEngine *engine)
+{
+    m_projectComposites.erase(engine);
+}
+
+void StageComposite::invalidateProject(IEngine *engine)
+{
+    // Used by the pen layer (it doesn't create the composite)
+    auto it = m_projectComposites.find(engine);
+
+    if (it != m_projectComposites.cend())
+        it->second->invalidate();
+}
+
+void StageComposite::invalidateAll()
+{
+    for (auto &[engine, composite] : m_projectComposites)
+        composite->invalidate();
+}
+
+void StageComposite::update()
+{
+    if (m_tilesVersion != m_version) {
+        m_tiles.clear();
+        m_tilesVersion = m_version;
+    }
+}
+
+long long StageComposite::tileKey(int x, int y)
+{
+    return static_cast<long long>((static_cast<unsigned long long>(static_cast<unsigned int>(x)) << 32) | static_cast<unsigned int>(y));
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#pragma once
+
+#include <QRgb>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <memory>
+
+namespace libscratchcpp
+{
+
+class IEngine;
+
+}
+
+namespace scratchcpprender
+{
+
+class IRenderedTarget;
+
+/*!
+ * \brief The StageComposite class caches blended colors of the stage, pen layer and sprites for color queries.
+ * Each querying target has its own composite without its layer. Tiles are built on demand and they're reused
+ * until the scene changes (see invalidate()).
+ */
+class StageComposite
+{
+    public:
+        static inline const int TILE_SIZE = 32;
+
+        StageComposite();
+        StageComposite(const StageComposite &) = delete;
+
+        void add(IRenderedTarget *target);
+        void remove(IRenderedTarget *target);
+        bool isEmpty() const;
+
+        void invalidate();
+        unsigned int version() const;
+
+        bool targetsValid() const;
+        bool supported() const;
+        const std::vector<IRenderedTarget *> &targets() const;
+        void setTargets(const std::vector<IRenderedTarget *> &targets, bool supported);
+
+        const QRgb *tile(const IRenderedTarget *excludedTarget, int tileX, int tileY);
+        QRgb *addTile(const IRenderedTarget *excludedTarget, int tileX, int tileY);
+
+        static int tileCoord(int coord);
+
+        static StageComposite *getProjectComposite(libscratchcpp::IEngine *engine);
+        static void removeProjectComposite(libscratchcpp::IEngine *engine);
+        static void invalidateProject(libscratchcpp::IEngine *engine);
+        static void invalidateAll();
+
+    private:
+        void update();
+        static long long tileKey(int x, int y);
+
+        static std::unordered_map<libscratchcpp::IEngine *, std::unique_ptr<StageComposite>> m_projectComposites;
+        std::unordered_set<IRenderedTarget *> m_users;
+        unsigned int m_version = 1;
+        unsigned int m_tilesVersion = 0;
+        unsigned int m_targetsVersion = 0;
+        bool m_supported = false;
+        std::vector<IRenderedTarget *> m_targets; // visible targets from front to back
+        std::unordered_map<const IRenderedTarget *, std::unordered_map<long long, std::vector<QRgb>>> m_tiles;
+};
+
+} // namespace scratchcpprender
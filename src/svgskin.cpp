@@ -1,22 +1,34 @@
 // SPDX-License-Identifier: LGPL-3.0-or-later
 
 #include <scratchcpp/costume.h>
+#include <QtConcurrent/QtConcurrent>
 
 #include "svgskin.h"
+#include "skinimagestore.h"
+#include "cputexturemanager.h"
 
 using namespace scratchcpprender;
 
 static const int MAX_TEXTURE_DIMENSION = 2048;
 static const int INDEX_OFFSET = 8;
 
+Q_GLOBAL_STATIC(QThreadPool, rasterizationPool)
+
 SVGSkin::SVGSkin(libscratchcpp::Costume *costume) :
     Skin()
 {
     if (!costume)
         return;
 
+    bool pending = false;
+    SkinImageStore::Images images = SkinImageStore::instance()->take(costume, &pending);
+
     // Load SVG data
-    m_svgRen.load(QByteArray(static_cast<const char *>(costume->data()), costume->dataSize()));
+    m_data = QByteArray(static_cast<const char *>(costume->data()), costume->dataSize());
+    m_svgRen.load(m_data);
+
+    if (RasterCache::instance()->enabled())
+        m_hash = RasterCache::hash(m_data);
 
     // Calculate maximum index (larger images will only be scaled up)
     const QRectF viewBox = m_svgRen.viewBox();
@@ -27,9 +39,21 @@ SVGSkin::SVGSkin(libscratchcpp::Costume *costume) :
     const int i1 = std::log2(MAX_TEXTURE_DIMENSION / viewBox.width()) + INDEX_OFFSET;
     const int i2 = std::log2(MAX_TEXTURE_DIMENSION / viewBox.height()) + INDEX_OFFSET;
     m_maxIndex = std::min(i1, i2);
+    setSize(textureSize(std::min(INDEX_OFFSET, m_maxIndex)));
+
+    // Use the default mip level rasterized in the background if there's any (see SkinImageStore)
+    if (INDEX_OFFSET <= m_maxIndex && !images.texture.isNull() && images.texture.size() == textureSize(INDEX_OFFSET)) {
+        const Texture texture = createTexture(images.texture, &images.hullPoints);
+
+        if (texture.isValid())
+            addScaledTexture(INDEX_OFFSET, texture);
+    } else if (images.texture.isNull() && pending) {
+        // Textures will be created when the default mip level is ready (see updateTextures())
+        m_pendingCostume = costume;
+    }
 }
 
-Texture SVGSkin::getTexture(double scale) const
+Texture SVGSkin::getTexture(double scale)
 {
     // https://github.com/scratchfoundation/scratch-render/blob/423bb700c36b8c1c0baae1e2413878a4f778849a/src/SVGSkin.js#L158-L176
     int mipLevel = std::max(std::ceil(std::log2(scale)) + INDEX_OFFSET, 0.0);
@@ -37,12 +61,33 @@ Texture SVGSkin::getTexture(double scale) const
     // Limit to maximum index
     mipLevel = std::min(mipLevel, m_maxIndex);
 
+    // Don't rasterize the costume while it's being prepared in the background
+    if (m_pendingCostume)
+        return Texture();
+
     auto it = m_textures.find(mipLevel);
 
-    if (it == m_textures.cend())
-        return const_cast<SVGSkin *>(this)->createScaledTexture(mipLevel); // TODO: Remove that awful const_cast ;)
-    else
-        return m_textureObjects.at(it->second);
+    if (it != m_textures.cend()) {
+        const Texture &texture = m_textureObjects.at(it->second);
+        markUsed(texture);
+        return texture;
+    }
+
+    // Large mip levels are rasterized in the background, the nearest available level is used until then (see updateTextures())
+    const QSize size = textureSize(mipLevel);
+
+    if (size.width() * size.height() > MAX_SYNC_PIXELS) {
+        const Texture nearest = nearestTexture(mipLevel);
+
+        if (nearest.isValid()) {
+            startRasterization(mipLevel);
+            markUsed(nearest);
+            return nearest;
+        }
+    }
+
+    // Small mip levels (and the first one) are rasterized right away, the caller needs the texture in this frame (e.g. for sensing)
+    return createScaledTexture(mipLevel);
 }
 
 double SVGSkin::getTextureScale(const Texture &texture) const
@@ -55,12 +100,151 @@ double SVGSkin::getTextureScale(const Texture &texture) const
     return 1;
 }
 
+bool SVGSkin::updateTextures()
+{
+    // Uploads the mip levels which have been rasterized in the background
+    bool added = updatePendingCostume();
+
+    for (auto it = m_pendingTextures.begin(); it != m_pendingTextures.end();) {
+        if (!it->second.isFinished()) {
+            it++;
+            continue;
+        }
+
+        const int index = it->first;
+        const RasterCache::Entry result = it->second.result();
+
+        // The mip level might have been created synchronously in the meantime
+        if (!result.image.isNull() && m_textures.find(index) == m_textures.cend()) {
+            const Texture texture = createTexture(result.image, &result.hullPoints);
+
+            // Try again later if there isn't an OpenGL context
+            if (!texture.isValid()) {
+                it++;
+                continue;
+            }
+
+            addScaledTexture(index, texture);
+            added = true;
+        }
+
+        it = m_pendingTextures.erase(it);
+    }
+
+    if (added)
+        newTexturesAvailable();
+
+    return added;
+}
+
+bool SVGSkin::claimPendingCostume()
+{
+    // Waits for the default mip level if the costume is being prepared in the background (sensing can't wait until the next frame)
+    if (!m_pendingCostume)
+        return false;
+
+    SkinImageStore::instance()->claim(m_pendingCostume, true);
+    return updateTextures();
+}
+
+void SVGSkin::waitForTextures()
+{
+    for (auto &[index, future] : m_pendingTextures)
+        future.waitForFinished();
+
+    updateTextures();
+}
+
 void SVGSkin::paint(QPainter *painter)
 {
     const QPaintDevice *device = painter->device();
     m_svgRen.render(painter, QRectF(0, 0, device->width(), device->height()));
 }
 
+void SVGSkin::textureRemoved(const Texture &texture)
+{
+    // The mip level will be rasterized again when it's needed
+    auto it = m_textureIndexes.find(texture.handle());
+
+    if (it != m_textureIndexes.cend()) {
+        m_textures.erase(it->second);
+        m_textureObjects.erase(texture.handle());
+        m_textureIndexes.erase(it);
+    }
+}
+
+RasterCache::Entry SVGSkin::prepareTexture(const libscratchcpp::Costume *costume)
+{
+    // Rasterizes the default mip level (scale 1) of the costume (this can be called from any thread)
+    const QByteArray data(static_cast<const char *>(costume->data()), costume->dataSize());
+    QSvgRenderer renderer(data);
+    const QRect viewBox = renderer.viewBox();
+
+    if (viewBox.width() > MAX_TEXTURE_DIMENSION || viewBox.height() > MAX_TEXTURE_DIMENSION)
+        return RasterCache::Entry();
+
+    const QByteArray hash = RasterCache::instance()->enabled() ? RasterCache::hash(data) : QByteArray();
+    return rasterize(data, hash, INDEX_OFFSET, viewBox.size(), &renderer);
+}
+
+RasterCache::Entry SVGSkin::rasterize(const QByteArray &data, const QByteArray &hash, int index, const QSize &size, QSvgRenderer *renderer)
+{
+    // Returns the texture image and its convex hull points, cached textures are used if there are any (this can be called from any thread)
+    RasterCache *cache = RasterCache::instance();
+    RasterCache::Entry entry;
+
+    if (cache->load(hash, index, entry) && entry.image.size() == size)
+        return entry;
+
+    // Renderers can't be shared between threads, so each job has its own renderer
+    std::unique_ptr<QSvgRenderer> ownRenderer;
+
+    if (!renderer) {
+        ownRenderer = std::make_unique<QSvgRenderer>(data);
+        renderer = ownRenderer.get();
+    }
+
+    entry.image = paintImage(size.width(), size.height(), [renderer, &size](QPainter *painter) { renderer->render(painter, QRectF(0, 0, size.width(), size.height())); });
+    CpuTextureManager::calculateConvexHullPoints(entry.image, entry.hullPoints);
+    cache->store(hash, index, entry);
+    return entry;
+}
+
+QSize SVGSkin::textureSize(int index) const
+{
+    const double scale = std::pow(2, index - INDEX_OFFSET);
+    const QRect viewBox = m_svgRen.viewBox();
+    return QSize(viewBox.width() * scale, viewBox.height() * scale);
+}
+
+Texture SVGSkin::nearestTexture(int index) const
+{
+    // Returns the available mip level which is closest to the given one (larger ones are preferred)
+    int nearest = -1;
+
+    for (const auto &[i, handle] : m_textures) {
+        if (nearest == -1 || std::abs(i - index) < std::abs(nearest - index) || (std::abs(i - index) == std::abs(nearest - index) && i > nearest))
+            nearest = i;
+    }
+
+    if (nearest == -1)
+        return Texture();
+
+    return m_textureObjects.at(m_textures.at(nearest));
+}
+
+void SVGSkin::startRasterization(int index)
+{
+    if (m_pendingTextures.find(index) != m_pendingTextures.cend())
+        return;
+
+    const QByteArray data = m_data;
+    const QByteArray hash = m_hash;
+    const QSize size = textureSize(index);
+
+    m_pendingTextures[index] = QtConcurrent::run(rasterizationPool, [data, hash, index, size]() { return rasterize(data, hash, index, size); });
+}
+
 Texture SVGSkin::createScaledTexture(int index)
 {
     Q_ASSERT(m_textures.find(index) == m_textures.cend());
@@ -69,23 +253,51 @@ Texture SVGSkin::createScaledTexture(int index)
     if (it != m_textures.cend())
         return m_textureObjects[it->second];
 
-    const double scale = std::pow(2, index - INDEX_OFFSET);
-    const QRect viewBox = m_svgRen.viewBox();
-    const double width = viewBox.width() * scale;
-    const double height = viewBox.height() * scale;
+    const QSize size = textureSize(index);
 
-    if (width > MAX_TEXTURE_DIMENSION || height > MAX_TEXTURE_DIMENSION) {
+    if (size.width() > MAX_TEXTURE_DIMENSION || size.height() > MAX_TEXTURE_DIMENSION) {
         Q_ASSERT(false); // this shouldn't happen because indexes are limited to the max index
         return Texture();
     }
 
-    const Texture texture = createAndPaintTexture(viewBox.width() * scale, viewBox.height() * scale);
+    if (!QOpenGLContext::currentContext() || size.width() <= 0 || size.height() <= 0)
+        return Texture();
 
-    if (texture.isValid()) {
-        m_textures[index] = texture.handle();
-        m_textureIndexes[texture.handle()] = index;
-        m_textureObjects[texture.handle()] = texture;
-    }
+    const RasterCache::Entry entry = rasterize(m_data, m_hash, index, size, &m_svgRen);
+    const Texture texture = createTexture(entry.image, &entry.hullPoints);
+
+    if (texture.isValid())
+        addScaledTexture(index, texture);
 
     return texture;
 }
+
+void SVGSkin::addScaledTexture(int index, const Texture &texture)
+{
+    m_textures[index] = texture.handle();
+    m_textureIndexes[texture.handle()] = index;
+    m_textureObjects[texture.handle()] = texture;
+}
+
+bool SVGSkin::updatePendingCostume()
+{
+    // Uploads the default mip level prepared in the background (other mip levels can be created after that)
+    if (!m_pendingCostume)
+        return false;
+
+    bool pending = false;
+    SkinImageStore::Images images = SkinImageStore::instance()->take(m_pendingCostume, &pending);
+
+    if (images.texture.isNull() && pending)
+        return false;
+
+    if (!images.texture.isNull() && images.texture.size() == textureSize(INDEX_OFFSET) && m_textures.find(INDEX_OFFSET) == m_textures.cend()) {
+        const Texture texture = createTexture(images.texture, &images.hullPoints);
+
+        if (texture.isValid())
+            addScaledTexture(INDEX_OFFSET, texture);
+    }
+
+    m_pendingCostume = nullptr;
+    return true;
+}
@@ -3,9 +3,11 @@
 #pragma once
 
 #include <QSvgRenderer>
+#include <QFuture>
 
 #include "skin.h"
 #include "texture.h"
+#include "rastercache.h"
 
 namespace libscratchcpp
 {
@@ -20,22 +22,41 @@ namespace scratchcpprender
 class SVGSkin : public Skin
 {
     public:
+        static inline const int MAX_SYNC_PIXELS = 256 * 256; // larger mip levels are rasterized in the background
+
         SVGSkin(libscratchcpp::Costume *costume);
 
-        Texture getTexture(double scale) const override;
+        Texture getTexture(double scale) override;
         double getTextureScale(const Texture &texture) const override;
 
+        bool updateTextures() override;
+        bool claimPendingCostume() override;
+        void waitForTextures();
+
+        static RasterCache::Entry prepareTexture(const libscratchcpp::Costume *costume);
+
     protected:
         void paint(QPainter *painter) override;
+        void textureRemoved(const Texture &texture) override;
 
     private:
+        static RasterCache::Entry rasterize(const QByteArray &data, const QByteArray &hash, int index, const QSize &size, QSvgRenderer *renderer = nullptr);
+        QSize textureSize(int index) const;
+        Texture nearestTexture(int index) const;
+        void startRasterization(int index);
         Texture createScaledTexture(int index);
+        void addScaledTexture(int index, const Texture &texture);
+        bool updatePendingCostume();
 
         std::unordered_map<int, GLuint> m_textures;
         std::unordered_map<GLuint, int> m_textureIndexes; // reverse map of m_textures
         std::unordered_map<GLuint, Texture> m_textureObjects;
+        std::unordered_map<int, QFuture<RasterCache::Entry>> m_pendingTextures; // mip levels which are being rasterized in the background
+        QByteArray m_data;
+        QByteArray m_hash; // see RasterCache
         QSvgRenderer m_svgRen;
         int m_maxIndex = 0;
+        const libscratchcpp::Costume *m_pendingCostume = nullptr; // prepared in the background (see SkinImageStore)
 };
 
 } // namespace scratchcpprender
@@ -5,7 +5,7 @@
 #include <scratchcpp/costume.h>
 
 #include "targetpainter.h"
-#include "irenderedtarget.h"
+#include "renderedtarget.h"
 #include "spritemodel.h"
 #include "bitmapskin.h"
 #include "shadermanager.h"
@@ -46,6 +46,12 @@ void TargetPainter::paint(QNanoPainter *painter)
     if (!texture.isValid())
         return;
 
+    // Use the texture with baked effects if there's one
+    EffectState effects = m_target->graphicEffects();
+
+    if (RenderedTarget *target = dynamic_cast<RenderedTarget *>(m_target))
+        target->bakeEffects(texture, effects);
+
     // Create a FBO for the current texture
     unsigned int fbo;
     glF.glGenFramebuffers(1, &fbo);
@@ -61,7 +67,6 @@ void TargetPainter::paint(QNanoPainter *painter)
     // Get the shader program for the current set of effects
     ShaderManager *shaderManager = ShaderManager::instance();
 
-    const auto &effects = m_target->graphicEffects();
     QOpenGLShaderProgram *shaderProgram = shaderManager->getShaderProgram(effects);
     Q_ASSERT(shaderProgram);
     Q_ASSERT(shaderProgram->isLinked());
@@ -0,0 +1,70 @@
+#include <convexhull.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+TEST(ConvexHullTest, Build)
+{
+    std::vector<QPointF> points = { QPointF(4, 4), QPointF(0, 0), QPointF(2, 1), QPointF(4, 0), QPointF(1, 3), QPointF(0, 4), QPointF(2, 0) };
+    std::vector<QPointF> hull;
+    ConvexHull::build(points, hull);
+    ASSERT_EQ(hull, std::vector<QPointF>({ QPointF(0, 0), QPointF(4, 0), QPointF(4, 4), QPointF(0, 4) }));
+
+    points = { QPointF(0, 0), QPointF(1, 1) };
+    ConvexHull::build(points, hull);
+    ASSERT_EQ(hull, points);
+
+    points.clear();
+    ConvexHull::build(points, hull);
+    ASSERT_TRUE(hull.empty());
+}
+
+TEST(ConvexHullTest, Intersects)
+{
+    std::vector<QPointF> points = { QPointF(0, 0), QPointF(4, 0), QPointF(4, 4), QPointF(0, 4) };
+    std::vector<QPointF> square;
+    ConvexHull::build(points, square);
+
+    points = { QPointF(0, -1), QPointF(1, 0), QPointF(0, 1), QPointF(-1, 0) };
+    std::vector<QPointF> diamond;
+    ConvexHull::build(points, diamond);
+
+    ASSERT_TRUE(ConvexHull::intersects(square, diamond));
+    ASSERT_TRUE(ConvexHull::intersects(square, diamond, QPointF(4.5, 2)));
+    ASSERT_TRUE(ConvexHull::intersects(square, diamond, QPointF(5, 2)));
+    ASSERT_FALSE(ConvexHull::intersects(square, diamond, QPointF(5.5, 2)));
+
+    // The bounding rectangles intersect, but the polygons don't
+    ASSERT_FALSE(ConvexHull::intersects(square, diamond, QPointF(-0.6, -0.6)));
+    ASSERT_FALSE(ConvexHull::intersects(diamond, square, QPointF(0.6, 0.6)));
+    ASSERT_TRUE(ConvexHull::intersects(diamond, square, QPointF(0.4, 0.4)));
+
+    ASSERT_FALSE(ConvexHull::intersects(square, {}));
+    ASSERT_FALSE(ConvexHull::intersects({}, diamond));
+}
+
+TEST(ConvexHullTest, IntersectionBounds)
+{
+    std::vector<QPointF> points = { QPointF(0, 0), QPointF(4, 0), QPointF(4, 4), QPointF(0, 4) };
+    std::vector<QPointF> square;
+    ConvexHull::build(points, square);
+
+    points = { QPointF(0, -1), QPointF(1, 0), QPointF(0, 1), QPointF(-1, 0) };
+    std::vector<QPointF> diamond;
+    ConvexHull::build(points, diamond);
+
+    QRectF rect;
+    ASSERT_TRUE(ConvexHull::intersectionBounds(square, square, rect, QPointF(3, -2)));
+    ASSERT_EQ(rect, QRectF(QPointF(3, 0), QPointF(4, 2)));
+
+    ASSERT_TRUE(ConvexHull::intersectionBounds(square, diamond, rect));
+    ASSERT_EQ(rect, QRectF(QPointF(0, 0), QPointF(1, 1)));
+
+    ASSERT_TRUE(ConvexHull::intersectionBounds(diamond, square, rect, QPointF(-2, 0.5)));
+    ASSERT_EQ(rect, QRectF(QPointF(-0.5, 0.5), QPointF(0.5, 1)));
+
+    ASSERT_FALSE(ConvexHull::intersectionBounds(square, diamond, rect, QPointF(-0.6, -0.6)));
+    ASSERT_FALSE(ConvexHull::intersectionBounds(square, square, rect, QPointF(5, 0)));
+    ASSERT_FALSE(ConvexHull::intersectionBounds(square, {}, rect));
+}
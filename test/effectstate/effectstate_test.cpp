@@ -0,0 +1,82 @@
+#include <effectstate.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+TEST(EffectStateTest, Constructors)
+{
+    EffectState state1;
+    ASSERT_TRUE(state1.empty());
+    ASSERT_EQ(state1.mask(), ShaderManager::Effect::NoEffect);
+
+    for (ShaderManager::Effect effect : ShaderManager::effects()) {
+        ASSERT_FALSE(state1.contains(effect));
+        ASSERT_EQ(state1.value(effect), 0);
+        ASSERT_EQ(state1.uniformValue(effect), ShaderManager::uniformValue(effect, 0));
+    }
+
+    EffectState state2({ { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 }, { ShaderManager::Effect::Whirl, 0 } });
+    ASSERT_FALSE(state2.empty());
+    ASSERT_EQ(state2.mask(), ShaderManager::Effect::Color | ShaderManager::Effect::Ghost);
+    ASSERT_EQ(state2.value(ShaderManager::Effect::Color), 64.9);
+    ASSERT_EQ(state2.value(ShaderManager::Effect::Ghost), 12.5);
+    ASSERT_EQ(state2.value(ShaderManager::Effect::Whirl), 0);
+    ASSERT_EQ(state2.uniformValue(ShaderManager::Effect::Color), ShaderManager::uniformValue(ShaderManager::Effect::Color, 64.9));
+    ASSERT_EQ(state2.uniformValue(ShaderManager::Effect::Ghost), ShaderManager::uniformValue(ShaderManager::Effect::Ghost, 12.5));
+    ASSERT_EQ(state2.uniformValue(ShaderManager::Effect::Whirl), ShaderManager::uniformValue(ShaderManager::Effect::Whirl, 0));
+
+    // Maps must be converted explicitly
+    static_assert(!std::is_convertible_v<std::unordered_map<ShaderManager::Effect, double>, EffectState>);
+}
+
+TEST(EffectStateTest, SetValue)
+{
+    EffectState state;
+    ASSERT_TRUE(state.setValue(ShaderManager::Effect::Brightness, -20.5));
+    ASSERT_FALSE(state.setValue(ShaderManager::Effect::Brightness, -20.5));
+    ASSERT_TRUE(state.contains(ShaderManager::Effect::Brightness));
+    ASSERT_EQ(state.value(ShaderManager::Effect::Brightness), -20.5);
+    ASSERT_EQ(state.uniformValue(ShaderManager::Effect::Brightness), ShaderManager::uniformValue(ShaderManager::Effect::Brightness, -20.5));
+
+    ASSERT_TRUE(state.setValue(ShaderManager::Effect::Mosaic, 40));
+    ASSERT_EQ(state.mask(), ShaderManager::Effect::Brightness | ShaderManager::Effect::Mosaic);
+
+    // Zero disables the effect
+    ASSERT_TRUE(state.setValue(ShaderManager::Effect::Brightness, 0));
+    ASSERT_FALSE(state.setValue(ShaderManager::Effect::Brightness, 0));
+    ASSERT_FALSE(state.contains(ShaderManager::Effect::Brightness));
+    ASSERT_EQ(state.mask(), ShaderManager::Effect::Mosaic);
+    ASSERT_EQ(state.uniformValue(ShaderManager::Effect::Brightness), ShaderManager::uniformValue(ShaderManager::Effect::Brightness, 0));
+
+    // NoEffect doesn't have a value
+    ASSERT_FALSE(state.setValue(ShaderManager::Effect::NoEffect, 10));
+    ASSERT_EQ(state.mask(), ShaderManager::Effect::Mosaic);
+    ASSERT_EQ(state.value(ShaderManager::Effect::Color), 0);
+
+    state.clear();
+    ASSERT_TRUE(state.empty());
+    ASSERT_EQ(state.value(ShaderManager::Effect::Mosaic), 0);
+    ASSERT_EQ(state.uniformValue(ShaderManager::Effect::Mosaic), ShaderManager::uniformValue(ShaderManager::Effect::Mosaic, 0));
+}
+
+TEST(EffectStateTest, Compare)
+{
+    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Pixelate, 5 } };
+    EffectState state1(effects);
+    EffectState state2;
+    ASSERT_NE(state1, state2);
+    ASSERT_EQ(state1.toMap(), effects);
+
+    state2.setValue(ShaderManager::Effect::Pixelate, 5);
+    state2.setValue(ShaderManager::Effect::Ghost, 30);
+    state2.setValue(ShaderManager::Effect::Color, 64.9);
+    ASSERT_NE(state1, state2);
+
+    // Copies are independent
+    EffectState state3 = state2;
+    state2.setValue(ShaderManager::Effect::Ghost, 0);
+    ASSERT_EQ(state1, state2);
+    ASSERT_NE(state2, state3);
+    ASSERT_EQ(state3.value(ShaderManager::Effect::Ghost), 30);
+}
@@ -5,12 +5,93 @@
 
 using namespace scratchcpprender;
 
+// QColor based implementation which was used before the float kernel
+static QRgb referenceTransformColor(ShaderManager::Effect effectMask, const EffectState &effects, QRgb color)
+{
+    if (qAlpha(color) == 0)
+        return color;
+
+    QColor inOutColor = QColor::fromRgba(color);
+
+    const bool enableColor = (effectMask & ShaderManager::Effect::Color) != 0;
+    const bool enableBrightness = (effectMask & ShaderManager::Effect::Brightness) != 0;
+
+    if (enableColor || enableBrightness) {
+        const float alpha = inOutColor.alphaF();
+        inOutColor.setRedF(inOutColor.redF() / alpha);
+        inOutColor.setGreenF(inOutColor.greenF() / alpha);
+        inOutColor.setBlueF(inOutColor.blueF() / alpha);
+
+        if (enableColor) {
+            QColor hsv = inOutColor.toHsv();
+            const float minV = 0.11f / 2.0f;
+            const float minS = 0.09f;
+
+            if (hsv.valueF() < minV)
+                hsv.setHsvF(0.0f, 1.0f, minV);
+            else if (hsv.saturationF() < minS)
+                hsv.setHsvF(0.0f, minS, hsv.valueF());
+
+            float hue = std::fmod(effects.uniformValue(ShaderManager::Effect::Color) + hsv.hueF(), 1.0f);
+
+            if (hue < 0.0f)
+                hue += 1.0f;
+
+            hsv.setHsvF(hue, hsv.saturationF(), hsv.valueF());
+            inOutColor = hsv.toRgb();
+        }
+
+        if (enableBrightness) {
+            const float brightness = effects.uniformValue(ShaderManager::Effect::Brightness) * 255.0f;
+            inOutColor.setRed(std::clamp(inOutColor.red() + brightness, 0.0f, 255.0f));
+            inOutColor.setGreen(std::clamp(inOutColor.green() + brightness, 0.0f, 255.0f));
+            inOutColor.setBlue(std::clamp(inOutColor.blue() + brightness, 0.0f, 255.0f));
+        }
+
+        inOutColor.setRedF(inOutColor.redF() * alpha);
+        inOutColor.setGreenF(inOutColor.greenF() * alpha);
+        inOutColor.setBlueF(inOutColor.blueF() * alpha);
+        inOutColor.setAlphaF(alpha);
+    }
+
+    const float ghost = effects.uniformValue(ShaderManager::Effect::Ghost);
+
+    if (ghost != 1) {
+        inOutColor.setRedF(inOutColor.redF() * ghost);
+        inOutColor.setGreenF(inOutColor.greenF() * ghost);
+        inOutColor.setBlueF(inOutColor.blueF() * ghost);
+        inOutColor.setAlphaF(inOutColor.alphaF() * ghost);
+    }
+
+    return inOutColor.rgba();
+}
+
+// Scalar implementation of the shape effects (see sprite.frag)
+static void referenceTransformPoint(const EffectState &effects, float &x, float &y)
+{
+    const float whirl = effects.uniformValue(ShaderManager::Effect::Whirl);
+    const float offsetX = x - 0.5f;
+    const float offsetY = y - 0.5f;
+    const float whirlFactor = std::max(1.0f - (std::sqrt((offsetX * offsetX) + (offsetY * offsetY)) / 0.5f), 0.0f);
+    const float whirlActual = whirl * whirlFactor * whirlFactor;
+    x = (std::cos(whirlActual) * offsetX) + (std::sin(whirlActual) * offsetY) + 0.5f;
+    y = (-std::sin(whirlActual) * offsetX) + (std::cos(whirlActual) * offsetY) + 0.5f;
+
+    const float fisheye = effects.uniformValue(ShaderManager::Effect::Fisheye);
+    const float vX = (x - 0.5f) / 0.5f;
+    const float vY = (y - 0.5f) / 0.5f;
+    const float vLength = std::sqrt((vX * vX) + (vY * vY));
+    const float r = std::pow(std::min(vLength, 1.0f), fisheye) * std::max(1.0f, vLength);
+    x = 0.5f + (r * (vX / vLength) * 0.5f);
+    y = 0.5f + (r * (vY / vLength) * 0.5f);
+}
+
 class EffectTransformTest : public testing::Test
 {
     public:
         void SetUp() override { }
 
-        std::unordered_map<ShaderManager::Effect, double> m_effects;
+        EffectState m_effects;
 };
 
 TEST_F(EffectTransformTest, NoEffect)
@@ -36,7 +117,7 @@ TEST_F(EffectTransformTest, NoEffect)
 TEST_F(EffectTransformTest, ColorEffect)
 {
     // 100
-    m_effects[ShaderManager::Effect::Color] = 100;
+    m_effects.setValue(ShaderManager::Effect::Color, 100);
     auto mask = ShaderManager::Effect::Color;
     QRgb color = qRgba(0, 0, 0, 0);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), color);
@@ -48,7 +129,7 @@ TEST_F(EffectTransformTest, ColorEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(128, 100, 100, 128));
 
     // 175
-    m_effects[ShaderManager::Effect::Color] = 175;
+    m_effects.setValue(ShaderManager::Effect::Color, 175);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(255, 0, 191));
 
@@ -59,7 +140,7 @@ TEST_F(EffectTransformTest, ColorEffect)
 TEST_F(EffectTransformTest, BrightnessEffect)
 {
     // -100
-    m_effects[ShaderManager::Effect::Brightness] = -100;
+    m_effects.setValue(ShaderManager::Effect::Brightness, -100);
     auto mask = ShaderManager::Effect::Brightness;
     QRgb color = qRgba(0, 0, 0, 0);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), color);
@@ -71,7 +152,7 @@ TEST_F(EffectTransformTest, BrightnessEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(0, 0, 0, 128));
 
     // -50
-    m_effects[ShaderManager::Effect::Brightness] = -50;
+    m_effects.setValue(ShaderManager::Effect::Brightness, -50);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(127, 0, 0));
 
@@ -79,7 +160,7 @@ TEST_F(EffectTransformTest, BrightnessEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(36, 64, 64, 128));
 
     // 50
-    m_effects[ShaderManager::Effect::Brightness] = 50;
+    m_effects.setValue(ShaderManager::Effect::Brightness, 50);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(255, 127, 127));
 
@@ -87,7 +168,7 @@ TEST_F(EffectTransformTest, BrightnessEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(128, 128, 128, 128));
 
     // 100
-    m_effects[ShaderManager::Effect::Brightness] = 100;
+    m_effects.setValue(ShaderManager::Effect::Brightness, 100);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgb(255, 255, 255));
 
@@ -98,7 +179,7 @@ TEST_F(EffectTransformTest, BrightnessEffect)
 TEST_F(EffectTransformTest, GhostEffect)
 {
     // 25
-    m_effects[ShaderManager::Effect::Ghost] = 25;
+    m_effects.setValue(ShaderManager::Effect::Ghost, 25);
     auto mask = ShaderManager::Effect::Ghost;
     QRgb color = qRgba(0, 0, 0, 0);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), color);
@@ -110,7 +191,7 @@ TEST_F(EffectTransformTest, GhostEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(75, 191, 150, 96));
 
     // 50
-    m_effects[ShaderManager::Effect::Ghost] = 50;
+    m_effects.setValue(ShaderManager::Effect::Ghost, 50);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(128, 0, 0, 128));
 
@@ -118,7 +199,7 @@ TEST_F(EffectTransformTest, GhostEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(50, 128, 100, 64));
 
     // 100
-    m_effects[ShaderManager::Effect::Ghost] = 100;
+    m_effects.setValue(ShaderManager::Effect::Ghost, 100);
     color = qRgba(255, 0, 0, 255);
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(0, 0, 0, 0));
 
@@ -126,10 +207,51 @@ TEST_F(EffectTransformTest, GhostEffect)
     ASSERT_EQ(EffectTransform::transformColor(mask, m_effects, color), qRgba(0, 0, 0, 0));
 }
 
+TEST_F(EffectTransformTest, ColorKernel)
+{
+    // The results must match the QColor based implementation
+    static const std::vector<double> colorValues = { 0, 1, 50, 100, 175, 199.9, -37.5 };
+    static const std::vector<double> brightnessValues = { 0, -100, -37, 0.5, 50, 100 };
+    static const std::vector<double> ghostValues = { 0, 33, 100 };
+
+    std::vector<QRgb> colors;
+
+    for (int a = 0; a < 256; a += (a < 4 ? 1 : 17)) {
+        for (int r = 0; r < 256; r += 15) {
+            for (int g = 0; g < 256; g += 17) {
+                for (int b = 0; b < 256; b += 51)
+                    colors.push_back(qRgba(r, g, b, a)); // includes colors which aren't premultiplied
+            }
+        }
+    }
+
+    std::vector<QRgb> row(colors.size());
+
+    for (double color : colorValues) {
+        for (double brightness : brightnessValues) {
+            for (double ghost : ghostValues) {
+                EffectState effects;
+                effects.setValue(ShaderManager::Effect::Color, color);
+                effects.setValue(ShaderManager::Effect::Brightness, brightness);
+                effects.setValue(ShaderManager::Effect::Ghost, ghost);
+                const auto mask = effects.mask();
+
+                EffectTransform::transformColors(mask, effects, colors.data(), row.data(), colors.size());
+
+                for (size_t i = 0; i < colors.size(); i++) {
+                    const QRgb expected = referenceTransformColor(mask, effects, colors[i]);
+                    ASSERT_EQ(EffectTransform::transformColor(mask, effects, colors[i]), expected) << std::hex << colors[i] << std::dec << " " << color << " " << brightness << " " << ghost;
+                    ASSERT_EQ(row[i], expected);
+                }
+            }
+        }
+    }
+}
+
 TEST_F(EffectTransformTest, FisheyeEffect)
 {
     // 50
-    m_effects[ShaderManager::Effect::Fisheye] = 50;
+    m_effects.setValue(ShaderManager::Effect::Fisheye, 50);
     auto mask = ShaderManager::Effect::Fisheye;
     QVector2D dst;
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.51, 0.49), dst);
@@ -137,7 +259,7 @@ TEST_F(EffectTransformTest, FisheyeEffect)
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.498f);
 
     // 200
-    m_effects[ShaderManager::Effect::Fisheye] = 200;
+    m_effects.setValue(ShaderManager::Effect::Fisheye, 200);
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.4, 0.68), dst);
     ASSERT_EQ(std::round(dst.x() * 1000.0f) / 1000.0f, 0.483f);
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.531f);
@@ -146,7 +268,7 @@ TEST_F(EffectTransformTest, FisheyeEffect)
 TEST_F(EffectTransformTest, WhirlEffect)
 {
     // 50
-    m_effects[ShaderManager::Effect::Whirl] = 50;
+    m_effects.setValue(ShaderManager::Effect::Whirl, 50);
     auto mask = ShaderManager::Effect::Whirl;
     QVector2D dst;
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.51, 0.49), dst);
@@ -154,7 +276,7 @@ TEST_F(EffectTransformTest, WhirlEffect)
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.486f);
 
     // 200
-    m_effects[ShaderManager::Effect::Whirl] = 200;
+    m_effects.setValue(ShaderManager::Effect::Whirl, 200);
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.4, 0.68), dst);
     ASSERT_EQ(std::round(dst.x() * 1000.0f) / 1000.0f, 0.633f);
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.657f);
@@ -163,7 +285,7 @@ TEST_F(EffectTransformTest, WhirlEffect)
 TEST_F(EffectTransformTest, PixelateEffect)
 {
     // 5
-    m_effects[ShaderManager::Effect::Pixelate] = 5;
+    m_effects.setValue(ShaderManager::Effect::Pixelate, 5);
     auto mask = ShaderManager::Effect::Pixelate;
     QVector2D dst;
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.51, 0.05), dst);
@@ -171,7 +293,7 @@ TEST_F(EffectTransformTest, PixelateEffect)
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.25f);
 
     // 20
-    m_effects[ShaderManager::Effect::Pixelate] = 20;
+    m_effects.setValue(ShaderManager::Effect::Pixelate, 20);
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.97, 0.68), dst);
     ASSERT_EQ(std::round(dst.x() * 1000.0f) / 1000.0f, 1.0f);
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 1.0f);
@@ -180,7 +302,7 @@ TEST_F(EffectTransformTest, PixelateEffect)
 TEST_F(EffectTransformTest, MosaicEffect)
 {
     // 50
-    m_effects[ShaderManager::Effect::Mosaic] = 50;
+    m_effects.setValue(ShaderManager::Effect::Mosaic, 50);
     auto mask = ShaderManager::Effect::Mosaic;
     QVector2D dst;
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.75, 0.25), dst);
@@ -188,8 +310,156 @@ TEST_F(EffectTransformTest, MosaicEffect)
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.5f);
 
     // 200
-    m_effects[ShaderManager::Effect::Mosaic] = 200;
+    m_effects.setValue(ShaderManager::Effect::Mosaic, 200);
     EffectTransform::transformPoint(mask, m_effects, QSize(), QVector2D(0.8, 0.68), dst);
     ASSERT_EQ(std::round(dst.x() * 1000.0f) / 1000.0f, 0.8f);
     ASSERT_EQ(std::round(dst.y() * 1000.0f) / 1000.0f, 0.28f);
 }
+
+TEST_F(EffectTransformTest, Specializations)
+{
+    // Each effect mask has its own transform, which must match the effects applied one by one
+    static const std::vector<ShaderManager::Effect> shapeEffects = { ShaderManager::Effect::Mosaic, ShaderManager::Effect::Pixelate, ShaderManager::Effect::Whirl, ShaderManager::Effect::Fisheye };
+    static const std::vector<QRgb> colors = { qRgba(0, 0, 0, 0), qRgba(255, 0, 0, 255), qRgba(50, 100, 25, 128), qRgba(255, 255, 255, 255), qRgba(200, 10, 255, 64) };
+    static const std::vector<QVector2D> points = { QVector2D(0.51, 0.49), QVector2D(0.4, 0.68), QVector2D(0.05, 0.97), QVector2D(0.75, 0.25) };
+    const QSize size(40, 25);
+
+    EffectState effects;
+    effects.setValue(ShaderManager::Effect::Color, 45);
+    effects.setValue(ShaderManager::Effect::Brightness, -20);
+    effects.setValue(ShaderManager::Effect::Ghost, 30);
+    effects.setValue(ShaderManager::Effect::Fisheye, 60);
+    effects.setValue(ShaderManager::Effect::Whirl, 120);
+    effects.setValue(ShaderManager::Effect::Pixelate, 8);
+    effects.setValue(ShaderManager::Effect::Mosaic, 15);
+
+    for (int i = 0; i < EffectTransform::MASK_COUNT; i++) {
+        const auto mask = static_cast<ShaderManager::Effect>(i);
+        EffectTransform::PointTransform pointTransform = EffectTransform::pointTransform(mask);
+        ASSERT_TRUE(pointTransform);
+
+        for (const QVector2D &point : points) {
+            QVector2D expected = point;
+
+            for (ShaderManager::Effect effect : shapeEffects) {
+                if ((mask & effect) != 0)
+                    EffectTransform::transformPoint(effect, effects, size, QVector2D(expected), expected);
+            }
+
+            QVector2D dst;
+            pointTransform(effects, size, point, dst);
+            ASSERT_EQ(dst, expected) << i;
+            EffectTransform::transformPoint(mask, effects, size, point, dst);
+            ASSERT_EQ(dst, expected) << i;
+        }
+
+        std::vector<QRgb> row(colors.size());
+        EffectTransform::colorTransform(mask, effects)(effects, colors.data(), row.data(), colors.size());
+
+        for (size_t j = 0; j < colors.size(); j++)
+            ASSERT_EQ(row[j], referenceTransformColor(mask, effects, colors[j])) << i;
+    }
+}
+
+TEST_F(EffectTransformTest, TransformPoints)
+{
+    // The results must match transformPoint()
+    static const std::vector<ShaderManager::Effect> masks = {
+        ShaderManager::Effect::NoEffect,
+        ShaderManager::Effect::Color,
+        ShaderManager::Effect::Fisheye,
+        ShaderManager::Effect::Whirl,
+        ShaderManager::Effect::Pixelate,
+        ShaderManager::Effect::Mosaic,
+        ShaderManager::Effect::Fisheye | ShaderManager::Effect::Whirl,
+        ShaderManager::Effect::Mosaic | ShaderManager::Effect::Pixelate | ShaderManager::Effect::Whirl | ShaderManager::Effect::Fisheye | ShaderManager::Effect::Ghost
+    };
+
+    const QSize size(40, 25);
+    std::vector<float> x;
+    std::vector<float> y;
+
+    for (int i = 0; i <= 50; i++) {
+        for (int j = 0; j <= 50; j++) {
+            x.push_back(j / 50.0f);
+            y.push_back(i / 50.0f);
+        }
+    }
+
+    EffectState effects;
+    effects.setValue(ShaderManager::Effect::Ghost, 30);
+    effects.setValue(ShaderManager::Effect::Fisheye, -40);
+    effects.setValue(ShaderManager::Effect::Whirl, 250);
+    effects.setValue(ShaderManager::Effect::Pixelate, 12);
+    effects.setValue(ShaderManager::Effect::Mosaic, 25);
+
+    std::vector<float> dstX(x.size());
+    std::vector<float> dstY(y.size());
+
+    // The center is NaN with fisheye
+    auto same = [](float a, float b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+
+    for (ShaderManager::Effect mask : masks) {
+        EffectTransform::transformPoints(mask, effects, size, x.data(), y.data(), dstX.data(), dstY.data(), x.size());
+
+        for (size_t i = 0; i < x.size(); i++) {
+            QVector2D dst;
+            EffectTransform::transformPoint(mask, effects, size, QVector2D(x[i], y[i]), dst);
+            ASSERT_TRUE(same(dstX[i], dst.x()) && same(dstY[i], dst.y())) << static_cast<int>(mask) << " " << x[i] << " " << y[i];
+        }
+
+        // In place
+        std::vector<float> inPlaceX = x;
+        std::vector<float> inPlaceY = y;
+        EffectTransform::transformPoints(mask, effects, size, inPlaceX.data(), inPlaceY.data(), inPlaceX.data(), inPlaceY.data(), x.size());
+
+        for (size_t i = 0; i < x.size(); i++)
+            ASSERT_TRUE(same(inPlaceX[i], dstX[i]) && same(inPlaceY[i], dstY[i]));
+    }
+}
+
+TEST_F(EffectTransformTest, WhirlFisheyeAccuracy)
+{
+    // Whirl and fisheye use approximations of sin, cos, exp and log, the error must be much smaller than a texel
+    static const std::vector<std::pair<double, double>> values = { { 0, 0 },     { 50, 0 },   { -90, 0 },    { 720, 0 },    { -5000, 0 }, { 0, -100 },   { 0, -40 },
+                                                                   { 0, 60 },    { 0, 1000 }, { 0, 1e9 },    { 250, -40 },  { -120, 60 }, { 3000, 500 } };
+    const auto mask = ShaderManager::Effect::Whirl | ShaderManager::Effect::Fisheye;
+    const QSize size(40, 25);
+    std::vector<float> x;
+    std::vector<float> y;
+
+    for (int i = -10; i <= 110; i++) {
+        for (int j = -10; j <= 110; j++) {
+            x.push_back(j / 100.0f + 0.0013f);
+            y.push_back(i / 100.0f + 0.0007f);
+        }
+    }
+
+    std::vector<float> dstX(x.size());
+    std::vector<float> dstY(y.size());
+
+    for (const auto &[whirl, fisheye] : values) {
+        EffectState effects;
+        effects.setValue(ShaderManager::Effect::Whirl, whirl);
+        effects.setValue(ShaderManager::Effect::Fisheye, fisheye);
+        EffectTransform::transformPoints(mask, effects, size, x.data(), y.data(), dstX.data(), dstY.data(), x.size());
+
+        for (size_t i = 0; i < x.size(); i++) {
+            float expectedX = x[i];
+            float expectedY = y[i];
+            referenceTransformPoint(effects, expectedX, expectedY);
+            ASSERT_LT(std::abs(dstX[i] - expectedX), 1e-5f) << whirl << " " << fisheye << " " << x[i] << " " << y[i];
+            ASSERT_LT(std::abs(dstY[i] - expectedY), 1e-5f) << whirl << " " << fisheye << " " << x[i] << " " << y[i];
+        }
+    }
+
+    // Points at the center are NaN with fisheye like in the scalar implementation
+    EffectState effects;
+    effects.setValue(ShaderManager::Effect::Fisheye, 50);
+    float centerX[5] = { 0.5f, 0.1f, 0.5f, 0.3f, 0.5f };
+    float centerY[5] = { 0.5f, 0.2f, 0.5f, 0.9f, 0.5f };
+    EffectTransform::transformPoints(ShaderManager::Effect::Fisheye, effects, size, centerX, centerY, centerX, centerY, 5);
+    ASSERT_TRUE(std::isnan(centerX[0]) && std::isnan(centerY[0]));
+    ASSERT_FALSE(std::isnan(centerX[1]) || std::isnan(centerY[1]));
+    ASSERT_TRUE(std::isnan(centerX[4]) && std::isnan(centerY[4]));
+}
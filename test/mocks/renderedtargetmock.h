@@ -59,6 +59,8 @@ class RenderedTargetMock : public IRenderedTarget
         MOCK_METHOD(libscratchcpp::Rect, getFastBounds, (), (const, override));
         MOCK_METHOD(QRectF, getBoundsForBubble, (), (const, override));
 
+        MOCK_METHOD(const QMatrix4x4 &, stampModelMatrix, (double), (const, override));
+
         MOCK_METHOD(bool, mirrorHorizontally, (), (const, override));
 
         MOCK_METHOD(Texture, texture, (), (const, override));
@@ -66,7 +68,7 @@ class RenderedTargetMock : public IRenderedTarget
         MOCK_METHOD(int, costumeWidth, (), (const, override));
         MOCK_METHOD(int, costumeHeight, (), (const, override));
 
-        MOCK_METHOD((const std::unordered_map<ShaderManager::Effect, double> &), graphicEffects, (), (const, override));
+        MOCK_METHOD(const EffectState &, graphicEffects, (), (const, override));
         MOCK_METHOD(void, setGraphicEffect, (ShaderManager::Effect effect, double value), (override));
         MOCK_METHOD(void, clearGraphicEffects, (), (override));
 
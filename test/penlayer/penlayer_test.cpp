@@ -576,3 +576,28 @@ TEST_F(PenLayerTest, TextureData)
     ASSERT_EQ(std::round(bounds.right() * 100) / 100, 1.67);
     ASSERT_EQ(std::round(bounds.bottom() * 100) / 100, -1.67);
 }
+
+TEST_F(PenLayerTest, PartialAlpha)
+{
+    PenLayer penLayer;
+    penLayer.setWidth(6);
+    penLayer.setHeight(4);
+    penLayer.setAntialiasingEnabled(false);
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(6));
+    penLayer.setEngine(&engine);
+    ASSERT_FALSE(penLayer.hasPartialAlpha());
+
+    PenAttributes attr;
+    attr.color = QNanoColor(255, 0, 0);
+    attr.diameter = 1;
+    penLayer.drawLine(attr, -3, 2, 3, -2);
+    ASSERT_FALSE(penLayer.hasPartialAlpha());
+
+    attr.color = QNanoColor(0, 128, 0, 128);
+    penLayer.drawLine(attr, -3, -2, 3, 2);
+    ASSERT_TRUE(penLayer.hasPartialAlpha());
+
+    penLayer.clear();
+    ASSERT_FALSE(penLayer.hasPartialAlpha());
+}
@@ -97,6 +97,10 @@ TEST_F(ProjectLoaderTest, Load)
     ASSERT_EQ(sprites[0]->sprite(), engine->targetAt(1));
     ASSERT_EQ(sprites[1]->sprite(), engine->targetAt(2));
 
+    // Costumes are decoded while loading
+    ASSERT_GT(loader.costumeCount(), 0);
+    ASSERT_EQ(loader.preparedCostumes(), loader.costumeCount());
+
     const auto &monitors = loader.monitorList();
     ASSERT_EQ(monitors.size(), 10);
 
@@ -109,6 +113,30 @@ TEST_F(ProjectLoaderTest, Load)
     ASSERT_EQ(valueMonitorModel->color(), QColor::fromString("#FF8C1A"));
 }
 
+TEST_F(ProjectLoaderTest, ProgressiveLoading)
+{
+    static const std::chrono::milliseconds timeout(5000);
+    ProjectLoader loader;
+    ASSERT_FALSE(loader.progressiveLoading());
+
+    QSignalSpy spy(&loader, &ProjectLoader::progressiveLoadingChanged);
+    loader.setProgressiveLoading(true);
+    ASSERT_TRUE(loader.progressiveLoading());
+    ASSERT_EQ(spy.count(), 1);
+
+    // Costumes are decoded after the project is published
+    load(&loader, "load_test.sb3");
+    ASSERT_EQ(loader.spriteList().size(), 2);
+    auto startTime = std::chrono::steady_clock::now();
+
+    while (loader.preparedCostumes() < loader.costumeCount() || loader.costumeCount() == 0)
+        ASSERT_LE(std::chrono::steady_clock::now(), startTime + timeout);
+
+    loader.setProgressiveLoading(false);
+    ASSERT_FALSE(loader.progressiveLoading());
+    ASSERT_EQ(spy.count(), 2);
+}
+
 TEST_F(ProjectLoaderTest, UnsupportedBlocks)
 {
     static const std::chrono::milliseconds timeout(5000);
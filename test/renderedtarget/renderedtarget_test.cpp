@@ -1,8 +1,13 @@
 #include <QtTest/QSignalSpy>
 #include <QOpenGLContext>
 #include <QOffscreenSurface>
+#include <QBuffer>
 #include <qnanopainter.h>
 #include <renderedtarget.h>
+#include <skin.h>
+#include <skinimagestore.h>
+#include <skinregistry.h>
+#include <cputexturestore.h>
 #include <stagemodel.h>
 #include <spritemodel.h>
 #include <scenemousearea.h>
@@ -725,19 +730,19 @@ TEST_F(RenderedTargetTest, GraphicEffects)
     std::unordered_map<ShaderManager::Effect, double> expected;
     expected[ShaderManager::Effect::Color] = 23.5;
     expected[ShaderManager::Effect::Ghost] = 95.7;
-    ASSERT_EQ(target.graphicEffects(), expected);
+    ASSERT_EQ(target.graphicEffects(), EffectState(expected));
 
     target.setGraphicEffect(ShaderManager::Effect::Color, 0);
     expected.erase(ShaderManager::Effect::Color);
-    ASSERT_EQ(target.graphicEffects(), expected);
+    ASSERT_EQ(target.graphicEffects(), EffectState(expected));
 
     target.setGraphicEffect(ShaderManager::Effect::Ghost, 0.5);
     expected[ShaderManager::Effect::Ghost] = 0.5;
-    ASSERT_EQ(target.graphicEffects(), expected);
+    ASSERT_EQ(target.graphicEffects(), EffectState(expected));
 
     target.setGraphicEffect(ShaderManager::Effect::Brightness, -150.7);
     expected[ShaderManager::Effect::Brightness] = -150.7;
-    ASSERT_EQ(target.graphicEffects(), expected);
+    ASSERT_EQ(target.graphicEffects(), EffectState(expected));
 
     target.clearGraphicEffects();
     ASSERT_TRUE(target.graphicEffects().empty());
@@ -897,6 +902,70 @@ TEST_F(RenderedTargetTest, GetFastBounds)
     ASSERT_EQ(std::round(bounds.top() * 100) / 100, 1324.22);
     ASSERT_EQ(std::round(bounds.right() * 100) / 100, -375.77);
     ASSERT_EQ(std::round(bounds.bottom() * 100) / 100, 1143.65);
+
+    EXPECT_CALL(engine, stageWidth()).Times(2).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).Times(2).WillRepeatedly(Return(360));
+    target.updateX(-25);
+    target.updateY(40);
+
+    bounds = target.getFastBounds();
+    ASSERT_EQ(std::round(bounds.left() * 100) / 100, -596.79);
+    ASSERT_EQ(std::round(bounds.top() * 100) / 100, 1484.52);
+    ASSERT_EQ(std::round(bounds.right() * 100) / 100, -476.41);
+    ASSERT_EQ(std::round(bounds.bottom() * 100) / 100, 1303.95);
+}
+
+TEST_F(RenderedTargetTest, StampModelMatrix)
+{
+    RenderedTarget target;
+
+    Sprite sprite;
+    sprite.setDirection(-46.37);
+    sprite.setSize(67.98);
+    SpriteModel spriteModel;
+    sprite.setInterface(&spriteModel);
+    target.setSpriteModel(&spriteModel);
+    EngineMock engine;
+    target.setEngine(&engine);
+    auto costume = std::make_shared<Costume>("", "", "png");
+    std::string costumeData = readFileStr("image.png");
+    costume->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume->setBitmapResolution(2);
+    sprite.addCostume(costume);
+
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    target.loadCostumes();
+    target.updateCostume(costume.get());
+    target.beforeRedraw();
+
+    const Texture &texture = target.cpuTexture();
+    ASSERT_TRUE(texture.isValid());
+    const float textureScale = texture.width() / static_cast<float>(target.costumeWidth());
+    const float aspectRatio = texture.height() / static_cast<float>(texture.width());
+    const float size = 0.6798;
+
+    QMatrix4x4 matrix;
+    matrix.rotate(270 + 46.37, 0, 0, 1);
+    matrix.scale(size * 2 / textureScale, aspectRatio * size * 2 / textureScale);
+    ASSERT_TRUE(qFuzzyCompare(target.stampModelMatrix(2), matrix));
+
+    // The matrix doesn't depend on the position
+    target.updateX(50);
+    ASSERT_TRUE(qFuzzyCompare(target.stampModelMatrix(2), matrix));
+
+    target.updateRotationStyle(Sprite::RotationStyle::LeftRight);
+    matrix.setToIdentity();
+    matrix.rotate(180, 0, 0, 1);
+    matrix.scale(-size * 3 / textureScale, aspectRatio * size * 3 / textureScale);
+    ASSERT_TRUE(qFuzzyCompare(target.stampModelMatrix(3), matrix));
+
+    target.updateRotationStyle(Sprite::RotationStyle::DoNotRotate);
+    target.updateSize(150);
+    matrix.setToIdentity();
+    matrix.rotate(180, 0, 0, 1);
+    matrix.scale(1.5 * 3 / textureScale, aspectRatio * 1.5 * 3 / textureScale);
+    ASSERT_TRUE(qFuzzyCompare(target.stampModelMatrix(3), matrix));
 }
 
 TEST_F(RenderedTargetTest, TouchingClones)
@@ -1068,6 +1137,165 @@ TEST_F(RenderedTargetTest, TouchingClones)
     ASSERT_FALSE(target.touchingClones({ &clone1, &clone2 }));
 }
 
+TEST_F(RenderedTargetTest, TouchingClonesSpans)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume2->setRotationCenterX(1);
+    costume2->setRotationCenterY(5);
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(1275);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // The result must match the result of checking each point
+    auto touching = [&target1, &target2]() {
+        for (int y = -120; y <= 120; y++) {
+            for (int x = -120; x <= 120; x++) {
+                if (target1.containsScratchPoint(x, y) && target2.containsScratchPoint(x, y))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    static const std::vector<double> directions = { 90, -90, 0, 180, 37.5, -124.8 };
+    static const std::vector<double> offsets = { -70, -44, -31, -18.5, -9, -2, 0, 4, 13, 27, 36.6, 52 };
+    int touchingCount = 0;
+
+    for (double direction : directions) {
+        target1.updateDirection(direction);
+        target2.updateDirection(-direction / 2);
+
+        for (auto style : { Sprite::RotationStyle::AllAround, Sprite::RotationStyle::LeftRight }) {
+            target1.updateRotationStyle(style);
+
+            for (double offset : offsets) {
+                target2.updateX(offset);
+                target2.updateY(offset * -0.6);
+                target1.beforeRedraw();
+                target2.beforeRedraw();
+
+                const bool expected = touching();
+                ASSERT_EQ(target1.touchingClones({ &sprite2 }), expected);
+                ASSERT_EQ(target2.touchingClones({ &sprite1 }), expected);
+                touchingCount += expected;
+            }
+        }
+    }
+
+    ASSERT_GT(touchingCount, 0);
+    ASSERT_LT(touchingCount, directions.size() * offsets.size() * 2);
+}
+
+TEST_F(RenderedTargetTest, TouchingClonesSilhouettes)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    std::string costumeData2 = costumeData;
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData2.size(), static_cast<void *>(costumeData2.data()));
+    costume2->setRotationCenterX(1);
+    costume2->setRotationCenterY(5);
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // Unrotated and unscaled targets are compared word by word, the result must match the result of checking each point
+    auto touching = [&target1, &target2]() {
+        for (int y = -20; y <= 20; y++) {
+            for (int x = -20; x <= 20; x++) {
+                if (target1.containsScratchPoint(x, y) && target2.containsScratchPoint(x, y))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    int touchingCount = 0;
+    int count = 0;
+
+    for (int y = -8; y <= 8; y++) {
+        for (int x = -8; x <= 8; x++) {
+            target2.updateX(x);
+            target2.updateY(y);
+            target1.beforeRedraw();
+            target2.beforeRedraw();
+
+            const bool expected = touching();
+            ASSERT_EQ(target1.touchingClones({ &sprite2 }), expected);
+            ASSERT_EQ(target2.touchingClones({ &sprite1 }), expected);
+            touchingCount += expected;
+            count++;
+        }
+    }
+
+    ASSERT_GT(touchingCount, 0);
+    ASSERT_LT(touchingCount, count);
+}
+
 TEST_F(RenderedTargetTest, TouchingColor)
 {
     EngineMock engine;
@@ -1264,7 +1492,7 @@ TEST_F(RenderedTargetTest, TouchingColor)
     EXPECT_CALL(target2, colorAtScratchPoint(3, -3)).WillOnce(Return(color4));
     EXPECT_CALL(target1, colorAtScratchPoint(3, -3)).WillOnce(Return(color1));
     ASSERT_TRUE(target.touchingColor(color5, color3));
-    ASSERT_EQ(target.graphicEffects().at(ShaderManager::Effect::Ghost), 100);
+    ASSERT_EQ(target.graphicEffects().value(ShaderManager::Effect::Ghost), 100);
 
     // Out of bounds: top left
     target.updateX(-300);
@@ -1314,3 +1542,805 @@ TEST_F(RenderedTargetTest, TouchingColor)
     EXPECT_CALL(stageTarget, colorAtScratchPoint).Times(0);
     ASSERT_FALSE(target.touchingColor(color1));
 }
+
+TEST_F(RenderedTargetTest, TouchingColorGpu)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume2->setRotationCenterX(1);
+    costume2->setRotationCenterY(5);
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(500);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // The results must match the CPU
+    ASSERT_FALSE(RenderedTarget::gpuQueriesEnabled());
+    static const std::vector<Rgb> colors = { 4278190335, 4294902015, 4294934656, 4278190208, 4286578816, 4286611711, 4286611456, 4294967295 };
+    static const std::vector<Rgb> masks = { 4278190335, 4286611711, 4278190080 };
+    static const std::vector<double> offsets = { -14, -9.5, -6, -3.25, 0, 2, 5.75, 11, 16 };
+    int touchingCount = 0;
+
+    for (double offset : offsets) {
+        target2.updateX(offset);
+        target2.updateY(offset * -0.5);
+        target1.beforeRedraw();
+        target2.beforeRedraw();
+
+        for (Rgb color : colors) {
+            RenderedTarget::setGpuQueriesEnabled(false);
+            const bool expected = target1.touchingColor(color);
+            RenderedTarget::setGpuQueriesEnabled(true);
+            ASSERT_EQ(target1.touchingColor(color), expected);
+            touchingCount += expected;
+
+            for (Rgb mask : masks) {
+                RenderedTarget::setGpuQueriesEnabled(false);
+                const bool expected = target1.touchingColor(color, mask);
+                RenderedTarget::setGpuQueriesEnabled(true);
+                ASSERT_EQ(target1.touchingColor(color, mask), expected);
+            }
+        }
+    }
+
+    RenderedTarget::setGpuQueriesEnabled(false);
+    ASSERT_GT(touchingCount, 0);
+}
+
+TEST_F(RenderedTargetTest, TouchingColorGpuParity)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Opaque and fully transparent texels only (the GPU is used for unrotated targets without effects)
+    QImage image(12, 10, QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+
+    for (int y = 0; y < image.height(); y++) {
+        for (int x = 0; x < image.width(); x++) {
+            if (x < 4)
+                image.setPixel(x, y, qRgb(255, 0, 0));
+            else if (x < 8 && y >= 2)
+                image.setPixel(x, y, qRgb(0, 255, 0));
+            else if (x > 8)
+                image.setPixel(x, y, qRgb(0, 0, 255));
+        }
+    }
+
+    QByteArray costumeData;
+    QBuffer buffer(&costumeData);
+    buffer.open(QIODevice::WriteOnly);
+    ASSERT_TRUE(image.save(&buffer, "png"));
+
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), costumeData.data());
+    costume1->setRotationCenterX(6);
+    costume1->setRotationCenterY(5);
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), costumeData.data());
+    costume2->setRotationCenterX(2);
+    costume2->setRotationCenterY(7);
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // The query mustn't change the OpenGL state
+    QOpenGLExtraFunctions glF(&m_context);
+    glF.initializeOpenGLFunctions();
+    glF.glClearColor(0.25f, 0.5f, 0.75f, 1.0f);
+    glF.glClearStencil(5);
+    glF.glStencilMask(0x0F);
+    glF.glStencilFunc(GL_LESS, 3, 0x07);
+    glF.glStencilOp(GL_ZERO, GL_INCR, GL_DECR);
+    glF.glColorMask(GL_TRUE, GL_FALSE, GL_TRUE, GL_FALSE);
+    glF.glActiveTexture(GL_TEXTURE2);
+
+    // Rotated, mirrored, scaled targets and targets with effects must give the same results as on the CPU
+    static const std::vector<std::function<void(RenderedTarget &)>> scenarios = {
+        [](RenderedTarget &) {},
+        [](RenderedTarget &target) { target.updateDirection(45); },
+        [](RenderedTarget &target) { target.updateDirection(180); },
+        [](RenderedTarget &target) {
+            target.updateRotationStyle(Sprite::RotationStyle::LeftRight);
+            target.updateDirection(-90);
+        },
+        [](RenderedTarget &target) { target.updateSize(150); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Whirl, 60); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Fisheye, 40); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Pixelate, 15); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Mosaic, 30); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Ghost, 50); },
+        [](RenderedTarget &target) { target.setGraphicEffect(ShaderManager::Effect::Color, 25); }
+    };
+
+    static const std::vector<Rgb> colors = { 4294901760, 4278255360, 4278190335, 4294967295, 4286578688, 4278223103 };
+    static const std::vector<Rgb> masks = { 4294901760, 4278255360, 4278190080 };
+    static const std::vector<double> offsets = { -9, -5.5, -2, 0, 3, 7.25, 10 };
+    int touchingCount = 0;
+
+    for (const auto &scenario : scenarios) {
+        for (RenderedTarget *changed : { &target1, &target2 }) {
+            for (RenderedTarget *target : { &target1, &target2 }) {
+                target->updateRotationStyle(Sprite::RotationStyle::AllAround);
+                target->updateDirection(90);
+                target->updateSize(100);
+                target->clearGraphicEffects();
+            }
+
+            scenario(*changed);
+
+            for (double offset : offsets) {
+                target2.updateX(offset);
+                target2.updateY(offset * -0.5);
+                target1.beforeRedraw();
+                target2.beforeRedraw();
+
+                for (Rgb color : colors) {
+                    RenderedTarget::setGpuQueriesEnabled(false);
+                    const bool expected = target1.touchingColor(color);
+                    RenderedTarget::setGpuQueriesEnabled(true);
+                    ASSERT_EQ(target1.touchingColor(color), expected);
+                    touchingCount += expected;
+
+                    for (Rgb mask : masks) {
+                        RenderedTarget::setGpuQueriesEnabled(false);
+                        const bool expected = target1.touchingColor(color, mask);
+                        RenderedTarget::setGpuQueriesEnabled(true);
+                        ASSERT_EQ(target1.touchingColor(color, mask), expected);
+                    }
+                }
+            }
+        }
+    }
+
+    RenderedTarget::setGpuQueriesEnabled(false);
+    ASSERT_GT(touchingCount, 0);
+
+    GLfloat clearColor[4];
+    GLboolean colorMask[4];
+    GLint value;
+    glF.glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    ASSERT_EQ(clearColor[0], 0.25f);
+    ASSERT_EQ(clearColor[1], 0.5f);
+    ASSERT_EQ(clearColor[2], 0.75f);
+    ASSERT_EQ(clearColor[3], 1.0f);
+    glF.glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+    ASSERT_TRUE(colorMask[0]);
+    ASSERT_FALSE(colorMask[1]);
+    ASSERT_TRUE(colorMask[2]);
+    ASSERT_FALSE(colorMask[3]);
+    glF.glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &value);
+    ASSERT_EQ(value, 5);
+    glF.glGetIntegerv(GL_STENCIL_WRITEMASK, &value);
+    ASSERT_EQ(value, 0x0F);
+    glF.glGetIntegerv(GL_STENCIL_FUNC, &value);
+    ASSERT_EQ(value, GL_LESS);
+    glF.glGetIntegerv(GL_STENCIL_REF, &value);
+    ASSERT_EQ(value, 3);
+    glF.glGetIntegerv(GL_STENCIL_VALUE_MASK, &value);
+    ASSERT_EQ(value, 0x07);
+    glF.glGetIntegerv(GL_STENCIL_FAIL, &value);
+    ASSERT_EQ(value, GL_ZERO);
+    glF.glGetIntegerv(GL_STENCIL_PASS_DEPTH_FAIL, &value);
+    ASSERT_EQ(value, GL_INCR);
+    glF.glGetIntegerv(GL_STENCIL_PASS_DEPTH_PASS, &value);
+    ASSERT_EQ(value, GL_DECR);
+    glF.glGetIntegerv(GL_ACTIVE_TEXTURE, &value);
+    ASSERT_EQ(value, GL_TEXTURE2);
+}
+
+TEST_F(RenderedTargetTest, TouchingColorComposite)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(500);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // The result must match the result of checking each point
+    auto touching = [&target1, &target2](Rgb color) {
+        for (int y = -60; y <= 60; y++) {
+            for (int x = -60; x <= 60; x++) {
+                const QRgb pixel = target2.colorAtScratchPoint(x, y);
+
+                if (target1.containsScratchPoint(x, y) && qAlpha(pixel) == 255 && (qRed(color) & 0b11111000) == (qRed(pixel) & 0b11111000) &&
+                    (qGreen(color) & 0b11111000) == (qGreen(pixel) & 0b11111000) && (qBlue(color) & 0b11110000) == (qBlue(pixel) & 0b11110000))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    static const Rgb color1 = 4278190335; // blue
+    static const Rgb color2 = 4286611456; // olive
+    static const std::vector<double> offsets = { -40, -17, -9.5, 0, 6, 12.25, 25, 40 };
+    int touchingCount = 0;
+
+    // Queries are repeated to use the cached composite
+    for (double offset : offsets) {
+        target2.updateX(offset);
+        target2.updateY(-offset / 2);
+
+        for (int i = 0; i < 2; i++) {
+            const bool expected1 = touching(color1);
+            const bool expected2 = touching(color2);
+            ASSERT_EQ(target1.touchingColor(color1), expected1);
+            ASSERT_EQ(target1.touchingColor(color2), expected2);
+            touchingCount += expected1 + expected2;
+        }
+    }
+
+    ASSERT_GT(touchingCount, 0);
+
+    // Effects invalidate the composite
+    target2.updateX(0);
+    target2.updateY(0);
+    ASSERT_EQ(target1.touchingColor(color1), touching(color1));
+    target2.setGraphicEffect(ShaderManager::Effect::Color, 50);
+    ASSERT_EQ(target1.touchingColor(color1), touching(color1));
+    target2.clearGraphicEffects();
+    ASSERT_EQ(target1.touchingColor(color1), touching(color1));
+}
+
+TEST_F(RenderedTargetTest, QueryCache)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(500);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    static const Rgb color = 4278190335; // blue
+    RenderedTarget::resetQueryCacheStats();
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 0);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 0);
+
+    // touchingClones()
+    ASSERT_TRUE(target1.touchingClones({ &sprite2 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 0);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 1);
+
+    ASSERT_TRUE(target1.touchingClones({ &sprite2 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 1);
+
+    // Other targets have their own results
+    ASSERT_TRUE(target2.touchingClones({ &sprite1 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 2);
+
+    // Changes of other targets invalidate the results
+    target2.updateX(100);
+    ASSERT_FALSE(target1.touchingClones({ &sprite2 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 3);
+
+    ASSERT_FALSE(target1.touchingClones({ &sprite2 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 2);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 3);
+
+    target1.updateX(100);
+    ASSERT_TRUE(target1.touchingClones({ &sprite2 }));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 2);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 4);
+
+    // touchingColor()
+    RenderedTarget::resetQueryCacheStats();
+    ASSERT_TRUE(target1.touchingColor(color));
+    ASSERT_TRUE(target1.touchingColor(color));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 1);
+
+    // The mask is a part of the key
+    target1.touchingColor(color, color);
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 2);
+
+    // Effects invalidate the results
+    target2.setGraphicEffect(ShaderManager::Effect::Color, 50);
+    ASSERT_FALSE(target1.touchingColor(color));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 3);
+
+    target2.setGraphicEffect(ShaderManager::Effect::Color, 0);
+    ASSERT_TRUE(target1.touchingColor(color));
+    ASSERT_EQ(RenderedTarget::queryCacheHits(), 1);
+    ASSERT_EQ(RenderedTarget::queryCacheMisses(), 4);
+
+    RenderedTarget::resetQueryCacheStats();
+}
+
+TEST_F(RenderedTargetTest, ParallelScan)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(1275);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    // The results must match the results of checking each point
+    auto touchingClones = [&target1, &target2]() {
+        for (int y = -180; y <= 180; y++) {
+            for (int x = -240; x <= 240; x++) {
+                if (target1.containsScratchPoint(x, y) && target2.containsScratchPoint(x, y))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    auto touchingColor = [&target1, &target2](Rgb color) {
+        for (int y = -180; y <= 180; y++) {
+            for (int x = -240; x <= 240; x++) {
+                const QRgb pixel = target2.colorAtScratchPoint(x, y);
+
+                if (target1.containsScratchPoint(x, y) && qAlpha(pixel) == 255 && (qRed(color) & 0b11111000) == (qRed(pixel) & 0b11111000) &&
+                    (qGreen(color) & 0b11111000) == (qGreen(pixel) & 0b11111000) && (qBlue(color) & 0b11110000) == (qBlue(pixel) & 0b11110000))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    static const Rgb color1 = 4278190335; // blue
+    static const Rgb color2 = 4286611456; // olive
+    static const std::vector<double> offsets = { -150, -92, -47.5, -20, 0, 13, 38.25, 80, 150 };
+    const int threshold = RenderedTarget::parallelScanThreshold();
+    RenderedTarget::setParallelScanThreshold(0);
+    int touchingCount = 0;
+
+    for (double offset : offsets) {
+        target2.updateX(offset);
+        target2.updateY(-offset / 2);
+        target2.clearGraphicEffects();
+
+        const bool expected = touchingClones();
+        ASSERT_EQ(target1.touchingClones({ &sprite2 }), expected);
+        ASSERT_EQ(target1.touchingColor(color1), touchingColor(color1));
+        ASSERT_EQ(target1.touchingColor(color2), touchingColor(color2));
+        touchingCount += expected;
+
+        // Shape-changing effects use the per-point loop
+        target2.setGraphicEffect(ShaderManager::Effect::Fisheye, 40);
+        ASSERT_EQ(target1.touchingClones({ &sprite2 }), touchingClones());
+    }
+
+    ASSERT_GT(touchingCount, 0);
+    ASSERT_LT(touchingCount, offsets.size());
+    RenderedTarget::setParallelScanThreshold(threshold);
+}
+
+TEST_F(RenderedTargetTest, ParallelScanMemoryBudget)
+{
+    EngineMock engine;
+    Sprite sprite1, sprite2;
+    SpriteModel model1, model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+    EXPECT_CALL(engine, getVisibleTargets(_)).WillRepeatedly(Invoke([&sprite1, &sprite2](std::vector<Target *> &dst) { dst = { &sprite2, &sprite1 }; }));
+
+    QQuickItem parent;
+    parent.setWidth(480);
+    parent.setHeight(360);
+
+    RenderedTarget target1(&parent), target2(&parent);
+    model1.setRenderedTarget(&target1);
+    model2.setRenderedTarget(&target2);
+    target1.setEngine(&engine);
+    target1.setSpriteModel(&model1);
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    // Load costumes
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite1.addCostume(costume1);
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite2.addCostume(costume2);
+
+    for (RenderedTarget *target : { &target1, &target2 }) {
+        target->loadCostumes();
+        target->updateSize(1275);
+        target->beforeRedraw();
+    }
+
+    target1.updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+
+    auto touchingClones = [&target1, &target2]() {
+        for (int y = -180; y <= 180; y++) {
+            for (int x = -240; x <= 240; x++) {
+                if (target1.containsScratchPoint(x, y) && target2.containsScratchPoint(x, y))
+                    return true;
+            }
+        }
+
+        return false;
+    };
+
+    // Preparing a target mustn't evict the textures of targets which were prepared before
+    CpuTextureStore *store = CpuTextureStore::instance();
+    const qint64 budget = store->memoryBudget();
+    store->setMemoryBudget(1);
+    const int threshold = RenderedTarget::parallelScanThreshold();
+    static const Rgb color = 4278190335; // blue
+    static const std::vector<double> offsets = { -150, -47.5, 0, 38.25, 150 };
+    int touchingCount = 0;
+
+    for (double offset : offsets) {
+        target2.updateX(offset);
+        target2.updateY(-offset / 2);
+        target1.beforeRedraw();
+        target2.beforeRedraw();
+
+        // Compare with the serial scan
+        RenderedTarget::setParallelScanThreshold(std::numeric_limits<int>::max());
+        const bool expected = touchingClones();
+        const bool expectedColor = target1.touchingColor(color);
+        RenderedTarget::setParallelScanThreshold(0);
+
+        ASSERT_EQ(target1.touchingClones({ &sprite2 }), expected);
+        ASSERT_EQ(target1.touchingColor(color), expectedColor);
+        ASSERT_LE(store->memoryUsage(), 1);
+        touchingCount += expected;
+    }
+
+    ASSERT_GT(touchingCount, 0);
+    RenderedTarget::setParallelScanThreshold(threshold);
+    store->setMemoryBudget(budget);
+}
+
+TEST_F(RenderedTargetTest, LazySkins)
+{
+    RenderedTarget target;
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+    target.setEngine(&engine);
+
+    Sprite sprite;
+    sprite.setVisible(true);
+    std::vector<std::shared_ptr<Costume>> costumes;
+    std::vector<std::string> costumeData(8, readFileStr("image.png")); // identical costumes would share their skins
+
+    for (int i = 0; i < 8; i++) {
+        auto costume = std::make_shared<Costume>("", "", "png");
+        costume->setData(costumeData[i].size(), static_cast<void *>(costumeData[i].data()));
+        sprite.addCostume(costume);
+        costumes.push_back(costume);
+    }
+
+    SpriteModel spriteModel;
+    sprite.setInterface(&spriteModel);
+    target.setSpriteModel(&spriteModel);
+    ASSERT_EQ(Skin::memoryUsage(), 0);
+
+    // Only the skin of the current costume is created
+    SkinImageStore *store = SkinImageStore::instance();
+    const int storeCount = store->count();
+    target.updateCostume(costumes[0].get());
+    target.loadCostumes();
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4);
+    ASSERT_TRUE(target.texture().isValid());
+
+    // Other costumes are decoded in the background
+    for (int i = 1; i < costumes.size(); i++) {
+        store->claim(costumes[i].get());
+        ASSERT_FALSE(store->isQueued(costumes[i].get()));
+        ASSERT_FALSE(store->isPending(costumes[i].get()));
+    }
+
+    ASSERT_EQ(store->count(), storeCount + 7);
+
+    // Skins are created when they're used
+    target.updateCostume(costumes[5].get());
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 2);
+    ASSERT_EQ(store->count(), storeCount + 6);
+    ASSERT_TRUE(target.texture().isValid());
+    ASSERT_EQ(target.texture().width(), 4);
+    ASSERT_EQ(target.costumeWidth(), 4);
+    ASSERT_EQ(target.costumeHeight(), 6);
+
+    target.updateCostume(costumes[0].get());
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 2);
+
+    // Prefetched images are deleted with the skins
+    target.setEngine(nullptr);
+    ASSERT_EQ(Skin::memoryUsage(), 0);
+    ASSERT_EQ(store->count(), storeCount);
+}
+
+TEST_F(RenderedTargetTest, SensePendingCostumes)
+{
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+
+    Sprite sprite;
+    sprite.setVisible(true);
+    SpriteModel model;
+    sprite.setInterface(&model);
+
+    RenderedTarget target;
+    target.setEngine(&engine);
+    target.setSpriteModel(&model);
+
+    // The costume is going to be prepared in the background (see ProjectLoader)
+    auto costume = std::make_shared<Costume>("", "", "png");
+    std::string costumeData = readFileStr("image.png");
+    costume->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    sprite.addCostume(costume);
+
+    SkinImageStore *store = SkinImageStore::instance();
+    store->setPending(costume.get());
+    target.updateCostume(costume.get());
+    target.loadCostumes();
+    target.updateX(-227.5);
+    target.updateY(165);
+    ASSERT_FALSE(target.texture().isValid());
+
+    // Sensing doesn't wait for the texture, the costume is prepared right away
+    ASSERT_FALSE(target.containsScratchPoint(-228, 165)); // [0, 0]
+    ASSERT_TRUE(target.texture().isValid());
+    ASSERT_FALSE(store->isPending(costume.get()));
+    ASSERT_TRUE(target.containsScratchPoint(-227, 164)); // [1, 1]
+    ASSERT_FALSE(target.containsScratchPoint(-226, 163)); // [2, 2]
+    ASSERT_TRUE(target.containsScratchPoint(-225, 163));  // [3, 2]
+
+    // Colors are available as well
+    Sprite sprite2;
+    sprite2.setVisible(true);
+    SpriteModel model2;
+    sprite2.setInterface(&model2);
+
+    RenderedTarget target2;
+    target2.setEngine(&engine);
+    target2.setSpriteModel(&model2);
+
+    auto costume2 = std::make_shared<Costume>("", "", "png");
+    std::string costumeData2 = readFileStr("image.png"); // identical costumes would share their skins
+    costume2->setData(costumeData2.size(), static_cast<void *>(costumeData2.data()));
+    sprite2.addCostume(costume2);
+
+    store->setPending(costume2.get());
+    target2.updateCostume(costume2.get());
+    target2.loadCostumes();
+    target2.updateX(-227.5);
+    target2.updateY(165);
+    ASSERT_FALSE(target2.texture().isValid());
+    ASSERT_EQ(target2.colorAtScratchPoint(-227, 164), target.colorAtScratchPoint(-227, 164));
+    ASSERT_NE(qAlpha(target2.colorAtScratchPoint(-227, 164)), 0);
+    ASSERT_TRUE(target2.texture().isValid());
+
+    target.setEngine(nullptr);
+    target2.setEngine(nullptr);
+    store->clear();
+}
+
+TEST_F(RenderedTargetTest, SharedSkins)
+{
+    EngineMock engine;
+    EXPECT_CALL(engine, stageWidth()).WillRepeatedly(Return(480));
+    EXPECT_CALL(engine, stageHeight()).WillRepeatedly(Return(360));
+
+    // Copied sprites with identical costumes
+    std::string costumeData = readFileStr("image.png");
+    auto costume1 = std::make_shared<Costume>("", "abc", "png");
+    auto costume2 = std::make_shared<Costume>("", "abc", "png");
+    auto costume3 = std::make_shared<Costume>("", "def", "png");
+    auto costume4 = std::make_shared<Costume>("", "abc", "png");
+    costume1->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume2->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume3->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume4->setData(costumeData.size(), static_cast<void *>(costumeData.data()));
+    costume4->setBitmapResolution(2);
+
+    Sprite sprite1;
+    sprite1.addCostume(costume1);
+    sprite1.addCostume(costume3);
+    Sprite sprite2;
+    sprite2.addCostume(costume2);
+    sprite2.addCostume(costume4);
+    SpriteModel model1;
+    SpriteModel model2;
+    sprite1.setInterface(&model1);
+    sprite2.setInterface(&model2);
+
+    auto target1 = std::make_unique<RenderedTarget>();
+    RenderedTarget target2;
+    target1->setEngine(&engine);
+    target2.setEngine(&engine);
+    target1->setSpriteModel(&model1);
+    target2.setSpriteModel(&model2);
+    target1->updateCostume(costume1.get());
+    target2.updateCostume(costume2.get());
+    target1->loadCostumes();
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4);
+
+    // The skin of the identical costume is used
+    target2.loadCostumes();
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4);
+    ASSERT_EQ(target1->texture(), target2.texture());
+    ASSERT_EQ(target1->cpuTexture(), target2.cpuTexture());
+
+    // Costumes with different asset IDs or bitmap resolutions don't share skins
+    target1->updateCostume(costume3.get());
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 2);
+    target2.updateCostume(costume4.get());
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 3);
+
+    // The shared skin isn't deleted while other targets use it
+    target2.updateCostume(costume2.get());
+    target1.reset();
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 2);
+    ASSERT_TRUE(target2.texture().isValid());
+    ASSERT_TRUE(SkinRegistry::instance()->contains(costume1.get()));
+    ASSERT_FALSE(SkinRegistry::instance()->contains(costume3.get()));
+
+    target2.setEngine(nullptr);
+    ASSERT_EQ(Skin::memoryUsage(), 0);
+    ASSERT_FALSE(SkinRegistry::instance()->contains(costume2.get()));
+}
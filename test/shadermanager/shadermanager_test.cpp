@@ -69,7 +69,7 @@ TEST_F(ShaderManagerTest, Instance)
 TEST_F(ShaderManagerTest, GetShaderProgram)
 {
     ShaderManager manager;
-    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
+    const EffectState effects({ { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } });
 
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     ASSERT_EQ(program->parent(), &manager);
@@ -90,13 +90,33 @@ TEST_F(ShaderManagerTest, GetShaderProgram)
     ASSERT_EQ(program, program);
 }
 
+TEST_F(ShaderManagerTest, GetShaderProgramDrawMode)
+{
+    ShaderManager manager;
+    const EffectState effects({ { ShaderManager::Effect::Color, 64.9 } });
+
+    QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
+    ASSERT_EQ(manager.getShaderProgram(effects, ShaderManager::DrawMode::Default), program);
+
+    QOpenGLShaderProgram *silhouetteProgram = manager.getShaderProgram(effects, ShaderManager::DrawMode::Silhouette);
+    ASSERT_TRUE(silhouetteProgram->isLinked());
+    ASSERT_NE(silhouetteProgram, program);
+    ASSERT_EQ(manager.getShaderProgram(effects, ShaderManager::DrawMode::Silhouette), silhouetteProgram);
+
+    QOpenGLShaderProgram *colorMaskProgram = manager.getShaderProgram(effects, ShaderManager::DrawMode::ColorMask);
+    ASSERT_TRUE(colorMaskProgram->isLinked());
+    ASSERT_NE(colorMaskProgram, program);
+    ASSERT_NE(colorMaskProgram, silhouetteProgram);
+    ASSERT_NE(colorMaskProgram->uniformLocation("u_colorMask"), -1);
+}
+
 TEST_F(ShaderManagerTest, SetUniforms)
 {
     QOpenGLFunctions glF(&m_context);
     glF.initializeOpenGLFunctions();
     ShaderManager manager;
 
-    std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } };
+    EffectState effects({ { ShaderManager::Effect::Color, 64.9 }, { ShaderManager::Effect::Ghost, 12.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 4, QSize(), effects);
@@ -129,7 +149,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 64.9 } };
+    EffectState effects({ { effect, 64.9 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -141,7 +161,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Below the minimum
-    effects[effect] = -395.7;
+    effects.setValue(effect, -395.7);
     program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -153,7 +173,7 @@ TEST_F(ShaderManagerTest, ColorEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Above the maximum
-    effects[effect] = 579.05;
+    effects.setValue(effect, 579.05);
     program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -180,7 +200,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 4.6 } };
+    EffectState effects({ { effect, 4.6 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -192,7 +212,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Below the minimum
-    effects[effect] = -102.9;
+    effects.setValue(effect, -102.9);
     program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -204,7 +224,7 @@ TEST_F(ShaderManagerTest, BrightnessEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Above the maximum
-    effects[effect] = 353.2;
+    effects.setValue(effect, 353.2);
     program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -231,7 +251,7 @@ TEST_F(ShaderManagerTest, GhostEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
+    EffectState effects({ { effect, 58.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -243,7 +263,7 @@ TEST_F(ShaderManagerTest, GhostEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Below the minimum
-    effects[effect] = -20.8;
+    effects.setValue(effect, -20.8);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -254,7 +274,7 @@ TEST_F(ShaderManagerTest, GhostEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Above the maximum
-    effects[effect] = 248.2;
+    effects.setValue(effect, 248.2);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -280,7 +300,7 @@ TEST_F(ShaderManagerTest, FisheyeEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
+    EffectState effects({ { effect, 58.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -291,7 +311,7 @@ TEST_F(ShaderManagerTest, FisheyeEffectValue)
     ASSERT_EQ(value, 1.585f);
     ASSERT_EQ(values.at(effect), value);
 
-    effects[effect] = -20.8;
+    effects.setValue(effect, -20.8);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -302,7 +322,7 @@ TEST_F(ShaderManagerTest, FisheyeEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Below the minimum
-    effects[effect] = -101;
+    effects.setValue(effect, -101);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -328,7 +348,7 @@ TEST_F(ShaderManagerTest, WhirlEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
+    EffectState effects({ { effect, 58.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -339,7 +359,7 @@ TEST_F(ShaderManagerTest, WhirlEffectValue)
     ASSERT_EQ(std::round(value * 1000) / 1000, 1.021f);
     ASSERT_EQ(values.at(effect), value);
 
-    effects[effect] = -20.8;
+    effects.setValue(effect, -20.8);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -365,7 +385,7 @@ TEST_F(ShaderManagerTest, PixelateEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
+    EffectState effects({ { effect, 58.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -376,7 +396,7 @@ TEST_F(ShaderManagerTest, PixelateEffectValue)
     ASSERT_EQ(value, 5.85f);
     ASSERT_EQ(values.at(effect), value);
 
-    effects[effect] = -20.8;
+    effects.setValue(effect, -20.8);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -402,7 +422,7 @@ TEST_F(ShaderManagerTest, MosaicEffectValue)
     ShaderManager manager;
 
     // In range
-    std::unordered_map<ShaderManager::Effect, double> effects = { { effect, 58.5 } };
+    EffectState effects({ { effect, 58.5 } });
     QOpenGLShaderProgram *program = manager.getShaderProgram(effects);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
@@ -413,7 +433,7 @@ TEST_F(ShaderManagerTest, MosaicEffectValue)
     ASSERT_EQ(value, 7.0f);
     ASSERT_EQ(values.at(effect), value);
 
-    effects[effect] = -21.8;
+    effects.setValue(effect, -21.8);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -424,7 +444,7 @@ TEST_F(ShaderManagerTest, MosaicEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Below the minimum
-    effects[effect] = 4;
+    effects.setValue(effect, 4);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -435,7 +455,7 @@ TEST_F(ShaderManagerTest, MosaicEffectValue)
     ASSERT_EQ(values.at(effect), value);
 
     // Above the maximum
-    effects[effect] = 5120;
+    effects.setValue(effect, 5120);
     program->bind();
     manager.setUniforms(program, 0, QSize(), effects);
     manager.getUniformValuesForEffects(effects, values);
@@ -472,3 +492,14 @@ TEST_F(ShaderManagerTest, EffectShapeChanges)
     ASSERT_TRUE(ShaderManager::effectShapeChanges(ShaderManager::Effect::Pixelate));
     ASSERT_TRUE(ShaderManager::effectShapeChanges(ShaderManager::Effect::Mosaic));
 }
+
+TEST_F(ShaderManagerTest, ShapeChangingEffects)
+{
+    using Effect = ShaderManager::Effect;
+    ASSERT_EQ(ShaderManager::shapeChangingEffects(Effect::NoEffect), Effect::NoEffect);
+    ASSERT_EQ(ShaderManager::shapeChangingEffects(Effect::Color | Effect::Brightness | Effect::Ghost), Effect::NoEffect);
+    ASSERT_EQ(ShaderManager::shapeChangingEffects(Effect::Fisheye), Effect::Fisheye);
+    ASSERT_EQ(ShaderManager::shapeChangingEffects(Effect::Color | Effect::Whirl | Effect::Ghost | Effect::Mosaic), Effect::Whirl | Effect::Mosaic);
+    ASSERT_EQ(ShaderManager::shapeChangingEffects(Effect::Color | Effect::Brightness | Effect::Ghost | Effect::Fisheye | Effect::Whirl | Effect::Pixelate | Effect::Mosaic),
+              Effect::Fisheye | Effect::Whirl | Effect::Pixelate | Effect::Mosaic);
+}
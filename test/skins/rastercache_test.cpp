@@ -0,0 +1,179 @@
+#include <scratchcpp/costume.h>
+#include <rastercache.h>
+#include <svgskin.h>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+static RasterCache::Entry createEntry(int width, int height)
+{
+    RasterCache::Entry entry;
+    entry.image = QImage(width, height, QImage::Format_RGBA8888);
+    entry.image.fill(Qt::transparent);
+    entry.image.setPixelColor(1, 0, QColor(255, 0, 0, 255));
+    entry.hullPoints = { { 1, 0 }, { 1, 0 } };
+    return entry;
+}
+
+TEST(RasterCacheTest, Disabled)
+{
+    RasterCache cache;
+    QTemporaryDir dir;
+    cache.setDirectory(dir.path());
+    ASSERT_FALSE(cache.enabled());
+    ASSERT_EQ(cache.sizeLimit(), RasterCache::DEFAULT_SIZE_LIMIT);
+
+    const QByteArray hash = RasterCache::hash("test");
+    cache.store(hash, 8, createEntry(4, 3));
+    ASSERT_EQ(cache.size(), 0);
+
+    RasterCache::Entry entry;
+    ASSERT_FALSE(cache.load(hash, 8, entry));
+}
+
+TEST(RasterCacheTest, StoreLoad)
+{
+    RasterCache cache;
+    QTemporaryDir dir;
+    cache.setDirectory(dir.path());
+    cache.setEnabled(true);
+    ASSERT_EQ(cache.directory(), dir.path());
+
+    const QByteArray hash = RasterCache::hash("test");
+    ASSERT_EQ(hash.size(), 16);
+    const RasterCache::Entry stored = createEntry(4, 3);
+    cache.store(hash, 8, stored);
+    ASSERT_GT(cache.size(), 4 * 3 * 4);
+
+    RasterCache::Entry entry;
+    ASSERT_FALSE(cache.load(hash, 9, entry));
+    ASSERT_FALSE(cache.load(RasterCache::hash("test2"), 8, entry));
+
+    ASSERT_TRUE(cache.load(hash, 8, entry));
+    ASSERT_EQ(entry.image, stored.image);
+    ASSERT_EQ(entry.image.format(), QImage::Format_RGBA8888);
+    ASSERT_EQ(entry.hullPoints, stored.hullPoints);
+
+    // The files are kept after restarting
+    RasterCache cache2;
+    cache2.setDirectory(dir.path());
+    cache2.setEnabled(true);
+    ASSERT_EQ(cache2.size(), cache.size());
+    ASSERT_TRUE(cache2.load(hash, 8, entry));
+    ASSERT_EQ(entry.image, stored.image);
+
+    // Broken files are deleted
+    QDir cacheDir(dir.path());
+    const QStringList files = cacheDir.entryList({ "*.raster" }, QDir::Files);
+    ASSERT_EQ(files.size(), 1);
+    QFile file(cacheDir.filePath(files[0]));
+    ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write("SCRC");
+    file.close();
+
+    ASSERT_FALSE(cache.load(hash, 8, entry));
+    ASSERT_FALSE(file.exists());
+    ASSERT_EQ(cache.size(), 0);
+}
+
+TEST(RasterCacheTest, LoadedFilesAreClosed)
+{
+    RasterCache cache;
+    QTemporaryDir dir;
+    cache.setDirectory(dir.path());
+    cache.setEnabled(true);
+
+    const RasterCache::Entry stored = createEntry(4, 3);
+    cache.store(RasterCache::hash("test"), 8, stored);
+
+    // Loaded images don't keep the files open
+    std::vector<RasterCache::Entry> entries(4096);
+
+    for (RasterCache::Entry &entry : entries)
+        ASSERT_TRUE(cache.load(RasterCache::hash("test"), 8, entry));
+
+    const QStringList files = QDir(dir.path()).entryList({ "*.raster" }, QDir::Files);
+    ASSERT_EQ(files.size(), 1);
+    ASSERT_TRUE(QFile::remove(dir.filePath(files[0])));
+    ASSERT_EQ(entries.back().image, stored.image);
+}
+
+TEST(RasterCacheTest, SizeLimit)
+{
+    RasterCache cache;
+    QTemporaryDir dir;
+    cache.setDirectory(dir.path());
+    cache.setEnabled(true);
+
+    const QByteArray hash1 = RasterCache::hash("test1");
+    const QByteArray hash2 = RasterCache::hash("test2");
+    cache.store(hash1, 8, createEntry(4, 3));
+    const qint64 size = cache.size();
+    QThread::msleep(5);
+    cache.store(hash2, 8, createEntry(4, 3));
+    ASSERT_EQ(cache.size(), size * 2);
+
+    // Least recently used files are deleted first
+    RasterCache::Entry entry;
+    QThread::msleep(5);
+    ASSERT_TRUE(cache.load(hash1, 8, entry));
+    cache.setSizeLimit(size);
+    ASSERT_EQ(cache.size(), size);
+    ASSERT_TRUE(cache.load(hash1, 8, entry));
+    ASSERT_FALSE(cache.load(hash2, 8, entry));
+
+    cache.clear();
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_FALSE(cache.load(hash1, 8, entry));
+}
+
+TEST(RasterCacheTest, SVGSkin)
+{
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    context.create();
+    ASSERT_TRUE(context.isValid());
+    surface.setFormat(context.format());
+    surface.create();
+    ASSERT_TRUE(surface.isValid());
+    context.makeCurrent(&surface);
+
+    RasterCache *cache = RasterCache::instance();
+    QTemporaryDir dir;
+    cache->setDirectory(dir.path());
+    cache->setEnabled(true);
+
+    Costume costume("", "", "svg");
+    std::string costumeData = readFileStr("image.svg");
+    costume.setData(costumeData.size(), costumeData.data());
+
+    // Rasterized mip levels are stored in the cache
+    QImage image;
+
+    {
+        SVGSkin skin(&costume);
+        Texture texture = skin.getTexture(2);
+        ASSERT_EQ(texture.width(), 26);
+        image = texture.toImage();
+        ASSERT_GT(cache->size(), 26 * 26 * 4);
+    }
+
+    // ...and they're loaded from the cache later
+    {
+        QFile file(dir.filePath(QString::fromLatin1(RasterCache::hash(QByteArray::fromStdString(costumeData)).toHex()) + "_9_v" + QString::number(RasterCache::FORMAT_VERSION) + ".raster"));
+        ASSERT_TRUE(file.exists());
+
+        SVGSkin skin(&costume);
+        Texture texture = skin.getTexture(2);
+        ASSERT_EQ(texture.width(), 26);
+        ASSERT_EQ(texture.toImage(), image);
+    }
+
+    cache->setEnabled(false);
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
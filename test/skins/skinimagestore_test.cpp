@@ -0,0 +1,297 @@
+#include <scratchcpp/costume.h>
+#include <skinimagestore.h>
+#include <bitmapskin.h>
+#include <svgskin.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+class SkinImageStoreTest : public testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            m_context.create();
+            ASSERT_TRUE(m_context.isValid());
+
+            m_surface.setFormat(m_context.format());
+            m_surface.create();
+            Q_ASSERT(m_surface.isValid());
+            m_context.makeCurrent(&m_surface);
+        }
+
+        void TearDown() override
+        {
+            ASSERT_EQ(m_context.surface(), &m_surface);
+            emit m_context.aboutToBeDestroyed();
+            m_context.doneCurrent();
+        }
+
+        QOpenGLContext m_context;
+        QOffscreenSurface m_surface;
+};
+
+TEST_F(SkinImageStoreTest, Prepare)
+{
+    SkinImageStore store;
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store.prepare(nullptr);
+    store.prepare(&pngCostume);
+    store.prepare(&svgCostume);
+    ASSERT_EQ(store.count(), 2);
+
+    SkinImageStore::Images images = store.take(&pngCostume);
+    ASSERT_EQ(images.image.size(), QSize(4, 6));
+    ASSERT_EQ(images.texture.size(), QSize(4, 6));
+    ASSERT_EQ(images.texture.format(), QImage::Format_RGBA8888);
+    ASSERT_EQ(store.count(), 1);
+
+    images = store.take(&pngCostume);
+    ASSERT_TRUE(images.image.isNull());
+    ASSERT_TRUE(images.texture.isNull());
+
+    images = store.take(&svgCostume);
+    ASSERT_TRUE(images.image.isNull());
+    ASSERT_EQ(images.texture.size(), QSize(13, 13));
+    ASSERT_EQ(store.count(), 0);
+
+    store.prepare(&pngCostume);
+    store.clear();
+    ASSERT_EQ(store.count(), 0);
+}
+
+TEST_F(SkinImageStoreTest, Skins)
+{
+    // Skins use the prepared images
+    SkinImageStore *store = SkinImageStore::instance();
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store->prepare(&pngCostume);
+    store->prepare(&svgCostume);
+    ASSERT_EQ(store->count(), 2);
+
+    BitmapSkin bitmapSkin(&pngCostume);
+    SVGSkin svgSkin(&svgCostume);
+    ASSERT_EQ(store->count(), 0);
+    ASSERT_EQ(svgSkin.textureCount(), 1);
+
+    Texture texture = bitmapSkin.getTexture(1);
+    ASSERT_EQ(texture.width(), 4);
+    ASSERT_EQ(texture.height(), 6);
+
+    QBuffer buffer;
+    texture.toImage().save(&buffer, "png");
+    QFile ref("png_result.png");
+    ref.open(QFile::ReadOnly);
+    buffer.open(QBuffer::ReadOnly);
+    ASSERT_EQ(buffer.readAll(), ref.readAll());
+
+    texture = svgSkin.getTexture(1);
+    ASSERT_EQ(texture.width(), 13);
+    ASSERT_EQ(svgSkin.textureCount(), 1);
+
+    buffer.close();
+    buffer.setData(QByteArray());
+    texture.toImage().save(&buffer, "png");
+    QFile svgRef("svg_texture_results/8.png");
+    svgRef.open(QFile::ReadOnly);
+    buffer.open(QBuffer::ReadOnly);
+    ASSERT_EQ(buffer.readAll(), svgRef.readAll());
+}
+
+TEST_F(SkinImageStoreTest, PendingCostumes)
+{
+    // Skins of pending costumes wait for the prepared images
+    SkinImageStore *store = SkinImageStore::instance();
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store->setPending(&pngCostume);
+    store->setPending(&svgCostume);
+    ASSERT_TRUE(store->isPending(&pngCostume));
+
+    BitmapSkin bitmapSkin(&pngCostume);
+    SVGSkin svgSkin(&svgCostume);
+    ASSERT_FALSE(bitmapSkin.getTexture(1).isValid());
+    ASSERT_FALSE(svgSkin.getTexture(1).isValid());
+    ASSERT_EQ(svgSkin.textureCount(), 0);
+
+    // The size is available before the textures
+    ASSERT_EQ(bitmapSkin.size(), QSize(4, 6));
+    ASSERT_EQ(svgSkin.size(), QSize(13, 13));
+
+    ASSERT_FALSE(bitmapSkin.updateTextures());
+    ASSERT_FALSE(svgSkin.updateTextures());
+
+    store->prepare(&pngCostume);
+    store->prepare(&svgCostume);
+    ASSERT_FALSE(store->isPending(&pngCostume));
+    ASSERT_TRUE(bitmapSkin.updateTextures());
+    ASSERT_TRUE(svgSkin.updateTextures());
+    ASSERT_EQ(store->count(), 0);
+    ASSERT_EQ(bitmapSkin.textureVersion(), 1);
+    ASSERT_EQ(svgSkin.textureVersion(), 1);
+
+    Texture texture = bitmapSkin.getTexture(1);
+    ASSERT_EQ(texture.width(), 4);
+    ASSERT_EQ(texture.height(), 6);
+
+    texture = svgSkin.getTexture(1);
+    ASSERT_EQ(texture.width(), 13);
+    ASSERT_EQ(svgSkin.textureCount(), 1);
+
+    // Skins decode costumes which weren't prepared
+    store->setPending(&pngCostume);
+    BitmapSkin bitmapSkin2(&pngCostume);
+    ASSERT_FALSE(bitmapSkin2.getTexture(1).isValid());
+    store->clear();
+    ASSERT_TRUE(bitmapSkin2.updateTextures());
+    ASSERT_EQ(bitmapSkin2.getTexture(1).width(), 4);
+}
+
+TEST_F(SkinImageStoreTest, ClaimPendingCostumes)
+{
+    // Skins can prepare pending costumes right away (e.g. for sensing)
+    SkinImageStore *store = SkinImageStore::instance();
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store->setPending(&pngCostume);
+    store->setPending(&svgCostume);
+
+    BitmapSkin bitmapSkin(&pngCostume);
+    SVGSkin svgSkin(&svgCostume);
+    ASSERT_FALSE(bitmapSkin.getTexture(1).isValid());
+    ASSERT_FALSE(svgSkin.getTexture(1).isValid());
+
+    ASSERT_TRUE(bitmapSkin.claimPendingCostume());
+    ASSERT_TRUE(svgSkin.claimPendingCostume());
+    ASSERT_FALSE(store->isPending(&pngCostume));
+    ASSERT_FALSE(store->isPending(&svgCostume));
+    ASSERT_EQ(bitmapSkin.getTexture(1).width(), 4);
+    ASSERT_EQ(svgSkin.getTexture(1).width(), 13);
+    ASSERT_FALSE(bitmapSkin.claimPendingCostume());
+    ASSERT_FALSE(svgSkin.claimPendingCostume());
+
+    // Claimed costumes are skipped when they're prepared later
+    store->prepare(&pngCostume);
+    store->prepare(&svgCostume);
+    ASSERT_EQ(store->count(), 0);
+
+    // Costumes are only skipped once
+    store->prepare(&pngCostume);
+    ASSERT_EQ(store->count(), 1);
+    store->clear();
+}
+
+TEST_F(SkinImageStoreTest, Prefetch)
+{
+    SkinImageStore store;
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store.prefetch(&pngCostume, 1);
+    store.prefetch(&svgCostume, 0);
+    ASSERT_TRUE(store.isPending(&pngCostume) || store.count() > 0);
+
+    // Claimed costumes are decoded right away if their job hasn't started yet
+    store.claim(&pngCostume);
+    store.claim(&svgCostume);
+    ASSERT_FALSE(store.isQueued(&pngCostume));
+    ASSERT_FALSE(store.isPending(&pngCostume));
+    ASSERT_FALSE(store.isPending(&svgCostume));
+    ASSERT_EQ(store.count(), 2);
+
+    // Prepared costumes aren't prefetched again
+    store.prefetch(&pngCostume, 1);
+    ASSERT_FALSE(store.isQueued(&pngCostume));
+    ASSERT_EQ(store.take(&pngCostume).texture.size(), QSize(4, 6));
+
+    store.remove(&svgCostume);
+    ASSERT_EQ(store.count(), 0);
+
+    // Removed costumes aren't decoded
+    store.prefetch(&pngCostume, 0);
+    store.remove(&pngCostume);
+    ASSERT_FALSE(store.isQueued(&pngCostume));
+    ASSERT_FALSE(store.isPending(&pngCostume));
+    store.clear();
+    ASSERT_EQ(store.count(), 0);
+}
+
+TEST_F(SkinImageStoreTest, Owners)
+{
+    // Clearing the entries of a project loader doesn't affect other loaders
+    SkinImageStore store;
+    int loader1, loader2;
+    Costume pngCostume("", "", "png");
+    std::string pngData = readFileStr("image.png");
+    pngCostume.setData(pngData.size(), pngData.data());
+
+    Costume svgCostume("", "", "svg");
+    std::string svgData = readFileStr("image.svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    Costume pendingCostume("", "", "png");
+    pendingCostume.setData(pngData.size(), pngData.data());
+
+    store.setOwner(&pngCostume, &loader1);
+    store.setOwner(&svgCostume, &loader2);
+    store.setOwner(&pendingCostume, &loader2);
+    store.prepare(&pngCostume);
+    store.prepare(&svgCostume);
+    store.setPending(&pendingCostume);
+    ASSERT_EQ(store.count(), 2);
+
+    // Costumes which aren't going to be prepared aren't pending anymore
+    store.clearPending(&loader1);
+    ASSERT_TRUE(store.isPending(&pendingCostume));
+    store.clearPending(&loader2);
+    ASSERT_FALSE(store.isPending(&pendingCostume));
+    ASSERT_EQ(store.count(), 2);
+
+    store.clear(&loader1);
+    ASSERT_EQ(store.count(), 1);
+    ASSERT_TRUE(store.take(&pngCostume).texture.isNull());
+
+    // Prefetch jobs of the loader are cancelled or finished
+    store.prefetch(&pngCostume, 0);
+    store.setOwner(&pngCostume, &loader1);
+    store.clear(&loader1);
+    ASSERT_FALSE(store.isQueued(&pngCostume));
+    ASSERT_FALSE(store.isPending(&pngCostume));
+
+    ASSERT_EQ(store.take(&svgCostume).texture.size(), QSize(13, 13));
+    store.clear(&loader2);
+    ASSERT_EQ(store.count(), 0);
+}
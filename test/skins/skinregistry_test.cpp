@@ -0,0 +1,146 @@
+#include <scratchcpp/costume.h>
+#include <skinregistry.h>
+#include <skinimagestore.h>
+#include <bitmapskin.h>
+#include <svgskin.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+class SkinRegistryTest : public testing::Test
+{
+    public:
+        void SetUp() override
+        {
+            m_context.create();
+            ASSERT_TRUE(m_context.isValid());
+
+            m_surface.setFormat(m_context.format());
+            m_surface.create();
+            Q_ASSERT(m_surface.isValid());
+            m_context.makeCurrent(&m_surface);
+        }
+
+        void TearDown() override
+        {
+            ASSERT_EQ(m_context.surface(), &m_surface);
+            emit m_context.aboutToBeDestroyed();
+            m_context.doneCurrent();
+        }
+
+        QOpenGLContext m_context;
+        QOffscreenSurface m_surface;
+};
+
+TEST_F(SkinRegistryTest, GetSkin)
+{
+    SkinRegistry *registry = SkinRegistry::instance();
+    ASSERT_EQ(registry->getSkin(nullptr), nullptr);
+    ASSERT_FALSE(registry->contains(nullptr));
+    ASSERT_EQ(registry->count(), 0);
+
+    std::string pngData = readFileStr("image.png");
+    std::string pngData2 = pngData;
+    std::string svgData = readFileStr("image.svg");
+
+    Costume costume1("", "", "png");
+    costume1.setData(pngData.size(), pngData.data());
+    Costume costume2("", "", "png");
+    costume2.setData(pngData.size(), pngData.data());
+    Costume costume3("", "", "png");
+    costume3.setData(pngData2.size(), pngData2.data());
+    Costume costume4("", "", "png");
+    costume4.setData(pngData.size(), pngData.data());
+    costume4.setBitmapResolution(2);
+
+    Costume svgCostume1("", "abc", "svg");
+    svgCostume1.setData(svgData.size(), svgData.data());
+    Costume svgCostume2("", "abc", "svg");
+    svgCostume2.setData(svgData.size(), svgData.data());
+    Costume svgCostume3("", "def", "svg");
+    svgCostume3.setData(svgData.size(), svgData.data());
+
+    // Costumes without an asset ID are identified by their data
+    std::shared_ptr<Skin> skin1 = registry->getSkin(&costume1);
+    ASSERT_TRUE(skin1);
+    ASSERT_TRUE(dynamic_cast<BitmapSkin *>(skin1.get()));
+    ASSERT_TRUE(registry->contains(&costume1));
+    ASSERT_TRUE(registry->contains(&costume2));
+    ASSERT_FALSE(registry->contains(&costume3));
+    ASSERT_FALSE(registry->contains(&costume4));
+    ASSERT_EQ(registry->getSkin(&costume2), skin1);
+    ASSERT_EQ(registry->count(), 1);
+
+    std::shared_ptr<Skin> skin3 = registry->getSkin(&costume3);
+    std::shared_ptr<Skin> skin4 = registry->getSkin(&costume4);
+    ASSERT_NE(skin3, skin1);
+    ASSERT_NE(skin4, skin1);
+    ASSERT_NE(skin4, skin3);
+    ASSERT_EQ(registry->count(), 3);
+
+    // Costumes with an asset ID are identified by it
+    std::shared_ptr<Skin> svgSkin1 = registry->getSkin(&svgCostume1);
+    ASSERT_TRUE(dynamic_cast<SVGSkin *>(svgSkin1.get()));
+    ASSERT_EQ(registry->getSkin(&svgCostume2), svgSkin1);
+    ASSERT_NE(registry->getSkin(&svgCostume3), svgSkin1);
+    ASSERT_EQ(registry->count(), 4);
+
+    // Identical costumes share the textures
+    ASSERT_EQ(skin1->getTexture(1), registry->getSkin(&costume2)->getTexture(1));
+    ASSERT_EQ(Skin::memoryUsage(), 4 * 6 * 4 * 3);
+
+    // Skins are deleted when the last reference is released
+    std::shared_ptr<Skin> skin2 = registry->getSkin(&costume2);
+    skin1.reset();
+    ASSERT_TRUE(registry->contains(&costume1));
+    skin2.reset();
+    ASSERT_FALSE(registry->contains(&costume1));
+    ASSERT_EQ(registry->count(), 3);
+
+    skin3.reset();
+    skin4.reset();
+    svgSkin1.reset();
+    ASSERT_EQ(registry->count(), 0);
+    ASSERT_EQ(Skin::memoryUsage(), 0);
+}
+
+TEST_F(SkinRegistryTest, PendingCostumes)
+{
+    // Skins of costumes which are pending for ProjectLoader don't prepare them
+    SkinRegistry *registry = SkinRegistry::instance();
+    SkinImageStore *store = SkinImageStore::instance();
+    std::string pngData = readFileStr("image.png");
+    std::string svgData = readFileStr("image.svg");
+
+    Costume pngCostume("", "", "png");
+    pngCostume.setData(pngData.size(), pngData.data());
+    Costume svgCostume("", "", "svg");
+    svgCostume.setData(svgData.size(), svgData.data());
+
+    store->setPending(&pngCostume);
+    store->setPending(&svgCostume);
+
+    std::shared_ptr<Skin> pngSkin = registry->getSkin(&pngCostume);
+    std::shared_ptr<Skin> svgSkin = registry->getSkin(&svgCostume);
+    ASSERT_TRUE(store->isPending(&pngCostume));
+    ASSERT_TRUE(store->isPending(&svgCostume));
+    ASSERT_FALSE(pngSkin->getTexture(1).isValid());
+    ASSERT_FALSE(svgSkin->getTexture(1).isValid());
+    ASSERT_EQ(pngSkin->size(), QSize(4, 6));
+
+    // Sensing claims them
+    ASSERT_TRUE(pngSkin->claimPendingCostume());
+    ASSERT_FALSE(store->isPending(&pngCostume));
+    ASSERT_EQ(pngSkin->getTexture(1).width(), 4);
+
+    store->prepare(&svgCostume);
+    ASSERT_TRUE(svgSkin->updateTextures());
+    ASSERT_EQ(svgSkin->getTexture(1).width(), 13);
+
+    pngSkin.reset();
+    svgSkin.reset();
+    store->clear();
+    ASSERT_EQ(registry->count(), 0);
+}
@@ -35,7 +35,7 @@ class SVGSkinTest : public testing::Test
 
         QOpenGLContext m_context;
         QOffscreenSurface m_surface;
-        std::unique_ptr<Skin> m_skin;
+        std::unique_ptr<SVGSkin> m_skin;
 };
 
 TEST_F(SVGSkinTest, Textures)
@@ -45,6 +45,11 @@ TEST_F(SVGSkinTest, Textures)
     for (int i = 0; i <= 18; i++) {
         double scale = std::pow(2, i - INDEX_OFFSET);
         Texture texture = m_skin->getTexture(scale);
+
+        // Large mip levels are rasterized in the background
+        m_skin->waitForTextures();
+        texture = m_skin->getTexture(scale);
+
         int dimension = static_cast<int>(13 * scale);
         ASSERT_TRUE(texture.isValid() || dimension == 0);
 
@@ -69,3 +74,83 @@ TEST_F(SVGSkinTest, Textures)
         ASSERT_EQ(buffer.readAll(), ref.readAll());
     }
 }
+
+TEST_F(SVGSkinTest, UnusedTextures)
+{
+    Skin::setUnusedFrames(5);
+    Texture texture1 = m_skin->getTexture(1);
+    Texture texture2 = m_skin->getTexture(2);
+    ASSERT_EQ(m_skin->textureCount(), 2);
+    ASSERT_EQ(m_skin->textureMemoryUsage(), (13 * 13 + 26 * 26) * 4);
+    ASSERT_EQ(Skin::memoryUsage(), m_skin->textureMemoryUsage());
+
+    for (int i = 0; i < 5; i++) {
+        m_skin->markUsed(texture1);
+        Skin::nextFrame();
+    }
+
+    ASSERT_EQ(m_skin->textureCount(), 2);
+
+    // Mip levels which haven't been used for a while are deleted
+    m_skin->markUsed(texture1);
+    Skin::nextFrame();
+    ASSERT_EQ(m_skin->textureCount(), 1);
+    ASSERT_EQ(m_skin->textureMemoryUsage(), 13 * 13 * 4);
+    ASSERT_EQ(Skin::memoryUsage(), 13 * 13 * 4);
+    ASSERT_EQ(m_skin->getTexture(1), texture1);
+
+    // ...and rasterized again when they're needed
+    texture2 = m_skin->getTexture(2);
+    ASSERT_TRUE(texture2.isValid());
+    ASSERT_EQ(texture2.width(), 26);
+    ASSERT_EQ(m_skin->getTextureScale(texture2), 2);
+    ASSERT_EQ(m_skin->textureCount(), 2);
+
+    // Textures which weren't used in the last frame are deleted when the memory budget is exceeded
+    Skin::setMemoryBudget(0);
+    m_skin->markUsed(texture2);
+    Skin::nextFrame();
+    ASSERT_EQ(m_skin->textureCount(), 2);
+
+    Skin::nextFrame();
+    ASSERT_EQ(m_skin->textureCount(), 0);
+    ASSERT_EQ(Skin::memoryUsage(), 0);
+
+    Skin::setMemoryBudget(Skin::DEFAULT_MEMORY_BUDGET);
+    Skin::setUnusedFrames(Skin::DEFAULT_UNUSED_FRAMES);
+}
+
+TEST_F(SVGSkinTest, BackgroundTextures)
+{
+    // Small mip levels are rasterized right away
+    ASSERT_LE(104 * 104, SVGSkin::MAX_SYNC_PIXELS);
+    Texture texture = m_skin->getTexture(8);
+    ASSERT_EQ(texture.width(), 104);
+    ASSERT_EQ(m_skin->textureVersion(), 0);
+    ASSERT_FALSE(m_skin->updateTextures());
+
+    // The nearest mip level is used until a large mip level is available
+    ASSERT_GT(832 * 832, SVGSkin::MAX_SYNC_PIXELS);
+    Texture nearest = m_skin->getTexture(64);
+    ASSERT_EQ(nearest, texture);
+    ASSERT_EQ(m_skin->getTextureScale(nearest), 8);
+    ASSERT_EQ(m_skin->getTexture(64), texture);
+    ASSERT_EQ(m_skin->textureCount(), 1);
+
+    m_skin->waitForTextures();
+    ASSERT_EQ(m_skin->textureVersion(), 1);
+    ASSERT_EQ(m_skin->textureCount(), 2);
+    ASSERT_FALSE(m_skin->updateTextures());
+
+    texture = m_skin->getTexture(64);
+    ASSERT_EQ(texture.width(), 832);
+    ASSERT_EQ(texture.height(), 832);
+    ASSERT_EQ(m_skin->getTextureScale(texture), 64);
+
+    // Larger mip levels are preferred
+    nearest = m_skin->getTexture(32);
+    ASSERT_EQ(nearest, texture);
+    m_skin->waitForTextures();
+    ASSERT_EQ(m_skin->textureVersion(), 2);
+    ASSERT_EQ(m_skin->getTexture(32).width(), 416);
+}
@@ -0,0 +1,192 @@
+#include <spatialindex.h>
+#include <enginemock.h>
+#include <renderedtargetmock.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+using ::testing::Return;
+
+TEST(SpatialIndexTest, AddRemove)
+{
+    SpatialIndex index;
+    RenderedTargetMock target1, target2;
+    ASSERT_TRUE(index.isEmpty());
+    ASSERT_FALSE(index.contains(&target1));
+
+    index.add(&target1);
+    ASSERT_FALSE(index.isEmpty());
+    ASSERT_TRUE(index.contains(&target1));
+    ASSERT_FALSE(index.contains(&target2));
+
+    index.add(&target2);
+    ASSERT_TRUE(index.contains(&target2));
+
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(-10, 10, 10, -10)));
+    EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(100, 50, 120, 20)));
+    index.query(QRectF(-5, -5, 10, 10));
+    ASSERT_TRUE(index.result(&target1));
+    ASSERT_FALSE(index.result(&target2));
+
+    index.remove(&target1);
+    ASSERT_FALSE(index.contains(&target1));
+    ASSERT_FALSE(index.isEmpty());
+
+    index.query(QRectF(-5, -5, 10, 10));
+    ASSERT_FALSE(index.result(&target1));
+    ASSERT_FALSE(index.result(&target2));
+
+    index.remove(&target2);
+    ASSERT_TRUE(index.isEmpty());
+}
+
+TEST(SpatialIndexTest, Query)
+{
+    SpatialIndex index;
+    RenderedTargetMock target1, target2, target3;
+    index.add(&target1);
+    index.add(&target2);
+    index.add(&target3);
+
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(-240, 180, -200, 150)));
+    EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(50, 25, 80, -5)));
+    EXPECT_CALL(target3, getFastBounds()).WillOnce(Return(Rect(-1000, 1000, 1000, -1000))); // large target
+    index.query(QRectF(40, -10, 20, 20));
+    ASSERT_FALSE(index.result(&target1));
+    ASSERT_TRUE(index.result(&target3));
+
+    const Rect *bounds = index.result(&target2);
+    ASSERT_TRUE(bounds);
+    ASSERT_EQ(bounds->left(), 50);
+    ASSERT_EQ(bounds->top(), 25);
+    ASSERT_EQ(bounds->right(), 80);
+    ASSERT_EQ(bounds->bottom(), -5);
+
+    // Bounds are only recalculated after invalidation
+    EXPECT_CALL(target1, getFastBounds).Times(0);
+    EXPECT_CALL(target2, getFastBounds).Times(0);
+    EXPECT_CALL(target3, getFastBounds).Times(0);
+    index.query(QRectF(-235, 155, 10, 10));
+    ASSERT_TRUE(index.result(&target1));
+    ASSERT_FALSE(index.result(&target2));
+    ASSERT_TRUE(index.result(&target3));
+
+    index.invalidate(&target1);
+    index.invalidate(&target1);
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(45, 0, 60, -20)));
+    index.query(QRectF(40, -10, 20, 20));
+    ASSERT_TRUE(index.result(&target1));
+    ASSERT_TRUE(index.result(&target2));
+    ASSERT_TRUE(index.result(&target3));
+
+    index.invalidate(&target3);
+    EXPECT_CALL(target3, getFastBounds()).WillOnce(Return(Rect(-240, 180, -200, 150)));
+    index.query(QRectF(40, -10, 20, 20));
+    ASSERT_TRUE(index.result(&target1));
+    ASSERT_TRUE(index.result(&target2));
+    ASSERT_FALSE(index.result(&target3));
+
+    // Empty query
+    index.query(QRectF());
+    ASSERT_FALSE(index.result(&target1));
+    ASSERT_FALSE(index.result(&target2));
+    ASSERT_FALSE(index.result(&target3));
+}
+
+TEST(SpatialIndexTest, Results)
+{
+    SpatialIndex index;
+    RenderedTargetMock target1, target2, target3;
+    index.add(&target1);
+    index.add(&target2);
+    index.add(&target3);
+
+    // Only overlapping targets are returned (once, even if they're in multiple cells)
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(-100, 100, 100, -100)));
+    EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(50, 25, 80, -5)));
+    EXPECT_CALL(target3, getFastBounds()).WillOnce(Return(Rect(-240, 180, -200, 150)));
+    const std::vector<SpatialIndex::Result> &results = index.query(QRectF(40, -10, 20, 20));
+    ASSERT_EQ(results.size(), 2);
+    ASSERT_TRUE((results[0].target == &target1 && results[1].target == &target2) || (results[0].target == &target2 && results[1].target == &target1));
+
+    const SpatialIndex::Result &result = results[0].target == &target2 ? results[0] : results[1];
+    ASSERT_EQ(result.bounds.left(), 50);
+    ASSERT_EQ(result.bounds.top(), 25);
+    ASSERT_TRUE(result.visible);
+    ASSERT_EQ(result.group, nullptr);
+
+    ASSERT_TRUE(index.query(QRectF()).empty());
+}
+
+TEST(SpatialIndexTest, VisibilityAndGroups)
+{
+    SpatialIndex index;
+    RenderedTargetMock target1, target2, target3;
+    int group1, group2;
+    index.add(&target1);
+    index.add(&target2);
+    index.add(&target3);
+    ASSERT_EQ(index.visibleCount(), 3);
+    ASSERT_EQ(index.groupSize(&group1), 0);
+
+    index.setVisible(&target2, false);
+    index.setVisible(&target2, false);
+    ASSERT_EQ(index.visibleCount(), 2);
+
+    index.setGroup(&target1, &group1);
+    index.setGroup(&target2, &group1);
+    index.setGroup(&target3, &group2);
+    ASSERT_EQ(index.groupSize(&group1), 2);
+    ASSERT_EQ(index.groupSize(&group2), 1);
+    ASSERT_EQ(index.visibleGroupSize(&group1), 1);
+    ASSERT_EQ(index.visibleGroupSize(&group2), 1);
+
+    index.setVisible(&target2, true);
+    ASSERT_EQ(index.visibleGroupSize(&group1), 2);
+    index.setVisible(&target2, false);
+    ASSERT_EQ(index.visibleGroupSize(&group1), 1);
+
+    EXPECT_CALL(target1, getFastBounds()).WillOnce(Return(Rect(-10, 10, 10, -10)));
+    EXPECT_CALL(target2, getFastBounds()).WillOnce(Return(Rect(-10, 10, 10, -10)));
+    EXPECT_CALL(target3, getFastBounds()).WillOnce(Return(Rect(-10, 10, 10, -10)));
+
+    for (const SpatialIndex::Result &result : index.query(QRectF(-5, -5, 10, 10))) {
+        ASSERT_EQ(result.visible, result.target != &target2);
+        ASSERT_EQ(result.group, result.target == &target3 ? static_cast<void *>(&group2) : static_cast<void *>(&group1));
+    }
+
+    index.setGroup(&target2, &group2);
+    ASSERT_EQ(index.groupSize(&group1), 1);
+    ASSERT_EQ(index.groupSize(&group2), 2);
+    ASSERT_EQ(index.visibleGroupSize(&group1), 1);
+    ASSERT_EQ(index.visibleGroupSize(&group2), 1);
+
+    index.remove(&target2);
+    ASSERT_EQ(index.visibleCount(), 2);
+    ASSERT_EQ(index.groupSize(&group2), 1);
+    ASSERT_EQ(index.visibleGroupSize(&group2), 1);
+
+    index.remove(&target1);
+    ASSERT_EQ(index.visibleCount(), 1);
+    ASSERT_EQ(index.groupSize(&group1), 0);
+    ASSERT_EQ(index.visibleGroupSize(&group1), 0);
+}
+
+TEST(SpatialIndexTest, ProjectIndex)
+{
+    EngineMock engine1, engine2;
+    ASSERT_EQ(SpatialIndex::getProjectIndex(nullptr), nullptr);
+
+    SpatialIndex *index1 = SpatialIndex::getProjectIndex(&engine1);
+    ASSERT_TRUE(index1);
+    ASSERT_EQ(SpatialIndex::getProjectIndex(&engine1), index1);
+
+    SpatialIndex *index2 = SpatialIndex::getProjectIndex(&engine2);
+    ASSERT_TRUE(index2);
+    ASSERT_NE(index2, index1);
+
+    SpatialIndex::removeProjectIndex(&engine1);
+    SpatialIndex::removeProjectIndex(&engine2);
+}
@@ -0,0 +1,115 @@
+#include <stagecomposite.h>
+#include <enginemock.h>
+#include <renderedtargetmock.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+using namespace libscratchcpp;
+
+TEST(StageCompositeTest, AddRemove)
+{
+    StageComposite composite;
+    RenderedTargetMock target1, target2;
+    ASSERT_TRUE(composite.isEmpty());
+
+    composite.add(&target1);
+    ASSERT_FALSE(composite.isEmpty());
+
+    composite.add(&target2);
+    composite.remove(&target1);
+    ASSERT_FALSE(composite.isEmpty());
+
+    composite.remove(&target2);
+    ASSERT_TRUE(composite.isEmpty());
+}
+
+TEST(StageCompositeTest, Targets)
+{
+    StageComposite composite;
+    RenderedTargetMock target1, target2;
+    ASSERT_FALSE(composite.targetsValid());
+    ASSERT_FALSE(composite.supported());
+
+    composite.setTargets({ &target1, &target2 }, true);
+    ASSERT_TRUE(composite.targetsValid());
+    ASSERT_TRUE(composite.supported());
+    ASSERT_EQ(composite.targets(), std::vector<IRenderedTarget *>({ &target1, &target2 }));
+
+    composite.setTargets({ &target2 }, false);
+    ASSERT_TRUE(composite.targetsValid());
+    ASSERT_FALSE(composite.supported());
+
+    const unsigned int version = composite.version();
+    composite.invalidate();
+    ASSERT_GT(composite.version(), version);
+    ASSERT_FALSE(composite.targetsValid());
+    ASSERT_FALSE(composite.supported());
+}
+
+TEST(StageCompositeTest, Tiles)
+{
+    StageComposite composite;
+    RenderedTargetMock target1, target2;
+    ASSERT_EQ(composite.tile(&target1, 0, 0), nullptr);
+
+    QRgb *tile = composite.addTile(&target1, 0, -1);
+    ASSERT_TRUE(tile);
+    tile[0] = qRgb(255, 0, 0);
+    tile[StageComposite::TILE_SIZE * StageComposite::TILE_SIZE - 1] = qRgb(0, 0, 255);
+
+    // Each target has its own tiles
+    ASSERT_EQ(composite.tile(&target1, 0, -1), tile);
+    ASSERT_EQ(composite.tile(&target1, 0, 0), nullptr);
+    ASSERT_EQ(composite.tile(&target2, 0, -1), nullptr);
+    ASSERT_EQ(composite.tile(&target1, 0, -1)[0], qRgb(255, 0, 0));
+
+    composite.addTile(&target2, 0, -1);
+    ASSERT_TRUE(composite.tile(&target2, 0, -1));
+
+    composite.remove(&target2);
+    ASSERT_EQ(composite.tile(&target2, 0, -1), nullptr);
+    ASSERT_EQ(composite.tile(&target1, 0, -1), tile);
+
+    // Tiles are dropped when the scene changes
+    composite.invalidate();
+    ASSERT_EQ(composite.tile(&target1, 0, -1), nullptr);
+}
+
+TEST(StageCompositeTest, TileCoord)
+{
+    const int size = StageComposite::TILE_SIZE;
+    ASSERT_EQ(StageComposite::tileCoord(0), 0);
+    ASSERT_EQ(StageComposite::tileCoord(size - 1), 0);
+    ASSERT_EQ(StageComposite::tileCoord(size), 1);
+    ASSERT_EQ(StageComposite::tileCoord(-1), -1);
+    ASSERT_EQ(StageComposite::tileCoord(-size), -1);
+    ASSERT_EQ(StageComposite::tileCoord(-size - 1), -2);
+}
+
+TEST(StageCompositeTest, ProjectComposite)
+{
+    EngineMock engine1, engine2;
+    ASSERT_EQ(StageComposite::getProjectComposite(nullptr), nullptr);
+
+    StageComposite *composite1 = StageComposite::getProjectComposite(&engine1);
+    ASSERT_TRUE(composite1);
+    ASSERT_EQ(StageComposite::getProjectComposite(&engine1), composite1);
+
+    StageComposite *composite2 = StageComposite::getProjectComposite(&engine2);
+    ASSERT_TRUE(composite2);
+    ASSERT_NE(composite2, composite1);
+
+    const unsigned int version = composite1->version();
+    StageComposite::invalidateProject(&engine1);
+    ASSERT_GT(composite1->version(), version);
+
+    const unsigned int version2 = composite2->version();
+    StageComposite::invalidateAll();
+    ASSERT_GT(composite1->version(), version + 1);
+    ASSERT_GT(composite2->version(), version2);
+
+    StageComposite::removeProjectComposite(&engine1);
+    StageComposite::removeProjectComposite(&engine2);
+    StageComposite::invalidateProject(&engine1); // doesn't create a composite
+}
@@ -79,7 +79,7 @@ TEST_F(TargetPainterTest, Paint)
 
     // Paint
     Texture texture(refFbo.texture(), refFbo.size());
-    std::unordered_map<ShaderManager::Effect, double> effects;
+    EffectState effects;
     EXPECT_CALL(target, texture()).WillOnce(Return(texture));
     EXPECT_CALL(target, costumeWidth()).WillOnce(Return(texture.width()));
     EXPECT_CALL(target, costumeHeight()).WillOnce(Return(texture.height()));
@@ -93,9 +93,9 @@ TEST_F(TargetPainterTest, Paint)
     // Paint with color effects
     glF.glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glF.glClear(GL_COLOR_BUFFER_BIT);
-    effects[ShaderManager::Effect::Color] = 46;
-    effects[ShaderManager::Effect::Brightness] = 20;
-    effects[ShaderManager::Effect::Ghost] = 84;
+    effects.setValue(ShaderManager::Effect::Color, 46);
+    effects.setValue(ShaderManager::Effect::Brightness, 20);
+    effects.setValue(ShaderManager::Effect::Ghost, 84);
     EXPECT_CALL(target, texture()).WillOnce(Return(texture));
     EXPECT_CALL(target, costumeWidth()).WillOnce(Return(texture.width()));
     EXPECT_CALL(target, costumeHeight()).WillOnce(Return(texture.height()));
@@ -111,10 +111,10 @@ TEST_F(TargetPainterTest, Paint)
     glF.glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glF.glClear(GL_COLOR_BUFFER_BIT);
     effects.clear();
-    effects[ShaderManager::Effect::Fisheye] = 46;
-    effects[ShaderManager::Effect::Whirl] = 50;
-    effects[ShaderManager::Effect::Pixelate] = 25;
-    effects[ShaderManager::Effect::Mosaic] = 30;
+    effects.setValue(ShaderManager::Effect::Fisheye, 46);
+    effects.setValue(ShaderManager::Effect::Whirl, 50);
+    effects.setValue(ShaderManager::Effect::Pixelate, 25);
+    effects.setValue(ShaderManager::Effect::Mosaic, 30);
     EXPECT_CALL(target, texture()).WillOnce(Return(texture));
     EXPECT_CALL(target, costumeWidth()).WillOnce(Return(texture.width()));
     EXPECT_CALL(target, costumeHeight()).WillOnce(Return(texture.height()));
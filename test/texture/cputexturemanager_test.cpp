@@ -110,7 +110,26 @@ TEST_F(CpuTextureManagerTest, TextureDataAndHullPoints)
 
         // Shape-changing effects
         auto mask = ShaderManager::Effect::Fisheye | ShaderManager::Effect::Whirl;
-        const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Fisheye, 20 }, { ShaderManager::Effect::Whirl, 50 } };
+        const EffectState effects({ { ShaderManager::Effect::Fisheye, 20 }, { ShaderManager::Effect::Whirl, 50 } });
+        manager.getTextureConvexHullPoints(texture1, texture1.size(), mask, effects, hullPoints);
+        ASSERT_EQ(hullPoints, refHullPoints3);
+
+        // Effect values are quantized
+        const EffectState similarEffects({ { ShaderManager::Effect::Fisheye, 20.03 }, { ShaderManager::Effect::Whirl, 49.98 } });
+        manager.getTextureConvexHullPoints(texture1, texture1.size(), mask, similarEffects, hullPoints);
+        ASSERT_EQ(hullPoints, refHullPoints3);
+        manager.getTextureConvexHullPoints(texture1, texture1.size(), mask | ShaderManager::Effect::Color, similarEffects, hullPoints);
+        ASSERT_EQ(hullPoints, refHullPoints3);
+
+        // Huge values don't overflow the cache key
+        for (double value : { 1e9, -1e9, 1e300, -1e300 }) {
+            const EffectState hugeEffects({ { ShaderManager::Effect::Fisheye, value }, { ShaderManager::Effect::Whirl, value } });
+            std::vector<QPoint> hugeHullPoints;
+            manager.getTextureConvexHullPoints(texture1, texture1.size(), mask, hugeEffects, hugeHullPoints);
+            manager.getTextureConvexHullPoints(texture1, texture1.size(), mask, hugeEffects, hullPoints);
+            ASSERT_EQ(hullPoints, hugeHullPoints);
+        }
+
         manager.getTextureConvexHullPoints(texture1, texture1.size(), mask, effects, hullPoints);
         ASSERT_EQ(hullPoints, refHullPoints3);
     }
@@ -167,7 +186,7 @@ TEST_F(CpuTextureManagerTest, GetPointColor)
     ASSERT_EQ(manager.getPointColor(texture, 2, 1, mask, {}), qRgb(255, 0, 255));
     ASSERT_EQ(manager.getPointColor(texture, 3, 1, mask, {}), qRgb(255, 128, 128));
 
-    std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Color, 50 } };
+    EffectState effects({ { ShaderManager::Effect::Color, 50 } });
     mask = ShaderManager::Effect::Color;
     ASSERT_EQ(manager.getPointColor(texture, 1, 1, mask, effects), qRgb(255, 0, 128));
     ASSERT_EQ(manager.getPointColor(texture, 2, 1, mask, effects), qRgb(255, 128, 0));
@@ -219,7 +238,7 @@ TEST_F(CpuTextureManagerTest, TextureContainsPoint)
     ASSERT_TRUE(manager.textureContainsPoint(texture, { 3.3, 3.5 }, mask, {}));
 
     mask = ShaderManager::Effect::Whirl;
-    const std::unordered_map<ShaderManager::Effect, double> effects = { { ShaderManager::Effect::Whirl, 100 } };
+    const EffectState effects({ { ShaderManager::Effect::Whirl, 100 } });
     ASSERT_TRUE(manager.textureContainsPoint(texture, { 1, 3 }, mask, effects));
     ASSERT_TRUE(manager.textureContainsPoint(texture, { 2, 3 }, mask, effects));
     ASSERT_FALSE(manager.textureContainsPoint(texture, { 3, 3 }, mask, effects));
@@ -229,3 +248,102 @@ TEST_F(CpuTextureManagerTest, TextureContainsPoint)
     emit context.aboutToBeDestroyed();
     context.doneCurrent();
 }
+
+TEST_F(CpuTextureManagerTest, TextureContainsPoints)
+{
+    // Create OpenGL context
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+
+    // Paint
+    QNanoPainter painter;
+    ImagePainter imgPainter(&painter, "image.png");
+
+    // Read texture data
+    Texture texture(imgPainter.fbo()->texture(), imgPainter.fbo()->size());
+
+    // The results must match textureContainsPoint()
+    std::vector<int> x;
+    std::vector<int> y;
+
+    for (int i = -2; i < 8; i++) {
+        for (int j = -2; j < 8; j++) {
+            x.push_back(j);
+            y.push_back(i);
+        }
+    }
+
+    std::vector<std::pair<ShaderManager::Effect, std::unordered_map<ShaderManager::Effect, double>>> cases = {
+        { ShaderManager::Effect::NoEffect, {} },
+        { ShaderManager::Effect::Color, { { ShaderManager::Effect::Color, 50 } } },
+        { ShaderManager::Effect::Whirl, { { ShaderManager::Effect::Whirl, 100 } } },
+        { ShaderManager::Effect::Fisheye | ShaderManager::Effect::Whirl, { { ShaderManager::Effect::Fisheye, 20 }, { ShaderManager::Effect::Whirl, 50 } } },
+        { ShaderManager::Effect::Pixelate | ShaderManager::Effect::Mosaic, { { ShaderManager::Effect::Pixelate, 15 }, { ShaderManager::Effect::Mosaic, 20 } } }
+    };
+
+    CpuTextureManager manager;
+    std::vector<char> dst(x.size());
+
+    for (const auto &[mask, values] : cases) {
+        const EffectState effects(values);
+        manager.textureContainsPoints(texture, x.data(), y.data(), x.size(), mask, effects, dst.data());
+
+        for (size_t i = 0; i < x.size(); i++)
+            ASSERT_EQ(dst[i], manager.textureContainsPoint(texture, QPointF(x[i], y[i]), mask, effects)) << x[i] << " " << y[i];
+    }
+
+    // Cleanup
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
+
+TEST_F(CpuTextureManagerTest, GetPointColors)
+{
+    // Create OpenGL context
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+
+    // Paint
+    QNanoPainter painter;
+    ImagePainter imgPainter(&painter, "image.png");
+
+    // Read texture data
+    Texture texture(imgPainter.fbo()->texture(), imgPainter.fbo()->size());
+
+    // The results must match getPointColor()
+    std::vector<int> x;
+    std::vector<int> y;
+
+    for (int i = -2; i < 8; i++) {
+        for (int j = -2; j < 8; j++) {
+            x.push_back(j);
+            y.push_back(i);
+        }
+    }
+
+    std::vector<std::pair<ShaderManager::Effect, std::unordered_map<ShaderManager::Effect, double>>> cases = {
+        { ShaderManager::Effect::NoEffect, {} },
+        { ShaderManager::Effect::Color, { { ShaderManager::Effect::Color, 50 } } },
+        { ShaderManager::Effect::Brightness | ShaderManager::Effect::Ghost, { { ShaderManager::Effect::Brightness, 20 }, { ShaderManager::Effect::Ghost, 30 } } },
+        { ShaderManager::Effect::Whirl, { { ShaderManager::Effect::Whirl, 100 } } },
+        { ShaderManager::Effect::Fisheye | ShaderManager::Effect::Whirl, { { ShaderManager::Effect::Fisheye, 20 }, { ShaderManager::Effect::Whirl, 50 } } },
+        { ShaderManager::Effect::Pixelate | ShaderManager::Effect::Mosaic, { { ShaderManager::Effect::Pixelate, 15 }, { ShaderManager::Effect::Mosaic, 20 } } }
+    };
+
+    CpuTextureManager manager;
+    std::vector<QRgb> dst(x.size());
+
+    for (const auto &[mask, values] : cases) {
+        const EffectState effects(values);
+        manager.getPointColors(texture, x.data(), y.data(), x.size(), mask, effects, dst.data());
+
+        for (size_t i = 0; i < x.size(); i++)
+            ASSERT_EQ(dst[i], manager.getPointColor(texture, x[i], y[i], mask, effects)) << x[i] << " " << y[i];
+    }
+
+    // Cleanup
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
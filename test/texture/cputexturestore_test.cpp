@@ -0,0 +1,216 @@
+#include <cputexturestore.h>
+#include <cputexturemanager.h>
+#include <texture.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+static QImage createImage()
+{
+    // The first row is the bottom row
+    QImage image(4, 3, QImage::Format_RGBA8888);
+    image.fill(Qt::transparent);
+    image.setPixelColor(1, 0, QColor(255, 0, 0, 255));
+    image.setPixelColor(2, 2, QColor(0, 0, 255, 255));
+    return image;
+}
+
+TEST(CpuTextureStoreTest, AddTexture)
+{
+    CpuTextureStore store;
+    const Texture texture(1, 4, 3);
+    ASSERT_EQ(store.count(), 0);
+    ASSERT_EQ(store.refCount(texture), 0);
+
+    store.addTexture(Texture(), createImage());
+    store.addTexture(Texture(2, 3, 3), createImage());
+    store.addTexture(Texture(3, 4, 3), createImage().convertToFormat(QImage::Format_ARGB32));
+    ASSERT_EQ(store.count(), 0);
+    ASSERT_EQ(store.memoryUsage(), 0);
+
+    store.addTexture(texture, createImage());
+    ASSERT_EQ(store.count(), 1);
+    ASSERT_EQ(store.refCount(texture), 1);
+    ASSERT_GT(store.memoryUsage(), 4 * 3 * 4);
+
+    CpuTextureStore::Entry *entry = store.acquire(texture);
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(store.refCount(texture), 2);
+    ASSERT_EQ(entry->texture(), texture);
+    ASSERT_TRUE(entry->hasShape());
+    ASSERT_TRUE(entry->hasData());
+    ASSERT_EQ(entry->silhouette().width(), 4);
+    ASSERT_EQ(entry->silhouette().height(), 3);
+    ASSERT_TRUE(entry->silhouette().contains(2, 0));
+    ASSERT_TRUE(entry->silhouette().contains(1, 2));
+    ASSERT_FALSE(entry->silhouette().contains(1, 0));
+    ASSERT_EQ(entry->hullPoints(), std::vector<QPoint>({ { 2, 0 }, { 1, 2 }, { 1, 2 }, { 2, 0 } }));
+
+    // The image isn't kept, only the data created from it is counted (the first row is the top row)
+    const size_t silhouetteSize = entry->silhouette().byteCount();
+    entry->silhouette().runs(0);
+    ASSERT_EQ(entry->silhouette().byteCount(), silhouetteSize);
+    ASSERT_EQ(store.memoryUsage(), static_cast<qint64>(4 * 3 * 4 + silhouetteSize + entry->hullPoints().size() * sizeof(QPoint)));
+
+    ASSERT_TRUE(store.getTexture(entry, true));
+    ASSERT_EQ(entry->data()[(0 * 4 + 2) * 4 + 2], 255);
+    ASSERT_EQ(entry->data()[(2 * 4 + 1) * 4], 255);
+    ASSERT_EQ(store.hits(), 1);
+    ASSERT_EQ(store.misses(), 0);
+
+    // Textures with a different size aren't the same texture
+    ASSERT_EQ(store.refCount(Texture(1, 3, 4)), 0);
+}
+
+TEST(CpuTextureStoreTest, RefCount)
+{
+    CpuTextureStore store;
+    const Texture texture1(1, 4, 3);
+    const Texture texture2(2, 4, 3);
+    CpuTextureStore::Entry *entry1 = store.acquire(texture1);
+    CpuTextureStore::Entry *entry2 = store.acquire(texture2);
+    ASSERT_EQ(store.acquire(texture1), entry1);
+    ASSERT_NE(entry1, entry2);
+    ASSERT_EQ(store.count(), 2);
+    ASSERT_EQ(store.refCount(texture1), 2);
+    ASSERT_EQ(store.refCount(texture2), 1);
+
+    // Entries without data must be read back
+    ASSERT_FALSE(entry1->hasShape());
+    ASSERT_FALSE(store.getTexture(entry1, false));
+    ASSERT_EQ(store.misses(), 1);
+
+    store.setTexture(entry1, std::vector<GLubyte>(4 * 3 * 4, 1), Silhouette(nullptr, 4, 3), { { 1, 1 } });
+    ASSERT_TRUE(store.getTexture(entry1, true));
+    ASSERT_EQ(entry1->hullPoints(), std::vector<QPoint>({ { 1, 1 } }));
+    ASSERT_EQ(store.hits(), 1);
+
+    store.release(texture1);
+    ASSERT_EQ(store.count(), 2);
+    ASSERT_EQ(store.refCount(texture1), 1);
+
+    store.release(texture1);
+    ASSERT_EQ(store.count(), 1);
+    ASSERT_EQ(store.refCount(texture1), 0);
+
+    const unsigned int generation = store.generation();
+    store.clear();
+    ASSERT_EQ(store.count(), 0);
+    ASSERT_EQ(store.refCount(texture2), 0);
+    ASSERT_EQ(store.memoryUsage(), 0);
+    ASSERT_NE(store.generation(), generation);
+}
+
+TEST(CpuTextureStoreTest, MemoryBudget)
+{
+    CpuTextureStore store;
+    ASSERT_EQ(store.memoryBudget(), CpuTextureStore::DEFAULT_MEMORY_BUDGET);
+
+    const Texture texture1(1, 4, 3);
+    const Texture texture2(2, 4, 3);
+    store.addTexture(texture1, createImage());
+    const qint64 size = store.memoryUsage();
+    store.addTexture(texture2, createImage());
+    ASSERT_EQ(store.memoryUsage(), size * 2);
+
+    // Least recently used textures are dropped first
+    CpuTextureStore::Entry *entry1 = store.acquire(texture1);
+    CpuTextureStore::Entry *entry2 = store.acquire(texture2);
+    ASSERT_TRUE(store.getTexture(entry1, false));
+    store.setMemoryBudget(size);
+    ASSERT_EQ(store.memoryUsage(), size);
+    ASSERT_EQ(store.evictions(), 1);
+    ASSERT_TRUE(entry1->hasShape());
+    ASSERT_FALSE(entry2->hasShape());
+    ASSERT_EQ(store.count(), 2);
+
+    // Dropped textures must be read again
+    ASSERT_FALSE(store.getTexture(entry2, false));
+    store.setTexture(entry2, {}, Silhouette(nullptr, 4, 3), {});
+    ASSERT_TRUE(entry2->hasShape());
+    ASSERT_FALSE(entry1->hasShape());
+    ASSERT_EQ(store.evictions(), 2);
+    ASSERT_LE(store.memoryUsage(), size);
+}
+
+TEST(CpuTextureStoreTest, PinnedTextures)
+{
+    CpuTextureStore *store = CpuTextureStore::instance();
+    const qint64 budget = store->memoryBudget();
+    const Texture texture1(1, 4, 3);
+    const Texture texture2(2, 4, 3);
+    store->addTexture(texture1, createImage());
+    store->addTexture(texture2, createImage());
+    const qint64 size = store->memoryUsage() / 2;
+
+    {
+        // Pinned textures aren't evicted
+        CpuTextureStore::PinnedTextures pins;
+        pins.add(texture1);
+        pins.add(Texture());
+        ASSERT_TRUE(store->isPinned(texture1));
+        ASSERT_FALSE(store->isPinned(texture2));
+        ASSERT_EQ(store->refCount(texture1), 2);
+
+        store->setMemoryBudget(0);
+        ASSERT_EQ(store->memoryUsage(), size);
+
+        CpuTextureStore::Entry *entry1 = store->acquire(texture1);
+        CpuTextureStore::Entry *entry2 = store->acquire(texture2);
+        ASSERT_TRUE(entry1->hasShape());
+        ASSERT_FALSE(entry2->hasShape());
+
+        // Reading another texture doesn't evict them either
+        store->setTexture(entry2, {}, Silhouette(nullptr, 4, 3), {});
+        ASSERT_TRUE(entry1->hasShape());
+        ASSERT_TRUE(store->getTexture(entry1, true));
+
+        store->release(texture1);
+        store->release(texture2);
+    }
+
+    // The budget applies again when the textures are unpinned
+    ASSERT_FALSE(store->isPinned(texture1));
+    ASSERT_EQ(store->refCount(texture1), 1);
+    ASSERT_EQ(store->memoryUsage(), 0);
+
+    store->setMemoryBudget(budget);
+    store->clear();
+}
+
+TEST(CpuTextureStoreTest, TextureManager)
+{
+    // Texture managers use the stored image instead of reading the texture back
+    CpuTextureStore *store = CpuTextureStore::instance();
+    const Texture texture(1, 4, 3);
+    store->addTexture(texture, createImage());
+
+    {
+        CpuTextureManager manager1;
+        CpuTextureManager manager2;
+        GLubyte *data = manager1.getTextureData(texture);
+        ASSERT_TRUE(data);
+        ASSERT_EQ(manager2.getTextureData(texture), data);
+        ASSERT_EQ(store->count(), 1);
+        ASSERT_EQ(store->refCount(texture), 3);
+
+        // The data is flipped (the first row is the top row)
+        ASSERT_EQ(manager1.getPointColor(texture, 2, 0, ShaderManager::Effect::NoEffect, {}), qRgba(0, 0, 255, 255));
+        ASSERT_EQ(manager1.getPointColor(texture, 1, 2, ShaderManager::Effect::NoEffect, {}), qRgba(255, 0, 0, 255));
+        ASSERT_EQ(manager1.getPointColor(texture, 1, 0, ShaderManager::Effect::NoEffect, {}), qRgba(0, 0, 0, 0));
+
+        ASSERT_TRUE(manager1.textureContainsPoint(texture, QPointF(2, 0), ShaderManager::Effect::NoEffect, {}));
+        ASSERT_FALSE(manager1.textureContainsPoint(texture, QPointF(2, 2), ShaderManager::Effect::NoEffect, {}));
+
+        std::vector<QPoint> points;
+        manager1.getTextureConvexHullPoints(texture, texture.size(), ShaderManager::Effect::NoEffect, {}, points);
+        ASSERT_EQ(points, std::vector<QPoint>({ { 2, 0 }, { 1, 2 }, { 1, 2 }, { 2, 0 } }));
+
+        manager1.removeTexture(texture);
+        ASSERT_EQ(store->refCount(texture), 2);
+    }
+
+    ASSERT_EQ(store->refCount(texture), 1);
+    store->clear();
+}
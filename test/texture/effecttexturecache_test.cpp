@@ -0,0 +1,212 @@
+#include <effecttexturecache.h>
+#include <texture.h>
+#include <qnanopainter.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+class EffectTextureCacheTest : public testing::Test
+{
+    public:
+        void createContextAndSurface(QOpenGLContext *context, QOffscreenSurface *surface)
+        {
+            QSurfaceFormat surfaceFormat;
+            surfaceFormat.setMajorVersion(4);
+            surfaceFormat.setMinorVersion(3);
+
+            context->setFormat(surfaceFormat);
+            context->create();
+            ASSERT_TRUE(context->isValid());
+
+            surface->setFormat(surfaceFormat);
+            surface->create();
+            ASSERT_TRUE(surface->isValid());
+
+            context->makeCurrent(surface);
+            ASSERT_EQ(QOpenGLContext::currentContext(), context);
+        }
+
+        std::unique_ptr<QOpenGLFramebufferObject> paintImage(QNanoPainter *painter, const QString &fileName)
+        {
+            QOpenGLFramebufferObjectFormat format;
+            format.setAttachment(QOpenGLFramebufferObject::CombinedDepthStencil);
+
+            auto fbo = std::make_unique<QOpenGLFramebufferObject>(4, 6, format);
+            fbo->bind();
+            painter->beginFrame(fbo->width(), fbo->height());
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            QNanoImage image = QNanoImage::fromCache(painter, fileName);
+            painter->drawImage(image, 0, 0);
+            painter->endFrame();
+            fbo->release();
+
+            return fbo;
+        }
+
+        static EffectState effect(ShaderManager::Effect effect, double value)
+        {
+            EffectState ret;
+            ret.setValue(effect, value);
+            return ret;
+        }
+
+        static bool colorsClose(QRgb a, QRgb b)
+        {
+            // The shader and the CPU might round differently
+            return std::abs(qRed(a) - qRed(b)) <= 2 && std::abs(qGreen(a) - qGreen(b)) <= 2 && std::abs(qBlue(a) - qBlue(b)) <= 2 && std::abs(qAlpha(a) - qAlpha(b)) <= 2;
+        }
+};
+
+TEST_F(EffectTextureCacheTest, BakedEffects)
+{
+    EffectState effects;
+    effects.setValue(ShaderManager::Effect::Color, 50.04);
+    effects.setValue(ShaderManager::Effect::Ghost, 20);
+    effects.setValue(ShaderManager::Effect::Fisheye, -12.36);
+    effects.setValue(ShaderManager::Effect::Pixelate, 5);
+
+    EffectState baked = EffectTextureCache::bakedEffects(effects);
+    ASSERT_EQ(baked.mask(), ShaderManager::Effect::Color | ShaderManager::Effect::Fisheye);
+    ASSERT_DOUBLE_EQ(baked.value(ShaderManager::Effect::Color), 50);
+    ASSERT_DOUBLE_EQ(baked.value(ShaderManager::Effect::Fisheye), -12.4);
+
+    EffectState remaining = EffectTextureCache::remainingEffects(effects);
+    ASSERT_EQ(remaining.mask(), ShaderManager::Effect::Ghost | ShaderManager::Effect::Pixelate);
+    ASSERT_EQ(remaining.value(ShaderManager::Effect::Ghost), 20);
+    ASSERT_EQ(remaining.value(ShaderManager::Effect::Pixelate), 5);
+    ASSERT_EQ(EffectTextureCache::remainingEffects(effects.mask()), remaining.mask());
+
+    // Values close to zero are not baked
+    effects.clear();
+    effects.setValue(ShaderManager::Effect::Brightness, 0.01);
+    ASSERT_TRUE(EffectTextureCache::bakedEffects(effects).empty());
+}
+
+TEST_F(EffectTextureCacheTest, GetTexture)
+{
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+
+    QNanoPainter painter;
+    auto fbo = paintImage(&painter, "image.png");
+    Texture texture(fbo->texture(), fbo->size());
+
+    EffectTextureCache cache;
+    ASSERT_EQ(cache.memoryBudget(), EffectTextureCache::DEFAULT_MEMORY_BUDGET);
+    ASSERT_FALSE(cache.getTexture(Texture(), effect(ShaderManager::Effect::Color, 50)).isValid());
+    ASSERT_FALSE(cache.getTexture(texture, {}).isValid());
+    ASSERT_FALSE(cache.getTexture(texture, effect(ShaderManager::Effect::Ghost, 50)).isValid());
+    ASSERT_EQ(cache.count(), 0);
+
+    // Color effect
+    const EffectState effects = effect(ShaderManager::Effect::Color, 50);
+    Texture baked = cache.getTexture(texture, effects);
+    ASSERT_TRUE(baked.isValid());
+    ASSERT_NE(baked, texture);
+    ASSERT_EQ(baked.size(), texture.size());
+    ASSERT_EQ(cache.count(), 1);
+    ASSERT_EQ(cache.memoryUsage(), 4 * 6 * 4 * 2);
+
+    // Quantized values use the same texture
+    EffectState similarEffects = effect(ShaderManager::Effect::Color, 50.02);
+    similarEffects.setValue(ShaderManager::Effect::Ghost, 10);
+    ASSERT_EQ(cache.getTexture(texture, similarEffects), baked);
+    ASSERT_EQ(cache.count(), 1);
+
+    // The CPU copy matches the CPU effect implementation
+    CpuTextureManager *manager = cache.textureManager();
+    CpuTextureManager cpuManager;
+
+    for (int y = 0; y < texture.height(); y++) {
+        for (int x = 0; x < texture.width(); x++) {
+            QRgb expected = cpuManager.getPointColor(texture, x, y, effects.mask(), effects);
+            QRgb color = manager->getPointColor(baked, x, y, ShaderManager::Effect::NoEffect, {});
+
+            if (qAlpha(expected) > 0)
+                ASSERT_TRUE(colorsClose(color, expected)) << x << " " << y;
+            else
+                ASSERT_EQ(qAlpha(color), 0);
+        }
+    }
+
+    // Shape-changing effects
+    Texture whirl = cache.getTexture(texture, effect(ShaderManager::Effect::Whirl, 100));
+    ASSERT_TRUE(whirl.isValid());
+    ASSERT_NE(whirl, baked);
+    ASSERT_EQ(cache.count(), 2);
+    ASSERT_TRUE(manager->getTextureSilhouette(whirl));
+
+    // Huge values don't overflow the cache key
+    Texture fisheye = cache.getTexture(texture, effect(ShaderManager::Effect::Fisheye, 1e9));
+    ASSERT_TRUE(fisheye.isValid());
+    ASSERT_EQ(cache.count(), 3);
+    ASSERT_EQ(cache.getTexture(texture, effect(ShaderManager::Effect::Fisheye, 1e9)), fisheye);
+    ASSERT_NE(cache.getTexture(texture, effect(ShaderManager::Effect::Fisheye, -1e9)), fisheye);
+    ASSERT_EQ(cache.count(), 4);
+
+    EffectState hugeEffects = EffectTextureCache::bakedEffects(effect(ShaderManager::Effect::Fisheye, 1e300));
+    ASSERT_EQ(hugeEffects.mask(), ShaderManager::Effect::Fisheye);
+    ASSERT_GT(hugeEffects.value(ShaderManager::Effect::Fisheye), 1e9);
+
+    cache.clear();
+    ASSERT_EQ(cache.count(), 0);
+    ASSERT_EQ(cache.memoryUsage(), 0);
+
+    // Cleanup
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
+
+TEST_F(EffectTextureCacheTest, MemoryBudget)
+{
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    createContextAndSurface(&context, &surface);
+
+    QNanoPainter painter;
+    auto fbo = paintImage(&painter, "image.png");
+    Texture texture(fbo->texture(), fbo->size());
+    const qint64 size = 4 * 6 * 4 * 2;
+
+    EffectTextureCache cache;
+    cache.setMemoryBudget(size * 2);
+    ASSERT_EQ(cache.memoryBudget(), size * 2);
+
+    Texture texture1 = cache.getTexture(texture, effect(ShaderManager::Effect::Color, 10));
+    Texture texture2 = cache.getTexture(texture, effect(ShaderManager::Effect::Color, 20));
+    ASSERT_TRUE(texture1.isValid());
+    ASSERT_TRUE(texture2.isValid());
+    ASSERT_EQ(cache.count(), 2);
+    ASSERT_EQ(cache.memoryUsage(), size * 2);
+
+    // The least recently used texture is dropped
+    unsigned int generation = cache.generation();
+    ASSERT_EQ(cache.getTexture(texture, effect(ShaderManager::Effect::Color, 10)), texture1);
+    Texture texture3 = cache.getTexture(texture, effect(ShaderManager::Effect::Color, 30));
+    ASSERT_TRUE(texture3.isValid());
+    ASSERT_EQ(cache.count(), 2);
+    ASSERT_EQ(cache.memoryUsage(), size * 2);
+    ASSERT_NE(cache.generation(), generation);
+    ASSERT_EQ(cache.getTexture(texture, effect(ShaderManager::Effect::Color, 10)), texture1);
+    ASSERT_EQ(cache.getTexture(texture, effect(ShaderManager::Effect::Color, 30)), texture3);
+
+    // Reducing the budget drops textures
+    generation = cache.generation();
+    cache.setMemoryBudget(size);
+    ASSERT_EQ(cache.count(), 1);
+    ASSERT_EQ(cache.memoryUsage(), size);
+    ASSERT_NE(cache.generation(), generation);
+
+    // Textures which don't fit aren't baked
+    cache.setMemoryBudget(size - 1);
+    ASSERT_EQ(cache.count(), 0);
+    ASSERT_FALSE(cache.getTexture(texture, effect(ShaderManager::Effect::Color, 10)).isValid());
+
+    // Cleanup
+    emit context.aboutToBeDestroyed();
+    context.doneCurrent();
+}
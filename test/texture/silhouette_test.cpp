@@ -0,0 +1,140 @@
+#include <silhouette.h>
+
+#include "../common.h"
+
+using namespace scratchcpprender;
+
+static std::vector<GLubyte> createPixels(int width, int height, const std::vector<QPoint> &opaquePoints)
+{
+    std::vector<GLubyte> pixels(width * height * 4, 0);
+
+    for (const QPoint &point : opaquePoints) {
+        GLubyte *pixel = &pixels[(point.y() * width + point.x()) * 4];
+        pixel[0] = 255;
+        pixel[3] = 1;
+    }
+
+    return pixels;
+}
+
+TEST(SilhouetteTest, Constructors)
+{
+    {
+        Silhouette silhouette;
+        ASSERT_TRUE(silhouette.isNull());
+        ASSERT_EQ(silhouette.width(), 0);
+        ASSERT_EQ(silhouette.height(), 0);
+        ASSERT_EQ(silhouette.wordsPerRow(), 0);
+        ASSERT_FALSE(silhouette.contains(0, 0));
+    }
+
+    {
+        Silhouette silhouette(nullptr, 130, 3);
+        ASSERT_FALSE(silhouette.isNull());
+        ASSERT_EQ(silhouette.width(), 130);
+        ASSERT_EQ(silhouette.height(), 3);
+        ASSERT_EQ(silhouette.wordsPerRow(), 3);
+        ASSERT_EQ(silhouette.byteCount(), 3 * 3 * 8);
+        ASSERT_FALSE(silhouette.contains(0, 0));
+
+        // The runs are counted when they're built
+        silhouette.runs(0);
+        ASSERT_GE(silhouette.byteCount(), 3 * 3 * 8 + 3 * sizeof(std::vector<Silhouette::Run>));
+    }
+}
+
+TEST(SilhouetteTest, Contains)
+{
+    const std::vector<QPoint> points = { { 0, 0 }, { 63, 0 }, { 64, 1 }, { 69, 2 }, { 5, 2 } };
+    auto pixels = createPixels(70, 3, points);
+    Silhouette silhouette(pixels.data(), 70, 3);
+    ASSERT_EQ(silhouette.wordsPerRow(), 2);
+
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 70; x++)
+            ASSERT_EQ(silhouette.contains(x, y), std::find(points.begin(), points.end(), QPoint(x, y)) != points.end());
+    }
+
+    ASSERT_FALSE(silhouette.contains(-1, 0));
+    ASSERT_FALSE(silhouette.contains(70, 2));
+    ASSERT_FALSE(silhouette.contains(0, 3));
+
+    // Bottom-up data (e.g. from glReadPixels())
+    Silhouette flipped(pixels.data(), 70, 3, true);
+    ASSERT_TRUE(flipped.contains(0, 2));
+    ASSERT_TRUE(flipped.contains(63, 2));
+    ASSERT_TRUE(flipped.contains(64, 1));
+    ASSERT_TRUE(flipped.contains(69, 0));
+    ASSERT_FALSE(flipped.contains(0, 0));
+}
+
+TEST(SilhouetteTest, Intersects)
+{
+    auto pixels1 = createPixels(100, 4, { { 0, 0 }, { 70, 1 }, { 99, 3 } });
+    auto pixels2 = createPixels(10, 2, { { 5, 1 } });
+    Silhouette silhouette1(pixels1.data(), 100, 4);
+    Silhouette silhouette2(pixels2.data(), 10, 2);
+
+    ASSERT_FALSE(silhouette1.intersects(Silhouette(), 0, 0));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 0, 0));
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, -5, -1));
+    ASSERT_TRUE(silhouette2.intersects(silhouette1, 5, 1));
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, 65, 0));
+    ASSERT_TRUE(silhouette2.intersects(silhouette1, -65, 0));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 64, 0));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 66, 0));
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, 94, 2));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 95, 2));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 94, 3));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 200, 0));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, -20, 0));
+
+    // Only texels in the rectangle are checked
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, 65, 0, QRect(70, 1, 1, 1)));
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, 65, 0, QRect(64, 0, 7, 2)));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 65, 0, QRect(71, 0, 29, 4)));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 65, 0, QRect(0, 0, 70, 4)));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, 65, 0, QRect(70, 2, 1, 2)));
+    ASSERT_TRUE(silhouette1.intersects(silhouette2, -5, -1, QRect(-10, -10, 11, 11)));
+    ASSERT_FALSE(silhouette1.intersects(silhouette2, -5, -1, QRect()));
+}
+
+TEST(SilhouetteTest, RowExtent)
+{
+    auto pixels = createPixels(150, 4, { { 3, 0 }, { 63, 1 }, { 64, 1 }, { 130, 1 }, { 0, 2 }, { 149, 2 } });
+    Silhouette silhouette(pixels.data(), 150, 4);
+    int first, last;
+
+    ASSERT_TRUE(silhouette.rowExtent(0, first, last));
+    ASSERT_EQ(first, 3);
+    ASSERT_EQ(last, 3);
+
+    ASSERT_TRUE(silhouette.rowExtent(1, first, last));
+    ASSERT_EQ(first, 63);
+    ASSERT_EQ(last, 130);
+
+    ASSERT_TRUE(silhouette.rowExtent(2, first, last));
+    ASSERT_EQ(first, 0);
+    ASSERT_EQ(last, 149);
+
+    ASSERT_FALSE(silhouette.rowExtent(3, first, last));
+    ASSERT_EQ(first, -1);
+    ASSERT_EQ(last, -1);
+}
+
+TEST(SilhouetteTest, PartialAlpha)
+{
+    std::vector<GLubyte> pixels(70 * 2 * 4, 0);
+    ASSERT_FALSE(Silhouette(pixels.data(), 70, 2).hasPartialAlpha());
+
+    pixels[(69 + 70) * 4 + 3] = 255;
+    ASSERT_FALSE(Silhouette(pixels.data(), 70, 2).hasPartialAlpha());
+
+    pixels[(65 + 70) * 4 + 3] = 254;
+    ASSERT_TRUE(Silhouette(pixels.data(), 70, 2).hasPartialAlpha());
+
+    pixels[(65 + 70) * 4 + 3] = 1;
+    ASSERT_TRUE(Silhouette(pixels.data(), 70, 2).hasPartialAlpha());
+
+    ASSERT_FALSE(Silhouette(nullptr, 70, 2).hasPartialAlpha());
+}